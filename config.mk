@@ -12,3 +12,14 @@ endif
 ifdef IP_FRAG
 MACROS += -DIP_FRAG
 endif
+
+# build the query path microbenchmark(shuke-server bench query ...).
+ifdef BENCH
+MACROS += -DSK_BENCH
+endif
+
+# link the pcap PMD(net_pcap vdev), DPDK should be built with
+# CONFIG_RTE_LIBRTE_PMD_PCAP=y.
+ifdef PCAP
+DPDKLIBS_EXTRA += -Wl,--whole-archive -Wl,-lrte_pmd_pcap -Wl,--no-whole-archive -lpcap
+endif
@@ -8,6 +8,8 @@
 #include <sys/resource.h>
 #include <sys/utsname.h>
 
+#include <rte_eth_bond.h>
+
 #define LEN_BYTES 4
 #define ADMIN_CONN_EXPIRE 3600
 
@@ -47,6 +49,10 @@ static void infoCommand(int argc, char *argv[], adminConn *c);
 static void debugCommand(int argc, char *argv[], adminConn *c);
 static void zoneCommand(int argc, char *argv[], adminConn *c);
 static void configCommand(int argc, char *argv[], adminConn *c);
+static void addrCommand(int argc, char *argv[], adminConn *c);
+static void captureCommand(int argc, char *argv[], adminConn *c);
+static void latencyCommand(int argc, char *argv[], adminConn *c);
+static void topkCommand(int argc, char *argv[], adminConn *c);
 
 typedef void adminCommandProc(int argc, char *argv[], adminConn *c);
 typedef struct {
@@ -59,7 +65,11 @@ static adminCommand adminCommandTable[] = {
     {(char *)"debug", debugCommand},
     {(char *)"info", infoCommand},
     {(char *)"zone", zoneCommand},
-    {(char *)"config", configCommand}
+    {(char *)"config", configCommand},
+    {(char *)"addr", addrCommand},
+    {(char *)"capture", captureCommand},
+    {(char *)"latency", latencyCommand},
+    {(char *)"topk", topkCommand}
 };
 
 static inline void adminConnMoveTail(adminConn *c) {
@@ -484,12 +494,14 @@ static sds genInfoString(char *section) {
                           "# Stats\r\n"
                           "total_requests:%lld\r\n"
                           "dropped_requests:%lld\r\n"
+                          "bad_dst_packets:%lld\r\n"
                           "avg_qps:%llu\r\n"
                           "qps:%llu\r\n"
                           "dropped_qps:%llu\r\n"
                           "num_zones:%lu\r\n",
                           (long long)nr_req,
                           (long long)nr_dropped,
+                          (long long)sk.nr_bad_dst,
                           (long long unsigned)(nr_req/uptime),
                           (long long unsigned)((nr_req - prev_nr_req)/(interval/1000.0)),
                           (long long unsigned)((nr_dropped - prev_nr_dropped)/(interval/1000.0)),
@@ -497,6 +509,19 @@ static sds genInfoString(char *section) {
         prev_nr_req = nr_req;
         prev_nr_dropped = nr_dropped;
 
+        if (sk.query_log_on) {
+            uint64_t written, dropped;
+            sk_qlog_stats(&written, &dropped);
+            s = sdscatprintf(s,
+                             "query_log_written:%llu\r\n"
+                             "query_log_dropped:%llu\r\n",
+                             (long long unsigned)written,
+                             (long long unsigned)dropped);
+        }
+
+        s = sdscat(s, "\r\n# Query counters\r\n");
+        s = sk_stats_info(s);
+
         if (!sk.only_udp) {
             s = sdscat(s, "\r\n");
             s = sdscatprintf(s,
@@ -559,13 +584,52 @@ static sds genInfoString(char *section) {
             char human[128];
             unsigned lcore_id = (unsigned )sk.lcore_ids[i];
             if (lcore_id == rte_get_master_lcore()) continue;
-            lcore_conf_t *qconf = &sk.lcore_conf[lcore_id];
+            lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
             numberToHuman(human, (unsigned long long)qconf->received_req);
             s = sdscatprintf(s, "%d: %s ", lcore_id, human);
         }
         s = sdscat(s, "\r\n");
     }
 
+    // bonds
+    if (sk.nr_bonds > 0 && (allsections || defsections || (strcasecmp(section, "bond") == 0))) {
+        if (sections++) s = sdscat(s, "\r\n");
+        for (int i = 0; i < sk.nr_bonds; ++i) {
+            sk_bond_t *b = &sk.bonds[i];
+            struct rte_eth_link link;
+            uint8_t active[RTE_MAX_ETHPORTS];
+            int nr_active;
+
+            memset(&link, 0, sizeof(link));
+            rte_eth_link_get_nowait(b->port_id, &link);
+            nr_active = rte_eth_bond_active_slaves_get(b->port_id, active, RTE_MAX_ETHPORTS);
+            if (i) s = sdscat(s, "\r\n");
+            s = sdscatprintf(s,
+                             "# Bond %s\r\n"
+                             "port:%d\r\n"
+                             "mode:%s\r\n"
+                             "link_status:%s\r\n"
+                             "link_speed:%u\r\n"
+                             "active_members:",
+                             b->name, b->port_id, sk_bond_mode_str(b->mode),
+                             link.link_status? "up": "down", link.link_speed);
+            for (int j = 0; j < nr_active; ++j) {
+                s = sdscatprintf(s, j? ",%d": "%d", active[j]);
+            }
+            s = sdscat(s, "\r\n");
+            for (int j = 0; j < b->nr_members; ++j) {
+                s = sk_bond_member_info(s, b, b->members[j]);
+            }
+        }
+    }
+
+    // load generator
+    if (sk.loadgen_lcore_id >= 0 && (allsections || defsections || (strcasecmp(section, "loadgen") == 0))) {
+        if (sections++) s = sdscat(s, "\r\n");
+        s = sdscat(s, "# Loadgen\r\n");
+        s = sk_loadgen_info(s);
+    }
+
     // cpu usage
     if (allsections || defsections || (strcasecmp(section, "cpu") == 0)) {
         if (sections++) s = sdscat(s, "\r\n");
@@ -747,6 +811,152 @@ end:
     adminConnAppendW(c, rep);
 }
 
+/*
+ * ADDR LIST
+ * ADDR ADD <port id> <addr[@vlan]>
+ */
+static void addrCommand(int argc, char *argv[], adminConn *c) {
+    adminReply *rep;
+    sds s = NULL;
+    char buf[INET6_ADDRSTRLEN+16];
+    sk_addr_t a;
+
+    if (argc < 2) {
+        s = sdsnewprintf("ADDR command needs at least 1 argument, but gives %d", argc-1);
+        goto end;
+    }
+    if (strcasecmp(argv[1], "LIST") == 0) {
+        s = sdsempty();
+        for (int i = 0; i < sk.nr_ports; ++i) {
+            port_info_t *pinfo = sk.port_info[sk.port_ids[i]];
+            for (int j = 0; j < pinfo->nr_addrs; ++j) {
+                sk_addr_format(&pinfo->addrs[j], buf, sizeof(buf));
+                s = sdscatprintf(s, "port:%d addr:%s svc_id:%d\r\n",
+                                 pinfo->port_id, buf, pinfo->addrs[j].svc_id);
+            }
+        }
+    } else if (strcasecmp(argv[1], "ADD") == 0) {
+        char *end;
+        long portid;
+        port_info_t *pinfo;
+
+        if (argc != 4) {
+            s = sdsnewprintf("ADDR ADD needs 2 arguments, but gives %d.", argc-2);
+            goto end;
+        }
+        // the sockets of lcores are opened before they are launched.
+        if (sk.socket_io_on) {
+            s = sdsnew("ADDR ADD is not supported by socket I/O backend, add the address to config and restart.");
+            goto end;
+        }
+        portid = strtol(argv[2], &end, 10);
+        if (*end != 0 || portid < 0 || portid >= RTE_MAX_ETHPORTS ||
+            sk.port_info[portid] == NULL) {
+            s = sdsnewprintf("invalid port %s.", argv[2]);
+            goto end;
+        }
+        pinfo = sk.port_info[portid];
+        if (sk_addr_parse(&a, argv[3]) != OK_CODE) {
+            s = sdsnewprintf("invalid address %s.", argv[3]);
+            goto end;
+        }
+        if (sk_port_add_addr((uint8_t)portid, &a) != OK_CODE) {
+            s = sdsnewprintf("can't add address %s to port %ld, maybe it already exists.", argv[3], portid);
+            goto end;
+        }
+        LOG_INFO(USER1, "add address %s to port %ld.", argv[3], portid);
+        if (!sk.only_udp && kni_ifconfig_addr((int)portid, pinfo->nr_addrs-1) != OK_CODE) {
+            s = sdsnewprintf("address %s is added, but can't be configured to KNI.", argv[3]);
+            goto end;
+        }
+    } else {
+        s = sdsnewprintf("unknown subcommand %s for ADDR.", argv[1]);
+    }
+end:
+    if (s == NULL) s = sdsnew("OK");
+    rep = adminReplyCreate(s);
+    adminConnAppendW(c, rep);
+}
+
+/*
+ * CAPTURE START [client=<prefix>] [qname=<suffix>] [qtype=<type>] [rcode=<rcode>]
+ *               [duration=<seconds>] [size=<MB>] [file=<path>]
+ * CAPTURE STOP
+ * CAPTURE STATUS
+ */
+static void captureCommand(int argc, char *argv[], adminConn *c) {
+    adminReply *rep;
+    char errstr[ERR_STR_LEN];
+    sds s = NULL;
+
+    if (argc < 2) {
+        s = sdsnewprintf("CAPTURE command needs at least 1 argument, but gives %d", argc-1);
+        goto end;
+    }
+    if (strcasecmp(argv[1], "START") == 0) {
+        if (sk_capture_start(errstr, argc-2, argv+2) != OK_CODE) s = sdsnew(errstr);
+    } else if (strcasecmp(argv[1], "STOP") == 0) {
+        if (sk_capture_stop(errstr) != OK_CODE) s = sdsnew(errstr);
+    } else if (strcasecmp(argv[1], "STATUS") == 0) {
+        s = sk_capture_status(sdsempty());
+    } else {
+        s = sdsnewprintf("unknown subcommand %s for CAPTURE.", argv[1]);
+    }
+end:
+    if (s == NULL) s = sdsnew("OK");
+    rep = adminReplyCreate(s);
+    adminConnAppendW(c, rep);
+}
+
+/*
+ * LATENCY
+ * LATENCY RESET
+ */
+static void latencyCommand(int argc, char *argv[], adminConn *c) {
+    adminReply *rep;
+    sds s = NULL;
+
+    if (argc == 1) {
+        s = sk_latency_info(sdsempty());
+    } else if (argc == 2 && strcasecmp(argv[1], "RESET") == 0) {
+        sk_latency_reset();
+    } else {
+        s = sdsnewprintf("LATENCY command needs 0 argument or RESET, but gives %d", argc-1);
+    }
+    if (s == NULL) s = sdsnew("OK");
+    rep = adminReplyCreate(s);
+    adminConnAppendW(c, rep);
+}
+
+/*
+ * TOPK [N]
+ * TOPK QNAME|CLIENT|ZONE [N]
+ */
+static void topkCommand(int argc, char *argv[], adminConn *c) {
+    adminReply *rep;
+    sds s = NULL;
+    int dim = -1;
+    long n = 10;
+    char *end;
+
+    if (argc > 3) {
+        s = sdsnewprintf("TOPK command needs at most 2 arguments, but gives %d", argc-1);
+        goto end;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (i == 1 && (dim = sk_topk_parse_dim(argv[i])) >= 0) continue;
+        n = strtol(argv[i], &end, 10);
+        if (*end != 0 || n <= 0 || n > INT32_MAX || i != argc - 1) {
+            s = sdsnewprintf("invalid argument %s for TOPK.", argv[i]);
+            goto end;
+        }
+    }
+    s = sk_topk_info(sdsempty(), dim, (int)n);
+end:
+    rep = adminReplyCreate(s);
+    adminConnAppendW(c, rep);
+}
+
 static void zoneCommand(int argc, char *argv[], adminConn *c) {
     adminReply *rep;
     zone *z;
@@ -0,0 +1,854 @@
+//
+// query path and control plane benchmarks, only built with `make BENCH=1`.
+//
+//     shuke-server bench query [scales] [queries] [zipf exponent]
+//     shuke-server bench control <zone dir> [reloads]
+//
+// query: for every scale(number of names, default 1000,10000,100000,1000000),
+// zones of BENCH_NAMES_PER_ZONE names(with the record mix of bench_mix.h)
+// are generated and loaded without any port, then a query mix(A, AAAA, MX, NS at apex and NXDOMAIN, names drawn
+// with zipf distribution) is replayed twice:
+//
+// 1. the stages of the query path are timed one by one with rdtsc: question
+//    parsing, checkLenLabel(), zoneDictGetZone(), zoneFetchValueAbs(),
+//    dumpDnsResp() and RRSetCompressPack()(answer section only, which
+//    includes getCommonSuffixOffset()).
+// 2. processUDPDnsQuery() is timed as a whole, the percentiles of cycles per
+//    query are computed, and the hardware counters(instructions, LLC misses
+//    and L1D read misses) are read through perf_event if it is permitted.
+//
+// control: the *.zone files in a directory(see tools/gen_zone_data.py -o)
+// are loaded like the file data store does, then
+//
+// 1. load: parse time and the memory used by the zones, both the heap(RSS)
+//    and the hugepage memory allocated from DPDK.
+// 2. replicate: zoneCopy() of all the zones to every socket with memory, as
+//    addZoneOtherNuma() and replaceZoneOtherNuma() do.
+// 3. reload: all the zones are parsed again and replaced while a reader
+//    thread sends queries, the query latency before and during the reload,
+//    the memory held by the zones waiting for RCU grace period and the time
+//    to drain them are reported.
+//
+// the mongodb data store(_mongoGetAllZone() fetching and parsing the
+// collections) is not covered, its load time depends on the mongodb server.
+//
+// the results are printed as one JSON object per line, so the outputs of
+// two commits can be compared by scripts.
+//
+#ifdef SK_BENCH
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "shuke.h"
+#include "utils.h"
+#include "bench_mix.h"
+
+#define BENCH_NAMES_PER_ZONE  10000
+#define BENCH_DEFAULT_SCALES  "1000,10000,100000,1000000"
+#define BENCH_DEFAULT_QUERIES 1000000
+#define BENCH_MAX_QUERY_SIZE  (DNS_HDR_SIZE + MAX_DOMAIN_LEN + 5)
+
+enum {
+    STAGE_PARSE = 0,
+    STAGE_CHECK_LABEL,
+    STAGE_GET_ZONE,
+    STAGE_FETCH_VALUE,
+    STAGE_DUMP_RESP,
+    STAGE_COMPRESS_PACK,
+    NR_STAGES,
+};
+
+static const char *stage_names[NR_STAGES] = {
+    "parse_question", "checkLenLabel", "zoneDictGetZone",
+    "zoneFetchValueAbs", "dumpDnsResp", "RRSetCompressPack",
+};
+
+enum {
+    COUNTER_CYCLES = 0,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_L1D_MISSES,
+    NR_COUNTERS,
+};
+
+static const char *counter_names[NR_COUNTERS] = {
+    "cycles", "instructions", "llc_misses", "l1d_read_misses",
+};
+
+/*
+ * the queries are packed as <2 bytes length><dns message>.
+ */
+typedef struct {
+    char *buf;
+    size_t *offsets;
+    int nr;
+} bench_queries_t;
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = type;
+    pe.size = sizeof(pe);
+    pe.config = config;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static void perf_open_all(int fds[NR_COUNTERS]) {
+    fds[COUNTER_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[COUNTER_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[COUNTER_LLC_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[COUNTER_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+                                        PERF_COUNT_HW_CACHE_L1D |
+                                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static void perf_ctl_all(int fds[NR_COUNTERS], unsigned long req) {
+    for (int i = 0; i < NR_COUNTERS; ++i) {
+        if (fds[i] >= 0) ioctl(fds[i], req, 0);
+    }
+}
+
+/*
+ * -1 if the counter is not available.
+ */
+static int64_t perf_read(int fd) {
+    int64_t v;
+    if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) return -1;
+    return v;
+}
+
+typedef struct {
+    long modulus;
+    long remainder;
+    const char *type;
+    const char *rdata;
+} bench_mix_t;
+
+static const bench_mix_t bench_mix[] = {
+#define BENCH_MIX(modulus, remainder, type, rdata) {modulus, remainder, type, rdata},
+    BENCH_MIX_TABLE
+#undef BENCH_MIX
+};
+
+static sds cat_mix_rdata(sds s, const char *rdata, long i, const char *origin) {
+    const char *p = rdata;
+    const char *end;
+
+    while (*p) {
+        if (*p != '{' || (end = strchr(p, '}')) == NULL) {
+            s = sdscatlen(s, p++, 1);
+            continue;
+        }
+        p++;
+        if (strncmp(p, "b2}", 3) == 0) s = sdscatprintf(s, "%ld", (i >> 16) & 0xFF);
+        else if (strncmp(p, "b1}", 3) == 0) s = sdscatprintf(s, "%ld", (i >> 8) & 0xFF);
+        else if (strncmp(p, "b0}", 3) == 0) s = sdscatprintf(s, "%ld", i & 0xFF);
+        else if (strncmp(p, "b2h}", 4) == 0) s = sdscatprintf(s, "%ld", 128 | ((i >> 16) & 0x7F));
+        else if (strncmp(p, "hex}", 4) == 0) s = sdscatprintf(s, "%lx", i);
+        else if (strncmp(p, "origin}", 7) == 0) s = sdscat(s, origin);
+        p = end + 1;
+    }
+    return s;
+}
+
+static sds gen_zone(sds s, int zone_id, long first, long last) {
+    char origin[32];
+
+    snprintf(origin, sizeof(origin), "z%d.bench.", zone_id);
+    s = sdscatprintf(s,
+                     "$ORIGIN %s\n"
+                     "$TTL 3600\n"
+                     "@ SOA ns1.%s hostmaster.%s 1 3600 900 604800 300\n"
+                     "@ NS ns1.%s\n"
+                     "@ NS ns2.%s\n"
+                     "ns1 A 10.255.0.1\n"
+                     "ns2 A 10.255.0.2\n"
+                     "mail A 10.255.0.3\n"
+                     "www A 10.255.0.4\n",
+                     origin, origin, origin, origin, origin);
+    for (long i = first; i < last; ++i) {
+        for (size_t k = 0; k < RTE_DIM(bench_mix); ++k) {
+            const bench_mix_t *mx = &bench_mix[k];
+
+            if (i % mx->modulus != mx->remainder) continue;
+            s = sdscatprintf(s, "n%ld %s ", i, mx->type);
+            s = cat_mix_rdata(s, mx->rdata, i, origin);
+            s = sdscatlen(s, "\n", 1);
+            // a CNAME can't coexist with other records.
+            if (strcmp(mx->type, "CNAME") == 0) break;
+        }
+    }
+    return s;
+}
+
+static zoneDict *load_zones(long nr_names) {
+    char errstr[ERR_STR_LEN];
+    zoneDict *zd = zoneDictCreate(0);
+    int nr_zones = (int)((nr_names + BENCH_NAMES_PER_ZONE - 1) / BENCH_NAMES_PER_ZONE);
+    sds s = sdsempty();
+    zone *z;
+
+    for (int i = 0; i < nr_zones; ++i) {
+        long first = (long)i * BENCH_NAMES_PER_ZONE;
+        long last = RTE_MIN(first + BENCH_NAMES_PER_ZONE, nr_names);
+
+        sdsclear(s);
+        s = gen_zone(s, i, first, last);
+        if (loadZoneFromStr(errstr, 0, s, &z) != OK_CODE) {
+            fprintf(stderr, "can't load zone %d: %s\n", i, errstr);
+            exit(1);
+        }
+        zoneUpdateRoundRabinInfo(z);
+        zoneDictAdd(zd, z);
+    }
+    sdsfree(s);
+    return zd;
+}
+
+/*
+ * pack a query of `dot` to p, return the bytes used.
+ */
+static size_t pack_query(char *p, uint16_t id, char *dot, uint16_t qtype) {
+    size_t len;
+
+    dumpDNSHeader(p + 2, DNS_HDR_SIZE, id, 0x0100, 1, 0, 0, 0);
+    dot2lenlabel(dot, p + 2 + DNS_HDR_SIZE);
+    len = DNS_HDR_SIZE + strlen(dot) + 1;
+    dump16be(qtype, p + 2 + len);
+    dump16be(DNS_CLASS_IN, p + 2 + len + 2);
+    len += 4;
+    dump16be((uint16_t)len, p);
+    return 2 + len;
+}
+
+static long zipf_pick(const double *cdf, long n) {
+    double r = (double)rand() / ((double)RAND_MAX + 1);
+    long lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (cdf[mid] > r) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+/*
+ * the mix: 60% A, 15% AAAA, 10% MX, 5% NS at apex and 10% NXDOMAIN.
+ */
+static void gen_queries(bench_queries_t *qs, long nr_names, int nr, double s) {
+    double *cdf = malloc(sizeof(double) * (size_t)nr_names);
+    char dot[MAX_DOMAIN_LEN+2];
+    char *p;
+    double sum = 0;
+
+    for (long i = 0; i < nr_names; ++i) {
+        sum += 1.0 / pow((double)(i + 1), s);
+        cdf[i] = sum;
+    }
+    for (long i = 0; i < nr_names; ++i) cdf[i] /= sum;
+
+    qs->buf = malloc((size_t)nr * (BENCH_MAX_QUERY_SIZE + 2));
+    qs->offsets = malloc(sizeof(size_t) * (size_t)nr);
+    qs->nr = nr;
+    p = qs->buf;
+    for (int i = 0; i < nr; ++i) {
+        // popular names are spread over the zones.
+        long idx = (zipf_pick(cdf, nr_names) * 7919) % nr_names;
+        int zone_id = (int)(idx / BENCH_NAMES_PER_ZONE);
+        int r = rand() % 100;
+        uint16_t qtype = DNS_TYPE_A;
+
+        if (r < 60) {
+            snprintf(dot, sizeof(dot), "n%ld.z%d.bench.", idx, zone_id);
+        } else if (r < 75) {
+            snprintf(dot, sizeof(dot), "n%ld.z%d.bench.", idx, zone_id);
+            qtype = DNS_TYPE_AAAA;
+        } else if (r < 85) {
+            snprintf(dot, sizeof(dot), "n%ld.z%d.bench.", idx - idx % 10, zone_id);
+            qtype = DNS_TYPE_MX;
+        } else if (r < 90) {
+            snprintf(dot, sizeof(dot), "z%d.bench.", zone_id);
+            qtype = DNS_TYPE_NS;
+        } else {
+            snprintf(dot, sizeof(dot), "nx%d.n%ld.z%d.bench.", rand(), idx, zone_id);
+        }
+        qs->offsets[i] = (size_t)(p - qs->buf);
+        p += pack_query(p, (uint16_t)i, dot, qtype);
+    }
+    free(cdf);
+}
+
+static uint64_t rdtsc_overhead(void) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t t0 = rte_rdtsc();
+        uint64_t t1 = rte_rdtsc();
+        best = RTE_MIN(best, t1 - t0);
+    }
+    return best;
+}
+
+static inline uint64_t stage_cycles(uint64_t t0, uint64_t t1, uint64_t overhead) {
+    return t1 - t0 > overhead? t1 - t0 - overhead: 0;
+}
+
+static void run_stages(bench_queries_t *qs, numaNode_t *node, uint64_t sums[NR_STAGES]) {
+    char buf[SK_RESP_BUF_SIZE];
+    char *name;
+    uint64_t overhead = rdtsc_overhead();
+    uint64_t t0, t1;
+    struct context ctx;
+    dnsDictValue *dv;
+    zone *z;
+    RRSet *rs;
+    int ret;
+
+    memset(sums, 0, sizeof(uint64_t) * NR_STAGES);
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.node = node;
+    ctx.lcore_id = (int)rte_lcore_id();
+    ctx.svc_id = -1;
+    ctx.resp = buf;
+    ctx.totallen = sizeof(buf);
+
+    for (int i = 0; i < qs->nr; ++i) {
+        char *q = qs->buf + qs->offsets[i];
+        size_t len = load16be(q);
+        rte_memcpy(buf, q + 2, len);
+
+        t0 = rte_rdtsc();
+        dnsHeader_load(buf, len, &ctx.hdr);
+        ret = parseDnsQuestion(buf + DNS_HDR_SIZE, len - DNS_HDR_SIZE, &ctx.name, &ctx.qType, &ctx.qClass);
+        ctx.nameLen = lenlabellen(ctx.name);
+        t1 = rte_rdtsc();
+        sums[STAGE_PARSE] += stage_cycles(t0, t1, overhead);
+        name = ctx.name;
+
+        t0 = rte_rdtsc();
+        checkLenLabel(name, 0);
+        t1 = rte_rdtsc();
+        sums[STAGE_CHECK_LABEL] += stage_cycles(t0, t1, overhead);
+
+        zoneDictRLock(node->zd);
+        t0 = rte_rdtsc();
+        z = zoneDictGetZone(node->zd, name);
+        t1 = rte_rdtsc();
+        sums[STAGE_GET_ZONE] += stage_cycles(t0, t1, overhead);
+        if (z == NULL) goto end;
+
+        t0 = rte_rdtsc();
+        dv = zoneFetchValueAbs(z, name, ctx.nameLen);
+        t1 = rte_rdtsc();
+        sums[STAGE_FETCH_VALUE] += stage_cycles(t0, t1, overhead);
+        if (dv == NULL) goto end;
+
+        ctx.z = z;
+        ctx.cur = DNS_HDR_SIZE + ret;
+        t0 = rte_rdtsc();
+        dumpDnsResp(&ctx, dv, z);
+        t1 = rte_rdtsc();
+        sums[STAGE_DUMP_RESP] += stage_cycles(t0, t1, overhead);
+
+        if ((rs = dnsDictValueGet(dv, ctx.qType)) != NULL) {
+            compressInfo temp = {ctx.name, DNS_HDR_SIZE, ctx.nameLen+1};
+            ctx.cps[0] = temp;
+            ctx.cps_sz = 1;
+            ctx.ari_sz = 0;
+            ctx.cur = DNS_HDR_SIZE + ret;
+            t0 = rte_rdtsc();
+            RRSetCompressPack(&ctx, rs, DNS_HDR_SIZE);
+            t1 = rte_rdtsc();
+            sums[STAGE_COMPRESS_PACK] += stage_cycles(t0, t1, overhead);
+        }
+end:
+        zoneDictRUnlock(node->zd);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y? -1: (x > y);
+}
+
+static void run_total(bench_queries_t *qs, numaNode_t *node, uint32_t *cycles,
+                      int64_t counters[NR_COUNTERS]) {
+    char buf[SK_RESP_BUF_SIZE];
+    char src[4] = {(char)192, 0, 2, 1};
+    int fds[NR_COUNTERS];
+    uint64_t overhead = rdtsc_overhead();
+
+    perf_open_all(fds);
+    perf_ctl_all(fds, PERF_EVENT_IOC_RESET);
+    perf_ctl_all(fds, PERF_EVENT_IOC_ENABLE);
+    for (int i = 0; i < qs->nr; ++i) {
+        char *q = qs->buf + qs->offsets[i];
+        size_t len = load16be(q);
+        uint64_t t0, t1;
+
+        rte_memcpy(buf, q + 2, len);
+        t0 = rte_rdtsc();
+        processUDPDnsQuery(buf, len, buf, sizeof(buf), ETHER_MTU, src, 5353, true, -1, NULL, NULL,
+                           node, (int)rte_lcore_id());
+        t1 = rte_rdtsc();
+        cycles[i] = (uint32_t)stage_cycles(t0, t1, overhead);
+    }
+    perf_ctl_all(fds, PERF_EVENT_IOC_DISABLE);
+    for (int i = 0; i < NR_COUNTERS; ++i) {
+        counters[i] = perf_read(fds[i]);
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+static void bench_one_scale(long nr_names, int nr_queries, double s) {
+    numaNode_t *node = sk.nodes[0];
+    bench_queries_t qs;
+    uint64_t sums[NR_STAGES];
+    int64_t counters[NR_COUNTERS];
+    uint32_t *cycles = malloc(sizeof(uint32_t) * (size_t)nr_queries);
+    uint64_t total = 0;
+    long long start = ustime();
+
+    node->zd = load_zones(nr_names);
+    sk.zd = node->zd;
+    fprintf(stderr, "%ld names are loaded in %.2f seconds.\n", nr_names,
+            (double)(ustime() - start) / 1000000);
+    gen_queries(&qs, nr_names, nr_queries, s);
+
+    // warm up
+    run_stages(&qs, node, sums);
+    run_stages(&qs, node, sums);
+    for (int i = 0; i < NR_STAGES; ++i) {
+        printf("{\"bench\":\"query_path\",\"version\":\"%s\",\"names\":%ld,\"queries\":%d,"
+               "\"zipf\":%.2f,\"stage\":\"%s\",\"cycles_per_query\":%.2f}\n",
+               SHUKE_VERSION, nr_names, nr_queries, s, stage_names[i],
+               (double)sums[i] / nr_queries);
+    }
+
+    run_total(&qs, node, cycles, counters);
+    for (int i = 0; i < nr_queries; ++i) total += cycles[i];
+    qsort(cycles, (size_t)nr_queries, sizeof(uint32_t), cmp_u32);
+    printf("{\"bench\":\"query_path\",\"version\":\"%s\",\"names\":%ld,\"queries\":%d,"
+           "\"zipf\":%.2f,\"stage\":\"processUDPDnsQuery\",\"cycles_per_query\":%.2f,"
+           "\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"qps_per_core\":%.0f",
+           SHUKE_VERSION, nr_names, nr_queries, s, (double)total / nr_queries,
+           cycles[nr_queries / 2], cycles[(long)nr_queries * 9 / 10],
+           cycles[(long)nr_queries * 99 / 100], cycles[(long)nr_queries * 999 / 1000],
+           (double)rte_get_tsc_hz() * nr_queries / (double)RTE_MAX(total, 1ULL));
+    for (int i = 0; i < NR_COUNTERS; ++i) {
+        if (counters[i] < 0) printf(",\"%s_per_query\":null", counter_names[i]);
+        else printf(",\"%s_per_query\":%.2f", counter_names[i], (double)counters[i] / nr_queries);
+    }
+    printf("}\n");
+    fflush(stdout);
+
+    free(cycles);
+    free(qs.buf);
+    free(qs.offsets);
+    zoneDictDestroy(node->zd);
+    rcu_barrier();
+    node->zd = sk.zd = NULL;
+}
+
+/*
+ * a numa node with only this lcore, the round robin info of zones needs it.
+ */
+static void setup_bench_node(numaNode_t *node, int *lcore_id) {
+    memset(node, 0, sizeof(*node));
+    node->lcore_ids = lcore_id;
+    node->nr_lcore_ids = 1;
+    node->min_lcore_id = node->max_lcore_id = node->main_lcore_id = *lcore_id;
+    sk.nodes[0] = node;
+    sk.master_numa_id = 0;
+}
+
+/*
+ * bench query [scales] [queries] [zipf exponent]
+ */
+int queryPathBench(int argc, char *argv[]) {
+    char *scales = argc >= 4? argv[3]: BENCH_DEFAULT_SCALES;
+    int nr_queries = argc >= 5? atoi(argv[4]): BENCH_DEFAULT_QUERIES;
+    double s = argc >= 6? atof(argv[5]): 1.0;
+    char *ss, *token, *saveptr = NULL;
+    numaNode_t node;
+    int lcore_id = (int)rte_lcore_id();
+
+    if (nr_queries <= 0) {
+        fprintf(stderr, "invalid number of queries %s.\n", argv[4]);
+        return -1;
+    }
+    rcu_register_thread();
+    setup_bench_node(&node, &lcore_id);
+
+    ss = strdup(scales);
+    for (token = strtok_r(ss, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+        long n = atol(token);
+        if (n <= 0) {
+            fprintf(stderr, "invalid scale %s.\n", token);
+            free(ss);
+            return -1;
+        }
+        bench_one_scale(n, nr_queries, s);
+    }
+    free(ss);
+    rcu_unregister_thread();
+    return 0;
+}
+
+/*----------------------------------------------
+ *     control plane
+ *---------------------------------------------*/
+#define BENCH_DEFAULT_RELOADS  3
+#define BENCH_READER_QUERIES   100000
+#define BENCH_MAX_SAMPLES      (1 << 22)
+#define BENCH_IDLE_US          1000000
+
+enum {
+    READER_IDLE = 0,
+    READER_RELOAD,
+    READER_STOP,
+};
+
+typedef struct {
+    long long rss_kb;
+    long long peak_rss_kb;
+    uint64_t hugepage_bytes;
+} bench_mem_t;
+
+typedef struct {
+    char **files;
+    int nr_files;
+    zone **zones;
+    long names;
+    long rrsets;
+    long records;
+} bench_corpus_t;
+
+typedef struct {
+    numaNode_t *node;
+    int lcore_id;
+    bench_queries_t qs;
+    volatile int phase;
+    uint32_t *samples[READER_STOP];
+    size_t nr_samples[READER_STOP];
+} bench_reader_t;
+
+static long long proc_status_kb(const char *key) {
+    char line[256];
+    size_t klen = strlen(key);
+    long long v = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (fp == NULL) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, key, klen) == 0 && line[klen] == ':') {
+            v = atoll(line + klen + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return v;
+}
+
+/*
+ * the hugepages are mapped when EAL is initialized, so the change of RSS
+ * is the memory allocated from the heap.
+ */
+static void get_mem(bench_mem_t *m) {
+    struct rte_malloc_socket_stats st;
+
+    m->rss_kb = proc_status_kb("VmRSS");
+    m->peak_rss_kb = proc_status_kb("VmHWM");
+    m->hugepage_bytes = 0;
+    for (int i = 0; i < RTE_MAX_NUMA_NODES; ++i) {
+        if (rte_malloc_get_socket_stats(i, &st) == 0)
+            m->hugepage_bytes += st.heap_allocsz_bytes;
+    }
+}
+
+static int list_zone_files(const char *dir, bench_corpus_t *c) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    int size = 0;
+
+    if (d == NULL) {
+        fprintf(stderr, "can't open %s: %s.\n", dir, strerror(errno));
+        return ERR_CODE;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (!endswith(de->d_name, ".zone")) continue;
+        if (c->nr_files == size) {
+            size = RTE_MAX(size * 2, 1024);
+            c->files = realloc(c->files, sizeof(char *) * (size_t)size);
+        }
+        c->files[c->nr_files] = malloc(strlen(dir) + strlen(de->d_name) + 2);
+        sprintf(c->files[c->nr_files++], "%s/%s", dir, de->d_name);
+    }
+    closedir(d);
+    if (c->nr_files == 0) {
+        fprintf(stderr, "no *.zone file in %s.\n", dir);
+        return ERR_CODE;
+    }
+    c->zones = calloc((size_t)c->nr_files, sizeof(zone *));
+    return OK_CODE;
+}
+
+static void count_zone(bench_corpus_t *c, zone *z) {
+    dictIterator *it = dictGetIterator(z->d);
+    dictEntry *de;
+
+    while ((de = dictNext(it)) != NULL) {
+        dnsDictValue *dv = dictGetVal(de);
+        c->names++;
+        for (int i = 0; i < SUPPORT_TYPE_NUM; ++i) {
+            if (dv->v.rsArr[i] == NULL) continue;
+            c->rrsets++;
+            c->records += dv->v.rsArr[i]->num;
+        }
+    }
+    dictReleaseIterator(it);
+}
+
+/*
+ * parse all the zone files, the zones are added to(or replace the zones in)
+ * the zone dict of node.
+ */
+static void load_corpus(bench_corpus_t *c, numaNode_t *node, bool replace) {
+    zone *z;
+
+    for (int i = 0; i < c->nr_files; ++i) {
+        if (loadZoneFromFile(0, c->files[i], &z) != OK_CODE) {
+            fprintf(stderr, "can't load zone file %s.\n", c->files[i]);
+            exit(1);
+        }
+        zoneUpdateRoundRabinInfo(z);
+        if (replace) {
+            zoneDictReplace(node->zd, z);
+        } else if (zoneDictAdd(node->zd, z) != DICT_OK) {
+            fprintf(stderr, "duplicate zone %s in %s.\n", z->dotOrigin, c->files[i]);
+            exit(1);
+        }
+        c->zones[i] = z;
+    }
+}
+
+static double pct_us(uint32_t *a, size_t n, double p) {
+    if (n == 0) return 0;
+    return (double)a[(size_t)((double)n * p)] * US_PER_S / rte_get_tsc_hz();
+}
+
+/*
+ * the reader sends NS and SOA queries at the apex and NXDOMAIN queries to
+ * random zones, like a worker lcore does during a reload.
+ */
+static void gen_reader_queries(bench_reader_t *r, bench_corpus_t *c) {
+    bench_queries_t *qs = &r->qs;
+    char dot[MAX_DOMAIN_LEN+2];
+    char *p;
+
+    qs->nr = BENCH_READER_QUERIES;
+    qs->buf = malloc((size_t)qs->nr * (BENCH_MAX_QUERY_SIZE + 2));
+    qs->offsets = malloc(sizeof(size_t) * (size_t)qs->nr);
+    p = qs->buf;
+    for (int i = 0; i < qs->nr; ++i) {
+        zone *z = c->zones[rand() % c->nr_files];
+        int k = rand() % 4;
+
+        qs->offsets[i] = (size_t)(p - qs->buf);
+        if (k < 3) {
+            p += pack_query(p, (uint16_t)i, z->dotOrigin, k < 2? DNS_TYPE_NS: DNS_TYPE_SOA);
+        } else {
+            snprintf(dot, sizeof(dot), "nx%d.%s", rand(), z->dotOrigin);
+            p += pack_query(p, (uint16_t)i, dot, DNS_TYPE_A);
+        }
+    }
+}
+
+static void *reader_main(void *arg) {
+    bench_reader_t *r = arg;
+    char buf[SK_RESP_BUF_SIZE];
+    char src[4] = {(char)192, 0, 2, 1};
+    int phase, i = 0;
+
+    rcu_register_thread();
+    while ((phase = r->phase) != READER_STOP) {
+        char *q = r->qs.buf + r->qs.offsets[i];
+        size_t len = load16be(q);
+        uint64_t t0, t1;
+
+        rte_memcpy(buf, q + 2, len);
+        t0 = rte_rdtsc();
+        processUDPDnsQuery(buf, len, buf, sizeof(buf), ETHER_MTU, src, 5353, true, -1, NULL, NULL,
+                           r->node, r->lcore_id);
+        t1 = rte_rdtsc();
+        if (r->nr_samples[phase] < BENCH_MAX_SAMPLES)
+            r->samples[phase][r->nr_samples[phase]++] = (uint32_t)RTE_MIN(t1 - t0, (uint64_t)UINT32_MAX);
+        if (++i == r->qs.nr) i = 0;
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bench_replicate(bench_corpus_t *c) {
+    struct rte_malloc_socket_stats st;
+    zone **copies = calloc((size_t)c->nr_files, sizeof(zone *));
+    bench_mem_t m0, m1;
+    long long start, elapsed;
+
+    for (int s = 0; s < RTE_MAX_NUMA_NODES; ++s) {
+        numaNode_t *saved = sk.nodes[s];
+
+        if (rte_malloc_get_socket_stats(s, &st) != 0 || st.heap_totalsz_bytes == 0) continue;
+        // the round robin info of the copies is built from the bench node.
+        if (saved == NULL) sk.nodes[s] = sk.nodes[0];
+        get_mem(&m0);
+        start = ustime();
+        for (int i = 0; i < c->nr_files; ++i) {
+            copies[i] = zoneCopy(c->zones[i], s);
+            zoneUpdateRoundRabinInfo(copies[i]);
+        }
+        elapsed = ustime() - start;
+        get_mem(&m1);
+        printf("{\"bench\":\"control_plane\",\"version\":\"%s\",\"phase\":\"replicate\","
+               "\"socket\":%d,\"zones\":%d,\"records\":%ld,\"seconds\":%.3f,"
+               "\"zones_per_sec\":%.0f,\"hugepage_bytes\":%"PRIu64",\"heap_bytes\":%lld}\n",
+               SHUKE_VERSION, s, c->nr_files, c->records, (double)elapsed / US_PER_S,
+               (double)c->nr_files * US_PER_S / RTE_MAX(elapsed, 1LL),
+               m1.hugepage_bytes - m0.hugepage_bytes, (m1.rss_kb - m0.rss_kb) * 1024);
+        fflush(stdout);
+        for (int i = 0; i < c->nr_files; ++i) zoneDestroy(copies[i]);
+        sk.nodes[s] = saved;
+    }
+    free(copies);
+}
+
+static void bench_reload(bench_corpus_t *c, numaNode_t *node, int lcore_id, int round) {
+    bench_reader_t r;
+    pthread_t tid;
+    bench_mem_t m0, m1, m2;
+    long long start, reload_us, drain_us;
+
+    memset(&r, 0, sizeof(r));
+    r.node = node;
+    r.lcore_id = lcore_id;
+    gen_reader_queries(&r, c);
+    for (int i = 0; i < READER_STOP; ++i)
+        r.samples[i] = malloc(sizeof(uint32_t) * BENCH_MAX_SAMPLES);
+    r.phase = READER_IDLE;
+    if (pthread_create(&tid, NULL, reader_main, &r) != 0) {
+        fprintf(stderr, "can't create reader thread.\n");
+        exit(1);
+    }
+    usleep(BENCH_IDLE_US);
+
+    r.phase = READER_RELOAD;
+    get_mem(&m0);
+    start = ustime();
+    load_corpus(c, node, true);
+    reload_us = ustime() - start;
+    // the replaced zones are freed after a grace period.
+    get_mem(&m1);
+    start = ustime();
+    rcu_barrier();
+    drain_us = ustime() - start;
+    get_mem(&m2);
+    r.phase = READER_STOP;
+    pthread_join(tid, NULL);
+
+    for (int i = 0; i < READER_STOP; ++i)
+        qsort(r.samples[i], r.nr_samples[i], sizeof(uint32_t), cmp_u32);
+    printf("{\"bench\":\"control_plane\",\"version\":\"%s\",\"phase\":\"reload\",\"round\":%d,"
+           "\"zones\":%d,\"records\":%ld,\"seconds\":%.3f,\"zones_per_sec\":%.0f,"
+           "\"hugepage_growth_bytes\":%"PRId64",\"rcu_backlog_hugepage_bytes\":%"PRId64","
+           "\"rcu_drain_ms\":%.3f,\"peak_rss_kb\":%lld,"
+           "\"idle_queries\":%zu,\"idle_p50_us\":%.2f,\"idle_p99_us\":%.2f,\"idle_p999_us\":%.2f,"
+           "\"reload_queries\":%zu,\"reload_p50_us\":%.2f,\"reload_p99_us\":%.2f,"
+           "\"reload_p999_us\":%.2f,\"reload_max_us\":%.2f}\n",
+           SHUKE_VERSION, round, c->nr_files, c->records, (double)reload_us / US_PER_S,
+           (double)c->nr_files * US_PER_S / RTE_MAX(reload_us, 1LL),
+           (int64_t)(m1.hugepage_bytes - m0.hugepage_bytes),
+           (int64_t)(m1.hugepage_bytes - m2.hugepage_bytes), (double)drain_us / 1000,
+           m2.peak_rss_kb,
+           r.nr_samples[READER_IDLE], pct_us(r.samples[READER_IDLE], r.nr_samples[READER_IDLE], 0.5),
+           pct_us(r.samples[READER_IDLE], r.nr_samples[READER_IDLE], 0.99),
+           pct_us(r.samples[READER_IDLE], r.nr_samples[READER_IDLE], 0.999),
+           r.nr_samples[READER_RELOAD], pct_us(r.samples[READER_RELOAD], r.nr_samples[READER_RELOAD], 0.5),
+           pct_us(r.samples[READER_RELOAD], r.nr_samples[READER_RELOAD], 0.99),
+           pct_us(r.samples[READER_RELOAD], r.nr_samples[READER_RELOAD], 0.999),
+           r.nr_samples[READER_RELOAD]?
+               pct_us(r.samples[READER_RELOAD], r.nr_samples[READER_RELOAD], 1.0 - 1.0 / r.nr_samples[READER_RELOAD]): 0);
+    fflush(stdout);
+
+    for (int i = 0; i < READER_STOP; ++i) free(r.samples[i]);
+    free(r.qs.buf);
+    free(r.qs.offsets);
+}
+
+/*
+ * bench control <zone dir> [reloads]
+ */
+int controlPlaneBench(int argc, char *argv[]) {
+    int reloads = argc >= 5? atoi(argv[4]): BENCH_DEFAULT_RELOADS;
+    int lcore_id = (int)rte_lcore_id();
+    bench_corpus_t c;
+    numaNode_t node;
+    bench_mem_t m0, m1;
+    long long start, elapsed;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: bench control <zone dir> [reloads]\n");
+        return -1;
+    }
+    memset(&c, 0, sizeof(c));
+    if (list_zone_files(argv[3], &c) != OK_CODE) return -1;
+
+    rcu_register_thread();
+    setup_bench_node(&node, &lcore_id);
+    node.zd = zoneDictCreate(0);
+    sk.zd = node.zd;
+
+    get_mem(&m0);
+    start = ustime();
+    load_corpus(&c, &node, false);
+    elapsed = ustime() - start;
+    get_mem(&m1);
+    for (int i = 0; i < c.nr_files; ++i) count_zone(&c, c.zones[i]);
+    printf("{\"bench\":\"control_plane\",\"version\":\"%s\",\"phase\":\"load\",\"zones\":%d,"
+           "\"names\":%ld,\"rrsets\":%ld,\"records\":%ld,\"seconds\":%.3f,\"zones_per_sec\":%.0f,"
+           "\"records_per_sec\":%.0f,\"hugepage_bytes\":%"PRIu64",\"heap_bytes\":%lld,"
+           "\"hugepage_bytes_per_record\":%.1f,\"heap_bytes_per_record\":%.1f,"
+           "\"rss_kb\":%lld,\"peak_rss_kb\":%lld}\n",
+           SHUKE_VERSION, c.nr_files, c.names, c.rrsets, c.records, (double)elapsed / US_PER_S,
+           (double)c.nr_files * US_PER_S / RTE_MAX(elapsed, 1LL),
+           (double)c.records * US_PER_S / RTE_MAX(elapsed, 1LL),
+           m1.hugepage_bytes - m0.hugepage_bytes, (m1.rss_kb - m0.rss_kb) * 1024,
+           (double)(m1.hugepage_bytes - m0.hugepage_bytes) / RTE_MAX(c.records, 1L),
+           (double)(m1.rss_kb - m0.rss_kb) * 1024 / RTE_MAX(c.records, 1L),
+           m1.rss_kb, m1.peak_rss_kb);
+    fflush(stdout);
+
+    bench_replicate(&c);
+    for (int i = 0; i < reloads; ++i) bench_reload(&c, &node, lcore_id, i);
+
+    zoneDictDestroy(node.zd);
+    rcu_barrier();
+    node.zd = sk.zd = NULL;
+    for (int i = 0; i < c.nr_files; ++i) free(c.files[i]);
+    free(c.files);
+    free(c.zones);
+    rcu_unregister_thread();
+    return 0;
+}
+
+#endif /* SK_BENCH */
@@ -0,0 +1,29 @@
+//
+// record mix of synthetic zones, used by `shuke-server bench` and
+// tools/gen_zone_data.py(which parses the BENCH_MIX lines of this file,
+// so keep one entry per line).
+//
+// name i of a zone gets the record if i % modulus == remainder, the CNAME
+// goes first since a name with a CNAME gets nothing else. the placeholders
+// of rdata are
+//
+//     {b2} {b1} {b0}  the bytes 2, 1 and 0 of i
+//     {b2h}           128 | (i >> 16 & 0x7F), the second A of round robin sets
+//     {hex}           i in hex
+//     {origin}        origin of the zone, ends with a dot
+//
+// besides SOA and NS at the apex, the zones have ns1, ns2, mail and www.
+//
+
+#ifndef _BENCH_MIX_H_
+#define _BENCH_MIX_H_
+
+#define BENCH_MIX_TABLE \
+    BENCH_MIX(20, 5, "CNAME", "www.{origin}") \
+    BENCH_MIX(1, 0, "A", "10.{b2}.{b1}.{b0}") \
+    BENCH_MIX(4, 0, "A", "10.{b2h}.{b1}.{b0}") \
+    BENCH_MIX(3, 0, "AAAA", "2001:db8::{hex}") \
+    BENCH_MIX(10, 0, "MX", "10 mail.{origin}") \
+    BENCH_MIX(7, 0, "TXT", "\"v=spf1 include:{origin} ~all\"")
+
+#endif /* _BENCH_MIX_H_ */
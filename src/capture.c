@@ -0,0 +1,480 @@
+//
+// on-demand packet capture.
+//
+// DPDK owns the NICs, so tcpdump only sees the traffic sent to KNI. when a
+// capture is started by the CAPTURE admin command, the lcores copy the UDP
+// queries and their responses to a single producer/single consumer ring of
+// fixed size slots owned by the lcore, a writer thread drains the rings to a
+// pcapng file until the capture is stopped or its duration or size limit is
+// reached. when no capture is running, the query path only tests
+// sk.capture_on.
+//
+// the query is copied to the free slot at the head of the ring before it is
+// overwritten by the response, the pair is published only if the response
+// matches the filters(client prefix, qname suffix, qtype and rcode). when a
+// ring is full, the packets are dropped and counted.
+//
+// the responses are captured before the checksums are computed by the NIC,
+// so they may show bad UDP checksums when checksum offload is enabled.
+//
+#include <arpa/inet.h>
+#include <time.h>
+
+#include "shuke.h"
+#include "utils.h"
+
+#define CAPTURE_IDLE_SLEEP_US 1000
+
+/* pcapng block types */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+typedef struct sk_cap_slot {
+    uint64_t ts_us;
+    uint32_t orig_len;
+    uint32_t cap_len;
+    uint8_t data[SK_CAPTURE_SNAPLEN];
+} sk_cap_slot_t;
+
+typedef struct sk_cap_ring {
+    /* written by the lcore */
+    volatile uint32_t head __rte_cache_aligned;
+    uint64_t nr_dropped;
+    // the query copied to the slot at head, waiting for its response.
+    struct rte_mbuf *pending_m;
+    uint16_t pending_id;
+
+    /* written by the writer thread */
+    volatile uint32_t tail __rte_cache_aligned;
+
+    uint32_t mask __rte_cache_aligned;
+    sk_cap_slot_t slots[];
+} sk_cap_ring_t;
+
+typedef struct {
+    int family;                 // 0 if any client is captured
+    uint8_t prefix[16];
+    int prefix_len;
+    char qname[MAX_DOMAIN_LEN+2];   // suffix in len label format
+    size_t qname_len;               // 0 if any name is captured
+    int qtype;                      // -1 if any type is captured
+    int rcode;                      // -1 if any rcode is captured
+} sk_cap_filter_t;
+
+static sk_cap_filter_t filter;
+static pthread_t writer_tid;
+static bool writer_started = false;
+static volatile bool writer_stop = false;
+
+// the current or last capture, updated by the writer thread.
+static char cap_file[PATH_MAX];
+static long long cap_start_ms;
+static long long cap_duration_ms;
+static uint64_t cap_max_size;
+static volatile uint64_t cap_packets;
+static volatile uint64_t cap_bytes;
+
+static inline uint32_t copy_packet(sk_cap_slot_t *slot, struct rte_mbuf *m, uint32_t len) {
+    uint32_t cap_len = RTE_MIN(len, (uint32_t)SK_CAPTURE_SNAPLEN);
+    const void *p = rte_pktmbuf_read(m, 0, cap_len, slot->data);
+
+    if (p == NULL) return 0;
+    if (p != slot->data) rte_memcpy(slot->data, p, cap_len);
+    slot->ts_us = rte_tsc_ustime();
+    slot->orig_len = len;
+    slot->cap_len = cap_len;
+    return cap_len;
+}
+
+/*
+ * copy the query(`len` bytes from the ethernet header) to the slot at head,
+ * called before the query is answered in place.
+ */
+void sk_capture_query(lcore_conf_t *qconf, struct rte_mbuf *m, uint32_t len) {
+    sk_cap_ring_t *r = qconf->cap_ring;
+    sk_cap_slot_t *slot;
+    uint32_t dns_off = m->l2_len + m->l3_len + m->l4_len;
+    uint32_t head;
+
+    if (unlikely(r == NULL)) return;
+    r->pending_m = NULL;
+    head = r->head;
+    // the query and its response need 2 slots.
+    if (head - r->tail + 2 > r->mask + 1) {
+        r->nr_dropped += 2;
+        return;
+    }
+    slot = &r->slots[head & r->mask];
+    if (copy_packet(slot, m, len) < dns_off + DNS_HDR_SIZE) return;
+    r->pending_m = m;
+    r->pending_id = *(uint16_t *)(slot->data + dns_off);
+}
+
+static bool match_prefix(const uint8_t *addr, int family) {
+    int bits = filter.prefix_len;
+    int nbytes = bits / 8;
+
+    if (family != filter.family) return false;
+    if (memcmp(addr, filter.prefix, (size_t)nbytes) != 0) return false;
+    bits %= 8;
+    if (bits == 0) return true;
+    return ((addr[nbytes] ^ filter.prefix[nbytes]) & (0xFF << (8 - bits))) == 0;
+}
+
+/*
+ * the name ends with the suffix at a label boundary.
+ */
+static bool match_suffix(const char *name, size_t name_len) {
+    const char *p = name;
+
+    while (name_len >= filter.qname_len) {
+        if (name_len == filter.qname_len)
+            return strncasecmp(p, filter.qname, name_len) == 0;
+        name_len -= (uint8_t)*p + 1;
+        p += (uint8_t)*p + 1;
+    }
+    return false;
+}
+
+static bool match_response(const sk_cap_slot_t *slot, uint32_t l2_len,
+                           uint32_t dns_off, bool is_ipv4) {
+    const uint8_t *dns = slot->data + dns_off;
+    const uint8_t *end = slot->data + slot->cap_len;
+    const uint8_t *p;
+
+    if (filter.family) {
+        // the client is the destination of the response.
+        const uint8_t *addr = slot->data + l2_len + (is_ipv4? 16: 24);
+        if (!match_prefix(addr, is_ipv4? AF_INET: AF_INET6)) return false;
+    }
+    if (filter.rcode >= 0 && (dns[3] & 0x0F) != filter.rcode) return false;
+    if (filter.qname_len == 0 && filter.qtype < 0) return true;
+
+    // the question section is never compressed.
+    for (p = dns + DNS_HDR_SIZE; p < end && *p; p += *p + 1) ;
+    if (p + 3 > end) return false;
+    if (filter.qtype >= 0 && load16be((char *)p + 1) != filter.qtype) return false;
+    if (filter.qname_len && !match_suffix((const char *)dns + DNS_HDR_SIZE,
+                                         (size_t)(p - dns - DNS_HDR_SIZE + 1)))
+        return false;
+    return true;
+}
+
+/*
+ * copy the response to the slot following the query and publish both
+ * if the response matches the filters, called right before it is sent.
+ */
+void sk_capture_response(lcore_conf_t *qconf, struct rte_mbuf *m, bool is_ipv4) {
+    sk_cap_ring_t *r = qconf->cap_ring;
+    sk_cap_slot_t *slot;
+    uint32_t dns_off = m->l2_len + m->l3_len + m->l4_len;
+    uint32_t head;
+
+    if (unlikely(r == NULL) || r->pending_m != m) return;
+    r->pending_m = NULL;
+    head = r->head;
+    slot = &r->slots[(head + 1) & r->mask];
+    if (copy_packet(slot, m, rte_pktmbuf_pkt_len(m)) < dns_off + DNS_HDR_SIZE) return;
+    if (*(uint16_t *)(slot->data + dns_off) != r->pending_id) return;
+    if (!match_response(slot, m->l2_len, dns_off, is_ipv4)) return;
+
+    // the slots must be visible before the new head.
+    rte_smp_wmb();
+    r->head = head + 2;
+}
+
+static uint64_t write_shb_idb(FILE *fp) {
+    uint32_t shb[7] = {PCAPNG_SHB, 28, PCAPNG_BYTE_ORDER_MAGIC,
+                       1, /* major 1, minor 0 */
+                       0xFFFFFFFF, 0xFFFFFFFF, /* section length is unknown */
+                       28};
+    uint32_t idb[5] = {PCAPNG_IDB, 20, PCAPNG_LINKTYPE_ETHERNET,
+                       SK_CAPTURE_SNAPLEN, 20};
+
+    fwrite_unlocked(shb, sizeof(shb), 1, fp);
+    fwrite_unlocked(idb, sizeof(idb), 1, fp);
+    return sizeof(shb) + sizeof(idb);
+}
+
+/*
+ * enhanced packet block, the timestamp resolution is microsecond(the default).
+ */
+static uint64_t write_epb(FILE *fp, const sk_cap_slot_t *slot) {
+    static const uint8_t zeros[4] = {0};
+    uint32_t pad = (4 - (slot->cap_len & 3)) & 3;
+    uint32_t total = 32 + slot->cap_len + pad;
+    uint32_t hdr[7] = {PCAPNG_EPB, total, 0,
+                       (uint32_t)(slot->ts_us >> 32), (uint32_t)slot->ts_us,
+                       slot->cap_len, slot->orig_len};
+
+    fwrite_unlocked(hdr, sizeof(hdr), 1, fp);
+    fwrite_unlocked(slot->data, slot->cap_len, 1, fp);
+    if (pad) fwrite_unlocked(zeros, pad, 1, fp);
+    fwrite_unlocked(&total, sizeof(total), 1, fp);
+    return total;
+}
+
+/*
+ * drop the packets left by the lcores that saw the end of last capture late.
+ */
+static void discard_rings(void) {
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_cap_ring_t *r = sk.lcore_conf[sk.lcore_ids[i]]->cap_ring;
+        r->tail = r->head;
+    }
+}
+
+static int drain_rings(FILE *fp) {
+    int n = 0;
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_cap_ring_t *r = sk.lcore_conf[sk.lcore_ids[i]]->cap_ring;
+        uint32_t head = r->head, tail = r->tail;
+
+        if (head == tail) continue;
+        // read the slots after the head.
+        rte_smp_rmb();
+        for (; tail != head; ++tail) {
+            cap_bytes += write_epb(fp, &r->slots[tail & r->mask]);
+            n++;
+        }
+        // the slots must be consumed before they are released.
+        rte_smp_mb();
+        r->tail = tail;
+    }
+    cap_packets += n;
+    return n;
+}
+
+static void *capture_writer(void *arg) {
+    FILE *fp = arg;
+
+    discard_rings();
+    cap_bytes = write_shb_idb(fp);
+    rte_smp_wmb();
+    sk.capture_on = true;
+
+    while (!writer_stop) {
+        if (drain_rings(fp) == 0) usleep(CAPTURE_IDLE_SLEEP_US);
+        if (cap_bytes >= cap_max_size || mstime() - cap_start_ms >= cap_duration_ms) break;
+    }
+    sk.capture_on = false;
+    // give the lcores that saw the flag a chance to finish their packets.
+    usleep(CAPTURE_IDLE_SLEEP_US);
+    drain_rings(fp);
+    fclose(fp);
+    LOG_INFO(USER1, "capture %s is finished, %llu packets, %llu bytes.", cap_file,
+             (unsigned long long)cap_packets, (unsigned long long)cap_bytes);
+    return NULL;
+}
+
+static int parse_client_prefix(char *errstr, const char *s) {
+    char buf[INET6_ADDRSTRLEN+4];
+    char *slash, *end;
+    long len;
+    int max;
+
+    snprintf(buf, sizeof(buf), "%s", s);
+    filter.family = strchr(buf, ':')? AF_INET6: AF_INET;
+    max = filter.family == AF_INET? 32: 128;
+    len = max;
+    if ((slash = strchr(buf, '/')) != NULL) {
+        *slash = 0;
+        len = strtol(slash + 1, &end, 10);
+        if (*end != 0 || end == slash + 1) len = -1;
+    }
+    if (len < 0 || len > max || inet_pton(filter.family, buf, filter.prefix) != 1) {
+        snprintf(errstr, ERR_STR_LEN, "invalid client prefix %s.", s);
+        return ERR_CODE;
+    }
+    filter.prefix_len = (int)len;
+    return OK_CODE;
+}
+
+static int parse_qname_suffix(char *errstr, const char *s) {
+    char buf[MAX_DOMAIN_LEN+2];
+    size_t len = strlen(s);
+
+    if (len == 0 || len > MAX_DOMAIN_LEN) {
+        snprintf(errstr, ERR_STR_LEN, "invalid qname suffix %s.", s);
+        return ERR_CODE;
+    }
+    // the root matches every name.
+    if (strcmp(s, ".") == 0) return OK_CODE;
+    snprintf(buf, sizeof(buf), "%s%s", s, s[len-1] == '.'? "": ".");
+    dot2lenlabel(buf, filter.qname);
+    filter.qname_len = strlen(buf) + 1;
+    if (checkLenLabel(filter.qname, filter.qname_len) < 0) {
+        snprintf(errstr, ERR_STR_LEN, "invalid qname suffix %s.", s);
+        return ERR_CODE;
+    }
+    return OK_CODE;
+}
+
+static int parse_rcode(const char *s) {
+    static const char *names[] = {"noerror", "formerr", "servfail", "nxdomain", "notimp", "refused"};
+    char *end;
+    long v;
+
+    for (int i = 0; i < (int)RTE_DIM(names); ++i) {
+        if (strcasecmp(s, names[i]) == 0) return i;
+    }
+    v = strtol(s, &end, 10);
+    if (*end != 0 || end == s || v < 0 || v > 15) return -1;
+    return (int)v;
+}
+
+static int parse_qtype(const char *s) {
+    char *end;
+    long v = strtol(s, &end, 10);
+
+    if (*end == 0 && end != s) return (v >= 0 && v <= UINT16_MAX)? (int)v: -1;
+    v = strToDNSType(s);
+    return v == PROTO_ERR? -1: (int)v;
+}
+
+/*
+ * CAPTURE START [client=<prefix>] [qname=<suffix>] [qtype=<type>] [rcode=<rcode>]
+ *               [duration=<seconds>] [size=<MB>] [file=<path>]
+ */
+int sk_capture_start(char *errstr, int argc, char *argv[]) {
+    long long duration = sk.capture_max_duration;
+    long long size = sk.capture_max_size;
+    char *file = NULL;
+    char timebuf[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    FILE *fp;
+
+    if (sk.socket_io_on || sk.lcore_conf[sk.lcore_ids[0]]->cap_ring == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "capture is disabled(capture_buffer_size is 0 or io_backend is socket).");
+        return ERR_CODE;
+    }
+    if (sk.capture_on) {
+        snprintf(errstr, ERR_STR_LEN, "capture %s is running.", cap_file);
+        return ERR_CODE;
+    }
+    if (writer_started) {
+        pthread_join(writer_tid, NULL);
+        writer_started = false;
+    }
+
+    memset(&filter, 0, sizeof(filter));
+    filter.qtype = -1;
+    filter.rcode = -1;
+    for (int i = 0; i < argc; ++i) {
+        char *k = argv[i], *v = strchr(argv[i], '=');
+        if (v == NULL) {
+            snprintf(errstr, ERR_STR_LEN, "invalid option %s, should be key=value.", k);
+            return ERR_CODE;
+        }
+        *v++ = 0;
+        if (strcasecmp(k, "client") == 0) {
+            if (parse_client_prefix(errstr, v) != OK_CODE) return ERR_CODE;
+        } else if (strcasecmp(k, "qname") == 0) {
+            if (parse_qname_suffix(errstr, v) != OK_CODE) return ERR_CODE;
+        } else if (strcasecmp(k, "qtype") == 0) {
+            if ((filter.qtype = parse_qtype(v)) < 0) goto invalid;
+        } else if (strcasecmp(k, "rcode") == 0) {
+            if ((filter.rcode = parse_rcode(v)) < 0) goto invalid;
+        } else if (strcasecmp(k, "duration") == 0) {
+            if ((duration = atoll(v)) <= 0) goto invalid;
+        } else if (strcasecmp(k, "size") == 0) {
+            if ((size = atoll(v)) <= 0) goto invalid;
+        } else if (strcasecmp(k, "file") == 0) {
+            file = v;
+        } else {
+            snprintf(errstr, ERR_STR_LEN, "unknown option %s.", k);
+            return ERR_CODE;
+        }
+        continue;
+invalid:
+        snprintf(errstr, ERR_STR_LEN, "invalid %s %s.", k, v);
+        return ERR_CODE;
+    }
+
+    if (file) {
+        snprintf(cap_file, sizeof(cap_file), "%s", file);
+    } else {
+        localtime_r(&now, &tm);
+        strftime(timebuf, sizeof(timebuf), "%Y%m%d-%H%M%S", &tm);
+        snprintf(cap_file, sizeof(cap_file), "%s/shuke-%d-%s.pcapng",
+                 sk.capture_dir, sk.port, timebuf);
+    }
+    if ((fp = fopen(cap_file, "w")) == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "can't open %s: %s.", cap_file, strerror(errno));
+        return ERR_CODE;
+    }
+    cap_start_ms = mstime();
+    cap_duration_ms = duration * 1000;
+    cap_max_size = (uint64_t)size * 1024 * 1024;
+    cap_packets = 0;
+    cap_bytes = 0;
+    writer_stop = false;
+    if (pthread_create(&writer_tid, NULL, capture_writer, fp) != 0) {
+        fclose(fp);
+        snprintf(errstr, ERR_STR_LEN, "can't create capture writer thread.");
+        return ERR_CODE;
+    }
+    writer_started = true;
+    LOG_INFO(USER1, "capture %s is started.", cap_file);
+    return OK_CODE;
+}
+
+int sk_capture_stop(char *errstr) {
+    if (!writer_started) {
+        snprintf(errstr, ERR_STR_LEN, "no capture is running.");
+        return ERR_CODE;
+    }
+    writer_stop = true;
+    pthread_join(writer_tid, NULL);
+    writer_started = false;
+    return OK_CODE;
+}
+
+sds sk_capture_status(sds s) {
+    uint64_t dropped = 0;
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_cap_ring_t *r = sk.lcore_conf[sk.lcore_ids[i]]->cap_ring;
+        if (r) dropped += r->nr_dropped;
+    }
+    return sdscatprintf(s,
+                        "capture_running:%d\r\n"
+                        "capture_file:%s\r\n"
+                        "capture_packets:%llu\r\n"
+                        "capture_bytes:%llu\r\n"
+                        "capture_dropped:%llu\r\n",
+                        sk.capture_on, cap_file,
+                        (unsigned long long)cap_packets,
+                        (unsigned long long)cap_bytes,
+                        (unsigned long long)dropped);
+}
+
+/*
+ * create the rings, must be called before the lcores are launched.
+ */
+int sk_init_capture(void) {
+    uint32_t nr_slots = rte_align32pow2((uint32_t)sk.capture_buffer_size);
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        int socketid = sk.numa_on? (int)rte_lcore_to_socket_id((unsigned)lcore_id): 0;
+        sk_cap_ring_t *r = socket_calloc(socketid, 1, sizeof(*r) + nr_slots * sizeof(sk_cap_slot_t));
+
+        r->mask = nr_slots - 1;
+        sk.lcore_conf[lcore_id]->cap_ring = r;
+    }
+    return OK_CODE;
+}
+
+/*
+ * stop the running capture, called when the server exits.
+ */
+void sk_stop_capture(void) {
+    char errstr[ERR_STR_LEN];
+    if (writer_started) sk_capture_stop(errstr);
+}
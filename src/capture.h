@@ -0,0 +1,29 @@
+//
+// on-demand packet capture.
+//
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sds.h"
+
+struct rte_mbuf;
+struct lcore_conf;
+
+// bytes of a packet kept in the capture, enough for a full ethernet frame.
+#define SK_CAPTURE_SNAPLEN 1536
+
+int sk_init_capture(void);
+void sk_stop_capture(void);
+
+int sk_capture_start(char *errstr, int argc, char *argv[]);
+int sk_capture_stop(char *errstr);
+sds sk_capture_status(sds s);
+
+void sk_capture_query(struct lcore_conf *qconf, struct rte_mbuf *m, uint32_t len);
+void sk_capture_response(struct lcore_conf *qconf, struct rte_mbuf *m, bool is_ipv4);
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,309 @@
+//
+// service addresses of ports.
+//
+// every port serves one or more ipv4/ipv6 addresses, an address may be
+// in a vlan(802.1Q or QinQ). lcores look up the (vlan, destination address)
+// of ARP, NDP, ICMPv6 and DNS packets in a small open addressing hash table,
+// the table is read only after it is created, addresses added at runtime
+// (through admin) are published by replacing the whole table with RCU.
+//
+#include <rte_malloc.h>
+
+#include "shuke.h"
+
+static int parse_vlan_id(const char *s, char **end) {
+    long vid = strtol(s, end, 10);
+    if (*end == s || vid <= 0 || vid >= 4095) return -1;
+    return (int)vid;
+}
+
+/*
+ * parse `addr[@vlan]`, vlan is `<id>` for 802.1Q or `<outer>.<inner>`
+ * for QinQ.
+ */
+int sk_addr_parse(sk_addr_t *a, const char *s) {
+    char buf[INET6_ADDRSTRLEN];
+    const char *at = strchr(s, '@');
+    size_t len = at? (size_t)(at - s): strlen(s);
+    char *end;
+    int outer = 0, inner;
+
+    memset(a, 0, sizeof(*a));
+    if (len >= sizeof(buf)) return ERR_CODE;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+
+    if (strchr(buf, ':')) {
+        if (!str2ipv6(buf, a->addr)) return ERR_CODE;
+        a->family = AF_INET6;
+    } else {
+        if (!str2ipv4(buf, a->addr)) return ERR_CODE;
+        a->family = AF_INET;
+    }
+    if (at) {
+        if ((inner = parse_vlan_id(at + 1, &end)) < 0) return ERR_CODE;
+        if (*end == '.') {
+            outer = inner;
+            if ((inner = parse_vlan_id(end + 1, &end)) < 0) return ERR_CODE;
+        }
+        if (*end != 0) return ERR_CODE;
+        a->vlan = SK_VLAN_KEY(outer, inner);
+    }
+    return OK_CODE;
+}
+
+const char *sk_addr_ntop(const sk_addr_t *a, char *buf, size_t size) {
+    return inet_ntop(a->family, a->addr, buf, (socklen_t)size);
+}
+
+sk_addr_table_t *sk_addr_table_create(const sk_addr_t *addrs, int n) {
+    uint32_t size = 16;
+    uint32_t idx;
+    sk_addr_table_t *tbl;
+
+    while (size < (uint32_t)n * 2) size <<= 1;
+    tbl = rte_zmalloc("addr_table", sizeof(*tbl) + size * sizeof(sk_addr_t),
+                      RTE_CACHE_LINE_SIZE);
+    if (tbl == NULL) return NULL;
+    tbl->mask = size - 1;
+
+    for (int i = 0; i < n; ++i) {
+        if (sk_addr_lookup(tbl, addrs[i].family, addrs[i].vlan, addrs[i].addr)) continue;
+        idx = sk_addr_hash(addrs[i].family, addrs[i].vlan, addrs[i].addr) & tbl->mask;
+        while (tbl->slots[idx].family != 0) {
+            idx = (idx + 1) & tbl->mask;
+        }
+        tbl->slots[idx] = addrs[i];
+        tbl->nr_addrs++;
+    }
+    return tbl;
+}
+
+void sk_addr_table_destroy(sk_addr_table_t *tbl) {
+    rte_free(tbl);
+}
+
+/*
+ * format the address as `addr[@vlan]`.
+ */
+int sk_addr_format(const sk_addr_t *a, char *buf, size_t size) {
+    char ip[INET6_ADDRSTRLEN];
+
+    sk_addr_ntop(a, ip, sizeof(ip));
+    if (a->vlan == 0)
+        return snprintf(buf, size, "%s", ip);
+    if (SK_VLAN_OUTER(a->vlan))
+        return snprintf(buf, size, "%s@%d.%d", ip, SK_VLAN_OUTER(a->vlan), SK_VLAN_INNER(a->vlan));
+    return snprintf(buf, size, "%s@%d", ip, SK_VLAN_INNER(a->vlan));
+}
+
+static bool addr_equal(const sk_addr_t *a, const sk_addr_t *b) {
+    return a->family == b->family && a->vlan == b->vlan &&
+           memcmp(a->addr, b->addr, a->family == AF_INET? 4: 16) == 0;
+}
+
+/*
+ * the same address on different ports shares the service id,
+ * otherwise the ids are allocated in the order the addresses are added.
+ * the id of a new address is only taken by commit_svc_id().
+ */
+static uint16_t next_svc_id = 0;
+
+static uint16_t lookup_svc_id(const sk_addr_t *a) {
+    for (int i = 0; i < sk.nr_ports; ++i) {
+        port_info_t *pinfo = sk.port_info[sk.port_ids[i]];
+        if (pinfo == NULL) continue;
+        for (int j = 0; j < pinfo->nr_addrs; ++j) {
+            if (addr_equal(&pinfo->addrs[j], a)) return pinfo->addrs[j].svc_id;
+        }
+    }
+    return next_svc_id;
+}
+
+static void commit_svc_id(const sk_addr_t *a) {
+    if (a->svc_id == next_svc_id) next_svc_id++;
+}
+
+/*
+ * append an address to the address list of `pinfo` and update the
+ * per port fields derived from it, the service id is not committed.
+ */
+static int append_addr(port_info_t *pinfo, sk_addr_t *a) {
+    sk_addr_t *addrs;
+
+    for (int i = 0; i < pinfo->nr_addrs; ++i) {
+        if (addr_equal(&pinfo->addrs[i], a)) return ERR_CODE;
+    }
+    addrs = realloc(pinfo->addrs, (pinfo->nr_addrs + 1) * sizeof(sk_addr_t));
+    if (addrs == NULL) return ERR_CODE;
+    pinfo->addrs = addrs;
+
+    a->svc_id = lookup_svc_id(a);
+    if (a->family == AF_INET && !pinfo->has_ipv4) {
+        memcpy(&pinfo->ipv4_addr, a->addr, 4);
+        pinfo->has_ipv4 = true;
+    } else if (a->family == AF_INET6 && !pinfo->has_ipv6) {
+        memcpy(pinfo->ipv6_addr, a->addr, 16);
+        pinfo->has_ipv6 = true;
+    }
+    if (a->vlan) pinfo->has_vlan = true;
+    pinfo->addrs[pinfo->nr_addrs++] = *a;
+    return OK_CODE;
+}
+
+/*
+ * append an address to the address list of the port, the address table
+ * is not updated.
+ */
+int sk_port_append_addr(port_info_t *pinfo, sk_addr_t *a) {
+    if (append_addr(pinfo, a) != OK_CODE) return ERR_CODE;
+    commit_svc_id(a);
+    return OK_CODE;
+}
+
+/*
+ * add an address to a port at runtime, must be called in master thread.
+ * the new state of the port is built in a copy and only committed after
+ * the new address table is published, so a failure leaves the port as it
+ * was. the old table is freed after all the lcores leave their read-side
+ * critical sections.
+ */
+int sk_port_add_addr(uint8_t portid, sk_addr_t *a) {
+    port_info_t *pinfo = sk.port_info[portid];
+    port_info_t tmp;
+    sk_addr_table_t *tbl, *old;
+    sk_addr_t *old_addrs;
+
+    if (pinfo == NULL) return ERR_CODE;
+    tmp = *pinfo;
+    tmp.addrs = malloc((pinfo->nr_addrs + 1) * sizeof(sk_addr_t));
+    if (tmp.addrs == NULL) return ERR_CODE;
+    memcpy(tmp.addrs, pinfo->addrs, pinfo->nr_addrs * sizeof(sk_addr_t));
+
+    if (append_addr(&tmp, a) != OK_CODE) goto error;
+    tbl = sk_addr_table_create(tmp.addrs, tmp.nr_addrs);
+    if (tbl == NULL) goto error;
+
+    old = rcu_xchg_pointer(&pinfo->addr_tbl, tbl);
+    commit_svc_id(a);
+    if (!pinfo->has_ipv6 && tmp.has_ipv6) rte_eth_allmulticast_enable(portid);
+    old_addrs = pinfo->addrs;
+    pinfo->addrs = tmp.addrs;
+    pinfo->nr_addrs = tmp.nr_addrs;
+    pinfo->has_ipv4 = tmp.has_ipv4;
+    pinfo->has_ipv6 = tmp.has_ipv6;
+    pinfo->has_vlan = tmp.has_vlan;
+    pinfo->ipv4_addr = tmp.ipv4_addr;
+    memcpy(pinfo->ipv6_addr, tmp.ipv6_addr, sizeof(pinfo->ipv6_addr));
+    free(old_addrs);
+
+    synchronize_rcu();
+    sk_addr_table_destroy(old);
+    return OK_CODE;
+
+error:
+    free(tmp.addrs);
+    return ERR_CODE;
+}
+
+#if defined(SK_TEST)
+#include "testhelp.h"
+
+static bool addr_roundtrip(const char *s, uint8_t family, uint32_t vlan) {
+    sk_addr_t a;
+    char buf[64];
+
+    if (sk_addr_parse(&a, s) != OK_CODE) return false;
+    if (a.family != family || a.vlan != vlan) return false;
+    sk_addr_format(&a, buf, sizeof(buf));
+    return strcmp(buf, s) == 0;
+}
+
+int addrTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    const char *strs[] = {"10.0.0.1", "10.0.0.1@100", "10.0.0.1@10.20",
+                          "2001:db8::1@100", "2001:db8::1", "10.0.0.1@100"};
+    const char *bad[] = {"10.0.0.1@0", "10.0.0.1@4095", "10.0.0.1@10.", "10.0.0.1@x",
+                         "10.0.0.1@10.20.30", "300.0.0.1", "2001:db8::g"};
+    sk_addr_t addrs[256];
+    sk_addr_table_t *tbl;
+    const sk_addr_t *found;
+    port_info_t p0, p1;
+    int port_ids[2] = {0, 1};
+    sk_addr_t a;
+    bool ok;
+
+    test_cond("parse ipv4", addr_roundtrip("10.0.0.1", AF_INET, 0));
+    test_cond("parse 802.1Q", addr_roundtrip("10.0.0.1@100", AF_INET, SK_VLAN_KEY(0, 100)));
+    test_cond("parse QinQ", addr_roundtrip("2001:db8::1@10.20", AF_INET6, SK_VLAN_KEY(10, 20)));
+    ok = true;
+    for (size_t i = 0; i < RTE_DIM(bad); ++i) {
+        if (sk_addr_parse(&a, bad[i]) == OK_CODE) ok = false;
+    }
+    test_cond("parse invalid addresses", ok);
+
+    for (size_t i = 0; i < RTE_DIM(strs); ++i) sk_addr_parse(&addrs[i], strs[i]);
+    tbl = sk_addr_table_create(addrs, RTE_DIM(strs));
+    test_cond("table skips duplicates", tbl->nr_addrs == RTE_DIM(strs) - 1);
+    ok = true;
+    for (size_t i = 0; i < RTE_DIM(strs); ++i) {
+        found = sk_addr_lookup(tbl, addrs[i].family, addrs[i].vlan, addrs[i].addr);
+        if (found == NULL || found->vlan != addrs[i].vlan) ok = false;
+    }
+    test_cond("lookup all addresses", ok);
+    test_cond("lookup other vlan",
+              sk_addr_lookup(tbl, AF_INET, SK_VLAN_KEY(0, 200), addrs[0].addr) == NULL);
+    test_cond("lookup inner vlan of QinQ",
+              sk_addr_lookup(tbl, AF_INET, SK_VLAN_KEY(0, 20), addrs[0].addr) == NULL);
+    sk_addr_parse(&a, "10.0.0.2@100");
+    test_cond("lookup other address", sk_addr_lookup(tbl, AF_INET, a.vlan, a.addr) == NULL);
+    sk_addr_table_destroy(tbl);
+
+    // a full table, every lookup has to probe.
+    for (int i = 0; i < 256; ++i) {
+        char s[32];
+        snprintf(s, sizeof(s), "10.0.%d.%d@%d", i / 16, i % 16, i % 3 + 1);
+        sk_addr_parse(&addrs[i], s);
+    }
+    tbl = sk_addr_table_create(addrs, 256);
+    ok = tbl->nr_addrs == 256 && tbl->mask + 1 >= 512;
+    for (int i = 0; i < 256; ++i) {
+        if (sk_addr_lookup(tbl, AF_INET, addrs[i].vlan, addrs[i].addr) == NULL) ok = false;
+        if (sk_addr_lookup(tbl, AF_INET, addrs[i].vlan + 3, addrs[i].addr) != NULL) ok = false;
+    }
+    test_cond("lookup 256 addresses", ok);
+    sk_addr_table_destroy(tbl);
+
+    memset(&p0, 0, sizeof(p0));
+    memset(&p1, 0, sizeof(p1));
+    sk.port_info[0] = &p0;
+    sk.port_info[1] = &p1;
+    sk.port_ids = port_ids;
+    sk.nr_ports = 2;
+    sk_addr_parse(&a, "10.0.0.1");
+    sk_port_append_addr(&p0, &a);
+    sk_addr_parse(&a, "10.0.0.2@100");
+    sk_port_append_addr(&p0, &a);
+    test_cond("append duplicate address", sk_port_append_addr(&p0, &a) == ERR_CODE && p0.nr_addrs == 2);
+    test_cond("port fields", p0.has_ipv4 && !p0.has_ipv6 && p0.has_vlan &&
+                             memcmp(&p0.ipv4_addr, p0.addrs[0].addr, 4) == 0);
+    sk_port_append_addr(&p1, &a);
+    test_cond("svc id shared by ports", p1.addrs[0].svc_id == p0.addrs[1].svc_id &&
+                                        p0.addrs[0].svc_id != p0.addrs[1].svc_id);
+
+    p0.addr_tbl = sk_addr_table_create(p0.addrs, p0.nr_addrs);
+    sk_addr_parse(&a, "10.0.0.3@10.20");
+    test_cond("add address", sk_port_add_addr(0, &a) == OK_CODE && p0.nr_addrs == 3 &&
+                             sk_addr_lookup(p0.addr_tbl, AF_INET, a.vlan, a.addr) != NULL);
+    tbl = p0.addr_tbl;
+    test_cond("add duplicate address", sk_port_add_addr(0, &a) == ERR_CODE &&
+                                       p0.nr_addrs == 3 && p0.addr_tbl == tbl);
+    sk_addr_table_destroy(p0.addr_tbl);
+    free(p0.addrs);
+    free(p1.addrs);
+    sk.port_info[0] = sk.port_info[1] = NULL;
+    sk.nr_ports = 0;
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,193 @@
+//
+// bonded ports.
+//
+// a bond aggregates several physical ports(members) into one logical port
+// with the bonding PMD(802.3ad LACP or balance-xor). the bond is served like
+// any other port: it owns the queues, the addresses and the KNI device, the
+// members are only driven by the bonding PMD.
+//
+// bonds are created after EAL is initialized and before the queues are set
+// up, they get the port ids following the physical ports and the virtual
+// devices(vdevs) in configuration order, so these ids should be used in
+// portmask, queue_config and bind.
+//
+// the LACP state machines of a lacp bond run in rte_eth_tx_burst, which the
+// lcores call with no packet on every drain pass of the tx buffers.
+//
+#include <rte_eth_bond.h>
+#include <rte_eth_bond_8023ad.h>
+
+#include "conf.h"
+#include "shuke.h"
+
+#define RTE_LOGTYPE_DPDK RTE_LOGTYPE_USER1
+
+static int parse_bond_mode(const char *s) {
+    if (strcasecmp(s, "lacp") == 0) return BONDING_MODE_8023AD;
+    if (strcasecmp(s, "balance-xor") == 0) return BONDING_MODE_BALANCE;
+    return -1;
+}
+
+static int parse_xmit_policy(const char *s) {
+    if (strcasecmp(s, "l2") == 0) return BALANCE_XMIT_POLICY_LAYER2;
+    if (strcasecmp(s, "l23") == 0) return BALANCE_XMIT_POLICY_LAYER23;
+    if (strcasecmp(s, "l34") == 0) return BALANCE_XMIT_POLICY_LAYER34;
+    return -1;
+}
+
+const char *sk_bond_mode_str(int mode) {
+    switch (mode) {
+        case BONDING_MODE_8023AD: return "lacp";
+        case BONDING_MODE_BALANCE: return "balance-xor";
+        default: return "unknown";
+    }
+}
+
+/*
+ * callback of `bonds` block, an entry is `<mode> <member ports> [xmit policy]`,
+ * e.g. `lacp 0,1 l34`.
+ */
+int sk_bond_conf_parse(char *errstr, int argc, char *argv[], void *privdata) {
+    ((void) privdata);
+    sk_bond_t *b;
+    char *p, *end;
+    int mode, policy = BALANCE_XMIT_POLICY_LAYER34;
+
+    if (argc != 2 && argc != 3) {
+        snprintf(errstr, ERR_STR_LEN, "bond entry needs 2 or 3 fields but gives %d", argc);
+        return CONF_ERR;
+    }
+    if ((mode = parse_bond_mode(argv[0])) < 0) {
+        snprintf(errstr, ERR_STR_LEN, "invalid bond mode %s(should be lacp or balance-xor)", argv[0]);
+        return CONF_ERR;
+    }
+    if (argc == 3 && (policy = parse_xmit_policy(argv[2])) < 0) {
+        snprintf(errstr, ERR_STR_LEN, "invalid xmit policy %s(should be l2, l23 or l34)", argv[2]);
+        return CONF_ERR;
+    }
+    if (sk.nr_bonds >= SK_MAX_BONDS) {
+        snprintf(errstr, ERR_STR_LEN, "too many bonds(max %d)", SK_MAX_BONDS);
+        return CONF_ERR;
+    }
+    b = &sk.bonds[sk.nr_bonds];
+    memset(b, 0, sizeof(*b));
+    b->mode = (uint8_t)mode;
+    b->xmit_policy = (uint8_t)policy;
+
+    for (p = argv[1]; *p; p = end) {
+        long id = strtol(p, &end, 10);
+        if (end == p || id < 0 || id >= RTE_MAX_ETHPORTS || (*end != ',' && *end != 0)) {
+            snprintf(errstr, ERR_STR_LEN, "invalid member ports %s", argv[1]);
+            return CONF_ERR;
+        }
+        if (sk_port_is_bond_member((int)id)) {
+            snprintf(errstr, ERR_STR_LEN, "port %ld is a member of more than one bond", id);
+            return CONF_ERR;
+        }
+        if (b->nr_members >= SK_MAX_BOND_MEMBERS) {
+            snprintf(errstr, ERR_STR_LEN, "too many members in bond(max %d)", SK_MAX_BOND_MEMBERS);
+            return CONF_ERR;
+        }
+        b->members[b->nr_members++] = (uint8_t)id;
+        if (*end == ',') end++;
+    }
+    if (b->nr_members == 0) {
+        snprintf(errstr, ERR_STR_LEN, "bond has no member ports");
+        return CONF_ERR;
+    }
+    sk.nr_bonds++;
+    return CONF_OK;
+}
+
+bool sk_port_is_bond_member(int portid) {
+    for (int i = 0; i < sk.nr_bonds; ++i) {
+        for (int j = 0; j < sk.bonds[i].nr_members; ++j) {
+            if (sk.bonds[i].members[j] == portid) return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * create the bonding devices and add the members to them,
+ * must be called before the bonds are configured.
+ */
+void sk_create_bonds(void) {
+    unsigned nb_dev_ports = rte_eth_dev_count();
+    sk_bond_t *b;
+    int ret, socketid;
+
+    for (int i = 0; i < sk.nr_bonds; ++i) {
+        b = &sk.bonds[i];
+        for (int j = 0; j < b->nr_members; ++j) {
+            if (b->members[j] >= nb_dev_ports)
+                rte_exit(EXIT_FAILURE, "this machine doesn't have port %d\n", b->members[j]);
+            if (SK_PORT_IN_MASK(b->members[j]))
+                rte_exit(EXIT_FAILURE, "port %d is a bond member, it should not be in portmask.\n",
+                         b->members[j]);
+        }
+        socketid = rte_eth_dev_socket_id(b->members[0]);
+        if (socketid < 0) socketid = 0;
+
+        snprintf(b->name, sizeof(b->name), "net_bonding%d", i);
+        ret = rte_eth_bond_create(b->name, b->mode, (uint8_t)socketid);
+        if (ret < 0)
+            rte_exit(EXIT_FAILURE, "can't create bond %s: err=%d\n", b->name, ret);
+        b->port_id = (uint8_t)ret;
+
+        for (int j = 0; j < b->nr_members; ++j) {
+            ret = rte_eth_bond_slave_add(b->port_id, b->members[j]);
+            if (ret < 0)
+                rte_exit(EXIT_FAILURE, "can't add port %d to bond %s: err=%d\n",
+                         b->members[j], b->name, ret);
+        }
+        if (rte_eth_bond_xmit_policy_set(b->port_id, b->xmit_policy) < 0)
+            rte_exit(EXIT_FAILURE, "can't set xmit policy of bond %s\n", b->name);
+
+        if (b->port_id >= SK_MAX_MASKED_PORT)
+            rte_exit(EXIT_FAILURE, "bond %s is port %d, portmask only selects ports below %d.\n",
+                     b->name, b->port_id, SK_MAX_MASKED_PORT);
+        if (!SK_PORT_IN_MASK(b->port_id))
+            rte_exit(EXIT_FAILURE, "bond %s is port %d, it should be in portmask.\n",
+                     b->name, b->port_id);
+        sk.port_info[b->port_id]->lacp = (b->mode == BONDING_MODE_8023AD);
+        LOG_INFO(DPDK, "bond %s(%s) is port %d, %d members.", b->name,
+                 sk_bond_mode_str(b->mode), b->port_id, b->nr_members);
+    }
+}
+
+/*
+ * release the members of the bonds, the bonds should be stopped.
+ */
+void sk_destroy_bonds(void) {
+    for (int i = 0; i < sk.nr_bonds; ++i) {
+        sk_bond_t *b = &sk.bonds[i];
+        for (int j = 0; j < b->nr_members; ++j) {
+            rte_eth_bond_slave_remove(b->port_id, b->members[j]);
+            rte_eth_dev_stop(b->members[j]);
+            rte_eth_dev_close(b->members[j]);
+        }
+    }
+}
+
+/*
+ * state of a member: link status and speed, for lacp,
+ * whether it is selected by the aggregator and the LACP actor/partner state.
+ */
+sds sk_bond_member_info(sds s, sk_bond_t *b, uint8_t member) {
+    struct rte_eth_link link;
+    struct rte_eth_bond_8023ad_slave_info info;
+    static const char *selection[] = {"unselected", "standby", "selected"};
+
+    memset(&link, 0, sizeof(link));
+    rte_eth_link_get_nowait(member, &link);
+    s = sdscatprintf(s, "member_%d:link=%s,speed=%u",
+                     member, link.link_status? "up": "down", link.link_speed);
+    if (b->mode == BONDING_MODE_8023AD &&
+        rte_eth_bond_8023ad_slave_info(b->port_id, member, &info) == 0) {
+        s = sdscatprintf(s, ",lacp=%s,actor_state=0x%02x,partner_state=0x%02x",
+                         (unsigned)info.selected < 3? selection[info.selected]: "unknown",
+                         info.actor_state, info.partner_state);
+    }
+    return sdscat(s, "\r\n");
+}
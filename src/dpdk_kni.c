@@ -3,6 +3,7 @@
 //
 
 #include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <netinet/in.h>
@@ -10,14 +11,32 @@
 
 #include "shuke.h"
 
+/*
+ * the exception path hands ARP, TCP and the other packets punted by the
+ * fast path to the kernel, and sends the packets of the kernel to the NIC.
+ * every port has a kernel interface named vEth<port id>, it is backed by
+ * one of:
+ *   kni:         rte_kni, needs the out-of-tree rte_kni kernel module.
+ *   tap:         the TAP PMD.
+ *   virtio_user: the virtio-user PMD with vhost-net as backend.
+ * tap and virtio_user interfaces are ethdev ports created at runtime, they
+ * are never in portmask.
+ */
+
 /* Total octets in ethernet header */
 #define KNI_ENET_HEADER_SIZE    14
 
 /* Total octets in the FCS */
 #define KNI_ENET_FCS_SIZE       4
 
+/* number of rx/tx descriptors of tap and virtio_user ports */
+#define EXCEPTION_PORT_DESC     512
+
 typedef struct {
+    // kni backend
     struct rte_kni *kni;
+    // tap and virtio_user backend
+    uint8_t vdev_port_id;
 
     /* number of pkts received from NIC, and sent to KNI */
     uint64_t rx_packets;
@@ -34,16 +53,202 @@ typedef struct {
 /* kni device statistics array */
 static sk_kni_conf_t *kni_conf_list[RTE_MAX_ETHPORTS];
 
+typedef struct {
+    const char *name;
+    // create the kernel interface of a port.
+    int (*alloc)(uint8_t port_id, struct rte_mempool *mbuf_pool);
+    // send packets to kernel, return the number of sent packets.
+    unsigned (*tx_burst)(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n);
+    // receive packets from kernel.
+    unsigned (*rx_burst)(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n);
+    // handle the requests(mtu, link up/down) of kernel, can be NULL.
+    void (*handle_request)(sk_kni_conf_t *kconf);
+    void (*release)(sk_kni_conf_t *kconf);
+} sk_exception_ops_t;
+
+static const sk_exception_ops_t *ex_ops;
+
 static int kni_change_mtu(uint8_t port_id, unsigned new_mtu);
 static int kni_config_network_interface(uint8_t port_id, uint8_t if_up);
 
+/*
+ * linux/ipv6.h conflicts with netinet/in.h, so define in6_ifreq here.
+ */
+struct sk_in6_ifreq {
+    struct in6_addr ifr6_addr;
+    uint32_t ifr6_prefixlen;
+    int ifr6_ifindex;
+};
+
+/*
+ * linux/if_vlan.h conflicts with net/if.h, so define vlan_ioctl_args here.
+ */
+struct sk_vlan_ioctl_args {
+    int cmd;
+    char device1[24];
+    union {
+        char device2[24];
+        int VID;
+        unsigned int skb_priority;
+        unsigned int name_type;
+        unsigned int bind_type;
+        unsigned int flag;
+    } u;
+    short vlan_qos;
+};
+
+#define SK_ADD_VLAN_CMD 0
+
+/* prefix length of the ipv6 addresses configured to KNI interfaces */
+#define KNI_IPV6_PREFIX_LEN 64
+
+static int
+kni_if_up(int sockfd, char *ifname) {
+    struct ifreq ifr;
+    int ret;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+    /* get flags */
+    ret = ioctl(sockfd, SIOCGIFFLAGS, &ifr);
+    if (ret < 0) {
+        LOG_ERROR(KNI, "get flags of %s error %s\n", ifname, strerror(errno));
+        return ret;
+    }
+    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+
+    /* set flags */
+    ret = ioctl(sockfd, SIOCSIFFLAGS, &ifr);
+    if (ret < 0) {
+        LOG_ERROR(KNI, "set flags of %s error %s\n", ifname, strerror(errno));
+    }
+    return ret;
+}
+
+/*
+ * create vlan interface <parent>.<vid> if it doesn't exist,
+ * the kernel's default vlan name type is used.
+ */
+static int
+kni_add_vlan_if(int sockfd, char *parent, uint16_t vid, char *ifname) {
+    struct sk_vlan_ioctl_args args;
+
+    snprintf(ifname, IFNAMSIZ, "%s.%d", parent, vid);
+    if (if_nametoindex(ifname) != 0) return 0;
+
+    memset(&args, 0, sizeof(args));
+    args.cmd = SK_ADD_VLAN_CMD;
+    strncpy(args.device1, parent, sizeof(args.device1)-1);
+    args.u.VID = vid;
+    if (ioctl(sockfd, SIOCSIFVLAN, &args) < 0) {
+        LOG_ERROR(KNI, "create vlan interface %s error %s\n", ifname, strerror(errno));
+        return -1;
+    }
+    if (if_nametoindex(ifname) == 0) {
+        LOG_ERROR(KNI, "can't find vlan interface %s, check the vlan name type.\n", ifname);
+        return -1;
+    }
+    return kni_if_up(sockfd, ifname);
+}
+
+/*
+ * get the interface of `vlan`, for QinQ the inner vlan interface is
+ * created on the outer vlan interface.
+ */
+static int
+kni_vlan_if(int sockfd, char *parent, uint32_t vlan, char *ifname) {
+    char outer_ifname[IFNAMSIZ];
+
+    if (vlan == 0) {
+        snprintf(ifname, IFNAMSIZ, "%s", parent);
+        return 0;
+    }
+    if (SK_VLAN_OUTER(vlan)) {
+        if (kni_add_vlan_if(sockfd, parent, SK_VLAN_OUTER(vlan), outer_ifname) < 0)
+            return -1;
+        parent = outer_ifname;
+    }
+    return kni_add_vlan_if(sockfd, parent, SK_VLAN_INNER(vlan), ifname);
+}
+
+static int
+kni_set_ipv4_addr(int sockfd, char *ifname, const uint8_t *ipaddr) {
+    struct ifreq ifr;
+    struct sockaddr_in* addr = (struct sockaddr_in*)&ifr.ifr_addr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+    addr->sin_family = AF_INET;
+    memcpy(&addr->sin_addr, ipaddr, 4);
+    return ioctl(sockfd, SIOCSIFADDR, &ifr);
+}
+
+static int
+kni_add_ipv6_addr(char *ifname, const uint8_t *ipaddr) {
+    struct sk_in6_ifreq ifr6;
+    int sockfd, ret;
+
+    sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sockfd < 0) return -1;
+    memset(&ifr6, 0, sizeof(ifr6));
+    memcpy(&ifr6.ifr6_addr, ipaddr, 16);
+    ifr6.ifr6_prefixlen = KNI_IPV6_PREFIX_LEN;
+    ifr6.ifr6_ifindex = (int)if_nametoindex(ifname);
+    ret = ioctl(sockfd, SIOCSIFADDR, &ifr6);
+    close(sockfd);
+    return ret;
+}
+
+/*
+ * config the idx-th address of the port to KNI, addresses in a vlan are
+ * configured to the vlan interface. the first ipv4 address of an interface
+ * is the address of the interface, others are configured to
+ * aliases(<ifname>:<n>).
+ */
 static int
-kni_ifconfig(int portid, char *ipaddr) {
+kni_config_addr(int sockfd, int portid, int idx) {
+    sk_kni_conf_t *kconf = kni_conf_list[portid];
+    port_info_t *pinfo = sk.port_info[portid];
+    sk_addr_t *a = &pinfo->addrs[idx];
+    char vlan_ifname[IFNAMSIZ];
+    char alias[IFNAMSIZ+8];
+    int nr_ipv4 = 0;
+    int ret;
+
+    if (kni_vlan_if(sockfd, kconf->veth_name, a->vlan, vlan_ifname) < 0) {
+        return ERR_CODE;
+    }
+    if (a->family == AF_INET) {
+        for (int j = 0; j < idx; ++j) {
+            if (pinfo->addrs[j].family == AF_INET && pinfo->addrs[j].vlan == a->vlan)
+                nr_ipv4++;
+        }
+        if (nr_ipv4 == 0) {
+            snprintf(alias, sizeof(alias), "%s", vlan_ifname);
+        } else {
+            snprintf(alias, sizeof(alias), "%s:%d", vlan_ifname, nr_ipv4);
+        }
+        ret = kni_set_ipv4_addr(sockfd, alias, a->addr);
+        if (ret < 0) {
+            LOG_ERROR(KNI, "set ipv4 address error %s\n", strerror(errno));
+            return ERR_CODE;
+        }
+    } else {
+        ret = kni_add_ipv6_addr(vlan_ifname, a->addr);
+        if (ret < 0 && errno != EEXIST) {
+            LOG_ERROR(KNI, "set ipv6 address error %s\n", strerror(errno));
+            return ERR_CODE;
+        }
+    }
+    return OK_CODE;
+}
+
+static int
+kni_ifconfig(int portid) {
     sk_kni_conf_t *kconf = kni_conf_list[portid];
     port_info_t *pinfo = sk.port_info[portid];
     char *ifname = kconf->veth_name;
     struct ifreq ifr;
-    struct sockaddr_in* addr = (struct sockaddr_in*)&ifr.ifr_addr;
     int sockfd;                     /* socket fd we use to manipulate stuff with */
 
     int ret;
@@ -62,37 +267,38 @@ kni_ifconfig(int portid, char *ipaddr) {
         LOG_ERROR(KNI, "set mac address error %s\n", strerror(errno));
         exit(-1);
     }
-    /* config ipv4 address */
-    addr->sin_family = AF_INET;
-    inet_pton(AF_INET, ipaddr, &addr->sin_addr);
-    ret = ioctl(sockfd, SIOCSIFADDR, &ifr);
-    if (ret < 0) {
-        LOG_ERROR(KNI, "set ipv4 address error %s\n", strerror(errno));
+    if (kni_if_up(sockfd, ifname) < 0) {
         exit(-1);
     }
-    /* get flags */
-    ret = ioctl(sockfd, SIOCGIFFLAGS, &ifr);
-    if (ret < 0) {
-        LOG_ERROR(KNI, "get flags error %s\n", strerror(errno));
-        exit(-1);
-    }
-    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
-
-    /* set flags */
-    ret = ioctl(sockfd, SIOCSIFFLAGS, &ifr);
-    if (ret < 0) {
-        LOG_ERROR(KNI, "set flags error %s\n", strerror(errno));
-        exit(-1);
+    /* config ip addresses, ipv6 addresses are added after the interface is up. */
+    for (int i = 0; i < pinfo->nr_addrs; ++i) {
+        if (kni_config_addr(sockfd, portid, i) != OK_CODE) {
+            exit(-1);
+        }
     }
     close(sockfd);
     return OK_CODE;
 }
 
+/*
+ * config an address added at runtime to KNI.
+ */
+int kni_ifconfig_addr(int portid, int idx) {
+    int sockfd, ret;
+
+    if (kni_conf_list[portid] == NULL) return ERR_CODE;
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) return ERR_CODE;
+    ret = kni_config_addr(sockfd, portid, idx);
+    close(sockfd);
+    return ret;
+}
+
 int kni_ifconfig_all()
 {
     for (int i = 0; i < sk.nr_ports; ++i) {
         int portid = sk.port_ids[i];
-        kni_ifconfig(portid, sk.bindaddr[i]);
+        kni_ifconfig(portid);
     }
     return OK_CODE;
 }
@@ -152,8 +358,11 @@ kni_alloc(uint8_t port_id, struct rte_mempool *mbuf_pool)
 
     memset(&dev_info, 0, sizeof(dev_info));
     rte_eth_dev_info_get(port_id, &dev_info);
-    conf.addr = dev_info.pci_dev->addr;
-    conf.id = dev_info.pci_dev->id;
+    // virtual ports(e.g. bonds) have no pci device.
+    if (dev_info.pci_dev) {
+        conf.addr = dev_info.pci_dev->addr;
+        conf.id = dev_info.pci_dev->id;
+    }
 
     memset(&ops, 0, sizeof(ops));
     ops.port_id = port_id;
@@ -170,6 +379,118 @@ kni_alloc(uint8_t port_id, struct rte_mempool *mbuf_pool)
     return 0;
 }
 
+static unsigned
+kni_tx_burst(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n) {
+    return rte_kni_tx_burst(kconf->kni, pkts, n);
+}
+
+static unsigned
+kni_rx_burst(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n) {
+    return rte_kni_rx_burst(kconf->kni, pkts, n);
+}
+
+static void
+kni_handle_request(sk_kni_conf_t *kconf) {
+    rte_kni_handle_request(kconf->kni);
+}
+
+static void
+kni_release(sk_kni_conf_t *kconf) {
+    if (rte_kni_release(kconf->kni))
+        LOG_ERR(KNI, "Fail to release kni\n");
+}
+
+/*
+ * create a tap or virtio_user port whose kernel interface is the
+ * veth of the port, the port has one rx queue and one tx queue.
+ */
+static int
+vdev_alloc(uint8_t port_id, struct rte_mempool *mbuf_pool, const char *devargs) {
+    sk_kni_conf_t *kconf = kni_conf_list[port_id];
+    struct rte_eth_conf port_conf;
+    uint8_t vport;
+    int socketid = mbuf_pool->socket_id;
+    int ret;
+
+    if (rte_eth_dev_attach(devargs, &vport) < 0)
+        rte_exit(EXIT_FAILURE, "can't create exception port %s.\n", devargs);
+
+    memset(&port_conf, 0, sizeof(port_conf));
+    ret = rte_eth_dev_configure(vport, 1, 1, &port_conf);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "can't configure exception port %d: err=%d\n", vport, ret);
+    ret = rte_eth_rx_queue_setup(vport, 0, EXCEPTION_PORT_DESC, (unsigned)socketid, NULL, mbuf_pool);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "can't setup rx queue of exception port %d: err=%d\n", vport, ret);
+    ret = rte_eth_tx_queue_setup(vport, 0, EXCEPTION_PORT_DESC, (unsigned)socketid, NULL);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "can't setup tx queue of exception port %d: err=%d\n", vport, ret);
+    ret = rte_eth_dev_start(vport);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "can't start exception port %d: err=%d\n", vport, ret);
+
+    kconf->vdev_port_id = vport;
+    LOG_INFO(KNI, "port %d: exception port %d(%s).", port_id, vport, devargs);
+    return 0;
+}
+
+static int
+tap_alloc(uint8_t port_id, struct rte_mempool *mbuf_pool) {
+    char devargs[128];
+    snprintf(devargs, sizeof(devargs), "net_tap%u,iface=%s",
+             port_id, kni_conf_list[port_id]->veth_name);
+    return vdev_alloc(port_id, mbuf_pool, devargs);
+}
+
+static int
+virtio_user_alloc(uint8_t port_id, struct rte_mempool *mbuf_pool) {
+    char devargs[128];
+    snprintf(devargs, sizeof(devargs),
+             "virtio_user%u,path=/dev/vhost-net,queues=1,queue_size=%d,iface=%s",
+             port_id, EXCEPTION_PORT_DESC, kni_conf_list[port_id]->veth_name);
+    return vdev_alloc(port_id, mbuf_pool, devargs);
+}
+
+static unsigned
+vdev_tx_burst(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n) {
+    return rte_eth_tx_burst(kconf->vdev_port_id, 0, pkts, (uint16_t)n);
+}
+
+static unsigned
+vdev_rx_burst(sk_kni_conf_t *kconf, struct rte_mbuf **pkts, unsigned n) {
+    return rte_eth_rx_burst(kconf->vdev_port_id, 0, pkts, (uint16_t)n);
+}
+
+static void
+vdev_release(sk_kni_conf_t *kconf) {
+    char name[RTE_ETH_NAME_MAX_LEN];
+
+    rte_eth_dev_stop(kconf->vdev_port_id);
+    rte_eth_dev_close(kconf->vdev_port_id);
+    rte_eth_dev_detach(kconf->vdev_port_id, name);
+}
+
+static const sk_exception_ops_t exception_ops_table[] = {
+    {"kni", kni_alloc, kni_tx_burst, kni_rx_burst, kni_handle_request, kni_release},
+    {"tap", tap_alloc, vdev_tx_burst, vdev_rx_burst, NULL, vdev_release},
+    {"virtio_user", virtio_user_alloc, vdev_tx_burst, vdev_rx_burst, NULL, vdev_release},
+};
+
+bool sk_exception_path_valid(const char *name) {
+    for (size_t i = 0; i < sizeof(exception_ops_table)/sizeof(exception_ops_table[0]); ++i) {
+        if (strcasecmp(name, exception_ops_table[i].name) == 0) return true;
+    }
+    return false;
+}
+
+static const sk_exception_ops_t *
+get_exception_ops(const char *name) {
+    for (size_t i = 0; i < sizeof(exception_ops_table)/sizeof(exception_ops_table[0]); ++i) {
+        if (strcasecmp(name, exception_ops_table[i].name) == 0) return &exception_ops_table[i];
+    }
+    return NULL;
+}
+
 /* Send burst of packets on an output interface */
 static inline int
 kni_send_burst(lcore_conf_t *qconf, uint16_t n, uint8_t port)
@@ -180,7 +501,12 @@ kni_send_burst(lcore_conf_t *qconf, uint16_t n, uint8_t port)
     int nb_kni_tx = 0;
 
     m_table = (struct rte_mbuf **)qconf->kni_tx_mbufs[port].m_table;
-    nb_kni_tx = rte_kni_tx_burst(kconf->kni, m_table, n);
+    if (qconf->kni_ring) {
+        // only exception lcore can access kni device.
+        nb_kni_tx = (int)rte_ring_sp_enqueue_burst(qconf->kni_ring, (void **)m_table, n, NULL);
+    } else {
+        nb_kni_tx = (int)ex_ops->tx_burst(kconf, m_table, n);
+    }
     if (unlikely(nb_kni_tx < n)) {
         for (int i = nb_kni_tx; i < n; ++i) {
             rte_pktmbuf_free(m_table[i]);
@@ -198,6 +524,15 @@ kni_send_single_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t port)
     int ret = 0;
     uint16_t len;
 
+    // kernel expects the vlan tags in packet data.
+    if (unlikely(m->ol_flags & (PKT_RX_VLAN_STRIPPED | PKT_RX_QINQ_STRIPPED))) {
+        if (sk_vlan_insert(m) != OK_CODE) {
+            qconf->stats.drop[SK_DROP_VLAN]++;
+            rte_pktmbuf_free(m);
+            return ret;
+        }
+    }
+
     len = qconf->kni_tx_mbufs[port].len;
     qconf->kni_tx_mbufs[port].m_table[len] = m;
     len++;
@@ -232,11 +567,11 @@ kni_process_tx(lcore_conf_t *qconf, uint8_t port_id)
 
         LOG_DEBUG(KNI, "port %d got %d packets and send %d packets to kni.", port_id, nb_tx, nb_kni_tx);
     }
-    rte_kni_handle_request(kconf->kni);
+    if (ex_ops->handle_request) ex_ops->handle_request(kconf);
     return 0;
 }
 
-static int
+static uint16_t
 kni_process_rx(uint8_t port_id, uint16_t queue_id,
                struct rte_mbuf **pkts_burst, unsigned count)
 {
@@ -244,7 +579,7 @@ kni_process_rx(uint8_t port_id, uint16_t queue_id,
     uint16_t nb_kni_rx, nb_rx;
 
     /* read packet from kni, and transmit to phy port */
-    nb_kni_rx = rte_kni_rx_burst(kconf->kni, pkts_burst, count);
+    nb_kni_rx = (uint16_t)ex_ops->rx_burst(kconf, pkts_burst, count);
 
     if (nb_kni_rx > 0) {
         nb_rx = rte_eth_tx_burst(port_id, queue_id, pkts_burst, nb_kni_rx);
@@ -259,21 +594,105 @@ kni_process_rx(uint8_t port_id, uint16_t queue_id,
 
         kconf->tx_packets += nb_rx;
     }
-    return 0;
+    return nb_kni_rx;
 }
 
-void
+/*
+ * returns the number of packets received from the kni device.
+ */
+unsigned
 sk_kni_process(lcore_conf_t *qconf, uint8_t port_id, uint16_t queue_id, struct rte_mbuf **pkts_burst, unsigned count)
 {
     kni_process_tx(qconf, port_id);
-    kni_process_rx(port_id, queue_id, pkts_burst, count);
+    return kni_process_rx(port_id, queue_id, pkts_burst, count);
+}
+
+/*
+ * used by the lcores except exception lcore, send the packets
+ * buffered by this lcore to exception lcore.
+ */
+void
+sk_kni_flush_tx(lcore_conf_t *qconf)
+{
+    uint8_t port_id;
+    uint16_t n;
+    int nb_tx;
+
+    for (int i = 0; i < qconf->nr_ports; ++i) {
+        port_id = (uint8_t )qconf->port_id_list[i];
+        n = qconf->kni_tx_mbufs[port_id].len;
+        if (n == 0) continue;
+        nb_tx = kni_send_burst(qconf, n, port_id);
+        if (nb_tx < n) {
+            qconf->nr_dropped += n - nb_tx;
+            qconf->stats.drop[SK_DROP_RING_FULL] += n - nb_tx;
+        }
+    }
+}
+
+/*
+ * used by exception lcore, fetch the packets from the rings of other
+ * lcores and send them to kni device of the port they are received from.
+ * returns the number of packets fetched.
+ */
+unsigned
+sk_kni_drain_rings(lcore_conf_t *qconf)
+{
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    unsigned nb_rx, total = 0;
+
+    for (int i = 0; i < qconf->nr_kni_rings; ++i) {
+        nb_rx = rte_ring_sc_dequeue_burst(qconf->kni_rings[i], (void **)pkts_burst,
+                                          MAX_PKT_BURST, NULL);
+        for (unsigned j = 0; j < nb_rx; ++j) {
+            kni_send_single_packet(qconf, pkts_burst[j], pkts_burst[j]->port);
+        }
+        total += nb_rx;
+    }
+    return total;
+}
+
+/*
+ * create a ring for every lcore which handles packets, these rings are
+ * consumed by exception lcore.
+ */
+static void
+kni_setup_rings(void)
+{
+    lcore_conf_t *exconf = sk.lcore_conf[sk.exception_lcore_id];
+    char name[RTE_RING_NAMESIZE];
+    int socketid = 0;
+
+    if (sk.numa_on)
+        socketid = (int)rte_lcore_to_socket_id((unsigned)sk.exception_lcore_id);
+
+    exconf->kni_rings = socket_calloc(socketid, (size_t)sk.nr_lcore_ids, sizeof(struct rte_ring *));
+    exconf->nr_kni_rings = 0;
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (lcore_id == sk.exception_lcore_id || qconf->nr_ports == 0) continue;
+        // I/O lcores never punt packets to KNI
+        if (qconf->role == LCORE_ROLE_IO) continue;
+
+        snprintf(name, sizeof(name), "kni_lcore_%d", lcore_id);
+        qconf->kni_ring = rte_ring_create(name, KNI_RING_SIZE, socketid,
+                                          RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (qconf->kni_ring == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create ring %s.\n", name);
+        exconf->kni_rings[exconf->nr_kni_rings++] = qconf->kni_ring;
+    }
 }
 
 /* Initialize KNI subsystem */
 void
 sk_init_kni_module(struct rte_mempool *mbuf_pool)
 {
-    rte_kni_init(rte_eth_dev_count());
+    ex_ops = get_exception_ops(sk.exception_path);
+    if (ex_ops == NULL)
+        rte_exit(EXIT_FAILURE, "invalid exception path %s.\n", sk.exception_path);
+    if (ex_ops->alloc == kni_alloc)
+        rte_kni_init(rte_eth_dev_count());
     for (int i = 0; i < sk.nr_ports; ++i) {
         int portid = sk.port_ids[i];
         assert(kni_conf_list[portid] == NULL);
@@ -282,11 +701,12 @@ sk_init_kni_module(struct rte_mempool *mbuf_pool)
                                             RTE_CACHE_LINE_SIZE);
         sk_kni_conf_t *kconf = kni_conf_list[portid];
         snprintf(kconf->veth_name, RTE_KNI_NAMESIZE, "vEth%u", portid);
-        kni_alloc(portid, mbuf_pool);
+        ex_ops->alloc(portid, mbuf_pool);
 
         char ring_name[RTE_KNI_NAMESIZE];
         snprintf((char*)ring_name, RTE_KNI_NAMESIZE, "kni_ring_%u", portid);
     }
+    kni_setup_rings();
 }
 
 int
@@ -297,8 +717,7 @@ cleanup_kni_module()
     for (int i = 0; i < sk.nr_ports; i++) {
         int portid = sk.port_ids[i];
         kconf = kni_conf_list[portid];
-        if (rte_kni_release(kconf->kni))
-            LOG_ERR(KNI, "Fail to release kni\n");
+        ex_ops->release(kconf);
     }
 #ifdef RTE_LIBRTE_XEN_DOM0
     rte_kni_close();
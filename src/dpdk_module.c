@@ -1,7 +1,11 @@
 //
 // Created by Yu Yang <yyangplus@NOSPAM.gmail.com> on 2017-05-02
 //
+#include <netinet/icmp6.h>
+
 #include <rte_arp.h>
+#include <rte_errno.h>
+#include <rte_jhash.h>
 
 #include "dpdk_module.h"
 #include "shuke.h"
@@ -18,6 +22,9 @@
 #define PREFETCH_OFFSET	  3
 
 #define KNI_MBUF_MAX 2048
+// max rounds the master lcore polls the exception queues in one tick,
+// so a flood of exception traffic can't starve the event loop.
+#define EXCEPTION_POLL_MAX_ROUNDS 64
 #define KNI_QUEUE_SIZE 2048
 
 /*
@@ -32,6 +39,17 @@ static uint16_t nb_txd = RTE_TEST_TX_DESC_DEFAULT;
 
 static struct rte_mempool * pktmbuf_pool[NB_SOCKETS];
 
+/*
+ * zero copy answers, the bodies are rendered answer sections referred by
+ * RRSets, responses refer to them through indirect mbufs.
+ */
+#define SK_ZC_NB_BODIES   4096
+#define SK_ZC_NB_INDIRECT 8192
+#define SK_ZC_BODY_SIZE   8192
+
+static struct rte_mempool *zc_body_pool[NB_SOCKETS];
+static struct rte_mempool *zc_indirect_pool[NB_SOCKETS];
+
 #ifdef IP_FRAG
 #define	DEFAULT_FLOW_TTL	MS_PER_S
 #define	DEFAULT_FLOW_NUM	0x1000
@@ -145,7 +163,7 @@ static void
 init_per_lcore() {
     lcore_conf_t *qconf;
     unsigned lcore_id = rte_lcore_id();
-    qconf = &sk.lcore_conf[lcore_id];
+    qconf = sk.lcore_conf[lcore_id];
     qconf->tsc_hz = rte_get_tsc_hz();
     qconf->start_us = (uint64_t )ustime();
     qconf->start_tsc = rte_rdtsc();
@@ -188,6 +206,21 @@ init_mem(unsigned nb_mbuf)
 
         }
 
+        if (sk.zerocopy_min_size > 0 && zc_body_pool[socketid] == NULL) {
+            snprintf(s, sizeof(s), "zc_body_pool_%d", socketid);
+            zc_body_pool[socketid] =
+                rte_pktmbuf_pool_create(s, SK_ZC_NB_BODIES, MEMPOOL_CACHE_SIZE, 0,
+                                        SK_ZC_BODY_SIZE, socketid);
+            snprintf(s, sizeof(s), "zc_indirect_pool_%d", socketid);
+            zc_indirect_pool[socketid] =
+                rte_pktmbuf_pool_create(s, SK_ZC_NB_INDIRECT, MEMPOOL_CACHE_SIZE, 0,
+                                        0, socketid);
+            if (zc_body_pool[socketid] == NULL || zc_indirect_pool[socketid] == NULL)
+                rte_exit(EXIT_FAILURE,
+                         "Cannot init zero copy pools on socket %d\n",
+                         socketid);
+        }
+
 #ifdef IP_FRAG
         struct rte_mempool *mp;
 
@@ -224,6 +257,17 @@ init_mem(unsigned nb_mbuf)
     return 0;
 }
 
+/* virtual devices(vdevs, bonds) have no pci device */
+static bool
+port_is_virtual(uint8_t portid)
+{
+    struct rte_eth_dev_info dev_info;
+
+    memset(&dev_info, 0, sizeof(dev_info));
+    rte_eth_dev_info_get(portid, &dev_info);
+    return dev_info.pci_dev == NULL;
+}
+
 /* Check the link status of all ports in up to 9s, and print them finally */
 static void
 check_all_ports_link_status(uint8_t port_num, uint32_t port_mask)
@@ -242,7 +286,7 @@ check_all_ports_link_status(uint8_t port_num, uint32_t port_mask)
         for (portid = 0; portid < port_num; portid++) {
             if (sk.force_quit)
                 return;
-            if ((port_mask & (1 << portid)) == 0)
+            if (portid >= SK_MAX_MASKED_PORT || (port_mask & (1u << portid)) == 0)
                 continue;
             memset(&link, 0, sizeof(link));
             rte_eth_link_get_nowait(portid, &link);
@@ -259,8 +303,11 @@ check_all_ports_link_status(uint8_t port_num, uint32_t port_mask)
                     LOG_RAW(INFO, DPDK, "Port %d Link Down\n", (uint8_t)portid);
                 continue;
             }
-            /* clear all_ports_up flag if any link down */
-            if (link.link_status == ETH_LINK_DOWN) {
+            /*
+             * clear all_ports_up flag if any link down, the link of
+             * virtual devices may never be up, don't wait for them.
+             */
+            if (link.link_status == ETH_LINK_DOWN && !port_is_virtual(portid)) {
                 all_ports_up = 0;
                 break;
             }
@@ -291,12 +338,24 @@ send_burst(lcore_conf_t *qconf, uint16_t n, uint8_t port)
     int ret;
     uint16_t queueid;
 
-    queueid = qconf->queue_id_list[port];
     m_table = (struct rte_mbuf **)qconf->tx_mbufs[port].m_table;
 
-    ret = rte_eth_tx_burst(port, queueid, m_table, n);
+    // packets flushed by a full buffer aren't stamped yet, they count as 0.
+    sk_lat_record(&qconf->lat_tx,
+                  qconf->tx_mbufs[port].tsc? qconf->tsc - qconf->tx_mbufs[port].tsc: 0, n);
+    qconf->tx_mbufs[port].tsc = 0;
+
+    if (qconf->role == LCORE_ROLE_WORKER) {
+        // pipeline mode: hand over the responses to the I/O lcore.
+        ret = rte_ring_sp_enqueue_burst(qconf->tx_rings[port],
+                                        (void **)m_table, n, NULL);
+    } else {
+        queueid = qconf->queue_id_list[port];
+        ret = rte_eth_tx_burst(port, queueid, m_table, n);
+    }
     LOG_DEBUG(DPDK, "burst send %d packets", ret);
     if (unlikely(ret < n)) {
+        qconf->stats.drop[qconf->role == LCORE_ROLE_WORKER? SK_DROP_RING_FULL: SK_DROP_TX_FULL] += n - ret;
         do {
             rte_pktmbuf_free(m_table[ret]);
         } while (++ret < n);
@@ -326,6 +385,12 @@ send_single_packet(lcore_conf_t *qconf,
     return 0;
 }
 
+int
+sk_send_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t port)
+{
+    return send_single_packet(qconf, m, port);
+}
+
 static uint16_t
 get_udptcp_checksum(void *l3_hdr, void *l4_hdr, bool is_ipv4)
 {
@@ -344,6 +409,166 @@ get_psd_sum(void *l3_hdr, bool is_ipv4, uint64_t ol_flags)
         return rte_ipv6_phdr_cksum(l3_hdr, ol_flags);
 }
 
+/*
+ * like get_udptcp_checksum, but the l4 data of the packet may span
+ * multiple segments.
+ */
+static uint16_t
+get_udptcp_checksum_mbuf(struct rte_mbuf *m, void *l3_hdr, void *l4_hdr, bool is_ipv4)
+{
+    uint32_t off = (uint32_t)(m->l2_len + m->l3_len);
+    uint16_t raw = 0;
+    uint32_t cksum;
+
+    if (m->nb_segs == 1)
+        return get_udptcp_checksum(l3_hdr, l4_hdr, is_ipv4);
+
+    rte_raw_cksum_mbuf(m, off, rte_pktmbuf_pkt_len(m) - off, &raw);
+    cksum = (uint32_t)raw + get_psd_sum(l3_hdr, is_ipv4, 0);
+    cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
+    cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
+    cksum = (~cksum) & 0xffff;
+    if (cksum == 0) cksum = 0xffff;
+    return (uint16_t)cksum;
+}
+
+/*
+ * append `len` bytes to the packet, when the last segment is full, new
+ * segments are allocated from the pool of the packet and chained to it.
+ * on failure the segments already chained are freed with the packet.
+ */
+static int
+sk_pktmbuf_write(struct rte_mbuf *m, const char *data, uint32_t len)
+{
+    struct rte_mbuf *last = rte_pktmbuf_lastseg(m);
+    struct rte_mbuf *seg;
+    uint32_t n;
+
+    while (len > 0) {
+        // the tailroom of an indirect mbuf belongs to the body it attaches.
+        n = RTE_MBUF_INDIRECT(last)? 0: rte_pktmbuf_tailroom(last);
+        if (n == 0) {
+            if (m->nb_segs == UINT8_MAX) return ERR_CODE;
+            seg = rte_pktmbuf_alloc(m->pool);
+            if (seg == NULL) return ERR_CODE;
+            // only the first segment needs headroom.
+            seg->data_off = 0;
+            last->next = seg;
+            last = seg;
+            m->nb_segs++;
+            continue;
+        }
+        if (n > len) n = len;
+        rte_memcpy(rte_pktmbuf_mtod_offset(last, char *, last->data_len), data, n);
+        last->data_len = (uint16_t)(last->data_len + n);
+        m->pkt_len += n;
+        data += n;
+        len -= n;
+    }
+    return OK_CODE;
+}
+
+/*
+ * the response doesn't fit in the tailroom of the query mbuf.
+ * since the packer needs a contiguous buffer(name compression refers to
+ * offsets), the response is built in the response buffer of lcore, then it
+ * is copied to the packet, more segments are chained when necessary.
+ * the query in `udp_data` is still intact when this function is called.
+ * the response is capped at `max_udp_size` bytes, so no more segments than
+ * needed are chained.
+ * the response is counted after it is written to the packet.
+ * return the size of the response.
+ */
+static int
+build_chained_response(lcore_conf_t *qconf, struct rte_mbuf *m,
+                       char *udp_data, size_t udp_data_len, size_t max_udp_size,
+                       char *src_addr, uint16_t src_port, bool is_ipv4, int svc_id)
+{
+    // the ipv4 total length and ipv6 payload length are 16 bits.
+    size_t max_len = SK_RESP_BUF_SIZE - m->l4_len - (is_ipv4? m->l3_len: 0);
+    char *resp = qconf->resp_buf;
+    uint16_t qtype;
+    int n;
+
+    if (resp == NULL || udp_data_len > max_len) return ERR_CODE;
+    rte_memcpy(resp, udp_data, udp_data_len);
+    if (max_len > max_udp_size) max_len = max_udp_size;
+    n = processUDPDnsQuery(resp, udp_data_len, resp, max_len, max_udp_size,
+                           src_addr, src_port, is_ipv4, svc_id, NULL, &qtype,
+                           qconf->node, qconf->lcore_id);
+    if (n < 0) return ERR_CODE;
+    if (sk_pktmbuf_write(m, resp, (uint32_t)n) != OK_CODE) {
+        qconf->stats.drop[SK_DROP_NO_MBUF]++;
+        return ERR_CODE;
+    }
+    sk_stats_response(&qconf->stats, qtype, load16be(resp + 2), (uint32_t)n, false);
+    LOG_DEBUG(DPDK, "response of %d bytes uses %d segments.", n, m->nb_segs);
+    return n;
+}
+
+/*
+ * render the answer section of the RRSet to a body if it is big enough,
+ * the RRSet owns one reference of the body and drops it in RRSetDestroy.
+ */
+void sk_zc_render(RRSet *rs) {
+    static bool warned = false;
+    struct rte_mempool *mp;
+    struct rte_mbuf *m;
+    int n;
+
+    if (sk.zerocopy_min_size == 0 || !RRSetIsZeroCopyable(rs)) return;
+    if (rs->len + 10 * rs->num < (unsigned)sk.zerocopy_min_size) return;
+    if (rs->socket_id < 0 || rs->socket_id >= NB_SOCKETS) return;
+    if ((mp = zc_body_pool[rs->socket_id]) == NULL) return;
+
+    m = rte_pktmbuf_alloc(mp);
+    if (m == NULL) {
+        if (!warned) LOG_WARN(DPDK, "zero copy bodies are used up, answers will be copied.");
+        warned = true;
+        return;
+    }
+    // the body is always behind other segments, no headroom is needed.
+    m->data_off = 0;
+    n = RRSetRenderAnswer(rs, rte_pktmbuf_mtod(m, char *), rte_pktmbuf_tailroom(m));
+    if (n < 0) {
+        rte_pktmbuf_free(m);
+        return;
+    }
+    rte_pktmbuf_append(m, (uint16_t)n);
+    rs->zc_body = m;
+}
+
+/*
+ * chain the slice of a rendered answer to the packet through an indirect mbuf.
+ * the RRSet may be retired right after the lcore leaves its RCU read-side
+ * critical section(lcores hold it for a whole burst), the indirect mbuf keeps
+ * the body alive until the packet is sent.
+ * the slice is copied when there is no free indirect mbuf.
+ */
+static int
+attach_zc_body(lcore_conf_t *qconf, struct rte_mbuf *m, zcSlice *zc)
+{
+    struct rte_mbuf *body = zc->body;
+    struct rte_mbuf *mi = rte_pktmbuf_alloc(zc_indirect_pool[qconf->node->numa_id]);
+
+    if (unlikely(mi == NULL)) {
+        if (sk_pktmbuf_write(m, rte_pktmbuf_mtod_offset(body, char *, zc->off), zc->len) != OK_CODE)
+            return ERR_CODE;
+        return sk_pktmbuf_write(m, zc->trailer, zc->trailer_len);
+    }
+
+    rte_pktmbuf_attach(mi, body);
+    mi->data_off = (uint16_t)(mi->data_off + zc->off);
+    mi->data_len = (uint16_t)zc->len;
+    mi->pkt_len = zc->len;
+    if (rte_pktmbuf_chain(m, mi) != 0) {
+        rte_pktmbuf_free(mi);
+        return ERR_CODE;
+    }
+    // the trailer goes to a new segment behind the indirect mbuf.
+    return sk_pktmbuf_write(m, zc->trailer, zc->trailer_len);
+}
+
 // return 1 if the cksum is correct, otherwise return 0
 static int
 verify_cksum(struct rte_mbuf *m) {
@@ -379,6 +604,28 @@ verify_cksum(struct rte_mbuf *m) {
     return ok;
 }
 
+/*
+ * allocate the buffers used to build responses bigger than one mbuf,
+ * I/O lcores never process queries.
+ */
+static void
+setup_resp_bufs(void)
+{
+    lcore_conf_t *qconf;
+    int socket;
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        qconf = sk.lcore_conf[lcore_id];
+        if (qconf->role == LCORE_ROLE_IO) continue;
+        socket = sk.numa_on? (int)rte_lcore_to_socket_id((unsigned)lcore_id): 0;
+        qconf->resp_buf = rte_malloc_socket("resp_buf", SK_RESP_BUF_SIZE,
+                                            RTE_CACHE_LINE_SIZE, socket);
+        if (qconf->resp_buf == NULL)
+            rte_exit(EXIT_FAILURE, "can't allocate response buffer for lcore %d.\n", lcore_id);
+    }
+}
+
 /*----------------------------------------------------------------------------*/
 #ifdef IP_FRAG
 static int
@@ -395,7 +642,7 @@ setup_ip_frag_tbl()
 
     for (int i = 0; i < sk.nr_lcore_ids; ++i) {
         int lcore_id = sk.lcore_ids[i];
-        qconf = &sk.lcore_conf[lcore_id];
+        qconf = sk.lcore_conf[lcore_id];
         socket = rte_lcore_to_socket_id(lcore_id);
         if (socket == SOCKET_ID_ANY) socket = 0;
 
@@ -439,7 +686,7 @@ ipv4_reassemble(lcore_conf_t *qconf, struct rte_mbuf *m,
         if (mo != m) {
             m = mo;
             *eth_hdr_pp = rte_pktmbuf_mtod(m, struct ether_hdr *);
-            *ip_hdr_pp = (struct ipv4_hdr *)(*eth_hdr_pp + 1);
+            *ip_hdr_pp = (struct ipv4_hdr *)((char *)*eth_hdr_pp + m->l2_len);
         }
 	 }
     return m;
@@ -450,7 +697,6 @@ ipv6_reassemble(lcore_conf_t *qconf, struct rte_mbuf *m,
                 struct ether_hdr **eth_hdr_pp,
                 struct ipv6_hdr **ip_hdr_pp)
 {
-    struct ether_hdr *eth_hdr = *eth_hdr_pp;
     struct ipv6_hdr *ip_hdr = *ip_hdr_pp;
     struct rte_ip_frag_tbl *tbl;
     struct rte_ip_frag_death_row *dr;
@@ -464,8 +710,7 @@ ipv6_reassemble(lcore_conf_t *qconf, struct rte_mbuf *m,
         tbl = qconf->frag_tbl;
         dr = &qconf->death_row;
 
-        /* prepare mbuf: setup l2_len/l3_len. */
-        m->l2_len = sizeof(*eth_hdr);
+        /* prepare mbuf: setup l3_len, l2_len is set by caller. */
         m->l3_len = sizeof(*ip_hdr) + sizeof(*frag_hdr);
 
         mo = rte_ipv6_frag_reassemble_packet(tbl, dr, m, rte_rdtsc(), ip_hdr, frag_hdr);
@@ -475,7 +720,7 @@ ipv6_reassemble(lcore_conf_t *qconf, struct rte_mbuf *m,
         if (mo != m) {
             m = mo;
             *eth_hdr_pp = rte_pktmbuf_mtod(m, struct ether_hdr *);
-            *ip_hdr_pp = (struct ipv6_hdr *)(eth_hdr + 1);
+            *ip_hdr_pp = (struct ipv6_hdr *)((char *)*eth_hdr_pp + m->l2_len);
         }
     }
     return m;
@@ -488,6 +733,7 @@ void
 ip_fragmentation(lcore_conf_t *qconf, struct rte_mbuf *m,
                  port_info_t *pinfo, bool is_ipv4) {
     struct ether_hdr * origin_eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    uint16_t l2_len = (uint16_t)m->l2_len;
     uint8_t port = (uint8_t)pinfo->port_id;
     struct rte_mbuf *new_m;
     uint16_t len;
@@ -498,7 +744,7 @@ ip_fragmentation(lcore_conf_t *qconf, struct rte_mbuf *m,
     len = qconf->tx_mbufs[port].len;
     LOG_DEBUG(DPDK, "ip fragmentation %d", m->pkt_len);
 
-    rte_pktmbuf_adj(m, (uint16_t)sizeof(struct ether_hdr));
+    rte_pktmbuf_adj(m, l2_len);
 
     if (is_ipv4) {
         len2 = rte_ipv4_fragment_packet(m,
@@ -507,8 +753,10 @@ ip_fragmentation(lcore_conf_t *qconf, struct rte_mbuf *m,
                                         IPV4_MTU_DEFAULT,
                                         direct_pool, indirect_pool);
         /* If we fail to fragment the packet */
-        if (unlikely (len2 < 0))
+        if (unlikely (len2 < 0)) {
+            qconf->stats.drop[SK_DROP_NO_MBUF]++;
             goto end;
+        }
     } else {
         len2 = rte_ipv6_fragment_packet(m,
                                         &qconf->tx_mbufs[port].m_table[len],
@@ -516,8 +764,10 @@ ip_fragmentation(lcore_conf_t *qconf, struct rte_mbuf *m,
                                         IPV6_MTU_DEFAULT,
                                         direct_pool, indirect_pool);
         /* If we fail to fragment the packet */
-        if (unlikely (len2 < 0))
+        if (unlikely (len2 < 0)) {
+            qconf->stats.drop[SK_DROP_NO_MBUF]++;
             goto end;
+        }
     }
 
     LOG_DEBUG(DPDK, "response splits to %d fragments.", len2);
@@ -525,18 +775,23 @@ ip_fragmentation(lcore_conf_t *qconf, struct rte_mbuf *m,
     for (int i = len; i < len + len2; i ++) {
         new_m = qconf->tx_mbufs[port].m_table[i];
         struct ether_hdr *eth_hdr = (struct ether_hdr *)
-            rte_pktmbuf_prepend(new_m, (uint16_t)sizeof(struct ether_hdr));
+            rte_pktmbuf_prepend(new_m, l2_len);
         if (eth_hdr == NULL) {
             rte_panic("No headroom in mbuf.\n");
         }
-        rte_memcpy(eth_hdr, origin_eth_h, sizeof(struct ether_hdr));
-        new_m->l2_len = sizeof(struct ether_hdr);
+        // the l2 header includes the vlan tags in packet data.
+        rte_memcpy(eth_hdr, origin_eth_h, l2_len);
+        new_m->l2_len = l2_len;
+        // vlan tags inserted by NIC.
+        new_m->ol_flags |= m->ol_flags & (PKT_TX_VLAN_PKT | PKT_TX_QINQ_PKT);
+        new_m->vlan_tci = m->vlan_tci;
+        new_m->vlan_tci_outer = m->vlan_tci_outer;
 
         if (is_ipv4) {
             if (pinfo->hw_features.tx_csum_ip) {
                 new_m->ol_flags |= (PKT_TX_IPV4 | PKT_TX_IP_CKSUM);
             } else {
-                struct ipv4_hdr *ipv4_h = (struct ipv4_hdr*)(eth_hdr+1);
+                struct ipv4_hdr *ipv4_h = (struct ipv4_hdr*)((char *)eth_hdr + l2_len);
                 new_m->ol_flags &= (~(PKT_TX_IPV4 | PKT_TX_IP_CKSUM));
                 ipv4_h->hdr_checksum = 0;
                 ipv4_h->hdr_checksum = rte_ipv4_cksum(ipv4_h);
@@ -560,25 +815,107 @@ end:
 }
 #endif
 
-int sk_handle_arp_request(struct rte_mbuf *m, int portid) {
+/*
+ * put the vlan tags stripped by NIC back to the packet data,
+ * so the packet can be passed to KNI or sent by NICs without vlan insert.
+ */
+int sk_vlan_insert(struct rte_mbuf *m) {
+    struct ether_hdr *oh, *nh;
+    struct vlan_hdr *vh;
+    uint16_t tci[2];
+    int nr_tags = 0;
+
+    if (m->ol_flags & PKT_RX_QINQ_STRIPPED) {
+        tci[nr_tags++] = m->vlan_tci_outer;
+        tci[nr_tags++] = m->vlan_tci;
+    } else if (m->ol_flags & PKT_RX_VLAN_STRIPPED) {
+        tci[nr_tags++] = m->vlan_tci;
+    }
+    if (nr_tags == 0) return OK_CODE;
+    if (rte_mbuf_refcnt_read(m) > 1) return ERR_CODE;
+
+    oh = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    nh = (struct ether_hdr *)rte_pktmbuf_prepend(m, (uint16_t)(nr_tags * sizeof(*vh)));
+    if (nh == NULL) return ERR_CODE;
+    // only move the mac addresses, the ether type stays after the tags.
+    memmove(nh, oh, 2 * ETHER_ADDR_LEN);
+    nh->ether_type = rte_cpu_to_be_16(nr_tags == 2? ETHER_TYPE_QINQ: ETHER_TYPE_VLAN);
+    vh = (struct vlan_hdr *)(nh + 1);
+    vh[0].vlan_tci = rte_cpu_to_be_16(tci[0]);
+    if (nr_tags == 2) {
+        vh[0].eth_proto = rte_cpu_to_be_16(ETHER_TYPE_VLAN);
+        vh[1].vlan_tci = rte_cpu_to_be_16(tci[1]);
+    }
+    m->ol_flags &= ~(PKT_RX_VLAN_STRIPPED | PKT_RX_QINQ_STRIPPED |
+                     PKT_TX_VLAN_PKT | PKT_TX_QINQ_PKT);
+    return OK_CODE;
+}
+
+/*
+ * find the vlan key of the packet and skip the 802.1Q/QinQ tags,
+ * m->l2_len and ether_type are set to the values of the inner frame.
+ * if the tags are stripped by NIC, they are inserted again on TX, by NIC
+ * if it supports vlan insert, otherwise by software.
+ * return ERR_CODE if the tags can't be inserted by software.
+ */
+static inline int
+parse_vlan(struct rte_mbuf **mp, port_info_t *pinfo, uint16_t *ether_type, uint32_t *vlanp) {
+    struct rte_mbuf *m = *mp;
+    struct ether_hdr *eth_h;
+    struct vlan_hdr *vh;
+    uint32_t vlan = 0;
+
+    if (m->ol_flags & PKT_RX_QINQ_STRIPPED) {
+        if (pinfo->hw_features.tx_qinq_insert) {
+            m->ol_flags |= PKT_TX_QINQ_PKT;
+            vlan = SK_VLAN_KEY(m->vlan_tci_outer & 0xFFF, m->vlan_tci & 0xFFF);
+        } else if (sk_vlan_insert(m) != OK_CODE) {
+            return ERR_CODE;
+        }
+    } else if (m->ol_flags & PKT_RX_VLAN_STRIPPED) {
+        if (pinfo->hw_features.tx_vlan_insert) {
+            m->ol_flags |= PKT_TX_VLAN_PKT;
+            vlan = m->vlan_tci & 0xFFF;
+        } else if (sk_vlan_insert(m) != OK_CODE) {
+            return ERR_CODE;
+        }
+    }
+    eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    *ether_type = rte_be_to_cpu_16(eth_h->ether_type);
+    m->l2_len = sizeof(struct ether_hdr);
+
+    vh = (struct vlan_hdr *)(eth_h + 1);
+    for (int i = 0; i < 2; ++i, ++vh) {
+        if (*ether_type != ETHER_TYPE_VLAN && *ether_type != ETHER_TYPE_QINQ) break;
+        vlan = (vlan << 16) | (rte_be_to_cpu_16(vh->vlan_tci) & 0xFFF);
+        *ether_type = rte_be_to_cpu_16(vh->eth_proto);
+        m->l2_len += sizeof(struct vlan_hdr);
+    }
+    *mp = m;
+    *vlanp = vlan;
+    return OK_CODE;
+}
+
+int sk_handle_arp_request(struct rte_mbuf *m, int portid, uint32_t vlan) {
     struct ether_hdr *eth_h;
     struct arp_hdr *arp_h;
     port_info_t *pinfo = sk.port_info[portid];
 
     eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
-    arp_h = (struct arp_hdr*)(eth_h + 1);
+    arp_h = (struct arp_hdr*)((char *)eth_h + m->l2_len);
 
     uint16_t arp_op_type = rte_be_to_cpu_16(arp_h->arp_op);
     if (arp_op_type == ARP_OP_REQUEST) {
-        if (memcmp(&arp_h->arp_data.arp_tip, &pinfo->ipv4_addr, 4) == 0) {
+        if (sk_addr_lookup(rcu_dereference(pinfo->addr_tbl), AF_INET, vlan, &arp_h->arp_data.arp_tip)) {
             LOG_DEBUG(DPDK, "got arp request for port %d.", portid);
             arp_h->arp_op = rte_cpu_to_be_16(ARP_OP_REPLY);
 
             struct arp_ipv4 *arp_data = &arp_h->arp_data;
+            uint32_t tip = arp_data->arp_tip;
             arp_data->arp_tip = arp_data->arp_sip;
             ether_addr_copy(&arp_data->arp_sha, &arp_data->arp_tha);
 
-            arp_data->arp_sip = pinfo->ipv4_addr;
+            arp_data->arp_sip = tip;
             ether_addr_copy(&pinfo->eth_addr, &arp_data->arp_sha);
 
             ether_addr_copy(&eth_h->s_addr, &eth_h->d_addr);
@@ -589,14 +926,139 @@ int sk_handle_arp_request(struct rte_mbuf *m, int portid) {
     return ERR_CODE;
 }
 
+/*
+ * answer the neighbor solicitation for the addresses of this port,
+ * the NS is rewritten to a neighbor advertisement in place.
+ */
+static int
+sk_handle_ndp_solicit(struct rte_mbuf *m, port_info_t *pinfo, uint32_t vlan,
+                      struct ether_hdr *eth_h, struct ipv6_hdr *ipv6_h) {
+    struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *)(ipv6_h + 1);
+    struct nd_neighbor_advert *na = (struct nd_neighbor_advert *)ns;
+    struct nd_opt_hdr *opt;
+    static const uint8_t unspec_addr[16] = {0};
+    static const uint8_t all_nodes_addr[16] = {0xff, 0x02, [15] = 0x01};
+    bool dad;
+    uint16_t len = sizeof(*na) + sizeof(*opt) + ETHER_ADDR_LEN;
+
+    if (rte_be_to_cpu_16(ipv6_h->payload_len) < sizeof(*ns)) return ERR_CODE;
+    // RFC 4861 7.1.1, NS must not be forwarded by routers.
+    if (ipv6_h->hop_limits != 255 || ns->nd_ns_code != 0) return ERR_CODE;
+    if (!sk_addr_lookup(rcu_dereference(pinfo->addr_tbl), AF_INET6, vlan, &ns->nd_ns_target)) return ERR_CODE;
+    if (m->nb_segs > 1 ||
+        m->l2_len + m->l3_len + len > m->data_len + rte_pktmbuf_tailroom(m)) {
+        return ERR_CODE;
+    }
+
+    // the source is unspecified when the sender is doing duplicate
+    // address detection, the NA should be sent to all nodes.
+    dad = memcmp(ipv6_h->src_addr, unspec_addr, 16) == 0;
+    if (dad) {
+        rte_memcpy(ipv6_h->dst_addr, all_nodes_addr, 16);
+        eth_h->d_addr = (struct ether_addr){{0x33, 0x33, 0, 0, 0, 0x01}};
+    } else {
+        rte_memcpy(ipv6_h->dst_addr, ipv6_h->src_addr, 16);
+        ether_addr_copy(&eth_h->s_addr, &eth_h->d_addr);
+    }
+    rte_memcpy(ipv6_h->src_addr, &ns->nd_ns_target, 16);
+    ether_addr_copy(&pinfo->eth_addr, &eth_h->s_addr);
+    ipv6_h->payload_len = rte_cpu_to_be_16(len);
+    ipv6_h->hop_limits = 255;
+
+    // target address stays in place.
+    na->nd_na_type = ND_NEIGHBOR_ADVERT;
+    na->nd_na_code = 0;
+    na->nd_na_flags_reserved = ND_NA_FLAG_OVERRIDE;
+    if (!dad) na->nd_na_flags_reserved |= ND_NA_FLAG_SOLICITED;
+    opt = (struct nd_opt_hdr *)(na + 1);
+    opt->nd_opt_type = ND_OPT_TARGET_LINKADDR;
+    opt->nd_opt_len = 1;
+    ether_addr_copy(&pinfo->eth_addr, (struct ether_addr *)(opt + 1));
+
+    m->data_len = m->pkt_len = m->l2_len + m->l3_len + len;
+    na->nd_na_cksum = 0;
+    na->nd_na_cksum = rte_ipv6_udptcp_cksum(ipv6_h, na);
+    return OK_CODE;
+}
+
+/*
+ * answer the echo request sent to the addresses of this port.
+ */
+static int
+sk_handle_icmpv6_echo(port_info_t *pinfo, uint32_t vlan, struct ether_hdr *eth_h,
+                      struct ipv6_hdr *ipv6_h) {
+    struct icmp6_hdr *icmp_h = (struct icmp6_hdr *)(ipv6_h + 1);
+    uint8_t addr[16];
+
+    if (!sk_addr_lookup(rcu_dereference(pinfo->addr_tbl), AF_INET6, vlan, ipv6_h->dst_addr)) return ERR_CODE;
+
+    rte_memcpy(addr, ipv6_h->src_addr, 16);
+    rte_memcpy(ipv6_h->src_addr, ipv6_h->dst_addr, 16);
+    rte_memcpy(ipv6_h->dst_addr, addr, 16);
+    ipv6_h->hop_limits = 64;
+    ether_addr_copy(&eth_h->s_addr, &eth_h->d_addr);
+    ether_addr_copy(&pinfo->eth_addr, &eth_h->s_addr);
+
+    icmp_h->icmp6_type = ICMP6_ECHO_REPLY;
+    icmp_h->icmp6_cksum = 0;
+    icmp_h->icmp6_cksum = rte_ipv6_udptcp_cksum(ipv6_h, icmp_h);
+    return OK_CODE;
+}
+
+/*
+ * handle the NDP and ICMPv6 echo packets, return OK_CODE if the packet is
+ * rewritten to a reply, otherwise the packet should be passed to kernel.
+ */
+int sk_handle_icmpv6(struct rte_mbuf *m, int portid, uint32_t vlan) {
+    port_info_t *pinfo = sk.port_info[portid];
+    struct ether_hdr *eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    struct ipv6_hdr *ipv6_h = (struct ipv6_hdr *)((char *)eth_h + m->l2_len);
+    struct icmp6_hdr *icmp_h = (struct icmp6_hdr *)(ipv6_h + 1);
+    uint16_t payload_len = rte_be_to_cpu_16(ipv6_h->payload_len);
+
+    if (payload_len < sizeof(*icmp_h) ||
+        m->data_len < m->l2_len + m->l3_len + payload_len) {
+        return ERR_CODE;
+    }
+    // NIC doesn't verify the checksum of ICMPv6
+    if (rte_ipv6_udptcp_cksum(ipv6_h, icmp_h) != 0xFFFF) {
+        LOG_DEBUG(DPDK, "wrong icmpv6 checksum.");
+        return ERR_CODE;
+    }
+    switch (icmp_h->icmp6_type) {
+        case ND_NEIGHBOR_SOLICIT:
+            LOG_DEBUG(DPDK, "got neighbor solicitation for port %d.", portid);
+            return sk_handle_ndp_solicit(m, pinfo, vlan, eth_h, ipv6_h);
+        case ICMP6_ECHO_REQUEST:
+            return sk_handle_icmpv6_echo(pinfo, vlan, eth_h, ipv6_h);
+        default:
+            return ERR_CODE;
+    }
+}
+
+// debug logging of packet handlers, `dbg` is a compile time constant.
+#define HP_DEBUG(...) do { if (dbg) LOG_DEBUG(DPDK, __VA_ARGS__); } while (0)
+
+/*
+ * the per-packet handler, it is specialized by the constant arguments(see
+ * DEFINE_PACKET_HANDLER), so the branches for the capabilities of port and
+ * debug logging are resolved at compile time.
+ * hw_csum: the port offloads all the checksums(rx, tx ip and tx l4).
+ * ptype: the port reports L2/L3 packet type.
+ * dbg: data plane debug logging is enabled.
+ */
 static inline __attribute__((always_inline)) void
-__handle_packet(struct rte_mbuf *m, uint8_t portid,
-                 lcore_conf_t *qconf)
+__handle_packet(struct rte_mbuf *m, uint8_t portid, lcore_conf_t *qconf,
+                const bool hw_csum, const bool ptype, const bool dbg)
 {
     port_info_t *pinfo = sk.port_info[portid];
-    if (pinfo->hw_features.rx_csum && !verify_cksum(m)) {
-        LOG_DEBUG(DPDK, "invalid cksum");
-        goto invalid;
+    const bool rx_csum = hw_csum || pinfo->hw_features.rx_csum;
+    const bool tx_csum_ip = hw_csum || pinfo->hw_features.tx_csum_ip;
+    const bool tx_csum_l4 = hw_csum || pinfo->hw_features.tx_csum_l4;
+
+    if (rx_csum && !verify_cksum(m)) {
+        HP_DEBUG("invalid cksum");
+        goto bad_csum;
     }
 
     uint16_t ether_type;
@@ -617,18 +1079,34 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
     char ipv6_addr[16];
     char *udp_data;
     size_t udp_data_len;
+    size_t max_udp_size;
     int n, total_h_len;
+    uint16_t qtype, flag;
+    uint32_t resp_len;
     void *src_addr = NULL;
-
+    void *dst_addr = NULL;
+    const sk_addr_t *svc;
+    uint32_t vlan;
+    zcSlice zc = {NULL, 0, 0, 0, {0}};
+
+    if (ptype && (m->packet_type & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER &&
+        !(m->ol_flags & (PKT_RX_VLAN_STRIPPED | PKT_RX_QINQ_STRIPPED)) &&
+        (RTE_ETH_IS_IPV4_HDR(m->packet_type) || RTE_ETH_IS_IPV6_HDR(m->packet_type))) {
+        // untagged ip packet classified by NIC.
+        vlan = 0;
+        m->l2_len = sizeof(struct ether_hdr);
+        ether_type = RTE_ETH_IS_IPV4_HDR(m->packet_type)? ETHER_TYPE_IPv4: ETHER_TYPE_IPv6;
+    } else if (parse_vlan(&m, pinfo, &ether_type, &vlan) != OK_CODE) {
+        qconf->stats.drop[SK_DROP_VLAN]++;
+        goto dropped;
+    }
     eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
-    ether_type = rte_be_to_cpu_16(eth_h->ether_type);
-    l3_h = (char *)(eth_h+1);
-    m->l2_len = sizeof(struct ether_hdr);
+    l3_h = (char *)eth_h + m->l2_len;
 
     switch (ether_type) {
         case ETHER_TYPE_ARP:
-            LOG_DEBUG(DPDK, "port %d got a arp packet.", portid);
-            if (sk_handle_arp_request(m, portid) == OK_CODE) {
+            HP_DEBUG("port %d got a arp packet.", portid);
+            if (sk_handle_arp_request(m, portid, vlan) == OK_CODE) {
                 send_single_packet(qconf, m, portid);
                 return;
             }
@@ -638,20 +1116,25 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
         case ETHER_TYPE_IPv4:
             is_ipv4 = true;
             ipv4_h = (struct ipv4_hdr *)l3_h;
-            if (! pinfo->hw_features.rx_csum) {
+            if (! rx_csum) {
                 // using software to verify cksum
                 if (rte_ipv4_cksum(ipv4_h) != 0xFFFF) {
-                    LOG_DEBUG(DPDK, "wrong ipv4 checksum, drop it.");
-                    goto invalid;
+                    HP_DEBUG("wrong ipv4 checksum, drop it.");
+                    goto bad_csum;
                 }
             }
-            m->l3_len = (ipv4_h->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+            if (ptype && (m->packet_type & RTE_PTYPE_L3_MASK) == RTE_PTYPE_L3_IPV4)
+                m->l3_len = sizeof(*ipv4_h);
+            else
+                m->l3_len = (ipv4_h->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
 #ifdef IP_FRAG
             m = ipv4_reassemble(qconf, m, &eth_h, &ipv4_h);
             if (!m) return;
+            l3_h = (char *)ipv4_h;
             mtu = IPV4_MTU_DEFAULT;
 #endif
             src_addr = &(ipv4_h->src_addr);
+            dst_addr = &(ipv4_h->dst_addr);
             ipproto = ipv4_h->next_proto_id;
             break;
         case ETHER_TYPE_IPv6:
@@ -660,53 +1143,74 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
 #ifdef IP_FRAG
             m = ipv6_reassemble(qconf, m, &eth_h, &ipv6_h);
             if (!m) return;
+            l3_h = (char *)ipv6_h;
             mtu = IPV6_MTU_DEFAULT;
 #endif
             m->ol_flags |= PKT_TX_IPV6;
             src_addr = ipv6_h->src_addr;
+            dst_addr = ipv6_h->dst_addr;
             ipproto = ipv6_h->proto;
             break;
         default:
-            LOG_DEBUG(DPDK, "invalid l3 proto");
+            HP_DEBUG("invalid l3 proto");
             goto invalid;
     }
     switch (ipproto) {
         case IPPROTO_UDP:
             udp_h = (struct udp_hdr *) (l3_h + m->l3_len);
-            if (! pinfo->hw_features.rx_csum) {
+            if (! rx_csum) {
                 // using software to verify cksum
                 if (get_udptcp_checksum(l3_h, udp_h, is_ipv4) != 0xFFFF) {
-                    LOG_DEBUG(DPDK, "wrong udp checksum, drop it.");
-                    goto invalid;
+                    HP_DEBUG("wrong udp checksum, drop it.");
+                    goto bad_csum;
                 }
             }
             // check the udp port
             if (rte_be_to_cpu_16(udp_h->dst_port) != sk.port) {
-                LOG_DEBUG(DPDK, "invalid udp port");
+                HP_DEBUG("invalid udp port");
                 goto invalid;
             }
+            svc = sk_addr_lookup(rcu_dereference(pinfo->addr_tbl),
+                                 is_ipv4? AF_INET: AF_INET6, vlan, dst_addr);
+            if (svc == NULL) goto bad_dst;
             break;
         case IPPROTO_TCP:
             if(sk.only_udp) goto invalid;
 
             tcp_h = (struct tcp_hdr *) (l3_h + m->l3_len);
-            if (! pinfo->hw_features.rx_csum) {
+            if (! rx_csum) {
                 // using software to verify cksum
                 if (get_udptcp_checksum(l3_h, tcp_h, is_ipv4) != 0xFFFF) {
-                    LOG_DEBUG(DPDK, "wrong udp checksum, drop it.");
-                    goto invalid;
+                    HP_DEBUG("wrong tcp checksum, drop it.");
+                    goto bad_csum;
                 }
             }
             // check the tcp port
             if (rte_be_to_cpu_16(tcp_h->dst_port) != sk.port) {
-                LOG_DEBUG(DPDK, "invalid tcp port");
+                HP_DEBUG("invalid tcp port");
                 goto invalid;
             }
-            LOG_DEBUG(DPDK, "port %d got a tcp packet.", portid);
-            kni_send_single_packet(qconf, m ,portid);
+            svc = sk_addr_lookup(rcu_dereference(pinfo->addr_tbl),
+                                 is_ipv4? AF_INET: AF_INET6, vlan, dst_addr);
+            if (svc == NULL) goto bad_dst;
+            HP_DEBUG("port %d got a tcp packet.", portid);
+            if (sk.tcp_fastpath_on) {
+                sk_tcp_handle_packet(qconf, m, portid, is_ipv4, svc->svc_id);
+            } else {
+                kni_send_single_packet(qconf, m ,portid);
+            }
+            return;
+        case IPPROTO_ICMPV6:
+            if (is_ipv4) goto invalid;
+            if (sk_handle_icmpv6(m, portid, vlan) == OK_CODE) {
+                send_single_packet(qconf, m, portid);
+                return;
+            }
+            if (!sk.only_udp) kni_send_single_packet(qconf, m ,portid);
+            else rte_pktmbuf_free(m);
             return;
         default:
-            LOG_DEBUG(DPDK, "invalid l4 proto");
+            HP_DEBUG("invalid l4 proto");
             goto invalid;
     }
 
@@ -714,20 +1218,45 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
 
     udp_data = (void *) (udp_h + 1);
     udp_data_len = (size_t )(rte_be_to_cpu_16(udp_h->dgram_len) - 8);
+    if (unlikely(sk.capture_on))
+        sk_capture_query(qconf, m, (uint32_t)(udp_data - rte_pktmbuf_mtod(m, char *) + udp_data_len));
     char *data_end = rte_pktmbuf_mtod(m, char*) + rte_pktmbuf_data_len(m);
     // move data end to the start of udp data.
     rte_pktmbuf_trim(m, (uint16_t)(data_end - udp_data));
 
+#ifdef IP_FRAG
+    // bigger responses are fragmented.
+    max_udp_size = SK_RESP_BUF_SIZE - m->l4_len - (is_ipv4? m->l3_len: 0);
+#else
+    max_udp_size = (size_t)(pinfo->mtu - m->l3_len - m->l4_len);
+#endif
     n = processUDPDnsQuery(udp_data, udp_data_len, udp_data,
-                           rte_pktmbuf_tailroom(m), src_addr, udp_h->src_port,
-                           is_ipv4, qconf->node, qconf->lcore_id);
-    if(n == ERR_CODE) goto dropped;
-
-    // ethernet frame should at least contain 64 bytes(include 4 byte CRC)
-    total_h_len = (int)(m->l2_len + m->l3_len + m->l4_len);
-    if (n + total_h_len < 60) n = 60 - total_h_len;
-    rte_pktmbuf_append(m, (uint16_t)n);
-    LOG_DEBUG(DPDK, "pkt_len: %u, udp len: %zu, port: %d",
+                           rte_pktmbuf_tailroom(m), max_udp_size, src_addr,
+                           udp_h->src_port, is_ipv4, svc->svc_id,
+                           sk.zerocopy_min_size? &zc: NULL, &qtype,
+                           qconf->node, qconf->lcore_id);
+    if (unlikely(n == NO_MEM_CODE)) {
+        n = build_chained_response(qconf, m, udp_data, udp_data_len, max_udp_size,
+                                   src_addr, udp_h->src_port, is_ipv4, svc->svc_id);
+    } else if (n >= 0) {
+        flag = load16be(udp_data + 2);
+        resp_len = (uint32_t)n;
+        // ethernet frame should at least contain 64 bytes(include 4 byte CRC)
+        total_h_len = (int)(m->l2_len + m->l3_len + m->l4_len);
+        if (zc.body == NULL && n + total_h_len < 60) n = 60 - total_h_len;
+        rte_pktmbuf_append(m, (uint16_t)n);
+        if (zc.body) {
+            if (attach_zc_body(qconf, m, &zc) != OK_CODE) {
+                qconf->stats.drop[SK_DROP_NO_MBUF]++;
+                goto dropped;
+            }
+            n += (int)(zc.len + zc.trailer_len);
+            resp_len += zc.len + zc.trailer_len;
+        }
+        sk_stats_response(&qconf->stats, qtype, flag, resp_len, false);
+    }
+    if (n < 0) goto dropped;
+    HP_DEBUG("pkt_len: %u, udp len: %zu, port: %d",
               rte_pktmbuf_pkt_len(m), udp_data_len, rte_be_to_cpu_16(udp_h->src_port));
 
     ++qconf->nr_req;
@@ -747,7 +1276,7 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
         ipv4_h->total_length = rte_cpu_to_be_16(m->l3_len+m->l4_len+n);
         ipv4_h->hdr_checksum = 0;
 
-        if (pinfo->hw_features.tx_csum_ip) {
+        if (tx_csum_ip) {
             m->ol_flags |= (PKT_TX_IPV4 | PKT_TX_IP_CKSUM);
         } else {
             ipv4_h->hdr_checksum = rte_ipv4_cksum(ipv4_h);
@@ -767,22 +1296,23 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
     /* set checksum parameters for HW offload */
     udp_h->dgram_cksum = 0;
 
-    if (pinfo->hw_features.tx_csum_l4) {
+    if (tx_csum_l4) {
         m->ol_flags |= PKT_TX_UDP_CKSUM;
         udp_h->dgram_cksum = get_psd_sum(l3_h, is_ipv4, m->ol_flags);
-        LOG_DEBUG(DPDK, "udp psd checksum: 0x%x.", udp_h->dgram_cksum);
+        HP_DEBUG("udp psd checksum: 0x%x.", udp_h->dgram_cksum);
     } else {
-        udp_h->dgram_cksum = get_udptcp_checksum(l3_h, udp_h, is_ipv4);
-        LOG_DEBUG(DPDK, "udp checksum: 0x%x.", udp_h->dgram_cksum);
+        udp_h->dgram_cksum = get_udptcp_checksum_mbuf(m, l3_h, udp_h, is_ipv4);
+        HP_DEBUG("udp checksum: 0x%x.", udp_h->dgram_cksum);
     }
+    if (unlikely(sk.capture_on)) sk_capture_response(qconf, m, is_ipv4);
 
 #ifdef IP_FRAG
-    if (likely(mtu + sizeof(struct ether_hdr) >= m->pkt_len)) {
+    if (likely((uint32_t)(mtu + m->l2_len) >= m->pkt_len)) {
         send_single_packet(qconf, m, portid);
     } else {
         // we must calculate the udp cksum when ip fragmentation is needed.
         udp_h->dgram_cksum = 0;
-        udp_h->dgram_cksum = get_udptcp_checksum(l3_h, udp_h, is_ipv4);
+        udp_h->dgram_cksum = get_udptcp_checksum_mbuf(m, l3_h, udp_h, is_ipv4);
         ip_fragmentation(qconf, m, pinfo, is_ipv4);
     }
 #else
@@ -791,17 +1321,120 @@ __handle_packet(struct rte_mbuf *m, uint8_t portid,
     return;
 
 dropped:
-    // LOG_DEBUG(DPDK, "drop packet.");
+    // HP_DEBUG("drop packet.");
     ++qconf->nr_dropped;
+    goto free_pkt;
+bad_dst:
+    HP_DEBUG("destination is not a service address.");
+    ++qconf->nr_bad_dst;
+    ++qconf->stats.drop[SK_DROP_BAD_DST];
+    goto free_pkt;
+bad_csum:
+    ++qconf->stats.drop[SK_DROP_BAD_CSUM];
+    goto free_pkt;
 invalid:
+    ++qconf->stats.drop[SK_DROP_NON_DNS];
+free_pkt:
     rte_pktmbuf_free(m);
 }
 
+#undef HP_DEBUG
+
+#define DEFINE_PACKET_HANDLER(name, hw_csum, ptype, dbg)                       \
+static void name(struct rte_mbuf *m, uint8_t portid, lcore_conf_t *qconf) {    \
+    __handle_packet(m, portid, qconf, hw_csum, ptype, dbg);                    \
+}
+
+DEFINE_PACKET_HANDLER(handle_packet_sw, false, false, false)
+DEFINE_PACKET_HANDLER(handle_packet_sw_ptype, false, true, false)
+DEFINE_PACKET_HANDLER(handle_packet_hw, true, false, false)
+DEFINE_PACKET_HANDLER(handle_packet_hw_ptype, true, true, false)
+DEFINE_PACKET_HANDLER(handle_packet_sw_dbg, false, false, true)
+DEFINE_PACKET_HANDLER(handle_packet_sw_ptype_dbg, false, true, true)
+DEFINE_PACKET_HANDLER(handle_packet_hw_dbg, true, false, true)
+DEFINE_PACKET_HANDLER(handle_packet_hw_ptype_dbg, true, true, true)
+
+// indexed by [hw_csum][ptype][dbg]
+static const sk_pkt_handler_t packet_handlers[2][2][2] = {
+    {
+        {handle_packet_sw, handle_packet_sw_dbg},
+        {handle_packet_sw_ptype, handle_packet_sw_ptype_dbg},
+    },
+    {
+        {handle_packet_hw, handle_packet_hw_dbg},
+        {handle_packet_hw_ptype, handle_packet_hw_ptype_dbg},
+    },
+};
+
+/*
+ * the handler only relies on packet type to classify untagged ipv4/ipv6 frames.
+ */
+static bool
+port_supports_ptype(uint8_t portid) {
+    uint32_t ptypes[64];
+    bool l2 = false, ipv4 = false, ipv6 = false;
+    int n = rte_eth_dev_get_supported_ptypes(portid, RTE_PTYPE_L2_MASK | RTE_PTYPE_L3_MASK,
+                                             ptypes, RTE_DIM(ptypes));
+
+    for (int i = 0; i < RTE_MIN(n, (int)RTE_DIM(ptypes)); ++i) {
+        if (ptypes[i] == RTE_PTYPE_L2_ETHER) l2 = true;
+        if (RTE_ETH_IS_IPV4_HDR(ptypes[i])) ipv4 = true;
+        if (RTE_ETH_IS_IPV6_HDR(ptypes[i])) ipv6 = true;
+    }
+    return l2 && ipv4 && ipv6;
+}
+
+/*
+ * the handler of a port with these capabilities, the debug variant is
+ * chosen by the log level.
+ */
+sk_pkt_handler_t
+sk_packet_handler(bool hw_csum, bool ptype) {
+    bool dbg = (RTE_LOG_DEBUG <= SK_LOG_DP_LEVEL) &&
+               rte_log_get_global_level() >= RTE_LOG_DEBUG;
+
+    return packet_handlers[hw_csum][ptype][dbg];
+}
+
+static sk_pkt_handler_t
+select_packet_handler(port_info_t *pinfo) {
+    struct hw_features *hw = &pinfo->hw_features;
+
+    return sk_packet_handler(hw->rx_csum && hw->tx_csum_ip && hw->tx_csum_l4, hw->rx_ptype);
+}
+
+/*
+ * choose the packet handler of every (lcore, port) once the capabilities of
+ * ports are known.
+ */
+static void
+setup_packet_handlers(void) {
+    for (int portid = 0; portid < RTE_MAX_ETHPORTS; ++portid) {
+        port_info_t *pinfo = sk.port_info[portid];
+        if (pinfo == NULL) continue;
+        pinfo->hw_features.rx_ptype = port_supports_ptype((uint8_t)portid);
+        LOG_INFO(DPDK, "port %d: packet type %s, checksum offload %s.", portid,
+                 pinfo->hw_features.rx_ptype? "supported": "unsupported",
+                 (pinfo->hw_features.rx_csum && pinfo->hw_features.tx_csum_ip &&
+                  pinfo->hw_features.tx_csum_l4)? "full": "partial");
+    }
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        lcore_conf_t *qconf = sk.lcore_conf[sk.lcore_ids[i]];
+        for (int portid = 0; portid < RTE_MAX_ETHPORTS; ++portid) {
+            if (sk.port_info[portid] == NULL) continue;
+            qconf->handlers[portid] = select_packet_handler(sk.port_info[portid]);
+        }
+    }
+}
+
 static void handle_packets(int nb_rx, struct rte_mbuf **pkts_burst,
                            uint8_t portid, lcore_conf_t *qconf)
 {
+    sk_pkt_handler_t handler = qconf->handlers[portid];
     int32_t j;
 
+    // the address tables are protected by RCU.
+    rcu_read_lock();
     /* Prefetch first packets */
     for (j = 0; j < PREFETCH_OFFSET && j < nb_rx; j++)
         rte_prefetch0(rte_pktmbuf_mtod(pkts_burst[j], void *));
@@ -813,95 +1446,724 @@ static void handle_packets(int nb_rx, struct rte_mbuf **pkts_burst,
     for (j = 0; j < (nb_rx - PREFETCH_OFFSET); j++) {
         rte_prefetch0(rte_pktmbuf_mtod(pkts_burst[
                                            j + PREFETCH_OFFSET], void *));
-        __handle_packet(pkts_burst[j], portid, qconf);
+        handler(pkts_burst[j], portid, qconf);
     }
 
     /* Forward remaining prefetched packets */
     for (; j < nb_rx; j++)
-        __handle_packet(pkts_burst[j], portid, qconf);
+        handler(pkts_burst[j], portid, qconf);
+    rcu_read_unlock();
 }
 
-int
-launch_one_lcore(__attribute__((unused)) void *dummy)
-{
-    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
-    unsigned lcore_id = rte_lcore_id();
-    lcore_conf_t *qconf = &sk.lcore_conf[lcore_id];
-    uint64_t prev_tsc, diff_tsc, cur_tsc;
-    int i, nb_rx;
-    uint8_t portid, queueid;
-    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) /
-        US_PER_S * BURST_TX_DRAIN_US;
+/*
+ * record the latency of a burst of `nb_rx` packets and stamp the tx buffers
+ * the responses went to, the next burst starts now.
+ */
+static inline void
+sk_lat_burst_done(lcore_conf_t *qconf, int nb_rx) {
+    uint64_t now = rte_rdtsc();
+    struct mbuf_table *buf;
+
+    sk_lat_record(&qconf->lat_rx, now - qconf->tsc, (uint64_t)nb_rx);
+    qconf->tsc = now;
+    for (int i = 0; i < qconf->nr_ports; ++i) {
+        buf = &qconf->tx_mbufs[qconf->port_id_list[i]];
+        if (buf->len > 0 && buf->tsc == 0) buf->tsc = now;
+    }
+}
 
-    rcu_register_thread();
+/*
+ * the bonding PMD sends LACPDUs from rte_eth_tx_burst, the partner drops a
+ * member whose LACPDUs stop, so the tx queues of lacp bonds are kicked even
+ * if there is nothing to send.
+ */
+static inline void
+kick_lacp_ports(lcore_conf_t *qconf) {
+    uint8_t portid;
 
-    prev_tsc = 0;
+    for (int i = 0; i < qconf->nr_ports; ++i) {
+        portid = (uint8_t )qconf->port_id_list[i];
+        if (sk.port_info[portid]->lacp)
+            rte_eth_tx_burst(portid, (uint16_t)qconf->queue_id_list[portid], NULL, 0);
+    }
+}
 
-    init_per_lcore();
+static inline void
+drain_tx_mbufs(lcore_conf_t *qconf) {
+    uint8_t portid;
 
-    if (qconf->nr_ports == 0) {
-        LOG_INFO(DPDK, "lcore %u has nothing to do.", lcore_id);
-        return 0;
+    for (int i = 0; i < qconf->nr_ports; ++i) {
+        portid = (uint8_t )qconf->port_id_list[i];
+        if (qconf->tx_mbufs[portid].len > 0) {
+            send_burst(qconf,
+                       qconf->tx_mbufs[portid].len,
+                       portid);
+            qconf->tx_mbufs[portid].len = 0;
+        }
     }
+    // workers don't own tx queues.
+    if (qconf->role != LCORE_ROLE_WORKER) kick_lacp_ports(qconf);
+}
 
-    LOG_INFO(DPDK, "entering main loop on lcore %u.", lcore_id);
+/*
+ * only the exception lcore touches the KNI devices, other lcores hand
+ * the packets punted to KNI over to it through their kni rings.
+ * returns the number of packets received.
+ */
+static inline unsigned
+poll_rx_queues(lcore_conf_t *qconf, struct rte_mbuf **pkts_burst) {
+    int i, nb_rx;
+    unsigned total = 0;
+    uint8_t portid, queueid;
 
     for (i = 0; i < qconf->nr_ports; i++) {
 
         portid = (uint8_t )qconf->port_id_list[i];
         queueid = (uint8_t )qconf->queue_id_list[portid];
-        LOG_INFO(DPDK,
-                " -- lcoreid=%u portid=%hhu rxqueueid=%hhu.",
-                lcore_id, portid, queueid);
+
+        nb_rx = rte_eth_rx_burst(portid, queueid, pkts_burst, MAX_PKT_BURST);
+        if (nb_rx == 0)
+            continue;
+        qconf->received_req += nb_rx;
+        // LOG_DEBUG(DPDK, "lcore %d recv port %d, queue %d, nb_rx: %d\n", qconf->lcore_id, portid, queueid, nb_rx);
+
+        handle_packets(nb_rx, pkts_burst, portid, qconf);
+        sk_lat_burst_done(qconf, nb_rx);
+        total += (unsigned)nb_rx;
     }
+    return total;
+}
+
+/*
+ * run-to-completion mode, every lcore polls its own rx queues and
+ * processes the packets.
+ */
+static void
+main_loop_rtc(lcore_conf_t *qconf) {
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    uint64_t prev_tsc, diff_tsc, cur_tsc;
+    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) /
+        US_PER_S * BURST_TX_DRAIN_US;
 
+    prev_tsc = 0;
     while (!sk.force_quit) {
 
         cur_tsc = rte_rdtsc();
+        qconf->tsc = cur_tsc;
 
         /*
          * TX burst queue drain
          */
         diff_tsc = cur_tsc - prev_tsc;
         if (unlikely(diff_tsc > drain_tsc)) {
-            for (i = 0; i < qconf->nr_ports; ++i) {
-                portid = (uint8_t )qconf->port_id_list[i];
-                if (qconf->tx_mbufs[portid].len > 0) {
-                    send_burst(qconf,
-                               qconf->tx_mbufs[portid].len,
-                               portid);
-                    qconf->tx_mbufs[portid].len = 0;
-                }
-            }
-
+            drain_tx_mbufs(qconf);
+            if (qconf->kni_ring) sk_kni_flush_tx(qconf);
+            if (qconf->tcp_tbl) sk_tcp_expire(qconf);
             prev_tsc = cur_tsc;
         }
         /*
          * Read packet from RX queues
          */
+        poll_rx_queues(qconf, pkts_burst);
+    }
+}
+
+/*
+ * exception lcore: handles the exception queues, the packets punted to KNI
+ * by other lcores and the KNI devices.
+ * returns the number of packets handled.
+ */
+static inline unsigned
+exception_poll_once(lcore_conf_t *qconf, struct rte_mbuf **pkts_burst) {
+    uint8_t portid, queueid;
+    unsigned n = 0;
+
+    // without flow steering, the exception queues are tx only.
+    if (sk.flow_steering_on) n += poll_rx_queues(qconf, pkts_burst);
+    n += sk_kni_drain_rings(qconf);
+    for (int i = 0; i < qconf->nr_ports; i++) {
+        portid = (uint8_t )qconf->port_id_list[i];
+        queueid = (uint8_t )qconf->queue_id_list[portid];
+        n += sk_kni_process(qconf, portid, queueid, pkts_burst, MAX_PKT_BURST);
+    }
+    return n;
+}
+
+static void
+main_loop_exception(lcore_conf_t *qconf) {
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    uint64_t prev_tsc, diff_tsc, cur_tsc;
+    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) /
+        US_PER_S * BURST_TX_DRAIN_US;
+
+    prev_tsc = 0;
+    while (!sk.force_quit) {
+        cur_tsc = rte_rdtsc();
+        qconf->tsc = cur_tsc;
+
+        diff_tsc = cur_tsc - prev_tsc;
+        if (unlikely(diff_tsc > drain_tsc)) {
+            drain_tx_mbufs(qconf);
+            if (qconf->tcp_tbl) sk_tcp_expire(qconf);
+            prev_tsc = cur_tsc;
+        }
+        exception_poll_once(qconf, pkts_burst);
+    }
+}
+
+/*
+ * called by the timer of master lcore when master lcore is the exception lcore.
+ * the queues and rings are drained until they are empty, a tick of the timer
+ * is too long to handle only one burst.
+ */
+void
+sk_exception_poll(void) {
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    lcore_conf_t *qconf = sk.lcore_conf[rte_lcore_id()];
+
+    qconf->tsc = rte_rdtsc();
+    for (int i = 0; i < EXCEPTION_POLL_MAX_ROUNDS; ++i) {
+        if (exception_poll_once(qconf, pkts_burst) == 0) break;
+        drain_tx_mbufs(qconf);
+        qconf->tsc = rte_rdtsc();
+    }
+    drain_tx_mbufs(qconf);
+    if (qconf->tcp_tbl) sk_tcp_expire(qconf);
+}
+
+/*
+ * hash of the addresses and ports of the packet, used by I/O lcore when
+ * the NIC doesn't give the rss hash. fragments and the packets other than
+ * TCP/UDP are hashed by the addresses only, so all the fragments of a
+ * datagram go to the same worker.
+ */
+static inline uint32_t
+sw_flow_hash(struct rte_mbuf *m) {
+    struct ether_hdr *eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    struct vlan_hdr *vh = (struct vlan_hdr *)(eth_h + 1);
+    uint16_t ether_type = rte_be_to_cpu_16(eth_h->ether_type);
+    uint32_t off = sizeof(struct ether_hdr);
+    uint32_t hash = 0, ports;
+    uint8_t proto;
+    char *l3_h;
+
+    for (int i = 0; i < 2; ++i, ++vh) {
+        if (ether_type != ETHER_TYPE_VLAN && ether_type != ETHER_TYPE_QINQ) break;
+        if (off + sizeof(struct vlan_hdr) > m->data_len) return 0;
+        ether_type = rte_be_to_cpu_16(vh->eth_proto);
+        off += sizeof(struct vlan_hdr);
+    }
+    l3_h = rte_pktmbuf_mtod_offset(m, char *, off);
+    if (ether_type == ETHER_TYPE_IPv4) {
+        struct ipv4_hdr *ipv4_h = (struct ipv4_hdr *)l3_h;
+        if (off + sizeof(*ipv4_h) > m->data_len) return 0;
+        hash = rte_jhash_2words(ipv4_h->src_addr, ipv4_h->dst_addr, 0);
+        if (ipv4_h->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_MF_FLAG | IPV4_HDR_OFFSET_MASK))
+            return hash;
+        proto = ipv4_h->next_proto_id;
+        off += (uint32_t)(ipv4_h->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+    } else if (ether_type == ETHER_TYPE_IPv6) {
+        struct ipv6_hdr *ipv6_h = (struct ipv6_hdr *)l3_h;
+        if (off + sizeof(*ipv6_h) > m->data_len) return 0;
+        hash = rte_jhash(ipv6_h->src_addr, 32, 0);
+        proto = ipv6_h->proto;
+        off += sizeof(*ipv6_h);
+    } else {
+        return 0;
+    }
+    if ((proto != IPPROTO_TCP && proto != IPPROTO_UDP) || off + 4 > m->data_len)
+        return hash;
+    // the source and destination ports.
+    ports = *rte_pktmbuf_mtod_offset(m, uint32_t *, off);
+    return rte_jhash_1word(ports, hash);
+}
+
+/*
+ * pipeline mode, I/O lcore.
+ * distributes the received packets to workers according to the rss hash(or
+ * sw_flow_hash if the NIC doesn't give it),
+ * so packets of the same flow always go to the same worker, then transmits
+ * the responses returned by workers.
+ */
+static void
+main_loop_io(lcore_conf_t *qconf) {
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    struct rte_mbuf *m;
+    struct mbuf_table *buf;
+    struct ret_ring *rr;
+    uint16_t widx;
+    int i, j, nb_rx, nb_tx;
+    uint8_t portid, queueid;
+    uint64_t prev_tsc = 0, cur_tsc;
+    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) /
+        US_PER_S * BURST_TX_DRAIN_US;
+
+    while (!sk.force_quit) {
+        cur_tsc = rte_rdtsc();
+        if (unlikely(cur_tsc - prev_tsc > drain_tsc)) {
+            kick_lacp_ports(qconf);
+            prev_tsc = cur_tsc;
+        }
+        /*
+         * Read packet from RX queues and dispatch them to workers.
+         */
         for (i = 0; i < qconf->nr_ports; i++) {
 
             portid = (uint8_t )qconf->port_id_list[i];
             queueid = (uint8_t )qconf->queue_id_list[portid];
 
-            if (!sk.only_udp) {
-                sk_kni_process(qconf, portid, queueid, pkts_burst, MAX_PKT_BURST);
-            }
-
             nb_rx = rte_eth_rx_burst(portid, queueid, pkts_burst, MAX_PKT_BURST);
             if (nb_rx == 0)
                 continue;
             qconf->received_req += nb_rx;
-            // LOG_DEBUG(DPDK, "lcore %d recv port %d, queue %d, nb_rx: %d\n", qconf->lcore_id, portid, queueid, nb_rx);
 
-            handle_packets(nb_rx, pkts_burst, portid, qconf);
+            for (j = 0; j < nb_rx; ++j) {
+                m = pkts_burst[j];
+                if (likely(m->ol_flags & PKT_RX_RSS_HASH)) {
+                    widx = (uint16_t)(m->hash.rss % qconf->nr_rings);
+                } else {
+                    widx = (uint16_t)(sw_flow_hash(m) % qconf->nr_rings);
+                }
+                buf = &qconf->ring_bufs[widx];
+                buf->m_table[buf->len++] = m;
+            }
+            for (j = 0; j < qconf->nr_rings; ++j) {
+                buf = &qconf->ring_bufs[j];
+                if (buf->len == 0) continue;
+                nb_tx = rte_ring_sp_enqueue_burst(qconf->rings[j],
+                                                  (void **)buf->m_table,
+                                                  buf->len, NULL);
+                if (unlikely(nb_tx < buf->len)) {
+                    qconf->nr_dropped += buf->len - nb_tx;
+                    qconf->stats.drop[SK_DROP_RING_FULL] += buf->len - nb_tx;
+                    do {
+                        rte_pktmbuf_free(buf->m_table[nb_tx]);
+                    } while (++nb_tx < buf->len);
+                }
+                buf->len = 0;
+            }
+        }
+        /*
+         * transmit the responses of workers.
+         */
+        for (i = 0; i < qconf->nr_ret_rings; ++i) {
+            rr = &qconf->ret_rings[i];
+            nb_rx = rte_ring_sc_dequeue_burst(rr->ring, (void **)pkts_burst,
+                                              MAX_PKT_BURST, NULL);
+            if (nb_rx == 0)
+                continue;
+            queueid = (uint8_t )qconf->queue_id_list[rr->port_id];
+            nb_tx = rte_eth_tx_burst(rr->port_id, queueid, pkts_burst, (uint16_t)nb_rx);
+            if (unlikely(nb_tx < nb_rx)) {
+                qconf->stats.drop[SK_DROP_TX_FULL] += nb_rx - nb_tx;
+                do {
+                    rte_pktmbuf_free(pkts_burst[nb_tx]);
+                } while (++nb_tx < nb_rx);
+            }
         }
     }
+}
+
+/*
+ * pipeline mode, worker lcore.
+ * fetches packets from I/O lcores, the responses are sent back to
+ * I/O lcores by send_burst.
+ */
+static void
+main_loop_worker(lcore_conf_t *qconf) {
+    struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
+    uint64_t prev_tsc, diff_tsc, cur_tsc;
+    int i, j, nb_rx;
+    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) /
+        US_PER_S * BURST_TX_DRAIN_US;
+
+    prev_tsc = 0;
+    while (!sk.force_quit) {
+
+        cur_tsc = rte_rdtsc();
+        qconf->tsc = cur_tsc;
+
+        diff_tsc = cur_tsc - prev_tsc;
+        if (unlikely(diff_tsc > drain_tsc)) {
+            drain_tx_mbufs(qconf);
+            if (qconf->kni_ring) sk_kni_flush_tx(qconf);
+            if (qconf->tcp_tbl) sk_tcp_expire(qconf);
+            prev_tsc = cur_tsc;
+        }
+
+        for (i = 0; i < qconf->nr_rings; ++i) {
+            nb_rx = rte_ring_sc_dequeue_burst(qconf->rings[i], (void **)pkts_burst,
+                                              MAX_PKT_BURST, NULL);
+            if (nb_rx == 0)
+                continue;
+            qconf->dequeued_req += nb_rx;
+
+            rcu_read_lock();
+            for (j = 0; j < PREFETCH_OFFSET && j < nb_rx; j++)
+                rte_prefetch0(rte_pktmbuf_mtod(pkts_burst[j], void *));
+            for (j = 0; j < (nb_rx - PREFETCH_OFFSET); j++) {
+                rte_prefetch0(rte_pktmbuf_mtod(pkts_burst[
+                                                   j + PREFETCH_OFFSET], void *));
+                qconf->handlers[pkts_burst[j]->port](pkts_burst[j], pkts_burst[j]->port, qconf);
+            }
+            for (; j < nb_rx; j++)
+                qconf->handlers[pkts_burst[j]->port](pkts_burst[j], pkts_burst[j]->port, qconf);
+            rcu_read_unlock();
+            sk_lat_burst_done(qconf, nb_rx);
+        }
+    }
+}
+
+int
+launch_one_lcore(__attribute__((unused)) void *dummy)
+{
+    unsigned lcore_id = rte_lcore_id();
+    lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+    uint8_t portid, queueid;
+    int i;
+
+    rcu_register_thread();
+
+    init_per_lcore();
+
+    if ((int)lcore_id == sk.loadgen_lcore_id) {
+        LOG_INFO(DPDK, "entering loadgen loop on lcore %u.", lcore_id);
+        sk_loadgen_main_loop();
+        rcu_unregister_thread();
+        return 0;
+    }
+    if (qconf->nr_ports == 0) {
+        LOG_INFO(DPDK, "lcore %u has nothing to do.", lcore_id);
+        rcu_unregister_thread();
+        return 0;
+    }
+    if (sk.socket_io_on) {
+        LOG_INFO(DPDK, "entering socket loop on lcore %u.", lcore_id);
+        sk_main_loop_socket(qconf);
+        rcu_unregister_thread();
+        return 0;
+    }
+
+    switch (qconf->role) {
+    case LCORE_ROLE_WORKER:
+        LOG_INFO(DPDK, "entering worker loop on lcore %u, %d rings.",
+                 lcore_id, qconf->nr_rings);
+        main_loop_worker(qconf);
+        break;
+    case LCORE_ROLE_IO:
+    case LCORE_ROLE_EXCEPTION:
+    case LCORE_ROLE_RTC:
+    default:
+        LOG_INFO(DPDK, "entering %s loop on lcore %u.",
+                 qconf->role == LCORE_ROLE_IO? "I/O":
+                 qconf->role == LCORE_ROLE_EXCEPTION? "exception": "main", lcore_id);
+
+        for (i = 0; i < qconf->nr_ports; i++) {
+
+            portid = (uint8_t )qconf->port_id_list[i];
+            queueid = (uint8_t )qconf->queue_id_list[portid];
+            LOG_INFO(DPDK,
+                     " -- lcoreid=%u portid=%hhu rxqueueid=%hhu.",
+                     lcore_id, portid, queueid);
+        }
+        if (qconf->role == LCORE_ROLE_IO) {
+            main_loop_io(qconf);
+        } else if (qconf->role == LCORE_ROLE_EXCEPTION) {
+            main_loop_exception(qconf);
+        } else {
+            main_loop_rtc(qconf);
+        }
+        break;
+    }
 
     rcu_unregister_thread();
     return 0;
 }
 
+static void
+setup_exception_queue(uint8_t portid, port_info_t *pinfo,
+                      struct rte_eth_dev_info *dev_info) {
+    int ret;
+    uint16_t queueid = pinfo->exception_queue_id;
+    unsigned lcore_id = (unsigned)sk.exception_lcore_id;
+    uint8_t socketid = 0;
+
+    if (sk.numa_on)
+        socketid = (uint8_t)rte_lcore_to_socket_id(lcore_id);
+
+    LOG_INFO(DPDK, "exception queue=<< lcore:%u, port:%d, queue:%d, socket:%d >>",
+             lcore_id, portid, queueid, socketid);
+    ret = rte_eth_tx_queue_setup(portid, queueid, nb_txd,
+                                 socketid, &dev_info->default_txconf);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE,
+                 "rte_eth_tx_queue_setup: err=%d, "
+                 "port=%d\n", ret, portid);
+    if (!sk.flow_steering_on) return;
+    ret = rte_eth_rx_queue_setup(portid, queueid, nb_rxd,
+                                 socketid,
+                                 &dev_info->default_rxconf,
+                                 pktmbuf_pool[socketid]);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE,
+                 "rte_eth_rx_queue_setup: err=%d, port=%d\n",
+                 ret, portid);
+}
+
+/*
+ * keep the exception queue out of the rss redirection table, so
+ * even if the flow rules are not supported, the exception lcore only
+ * gets the packets sent to it explicitly.
+ */
+static int
+update_rss_reta(uint8_t portid, port_info_t *pinfo) {
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_rss_reta_entry64 reta_conf[ETH_RSS_RETA_SIZE_512/RTE_RETA_GROUP_SIZE];
+    uint16_t reta_size;
+
+    rte_eth_dev_info_get(portid, &dev_info);
+    reta_size = dev_info.reta_size;
+    if (reta_size == 0 || reta_size > ETH_RSS_RETA_SIZE_512) {
+        return ERR_CODE;
+    }
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (uint16_t i = 0; i < reta_size; ++i) {
+        reta_conf[i / RTE_RETA_GROUP_SIZE].mask = UINT64_MAX;
+        reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE] =
+            (uint16_t)(i % pinfo->nr_lcore);
+    }
+    if (rte_eth_dev_rss_reta_update(portid, reta_conf, reta_size) != 0) {
+        return ERR_CODE;
+    }
+    return OK_CODE;
+}
+
+/*
+ * create a flow rule which matches ETH[/VLAN]/<l3>/<l4 dst port> and append
+ * it to the flow list of the port.
+ */
+static int
+create_dns_flow(uint8_t portid, port_info_t *pinfo, bool vlan, enum rte_flow_item_type l3,
+                enum rte_flow_item_type l4, struct rte_flow_action *actions) {
+    struct rte_flow_attr attr;
+    struct rte_flow_item pattern[5];
+    struct rte_flow_item *item = pattern;
+    struct rte_flow_item_udp udp_spec, udp_mask;
+    struct rte_flow_item_tcp tcp_spec, tcp_mask;
+    struct rte_flow_error error;
+    struct rte_flow *flow;
+
+    memset(&attr, 0, sizeof(attr));
+    memset(pattern, 0, sizeof(pattern));
+    memset(&udp_spec, 0, sizeof(udp_spec));
+    memset(&udp_mask, 0, sizeof(udp_mask));
+    memset(&tcp_spec, 0, sizeof(tcp_spec));
+    memset(&tcp_mask, 0, sizeof(tcp_mask));
+
+    attr.ingress = 1;
+    attr.priority = 0;
+
+    (item++)->type = RTE_FLOW_ITEM_TYPE_ETH;
+    // any vlan id
+    if (vlan) (item++)->type = RTE_FLOW_ITEM_TYPE_VLAN;
+    (item++)->type = l3;
+    item->type = l4;
+    if (l4 == RTE_FLOW_ITEM_TYPE_UDP) {
+        udp_spec.hdr.dst_port = rte_cpu_to_be_16((uint16_t)sk.port);
+        udp_mask.hdr.dst_port = UINT16_MAX;
+        item->spec = &udp_spec;
+        item->mask = &udp_mask;
+    } else {
+        tcp_spec.hdr.dst_port = rte_cpu_to_be_16((uint16_t)sk.port);
+        tcp_mask.hdr.dst_port = UINT16_MAX;
+        item->spec = &tcp_spec;
+        item->mask = &tcp_mask;
+    }
+    (++item)->type = RTE_FLOW_ITEM_TYPE_END;
+
+    flow = rte_flow_create(portid, &attr, pattern, actions, &error);
+    if (flow == NULL) {
+        LOG_WARN(DPDK, "port %d: can't create %s%s %s flow rule: %s.", portid,
+                 vlan? "VLAN ": "",
+                 l3 == RTE_FLOW_ITEM_TYPE_IPV4? "IPv4": "IPv6",
+                 l4 == RTE_FLOW_ITEM_TYPE_UDP? "UDP": "TCP",
+                 error.message? error.message: "unknown error");
+        return ERR_CODE;
+    }
+    pinfo->flows[pinfo->nr_flows++] = flow;
+    return OK_CODE;
+}
+
+/*
+ * install the flow rules:
+ *   1. UDP(and TCP if tcp fast path is on) to the DNS port of every address
+ *      family the port serves, untagged or 802.1Q tagged(only if the port
+ *      has addresses in vlans) => rss among the queues of lcores.
+ *   2. everything else => exception queue.
+ * the destination address is checked by lcores, since a port may serve
+ * many addresses.
+ * if the NIC doesn't support them, the lcores classify the packets in
+ * software like before.
+ */
+static int
+setup_flow_steering(uint8_t portid, port_info_t *pinfo) {
+    struct rte_flow_attr attr;
+    struct rte_flow_item pattern[2];
+    struct rte_flow_action actions[2];
+    struct rte_flow_action_queue ex_queue;
+    struct rte_flow_action_rss *rss;
+    struct rte_flow_error error;
+    struct rte_flow *flow;
+    enum rte_flow_item_type l3_types[2];
+    int nr_l3 = 0;
+    int ret = OK_CODE;
+
+    if (pinfo->has_ipv4) l3_types[nr_l3++] = RTE_FLOW_ITEM_TYPE_IPV4;
+    if (pinfo->has_ipv6) l3_types[nr_l3++] = RTE_FLOW_ITEM_TYPE_IPV6;
+
+    rss = malloc(sizeof(*rss) + sizeof(uint16_t) * pinfo->nr_lcore);
+    if (rss == NULL) {
+        LOG_WARN(DPDK, "port %d: can't allocate the rss action of flow rules.", portid);
+        goto fallback;
+    }
+    // use the rss configuration of the port
+    rss->rss_conf = NULL;
+    rss->num = (uint16_t)pinfo->nr_lcore;
+    for (int i = 0; i < pinfo->nr_lcore; ++i) {
+        rss->queue[i] = (uint16_t)i;
+    }
+
+    memset(actions, 0, sizeof(actions));
+    actions[0].type = RTE_FLOW_ACTION_TYPE_RSS;
+    actions[0].conf = rss;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    for (int v = 0; v < (pinfo->has_vlan? 2: 1); ++v) {
+        for (int i = 0; i < nr_l3 && ret == OK_CODE; ++i) {
+            ret = create_dns_flow(portid, pinfo, v, l3_types[i], RTE_FLOW_ITEM_TYPE_UDP, actions);
+            // DNS over TCP is also handled by lcores when tcp fast path is on.
+            if (ret == OK_CODE && sk.tcp_fastpath_on) {
+                ret = create_dns_flow(portid, pinfo, v, l3_types[i], RTE_FLOW_ITEM_TYPE_TCP, actions);
+            }
+        }
+    }
+    free(rss);
+    if (ret != OK_CODE) goto fallback;
+
+    // everything else goes to exception queue.
+    memset(&attr, 0, sizeof(attr));
+    memset(pattern, 0, sizeof(pattern));
+    attr.ingress = 1;
+    attr.priority = 1;
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    pattern[1].type = RTE_FLOW_ITEM_TYPE_END;
+
+    ex_queue.index = pinfo->exception_queue_id;
+    actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+    actions[0].conf = &ex_queue;
+
+    flow = rte_flow_create(portid, &attr, pattern, actions, &error);
+    if (flow == NULL) {
+        LOG_WARN(DPDK, "port %d: can't create exception flow rule: %s.", portid,
+                 error.message? error.message: "unknown error");
+        goto fallback;
+    }
+    pinfo->flows[pinfo->nr_flows++] = flow;
+    pinfo->flow_steering = true;
+    LOG_INFO(DPDK, "port %d: flow steering enabled, exception queue %d.",
+             portid, pinfo->exception_queue_id);
+    return OK_CODE;
+
+fallback:
+    rte_flow_flush(portid, &error);
+    memset(pinfo->flows, 0, sizeof(pinfo->flows));
+    pinfo->nr_flows = 0;
+    pinfo->flow_steering = false;
+    LOG_WARN(DPDK, "port %d: fallback to software classification.", portid);
+    return ERR_CODE;
+}
+
+/*
+ * number of mbufs which can be held by the rings of pipeline mode.
+ */
+static unsigned
+pipeline_nb_mbuf(void) {
+    if (!sk.pipeline_on) return 0;
+    return (unsigned)(sk.nr_worker_lcores * (sk.nr_io_lcores + sk.nr_ports) *
+                      PIPELINE_RING_SIZE);
+}
+
+static struct rte_ring *
+create_pipeline_ring(const char *prefix, unsigned a, unsigned b, unsigned lcore_id) {
+    char name[RTE_RING_NAMESIZE];
+    struct rte_ring *r;
+    int socketid = 0;
+
+    if (sk.numa_on)
+        socketid = (int)rte_lcore_to_socket_id(lcore_id);
+    snprintf(name, sizeof(name), "%s_%u_%u", prefix, a, b);
+    r = rte_ring_create(name, PIPELINE_RING_SIZE, socketid,
+                        RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (r == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create ring %s: %s\n",
+                 name, rte_strerror(rte_errno));
+    return r;
+}
+
+/*
+ * create the rings between I/O lcores and workers.
+ * every (I/O lcore, worker) couple has a ring for the queries,
+ * every (worker, port) couple has a ring for the responses, it is
+ * drained by one of the I/O lcores which own a tx queue of that port.
+ */
+static void
+setup_pipeline_rings(void) {
+    lcore_conf_t *ioconf, *wconf;
+    port_info_t *pinfo;
+    int socketid;
+
+    for (int i = 0; i < sk.nr_io_lcores; ++i) {
+        ioconf = sk.lcore_conf[sk.io_lcore_ids[i]];
+        socketid = sk.numa_on? (int)rte_lcore_to_socket_id(ioconf->lcore_id): 0;
+        ioconf->nr_rings = (uint16_t)sk.nr_worker_lcores;
+        ioconf->rings = socket_calloc(socketid, (size_t)sk.nr_worker_lcores, sizeof(struct rte_ring *));
+        ioconf->ring_bufs = socket_calloc(socketid, (size_t)sk.nr_worker_lcores, sizeof(struct mbuf_table));
+        ioconf->ret_rings = socket_calloc(socketid, (size_t)(sk.nr_worker_lcores * sk.nr_ports),
+                                          sizeof(struct ret_ring));
+        ioconf->nr_ret_rings = 0;
+    }
+
+    for (int i = 0; i < sk.nr_worker_lcores; ++i) {
+        wconf = sk.lcore_conf[sk.worker_lcore_ids[i]];
+        socketid = sk.numa_on? (int)rte_lcore_to_socket_id(wconf->lcore_id): 0;
+        wconf->nr_rings = (uint16_t)sk.nr_io_lcores;
+        wconf->rings = socket_calloc(socketid, (size_t)sk.nr_io_lcores, sizeof(struct rte_ring *));
+        for (int j = 0; j < sk.nr_io_lcores; ++j) {
+            ioconf = sk.lcore_conf[sk.io_lcore_ids[j]];
+            wconf->rings[j] = create_pipeline_ring("pl_rx", ioconf->lcore_id,
+                                                   wconf->lcore_id, wconf->lcore_id);
+            ioconf->rings[i] = wconf->rings[j];
+        }
+
+        // a worker can send responses to every port
+        wconf->nr_ports = 0;
+        for (int j = 0; j < sk.nr_ports; ++j) {
+            uint8_t portid = (uint8_t)sk.port_ids[j];
+            pinfo = sk.port_info[portid];
+            ioconf = sk.lcore_conf[pinfo->lcore_list[i % pinfo->nr_lcore]];
+
+            wconf->port_id_list[wconf->nr_ports++] = portid;
+            wconf->tx_rings[portid] = create_pipeline_ring("pl_tx", wconf->lcore_id,
+                                                           portid, ioconf->lcore_id);
+            ioconf->ret_rings[ioconf->nr_ret_rings].ring = wconf->tx_rings[portid];
+            ioconf->ret_rings[ioconf->nr_ret_rings].port_id = portid;
+            ioconf->nr_ret_rings++;
+            LOG_INFO(DPDK, "pipeline: worker %u port %d => I/O lcore %u.",
+                     wconf->lcore_id, portid, ioconf->lcore_id);
+        }
+    }
+}
+
 void
 init_dpdk_eal() {
     int ret;
@@ -914,7 +2176,7 @@ init_dpdk_eal() {
     snprintf(master_lcore_cmd, 128, "--master-lcore=%d", sk.master_lcore_id);
     snprintf(log_cmd, 128, "--log-level=%d", log_level);
     /* initialize the rte env first*/
-    char *argv[] = {
+    char *argv[16 + CONFIG_VDEV_MAX * 2] = {
             "",
             "-l",
             sk.total_lcore_list,
@@ -923,9 +2185,24 @@ init_dpdk_eal() {
             master_lcore_cmd,
             log_cmd,
             "--proc-type=auto",
-            "--"
     };
-    const int argc = 9;
+    int argc = 8;
+    // socket I/O backend doesn't need any NIC.
+    if (sk.socket_io_on || !sk.pci_on) {
+        argv[argc++] = "--no-pci";
+    }
+    // nor hugepages, the heaps of rte_malloc come from anonymous memory.
+    if (sk.socket_io_on) {
+        argv[argc++] = "--no-huge";
+        argv[argc++] = "-m";
+        argv[argc++] = SK_SOCK_IO_MEM_MB;
+    }
+    // virtual devices get the port ids after the physical ports.
+    for (int i = 0; i < sk.vdevs_count; ++i) {
+        argv[argc++] = "--vdev";
+        argv[argc++] = sk.vdevs[i];
+    }
+    argv[argc++] = "--";
     /*
      * reset optind, because rte_eal_init uses getopt.
      */
@@ -946,8 +2223,14 @@ void prepare_eth_port_conf(struct rte_eth_conf *port_conf,
                            port_info_t *pinfo) {
     memset(port_conf, 0, sizeof(*port_conf));
 
-    port_conf->rxmode.mq_mode = ETH_MQ_RX_RSS;
-    port_conf->rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK;
+    // virtual devices(null, ring, pcap...) usually don't support RSS.
+    if (dev_info->flow_type_rss_offloads & ETH_RSS_PROTO_MASK) {
+        port_conf->rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf->rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK & dev_info->flow_type_rss_offloads;
+    } else {
+        LOG_INFO(DPDK, "PORT %d doesn't support RSS.", pinfo->port_id);
+        port_conf->rxmode.mq_mode = ETH_MQ_RX_NONE;
+    }
     /* setting the rss key */
     // static const uint8_t key[] = {
     //     0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, /* 10 */
@@ -986,6 +2269,16 @@ void prepare_eth_port_conf(struct rte_eth_conf *port_conf,
         pinfo->hw_features.tx_csum_ip = 1;
     }
 
+    if ((dev_info->tx_offload_capa & DEV_TX_OFFLOAD_VLAN_INSERT)) {
+        LOG_INFO(DPDK, "PORT %d TX vlan insert offload supported", pinfo->port_id);
+        pinfo->hw_features.tx_vlan_insert = 1;
+    }
+
+    if ((dev_info->tx_offload_capa & DEV_TX_OFFLOAD_QINQ_INSERT)) {
+        LOG_INFO(DPDK, "PORT %d TX QinQ insert offload supported", pinfo->port_id);
+        pinfo->hw_features.tx_qinq_insert = 1;
+    }
+
     if ((dev_info->tx_offload_capa & DEV_TX_OFFLOAD_UDP_CKSUM) &&
         (dev_info->tx_offload_capa & DEV_TX_OFFLOAD_TCP_CKSUM)) {
         LOG_INFO(DPDK, "PORT %d TX TCP&UDP checksum offload supported", pinfo->port_id);
@@ -996,6 +2289,9 @@ void prepare_eth_port_conf(struct rte_eth_conf *port_conf,
 void prepare_eth_rx_tx_conf(struct rte_eth_dev_info *dev_info) {
     dev_info->default_txconf.txq_flags = ETH_TXQ_FLAGS_NOMULTMEMP |
                                         ETH_TXQ_FLAGS_NOREFCOUNT;
+    // zero copy answers are indirect mbufs from another pool.
+    if (sk.zerocopy_min_size > 0)
+        dev_info->default_txconf.txq_flags = 0;
 
     /* Disable features that are not supported by port's HW */
     if (!(dev_info->tx_offload_capa & DEV_TX_OFFLOAD_UDP_CKSUM)) {
@@ -1033,12 +2329,22 @@ init_dpdk_module() {
             rte_exit(EXIT_FAILURE, "Invalid packet length\n");
         }
     }
+    // bonds get their port ids here, so count the ports after creating them.
+    sk_create_bonds();
+    // the loadgen port follows the bonds.
+    if (sk.loadgen_lcore_id >= 0) sk_create_loadgen_port();
     nb_dev_ports = rte_eth_dev_count();
 
     nb_lcores = rte_lcore_count();
     LOG_INFO(DPDK, "found %d cores, master cores: %d, %d",
              nb_lcores, rte_get_master_lcore(), rte_lcore_id());
 
+    // the socket backend has no port to initialize.
+    if (sk.socket_io_on) {
+        sk_init_socket_io();
+        goto end;
+    }
+
 
     /* initialize all ports */
     for (int i = 0; i < sk.nr_ports; i++) {
@@ -1059,6 +2365,11 @@ init_dpdk_module() {
          */
         nb_rx_queue = (uint8_t )pinfo->nr_lcore;
         nb_tx_queue = (uint32_t )(pinfo->nr_lcore);
+        if (sk.exception_queue_on) {
+            // the exception queue only receives packets when flow steering is on.
+            if (sk.flow_steering_on) nb_rx_queue++;
+            nb_tx_queue++;
+        }
 
         if (nb_rx_queue > dev_info.max_rx_queues) {
             rte_exit(EXIT_FAILURE,
@@ -1083,6 +2394,12 @@ init_dpdk_module() {
                      "Cannot configure device: err=%d, port=%d\n",
                      ret, portid);
 
+        if (sk.jumbo_on) {
+            pinfo->mtu = (uint16_t)(sk.max_pkt_len - ETHER_HDR_LEN - ETHER_CRC_LEN);
+        } else if (rte_eth_dev_get_mtu(portid, &pinfo->mtu) != 0) {
+            pinfo->mtu = ETHER_MTU;
+        }
+
         rte_eth_macaddr_get(portid, &sk.port_info[portid]->eth_addr);
         ether_format_addr(sk.port_info[portid]->eth_addr_s,
                           ETHER_ADDR_FMT_SIZE,
@@ -1090,6 +2407,10 @@ init_dpdk_module() {
         LOG_INFO(DPDK, "port %d mac address: %s.", portid,
                  sk.port_info[portid]->eth_addr_s);
 
+        pinfo->addr_tbl = sk_addr_table_create(pinfo->addrs, pinfo->nr_addrs);
+        if (pinfo->addr_tbl == NULL)
+            rte_exit(EXIT_FAILURE, "can't create address table for port %d.\n", portid);
+
         /* init memory */
         unsigned nb_mbuf = RTE_MAX(
             (nb_dev_ports*nb_rx_queue*RTE_TEST_RX_DESC_DEFAULT +
@@ -1097,7 +2418,9 @@ init_dpdk_module() {
              nb_dev_ports*nb_tx_queue*RTE_TEST_TX_DESC_DEFAULT +
              nb_lcores*MEMPOOL_CACHE_SIZE  +
              nb_dev_ports*KNI_MBUF_MAX     +
-             nb_dev_ports*KNI_QUEUE_SIZE),
+             nb_dev_ports*KNI_QUEUE_SIZE   +
+             nb_lcores*KNI_RING_SIZE       +
+             pipeline_nb_mbuf()),
             (unsigned)8192);
         ret = init_mem(nb_mbuf);
 
@@ -1105,11 +2428,11 @@ init_dpdk_module() {
             rte_exit(EXIT_FAILURE, "init_mem failed\n");
 
         /* init one RX, TX queue per couple (lcore,port) */
-        for (int i = 0; i < sk.nr_lcore_ids; ++i) {
-            lcore_id = (unsigned )sk.lcore_ids[i];
-            qconf = &sk.lcore_conf[lcore_id];
+        for (int i = 0; i < pinfo->nr_lcore; ++i) {
+            lcore_id = (unsigned )pinfo->lcore_list[i];
+            qconf = sk.lcore_conf[lcore_id];
             queueid = qconf->queue_id_list[portid];
-            if (lcore_id == rte_get_master_lcore()) continue;
+            assert(lcore_id != rte_get_master_lcore());
             assert(rte_lcore_is_enabled(lcore_id));
 
             if (sk.numa_on)
@@ -1141,16 +2464,27 @@ init_dpdk_module() {
                          "rte_eth_rx_queue_setup: err=%d, port=%d\n",
                          ret, portid);
         }
+        if (sk.exception_queue_on) {
+            setup_exception_queue(portid, pinfo, &dev_info);
+        }
     }
 
 
+    setup_resp_bufs();
 #ifdef IP_FRAG
     setup_ip_frag_tbl();
 #endif
+    if (sk.pipeline_on) {
+        setup_pipeline_rings();
+    }
+    if (sk.tcp_fastpath_on && !sk.only_udp) {
+        if (sk_init_tcp_module() != OK_CODE)
+            rte_exit(EXIT_FAILURE, "can't init tcp fast path.\n");
+    }
 
     /* start ports */
     for (portid = 0; portid < nb_dev_ports; portid++) {
-        if ((sk.portmask & (1 << portid)) == 0) {
+        if (!SK_PORT_IN_MASK(portid)) {
             continue;
         }
         /* Start device */
@@ -1168,10 +2502,24 @@ init_dpdk_module() {
          */
         if (sk.promiscuous_on)
             rte_eth_promiscuous_enable(portid);
+        /* neighbor solicitations are sent to solicited-node multicast address */
+        if (sk.port_info[portid]->has_ipv6)
+            rte_eth_allmulticast_enable(portid);
+
+        if (sk.exception_queue_on && sk.flow_steering_on) {
+            if (update_rss_reta(portid, sk.port_info[portid]) != OK_CODE) {
+                LOG_WARN(DPDK, "port %d: can't update rss reta, exception queue may receive DNS queries.", portid);
+            }
+            setup_flow_steering(portid, sk.port_info[portid]);
+        }
     }
 
+    // the supported packet types are known after the ports are started.
+    setup_packet_handlers();
+
     check_all_ports_link_status((uint8_t)nb_dev_ports, (uint32_t )sk.portmask);
 
+end:
     rte_timer_subsystem_init();
     sk.hz = rte_get_timer_hz();
 
@@ -1180,6 +2528,60 @@ init_dpdk_module() {
     return 0;
 }
 
+/*
+ * offline replay(see replay.c) feeds the packets in a pcap to the packet
+ * handler of the first port on master lcore, no port is started and the
+ * responses are left in the tx buffer of master lcore.
+ * return the id of the port.
+ */
+int
+init_replay_module(void) {
+    lcore_conf_t *qconf = sk.lcore_conf[rte_lcore_id()];
+    port_info_t *pinfo, *p;
+    sk_addr_t *addrs;
+    uint8_t portid;
+    int nr_addrs = 0;
+
+    if (sk.nr_ports == 0)
+        rte_exit(EXIT_FAILURE, "replay needs at least one port in config.\n");
+    portid = (uint8_t)sk.port_ids[0];
+    pinfo = sk.port_info[portid];
+
+    // the pcap may contain the queries to the addresses of all the ports.
+    for (int i = 0; i < sk.nr_ports; ++i)
+        nr_addrs += sk.port_info[sk.port_ids[i]]->nr_addrs;
+    addrs = calloc((size_t)RTE_MAX(nr_addrs, 1), sizeof(*addrs));
+    nr_addrs = 0;
+    for (int i = 0; i < sk.nr_ports; ++i) {
+        p = sk.port_info[sk.port_ids[i]];
+        memcpy(addrs + nr_addrs, p->addrs, p->nr_addrs * sizeof(*addrs));
+        nr_addrs += p->nr_addrs;
+    }
+    pinfo->addr_tbl = sk_addr_table_create(addrs, nr_addrs);
+    free(addrs);
+    if (pinfo->addr_tbl == NULL)
+        rte_exit(EXIT_FAILURE, "can't create address table for replay.\n");
+
+    if (init_mem(8192) < 0)
+        rte_exit(EXIT_FAILURE, "init_mem failed\n");
+    setup_resp_bufs();
+#ifdef IP_FRAG
+    setup_ip_frag_tbl();
+#endif
+    // no offload, the checksums are verified and computed by software.
+    memset(&pinfo->hw_features, 0, sizeof(pinfo->hw_features));
+    pinfo->mtu = ETHER_MTU;
+    qconf->nr_ports = 1;
+    qconf->port_id_list[0] = portid;
+    qconf->handlers[portid] = select_packet_handler(pinfo);
+
+    rte_timer_subsystem_init();
+    sk.hz = rte_get_timer_hz();
+
+    init_per_lcore();
+    return portid;
+}
+
 int start_dpdk_threads(void) {
     int ret = 0;
     for (int i = 0; i < sk.nr_lcore_ids; i++) {
@@ -1201,17 +2603,31 @@ int cleanup_dpdk_module(void) {
 
     rte_eal_mp_wait_lcore();
 
+    if (sk.socket_io_on) {
+        sk_cleanup_socket_io();
+        return 0;
+    }
+
     nb_ports = rte_eth_dev_count();
 
     /* stop ports */
     for (portid = 0; portid < nb_ports; portid++) {
-        if ((sk.portmask & (1 << portid)) == 0)
+        if (!SK_PORT_IN_MASK(portid))
             continue;
         LOG_INFO(DPDK, "Closing port %d...", portid);
+        if (sk.port_info[portid] && sk.port_info[portid]->flow_steering) {
+            struct rte_flow_error error;
+            rte_flow_flush(portid, &error);
+        }
         rte_eth_dev_stop(portid);
         rte_eth_dev_close(portid);
         LOG_INFO(DPDK, "port %d Done.", portid);
+        if (sk.port_info[portid]) {
+            sk_addr_table_destroy(sk.port_info[portid]->addr_tbl);
+            sk.port_info[portid]->addr_tbl = NULL;
+        }
     }
+    sk_destroy_bonds();
     return 0;
 }
 
@@ -1228,7 +2644,7 @@ init_kni_module(void) {
  */
 uint64_t rte_tsc_ustime() {
     unsigned lcore_id = rte_lcore_id();
-    lcore_conf_t *qconf = &sk.lcore_conf[lcore_id];
+    lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
     const uint64_t cur_tsc = rte_rdtsc();
     return qconf->start_us + (cur_tsc - qconf->start_tsc)*US_PER_S/qconf->tsc_hz;
 }
@@ -1241,7 +2657,7 @@ uint64_t rte_tsc_time() {
     return rte_tsc_ustime()/US_PER_S;
 }
 
-#ifdef SK_TEST
+#if defined(SK_TEST) || defined(SK_BENCH)
 /*
  * init dpdk eal, mainly for test
  */
@@ -1256,7 +2672,7 @@ void initTestDpdkEal() {
             "4",
             "--"
     };
-    const int argc = 9;
+    const int argc = RTE_DIM(argv);
     /*
      * reset optind, because rte_eal_init uses getopt.
      */
@@ -41,24 +41,91 @@
 #include <rte_cpuflags.h>
 #include <rte_timer.h>
 #include <rte_kni.h>
+#include <rte_ring.h>
+#include <rte_flow.h>
+#include <rte_jhash.h>
 
 #ifdef IP_FRAG
 #include <rte_ip_frag.h>
 #endif
 
+#include "ds.h"
+#include "latency.h"
+#include "stats.h"
+
 #define MAX_PKT_BURST     32
 #define BURST_TX_DRAIN_US 100 /* TX drain every ~100us */
 
 
+/* size of the rings between I/O lcores and worker lcores in pipeline mode */
+#define PIPELINE_RING_SIZE 1024
+/* size of the rings from lcores to exception lcore(packets punted to KNI) */
+#define KNI_RING_SIZE 1024
+/* max number of flow rules installed on a port by flow steering */
+#define SK_MAX_FLOWS 16
+/* size of the per-lcore buffer used to build responses bigger than one mbuf */
+#define SK_RESP_BUF_SIZE  UINT16_MAX
+/* max number of bonds and members of a bond */
+#define SK_MAX_BONDS         8
+#define SK_MAX_BOND_MEMBERS  8
+/* max number of sockets of an lcore in socket I/O backend */
+#define SK_MAX_SOCKS         64
+/* memory(MB) of EAL in socket I/O backend, which runs without hugepages */
+#define SK_SOCK_IO_MEM_MB    "512"
+
 struct mbuf_table {
     uint16_t len;
+    // TSC when the first packet was buffered, 0 if unknown.
+    uint64_t tsc;
     struct rte_mbuf *m_table[MAX_PKT_BURST];
 };
 
 struct numaNode_s;
+struct tcp_table;
+struct sk_sock;
+struct sk_qlog_ring;
+struct sk_cap_ring;
+struct sk_topk;
+struct lcore_conf;
+
+// per-packet handler, specialized for the capabilities of a port.
+typedef void (*sk_pkt_handler_t)(struct rte_mbuf *m, uint8_t portid, struct lcore_conf *qconf);
+
+/*
+ * in run-to-completion mode every lcore owns a rx/tx queue per port and
+ * processes the packets itself.
+ * in pipeline mode, I/O lcores own the NIC queues and distribute packets
+ * to worker lcores through rings, workers send responses back to I/O lcores.
+ */
+enum lcore_role {
+    LCORE_ROLE_RTC = 0,
+    LCORE_ROLE_IO,
+    LCORE_ROLE_WORKER,
+    // owns the exception queues, handles ARP/TCP/KNI traffic.
+    LCORE_ROLE_EXCEPTION,
+};
+
+// a ring from which an I/O lcore fetches responses of a worker for one port
+struct ret_ring {
+    struct rte_ring *ring;
+    uint16_t port_id;
+};
 
 typedef struct lcore_conf {
+    /*
+     * the structure is allocated on the socket of the lcore, fields are
+     * grouped by access pattern so the lines written in the packet loop
+     * don't hold the read mostly fields.
+     */
+
+    /* read mostly, set at init */
     uint16_t lcore_id;
+    uint8_t role;
+    struct numaNode_s *node;
+    // used to implement time function
+    uint64_t tsc_hz;
+    uint64_t start_tsc;
+    uint64_t start_us;
 
     /*
      * one port one rx queue and one tx queue
@@ -67,33 +134,118 @@ typedef struct lcore_conf {
     uint16_t nr_ports;
     uint16_t port_id_list[RTE_MAX_ETHPORTS];
     uint16_t queue_id_list[RTE_MAX_ETHPORTS];
+    // packet handler of every port, chosen at init.
+    sk_pkt_handler_t handlers[RTE_MAX_ETHPORTS];
 
-    struct mbuf_table tx_mbufs[RTE_MAX_ETHPORTS];
-    struct mbuf_table kni_tx_mbufs[RTE_MAX_ETHPORTS];
+    /*
+     * pipeline mode.
+     * I/O lcore: rings[i] sends packets to i-th worker, ret_rings contains the
+     *            rings it should drain and transmit.
+     * worker lcore: rings[i] receives packets from i-th I/O lcore,
+     *               tx_rings[portid] returns responses to an I/O lcore.
+     */
+    uint16_t nr_rings;
+    struct rte_ring **rings;
+    struct mbuf_table *ring_bufs;
+    uint16_t nr_ret_rings;
+    struct ret_ring *ret_rings;
+    struct rte_ring *tx_rings[RTE_MAX_ETHPORTS];
 
-    struct numaNode_s *node;
+    /*
+     * exception path.
+     * exception lcore: kni_rings contains the rings of all the other lcores.
+     * other lcores: kni_ring is used to send packets to exception lcore.
+     */
+    struct rte_ring *kni_ring;
+    uint16_t nr_kni_rings;
+    struct rte_ring **kni_rings;
+
+    // connection table of tcp fast path.
+    struct tcp_table *tcp_tbl;
+    // responses that don't fit in the query mbuf are built here and
+    // copied to a chain of mbufs.
+    char *resp_buf;
+    // sockets of socket I/O backend.
+    struct sk_sock *socks;
+    int nr_socks;
+    // query log records produced by this lcore.
+    struct sk_qlog_ring *qlog_ring;
+    // packets captured by this lcore.
+    struct sk_cap_ring *cap_ring;
+    // heavy hitter sketches updated by this lcore.
+    struct sk_topk *topk;
+
+    /* statistics, written by this lcore, read by master */
+    int64_t nr_req __rte_cache_aligned;   // number of processed requests
+    int64_t nr_dropped;
+    // DNS packets whose destination isn't a service address.
+    int64_t nr_bad_dst;
+    // packets received from NIC, only counted by the lcores owning rx queues.
+    int64_t received_req;
+    // packets fetched from the rings of I/O lcores by a worker.
+    int64_t dequeued_req;
+    sk_query_stats_t stats __rte_cache_aligned;
+
+    /* written for every packet */
+    // TSC of the start of the current rx burst.
+    uint64_t tsc __rte_cache_aligned;
     uint16_t ipv4_packet_id;
-    // used to implement time function
-    uint64_t tsc_hz;
-    uint64_t start_tsc;
-    uint64_t start_us;
+    struct mbuf_table tx_mbufs[RTE_MAX_ETHPORTS];
+    struct mbuf_table kni_tx_mbufs[RTE_MAX_ETHPORTS];
 
 #ifdef IP_FRAG
     struct rte_ip_frag_tbl *frag_tbl;
     struct rte_ip_frag_death_row death_row;
 #endif
 
-    // statistics
-    int64_t nr_req;                   // number of processed requests
-    int64_t nr_dropped;
-
-    int64_t received_req;
+    /* latency histograms, written by this lcore, read by master */
+    sk_lat_hist_t lat_rx __rte_cache_aligned;
+    sk_lat_hist_t lat_tx;
 } __rte_cache_aligned lcore_conf_t;
 
+/*
+ * vlan key of a packet or an address, 0 means untagged.
+ * for QinQ, the outer vlan id is in the high 16 bits.
+ */
+#define SK_VLAN_KEY(outer, inner) (((uint32_t)(outer) << 16) | (inner))
+#define SK_VLAN_OUTER(key) ((uint16_t)((key) >> 16))
+#define SK_VLAN_INNER(key) ((uint16_t)((key) & 0xFFFF))
+
+/*
+ * an address served by a port, the address is in network order,
+ * ipv4 address only uses the first 4 bytes.
+ */
+typedef struct sk_addr {
+    uint8_t family;          // AF_INET or AF_INET6, 0 means empty slot
+    // service id, the same address on different ports has the same id,
+    // the query path can use it to select per-address behavior.
+    uint16_t svc_id;
+    uint32_t vlan;           // vlan key, see SK_VLAN_KEY
+    uint8_t addr[16];
+} sk_addr_t;
+
+/*
+ * a small open addressing hash table used by lcores to check the
+ * destination address of packets, its size is a power of 2 and at least
+ * twice the number of addresses, so lookup always meets an empty slot.
+ * the table is never modified after creation, when addresses are added at
+ * runtime a new table is published with RCU, so lcores must look up it
+ * in RCU read-side critical section.
+ */
+typedef struct sk_addr_table {
+    uint32_t mask;
+    uint32_t nr_addrs;
+    sk_addr_t slots[];
+} sk_addr_table_t;
+
 struct hw_features {
     uint8_t rx_csum;
     uint8_t tx_csum_ip;
     uint8_t tx_csum_l4;
+    uint8_t tx_vlan_insert;
+    uint8_t tx_qinq_insert;
+    // L2/L3 packet type of untagged ip frames is reported.
+    uint8_t rx_ptype;
 };
 
 typedef struct port_info {
@@ -106,34 +258,186 @@ typedef struct port_info {
     int nr_lcore;
     int *lcore_list;
 
+    // all the addresses of this port in configuration order,
+    // only accessed by master thread.
+    sk_addr_t *addrs;
+    int nr_addrs;
+    // RCU protected.
+    sk_addr_table_t *addr_tbl;
+    // true if some addresses are in vlans.
+    bool has_vlan;
+    // the first ipv4 and ipv6 address, they are configured to KNI interface.
+    bool has_ipv4;
+    bool has_ipv6;
     uint32_t ipv4_addr;
+    uint8_t ipv6_addr[16];
+    // ip mtu, udp responses never exceed it unless IP_FRAG is defined.
+    uint16_t mtu;
+    // a bond in lacp mode(see kick_lacp_ports).
+    bool lacp;
     struct hw_features hw_features;
+
+    /*
+     * the exception queue receives all the traffic except DNS queries over
+     * UDP, its id is nr_lcore. flow_steering is true only when the flow
+     * rules are installed successfully, otherwise the lcores still punt
+     * non-DNS packets to KNI by themselves.
+     */
+    uint16_t exception_queue_id;
+    bool flow_steering;
+    struct rte_flow *flows[SK_MAX_FLOWS];
+    int nr_flows;
 } __rte_cache_aligned port_info_t;
 
+/*
+ * a bonded port(see dpdk_bond.c), port_id is assigned when the bond is created.
+ */
+typedef struct sk_bond {
+    char name[32];
+    uint8_t mode;            // BONDING_MODE_8023AD or BONDING_MODE_BALANCE
+    uint8_t xmit_policy;
+    uint8_t port_id;
+    int nr_members;
+    uint8_t members[SK_MAX_BOND_MEMBERS];
+} sk_bond_t;
+
 void init_dpdk_eal();
 int init_dpdk_module(void);
+int init_replay_module(void);
+sk_pkt_handler_t sk_packet_handler(bool hw_csum, bool ptype);
 int start_dpdk_threads(void);
 int cleanup_dpdk_module(void);
+void sk_exception_poll(void);
+int sk_send_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t port);
+int sk_vlan_insert(struct rte_mbuf *m);
+
+/*----------------------------------------------
+ *     service addresses
+ *---------------------------------------------*/
+int sk_addr_parse(sk_addr_t *a, const char *s);
+const char *sk_addr_ntop(const sk_addr_t *a, char *buf, size_t size);
+int sk_addr_format(const sk_addr_t *a, char *buf, size_t size);
+sk_addr_table_t *sk_addr_table_create(const sk_addr_t *addrs, int n);
+void sk_addr_table_destroy(sk_addr_table_t *tbl);
+int sk_port_append_addr(port_info_t *pinfo, sk_addr_t *a);
+int sk_port_add_addr(uint8_t portid, sk_addr_t *a);
+
+static inline uint32_t
+sk_addr_hash(uint8_t family, uint32_t vlan, const void *addr) {
+    if (family == AF_INET)
+        return rte_jhash_2words(*(const uint32_t *)addr, vlan, AF_INET);
+    return rte_jhash_32b((const uint32_t *)addr, 4, vlan ^ AF_INET6);
+}
+
+/*
+ * return the entry of `addr` in `vlan` if it is in the table,
+ * otherwise return NULL.
+ */
+static inline const sk_addr_t *
+sk_addr_lookup(const sk_addr_table_t *tbl, uint8_t family, uint32_t vlan, const void *addr) {
+    size_t len = (family == AF_INET)? 4: 16;
+    uint32_t idx = sk_addr_hash(family, vlan, addr) & tbl->mask;
+    const sk_addr_t *a;
+
+    for (;;) {
+        a = &tbl->slots[idx];
+        if (a->family == 0) return NULL;
+        if (a->family == family && a->vlan == vlan && memcmp(a->addr, addr, len) == 0)
+            return a;
+        idx = (idx + 1) & tbl->mask;
+    }
+}
 
 uint64_t rte_tsc_ustime();
 uint64_t rte_tsc_mstime();
 uint64_t rte_tsc_time();
 
+/*----------------------------------------------
+ *     bonds
+ *---------------------------------------------*/
+int sk_bond_conf_parse(char *errstr, int argc, char *argv[], void *privdata);
+const char *sk_bond_mode_str(int mode);
+bool sk_port_is_bond_member(int portid);
+void sk_create_bonds(void);
+void sk_destroy_bonds(void);
+sds sk_bond_member_info(sds s, sk_bond_t *b, uint8_t member);
+
+/*----------------------------------------------
+ *     offline pcap replay
+ *---------------------------------------------*/
+int sk_replay_pcap(const char *in, const char *out, uint8_t portid, bool all_handlers);
+
+/*----------------------------------------------
+ *     load generator
+ *---------------------------------------------*/
+// latency histogram of load generator, 1 microsecond per bucket.
+#define SK_LOADGEN_HIST_SIZE   10000
+// the client addresses are in 198.18.0.0/15.
+#define SK_LOADGEN_MAX_CLIENTS (1 << 17)
+
+typedef struct {
+    bool running;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t ok;
+    uint64_t bad_rcode;
+    uint64_t bad_answer;
+    uint64_t lost;
+    double qps;
+    uint64_t hist[SK_LOADGEN_HIST_SIZE];
+} sk_loadgen_stats_t;
+
+extern sk_loadgen_stats_t sk_loadgen_stats;
+
+void sk_create_loadgen_port(void);
+void sk_loadgen_main_loop(void);
+uint64_t sk_loadgen_percentile(double pct);
+sds sk_loadgen_info(sds s);
+
+/*----------------------------------------------
+ *     zero copy answers
+ *---------------------------------------------*/
+void sk_zc_render(RRSet *rs);
+
 /*----------------------------------------------
  *     kni
  *---------------------------------------------*/
+bool sk_exception_path_valid(const char *name);
 void sk_init_kni_module(struct rte_mempool *mbuf_pool);
 void init_kni_module(void);
 int cleanup_kni_module();
 int kni_ifconfig_all();
+int kni_ifconfig_addr(int portid, int idx);
 
 int kni_send_single_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t port);
 
-void
+unsigned
 sk_kni_process(lcore_conf_t *qconf, uint8_t port_id, uint16_t queue_id, struct rte_mbuf **pkts_burst, unsigned count);
+void sk_kni_flush_tx(lcore_conf_t *qconf);
+unsigned sk_kni_drain_rings(lcore_conf_t *qconf);
 
-#ifdef SK_TEST
+/*----------------------------------------------
+ *     socket I/O backend
+ *---------------------------------------------*/
+void sk_init_socket_io(void);
+void sk_cleanup_socket_io(void);
+void sk_main_loop_socket(lcore_conf_t *qconf);
+
+/*----------------------------------------------
+ *     tcp fast path
+ *---------------------------------------------*/
+int sk_init_tcp_module(void);
+void sk_tcp_handle_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t portid, bool is_ipv4,
+                          int svc_id);
+void sk_tcp_expire(lcore_conf_t *qconf);
+
+#if defined(SK_TEST) || defined(SK_BENCH)
 void initTestDpdkEal();
 #endif
 
+#if defined(SK_TEST)
+int tcpTest(int argc, char *argv[]);
+int addrTest(int argc, char *argv[]);
+#endif
+
 #endif  /* __DPDK_MODULE_H__ */
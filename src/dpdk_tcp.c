@@ -0,0 +1,826 @@
+//
+// a minimal userspace tcp implementation used to serve DNS over TCP
+// in dpdk lcores.
+//
+// * SYN is answered with a SYN cookie, so no state is kept before the
+//   client sends the first query.
+// * TCP fast open is supported, the query carried by SYN is answered
+//   immediately if the cookie is valid.
+// * every query must be contained in one segment. the responses are split
+//   into segments of the client's mss, they must fit in the window the
+//   client advertised, otherwise the connection is reset.
+// * responses are never buffered, if the client retransmits the last
+//   segment, the response will be generated again. when the responses
+//   take several segments, the ACK of the query is held until the client
+//   acks all of them, so a lost segment makes the client retransmit the
+//   query.
+//
+// every lcore owns a connection table, since the packets of the same
+// flow are always dispatched to the same lcore by rss, no lock is needed.
+//
+#include <rte_hash.h>
+#include <rte_jhash.h>
+
+#include "shuke.h"
+
+#define RTE_LOGTYPE_DPDK RTE_LOGTYPE_USER1
+
+#define TCP_FIN_FLAG 0x01
+#define TCP_SYN_FLAG 0x02
+#define TCP_RST_FLAG 0x04
+#define TCP_PSH_FLAG 0x08
+#define TCP_ACK_FLAG 0x10
+
+#define TCP_OPT_EOL     0
+#define TCP_OPT_NOP     1
+#define TCP_OPT_MSS     2
+#define TCP_OPT_TFO     34
+#define TCP_TFO_COOKIE_LEN 8
+
+#define TCP_HDR_LEN     20
+// l2, l3 and tcp headers(without options) of a segment
+#define TCP_MAX_HDR_LEN 128
+#define TCP_WINDOW      65535
+// max size of tcp payload handled by fast path
+#define TCP_MAX_PAYLOAD 65535
+
+#define COOKIEBITS 24
+#define COOKIEMASK (((uint32_t)1 << COOKIEBITS) - 1)
+// the period of syn cookie counter(seconds)
+#define SYNCOOKIE_PERIOD 64
+#define MAX_SYNCOOKIE_AGE 2
+
+// number of connections checked in every expire round
+#define TCP_EXPIRE_BATCH 64
+
+#define TCP_SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+
+typedef struct {
+    uint8_t saddr[16];
+    uint8_t daddr[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t is_ipv4;
+} tcp_conn_key_t;
+
+typedef struct {
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;
+    // the sequence of the last segment processed and its response,
+    // used to answer the retransmitted segment.
+    uint32_t last_req_seq;
+    uint32_t last_resp_seq;
+    uint16_t mss;
+    // the ACK of the last query is held until its response is acked.
+    bool held;
+    uint32_t held_ack;
+    uint64_t last_active_tsc;
+} tcp_conn_t;
+
+struct tcp_table {
+    struct rte_hash *h;
+    tcp_conn_t *conns;
+    uint32_t iter;
+    uint64_t idle_tsc;
+
+    // copy of the payload of current segment.
+    char qbuf[TCP_MAX_PAYLOAD];
+    // response of current query.
+    char rbuf[TCP_MAX_PAYLOAD];
+    // responses of current segment.
+    char sbuf[TCP_MAX_PAYLOAD];
+};
+
+static const uint16_t msstab[] = {536, 1300, 1440, 1460};
+static uint32_t tcp_secret[4];
+
+static inline uint32_t
+cookie_hash(const tcp_conn_key_t *k, uint32_t count, int c) {
+    return rte_jhash(k, sizeof(*k), tcp_secret[c] + count);
+}
+
+static inline uint32_t
+cookie_counter(void) {
+    return (uint32_t)(rte_rdtsc() / (rte_get_tsc_hz() * SYNCOOKIE_PERIOD));
+}
+
+static inline uint32_t
+syn_cookie_at(const tcp_conn_key_t *k, uint32_t sseq, uint32_t mssind, uint32_t count) {
+    return cookie_hash(k, 0, 0) + sseq + (count << COOKIEBITS) +
+           ((cookie_hash(k, count, 1) + mssind) & COOKIEMASK);
+}
+
+static uint32_t
+make_syn_cookie(const tcp_conn_key_t *k, uint32_t sseq, uint32_t mssind) {
+    return syn_cookie_at(k, sseq, mssind, cookie_counter());
+}
+
+/*
+ * return mss index if the cookie is valid, otherwise return -1.
+ */
+static int
+check_syn_cookie(const tcp_conn_key_t *k, uint32_t cookie, uint32_t sseq) {
+    uint32_t count = cookie_counter();
+    uint32_t diff;
+
+    cookie -= cookie_hash(k, 0, 0) + sseq;
+    diff = (count - (cookie >> COOKIEBITS)) & ((uint32_t)-1 >> COOKIEBITS);
+    if (diff >= MAX_SYNCOOKIE_AGE) return -1;
+    cookie = (cookie - cookie_hash(k, count - diff, 1)) & COOKIEMASK;
+    if (cookie >= RTE_DIM(msstab)) return -1;
+    return (int)cookie;
+}
+
+static void
+make_tfo_cookie(const tcp_conn_key_t *k, uint8_t *cookie) {
+    uint32_t c[2];
+    size_t len = k->is_ipv4? 4: 16;
+    c[0] = rte_jhash(k->saddr, (uint32_t)len, tcp_secret[2]);
+    c[1] = rte_jhash(k->saddr, (uint32_t)len, tcp_secret[3]);
+    rte_memcpy(cookie, c, TCP_TFO_COOKIE_LEN);
+}
+
+static inline uint16_t
+mss_to_index(uint16_t mss) {
+    uint16_t idx = (uint16_t)(RTE_DIM(msstab) - 1);
+    for (; idx > 0; --idx) {
+        if (mss >= msstab[idx]) break;
+    }
+    return idx;
+}
+
+static void
+build_conn_key(tcp_conn_key_t *k, void *l3_h, struct tcp_hdr *tcp_h, bool is_ipv4) {
+    memset(k, 0, sizeof(*k));
+    if (is_ipv4) {
+        struct ipv4_hdr *ipv4_h = l3_h;
+        rte_memcpy(k->saddr, &ipv4_h->src_addr, 4);
+        rte_memcpy(k->daddr, &ipv4_h->dst_addr, 4);
+    } else {
+        struct ipv6_hdr *ipv6_h = l3_h;
+        rte_memcpy(k->saddr, ipv6_h->src_addr, 16);
+        rte_memcpy(k->daddr, ipv6_h->dst_addr, 16);
+    }
+    k->sport = tcp_h->src_port;
+    k->dport = tcp_h->dst_port;
+    k->is_ipv4 = is_ipv4;
+}
+
+/*
+ * parse the options of SYN segment.
+ * tfo_len is set to -1 if no TFO option, 0 if it is a cookie request.
+ */
+static void
+parse_syn_options(struct tcp_hdr *tcp_h, uint16_t *mss, int *tfo_len, uint8_t **tfo_cookie) {
+    uint8_t *opt = (uint8_t *)(tcp_h + 1);
+    uint8_t *end = (uint8_t *)tcp_h + ((tcp_h->data_off >> 4) << 2);
+    uint8_t kind, len;
+
+    *mss = 536;
+    *tfo_len = -1;
+    *tfo_cookie = NULL;
+    while (opt < end) {
+        kind = *opt;
+        if (kind == TCP_OPT_EOL) break;
+        if (kind == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end) break;
+        len = opt[1];
+        if (len < 2 || opt + len > end) break;
+        if (kind == TCP_OPT_MSS && len == 4) {
+            *mss = (uint16_t)((opt[2] << 8) | opt[3]);
+        } else if (kind == TCP_OPT_TFO) {
+            *tfo_len = len - 2;
+            *tfo_cookie = opt + 2;
+        }
+        opt += len;
+    }
+}
+
+/*
+ * rewrite the headers of m to a reply segment of the received segment.
+ * the payload(data_len bytes) must already be placed after tcp header and options.
+ */
+static void
+tcp_prepare_reply(struct rte_mbuf *m, port_info_t *pinfo, lcore_conf_t *qconf,
+                  bool is_ipv4, uint8_t flags, uint32_t seq, uint32_t ack,
+                  uint8_t *opts, uint16_t optlen, uint16_t data_len) {
+    struct ether_hdr *eth_h = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    char *l3_h = (char *)eth_h + m->l2_len;
+    struct tcp_hdr *tcp_h = (struct tcp_hdr *)(l3_h + m->l3_len);
+    struct ether_addr eth_addr;
+    uint16_t tcp_len = (uint16_t)(TCP_HDR_LEN + optlen + data_len);
+    uint16_t port;
+    uint32_t total_len;
+
+    ether_addr_copy(&eth_h->s_addr, &eth_addr);
+    ether_addr_copy(&eth_h->d_addr, &eth_h->s_addr);
+    ether_addr_copy(&eth_addr, &eth_h->d_addr);
+
+    // the vlan tags stripped by NIC are inserted by NIC again.
+    m->ol_flags &= (PKT_TX_VLAN_PKT | PKT_TX_QINQ_PKT);
+    m->l4_len = (uint64_t)(TCP_HDR_LEN + optlen);
+    if (is_ipv4) {
+        struct ipv4_hdr *ipv4_h = (struct ipv4_hdr *)l3_h;
+        uint32_t ipv4_addr = ipv4_h->src_addr;
+        ipv4_h->src_addr = ipv4_h->dst_addr;
+        ipv4_h->dst_addr = ipv4_addr;
+        ipv4_h->time_to_live = 64;
+        ipv4_h->fragment_offset = 0;
+        ipv4_h->packet_id = rte_cpu_to_be_16(qconf->ipv4_packet_id);
+        qconf->ipv4_packet_id += sk.nr_lcore_ids;
+        ipv4_h->total_length = rte_cpu_to_be_16((uint16_t)(m->l3_len + tcp_len));
+        ipv4_h->hdr_checksum = 0;
+        if (pinfo->hw_features.tx_csum_ip) {
+            m->ol_flags |= (PKT_TX_IPV4 | PKT_TX_IP_CKSUM);
+        } else {
+            ipv4_h->hdr_checksum = rte_ipv4_cksum(ipv4_h);
+        }
+    } else {
+        struct ipv6_hdr *ipv6_h = (struct ipv6_hdr *)l3_h;
+        uint8_t ipv6_addr[16];
+        rte_memcpy(ipv6_addr, ipv6_h->dst_addr, 16);
+        rte_memcpy(ipv6_h->dst_addr, ipv6_h->src_addr, 16);
+        rte_memcpy(ipv6_h->src_addr, ipv6_addr, 16);
+        ipv6_h->hop_limits = 64;
+        ipv6_h->payload_len = rte_cpu_to_be_16(tcp_len);
+        m->ol_flags |= PKT_TX_IPV6;
+    }
+
+    port = tcp_h->src_port;
+    tcp_h->src_port = tcp_h->dst_port;
+    tcp_h->dst_port = port;
+    tcp_h->sent_seq = rte_cpu_to_be_32(seq);
+    tcp_h->recv_ack = rte_cpu_to_be_32(ack);
+    tcp_h->data_off = (uint8_t)(((TCP_HDR_LEN + optlen) >> 2) << 4);
+    tcp_h->tcp_flags = flags;
+    tcp_h->rx_win = rte_cpu_to_be_16(TCP_WINDOW);
+    tcp_h->tcp_urp = 0;
+    if (optlen > 0) {
+        rte_memcpy(tcp_h + 1, opts, optlen);
+    }
+
+    total_len = (uint32_t)(m->l2_len + m->l3_len + tcp_len);
+    // ethernet frame should at least contain 64 bytes(include 4 byte CRC)
+    if (total_len < 60) total_len = 60;
+    m->data_len = (uint16_t)total_len;
+    m->pkt_len = total_len;
+
+    tcp_h->cksum = 0;
+    if (pinfo->hw_features.tx_csum_l4) {
+        m->ol_flags |= PKT_TX_TCP_CKSUM;
+        if (is_ipv4) {
+            tcp_h->cksum = rte_ipv4_phdr_cksum((struct ipv4_hdr *)l3_h, m->ol_flags);
+        } else {
+            tcp_h->cksum = rte_ipv6_phdr_cksum((struct ipv6_hdr *)l3_h, m->ol_flags);
+        }
+    } else {
+        if (is_ipv4) {
+            tcp_h->cksum = rte_ipv4_udptcp_cksum((struct ipv4_hdr *)l3_h, tcp_h);
+        } else {
+            tcp_h->cksum = rte_ipv6_udptcp_cksum((struct ipv6_hdr *)l3_h, tcp_h);
+        }
+    }
+}
+
+static void
+tcp_send_rst(lcore_conf_t *qconf, struct rte_mbuf *m, port_info_t *pinfo,
+             bool is_ipv4, uint32_t seq, uint32_t ack) {
+    tcp_prepare_reply(m, pinfo, qconf, is_ipv4, TCP_RST_FLAG | TCP_ACK_FLAG,
+                      seq, ack, NULL, 0, 0);
+    sk_send_packet(qconf, m, pinfo->port_id);
+}
+
+/*
+ * allocate a reply mbuf with the headers(`hdr_len` bytes of `hdr`, up to the
+ * tcp header without options) of orig, orig may be rewritten already.
+ */
+static struct rte_mbuf *
+tcp_alloc_segment(struct rte_mbuf *orig, const char *hdr, uint16_t hdr_len) {
+    struct rte_mbuf *m = rte_pktmbuf_alloc(orig->pool);
+
+    if (m == NULL) return NULL;
+    if (rte_pktmbuf_append(m, hdr_len) == NULL) {
+        rte_pktmbuf_free(m);
+        return NULL;
+    }
+    rte_memcpy(rte_pktmbuf_mtod(m, void *), hdr, hdr_len);
+    m->l2_len = orig->l2_len;
+    m->l3_len = orig->l3_len;
+    m->port = orig->port;
+    m->ol_flags = orig->ol_flags & (PKT_TX_VLAN_PKT | PKT_TX_QINQ_PKT);
+    m->vlan_tci = orig->vlan_tci;
+    m->vlan_tci_outer = orig->vlan_tci_outer;
+    return m;
+}
+
+/*
+ * build a SYN-ACK, if m is NULL, a new mbuf is allocated and the headers
+ * of orig are copied to it.
+ */
+static int
+tcp_send_synack(lcore_conf_t *qconf, struct rte_mbuf *m, struct rte_mbuf *orig,
+                port_info_t *pinfo, bool is_ipv4, uint32_t isn, uint32_t ack,
+                uint16_t mss, const uint8_t *tfo_cookie) {
+    uint8_t opts[4 + 2 + TCP_TFO_COOKIE_LEN + 2];
+    uint16_t optlen = 0;
+
+    if (m == NULL) {
+        m = tcp_alloc_segment(orig, rte_pktmbuf_mtod(orig, char *),
+                              (uint16_t)(orig->l2_len + orig->l3_len + TCP_HDR_LEN));
+        if (m == NULL) return ERR_CODE;
+    }
+
+    opts[optlen++] = TCP_OPT_MSS;
+    opts[optlen++] = 4;
+    opts[optlen++] = (uint8_t)(mss >> 8);
+    opts[optlen++] = (uint8_t)(mss & 0xff);
+    if (tfo_cookie) {
+        opts[optlen++] = TCP_OPT_TFO;
+        opts[optlen++] = 2 + TCP_TFO_COOKIE_LEN;
+        rte_memcpy(opts + optlen, tfo_cookie, TCP_TFO_COOKIE_LEN);
+        optlen += TCP_TFO_COOKIE_LEN;
+        opts[optlen++] = TCP_OPT_NOP;
+        opts[optlen++] = TCP_OPT_NOP;
+    }
+    tcp_prepare_reply(m, pinfo, qconf, is_ipv4, TCP_SYN_FLAG | TCP_ACK_FLAG,
+                      isn, ack, opts, optlen, 0);
+    sk_send_packet(qconf, m, pinfo->port_id);
+    return OK_CODE;
+}
+
+/*
+ * answer all the complete queries in the payload, the responses are written to
+ * out.
+ * return the length of responses, the number of bytes consumed is stored to consumed.
+ * return -1 if the first response doesn't fit in out_cap bytes.
+ */
+static int
+tcp_answer_queries(lcore_conf_t *qconf, struct tcp_table *tbl, char *data, int len,
+                   char *out, int out_cap, int *consumed, void *src_addr,
+                   uint16_t sport, bool is_ipv4, int svc_id) {
+    int off = 0, w = 0;
+    int qlen, n;
+
+    rte_memcpy(tbl->qbuf, data, (size_t)len);
+    while (len - off >= 2) {
+        qlen = (tbl->qbuf[off] << 8 & 0xff00) | (tbl->qbuf[off+1] & 0xff);
+        if (off + 2 + qlen > len) break;
+
+        rte_memcpy(tbl->rbuf, tbl->qbuf + off + 2, (size_t)qlen);
+        n = processFastTCPDnsQuery(tbl->rbuf, (size_t)qlen, tbl->rbuf, TCP_MAX_PAYLOAD,
+                                   src_addr, sport, is_ipv4, svc_id, qconf->node, qconf->lcore_id);
+        if (n >= 0) {
+            if (w + 2 + n > out_cap) {
+                if (w == 0) return -1;
+                break;
+            }
+            out[w] = (char)(n >> 8);
+            out[w+1] = (char)(n & 0xff);
+            rte_memcpy(out + w + 2, tbl->rbuf, (size_t)n);
+            w += 2 + n;
+            ++qconf->nr_req;
+        }
+        off += 2 + qlen;
+    }
+    *consumed = off;
+    return w;
+}
+
+/*
+ * send `len` bytes of data in segments of at most `mss` bytes, the first
+ * segment reuses m. PSH and FIN(if set in flags) are only set on the last
+ * segment. if an mbuf can't be allocated, the rest segments are not sent,
+ * the client retransmits the query later.
+ */
+static void
+tcp_send_response(lcore_conf_t *qconf, struct rte_mbuf *m, port_info_t *pinfo,
+                  bool is_ipv4, uint8_t flags, uint32_t seq, uint32_t ack,
+                  const char *data, int len, uint16_t mss) {
+    uint16_t hdr_len = (uint16_t)(m->l2_len + m->l3_len + TCP_HDR_LEN);
+    char hdr[TCP_MAX_HDR_LEN];
+    uint8_t last_flags = flags;
+    int off = 0, n;
+
+    if (len > mss) {
+        // m is rewritten by tcp_prepare_reply, keep the headers of the query.
+        rte_memcpy(hdr, rte_pktmbuf_mtod(m, char *), hdr_len);
+        flags &= (uint8_t)~(TCP_PSH_FLAG | TCP_FIN_FLAG);
+    }
+    do {
+        n = RTE_MIN(len - off, (int)mss);
+        if (off > 0) {
+            m = tcp_alloc_segment(m, hdr, hdr_len);
+            if (m == NULL || rte_pktmbuf_tailroom(m) < n) {
+                if (m) rte_pktmbuf_free(m);
+                qconf->stats.drop[SK_DROP_NO_MBUF]++;
+                return;
+            }
+        }
+        rte_memcpy(rte_pktmbuf_mtod(m, char *) + hdr_len, data + off, (size_t)n);
+        tcp_prepare_reply(m, pinfo, qconf, is_ipv4, off + n == len? last_flags: flags,
+                          seq + (uint32_t)off, ack, NULL, 0, (uint16_t)n);
+        sk_send_packet(qconf, m, pinfo->port_id);
+        off += n;
+    } while (off < len);
+}
+
+/*
+ * answer the queries in the segment and send the responses.
+ * `wnd` is the window of the client, it never scales the window since the
+ * window scale option is not sent.
+ */
+static void
+tcp_process_data(lcore_conf_t *qconf, struct tcp_table *tbl, tcp_conn_t *conn,
+                 struct rte_mbuf *m, port_info_t *pinfo, bool is_ipv4, int svc_id,
+                 char *data, int data_len, void *src_addr, uint16_t sport,
+                 uint16_t wnd, uint32_t seq, uint32_t snd_seq, bool fin) {
+    int out_cap, w, consumed = 0;
+    uint8_t flags = TCP_ACK_FLAG;
+    uint16_t mss = conn->mss;
+    uint32_t ack;
+
+    // the segments are built in mbufs of the pool of m.
+    out_cap = (int)(m->buf_len - m->data_off - (m->l2_len + m->l3_len + TCP_HDR_LEN));
+    if (out_cap < mss) mss = (uint16_t)out_cap;
+    out_cap = RTE_MAX((int)wnd, (int)mss);
+
+    w = tcp_answer_queries(qconf, tbl, data, data_len, tbl->sbuf, out_cap, &consumed,
+                           src_addr, sport, is_ipv4, svc_id);
+    if (w < 0) {
+        LOG_DEBUG(DPDK, "tcp response exceeds the window of client, reset the connection.");
+        tcp_send_rst(qconf, m, pinfo, is_ipv4, snd_seq, seq + (uint32_t)data_len);
+        conn->mss = 0;
+        return;
+    }
+    if (consumed == 0 && data_len > 0) {
+        LOG_DEBUG(DPDK, "tcp query is not contained in one segment, reset the connection.");
+        tcp_send_rst(qconf, m, pinfo, is_ipv4, snd_seq, seq + (uint32_t)data_len);
+        conn->mss = 0;
+        return;
+    }
+    ack = seq + (uint32_t)consumed;
+    if (w > 0) flags |= TCP_PSH_FLAG;
+    conn->held = false;
+    if (w > mss && TCP_SEQ_LT(conn->rcv_nxt, ack)) {
+        // acked after the client acks all the segments, so the query is
+        // retransmitted if any of them is lost. FIN is acked after that.
+        conn->held = true;
+        conn->held_ack = ack;
+        ack = seq;
+    } else if (fin && consumed == data_len) {
+        // client closes the connection, close it too.
+        flags |= TCP_FIN_FLAG;
+        ack++;
+    }
+    conn->last_req_seq = seq;
+    conn->last_resp_seq = snd_seq;
+    if (TCP_SEQ_LT(conn->rcv_nxt, ack)) conn->rcv_nxt = ack;
+    if (TCP_SEQ_LT(conn->snd_nxt, snd_seq + (uint32_t)w)) conn->snd_nxt = snd_seq + (uint32_t)w;
+
+    tcp_send_response(qconf, m, pinfo, is_ipv4, flags, snd_seq, ack, tbl->sbuf, w, mss);
+}
+
+static tcp_conn_t *
+tcp_conn_create(struct tcp_table *tbl, tcp_conn_key_t *k) {
+    int32_t pos = rte_hash_add_key(tbl->h, k);
+    if (pos < 0) return NULL;
+    tcp_conn_t *conn = &tbl->conns[pos];
+    memset(conn, 0, sizeof(*conn));
+    return conn;
+}
+
+static inline void
+tcp_conn_delete(struct tcp_table *tbl, tcp_conn_key_t *k) {
+    rte_hash_del_key(tbl->h, k);
+}
+
+void
+sk_tcp_handle_packet(lcore_conf_t *qconf, struct rte_mbuf *m, uint8_t portid, bool is_ipv4,
+                     int svc_id) {
+    port_info_t *pinfo = sk.port_info[portid];
+    struct tcp_table *tbl = qconf->tcp_tbl;
+    char *l3_h = rte_pktmbuf_mtod(m, char *) + m->l2_len;
+    struct tcp_hdr *tcp_h = (struct tcp_hdr *)(l3_h + m->l3_len);
+    uint16_t ip_payload_len;
+    tcp_conn_key_t key;
+    tcp_conn_t *conn = NULL;
+    int32_t pos;
+    uint32_t seq, ack, isn;
+    uint8_t flags;
+    char *data;
+    int data_len, mssind;
+    void *src_addr;
+    bool fin;
+
+    if (unlikely(!rte_pktmbuf_is_contiguous(m))) goto invalid;
+
+    if (is_ipv4) {
+        struct ipv4_hdr *ipv4_h = (struct ipv4_hdr *)l3_h;
+        ip_payload_len = (uint16_t)(rte_be_to_cpu_16(ipv4_h->total_length) - m->l3_len);
+        src_addr = &ipv4_h->src_addr;
+    } else {
+        struct ipv6_hdr *ipv6_h = (struct ipv6_hdr *)l3_h;
+        ip_payload_len = rte_be_to_cpu_16(ipv6_h->payload_len);
+        src_addr = ipv6_h->src_addr;
+    }
+    m->l4_len = (uint64_t)((tcp_h->data_off >> 4) << 2);
+    if (m->l4_len < TCP_HDR_LEN || m->l4_len > ip_payload_len) goto invalid;
+
+    data = (char *)tcp_h + m->l4_len;
+    data_len = ip_payload_len - (int)m->l4_len;
+    if (data + data_len > rte_pktmbuf_mtod(m, char *) + rte_pktmbuf_data_len(m)) goto invalid;
+    seq = rte_be_to_cpu_32(tcp_h->sent_seq);
+    ack = rte_be_to_cpu_32(tcp_h->recv_ack);
+    flags = tcp_h->tcp_flags;
+    fin = (flags & TCP_FIN_FLAG) != 0;
+
+    build_conn_key(&key, l3_h, tcp_h, is_ipv4);
+
+    if (flags & TCP_RST_FLAG) {
+        tcp_conn_delete(tbl, &key);
+        goto invalid;
+    }
+
+    if (flags & TCP_SYN_FLAG) {
+        uint16_t mss;
+        int tfo_len;
+        uint8_t *tfo_cookie;
+        uint8_t cookie[TCP_TFO_COOKIE_LEN];
+
+        if (flags & TCP_ACK_FLAG) goto invalid;
+        parse_syn_options(tcp_h, &mss, &tfo_len, &tfo_cookie);
+        mssind = mss_to_index(mss);
+        isn = make_syn_cookie(&key, seq, (uint32_t)mssind);
+
+        if (tfo_len < 0) {
+            tcp_send_synack(qconf, m, NULL, pinfo, is_ipv4, isn, seq + 1, msstab[mssind], NULL);
+            return;
+        }
+        make_tfo_cookie(&key, cookie);
+        if (tfo_len != TCP_TFO_COOKIE_LEN || memcmp(cookie, tfo_cookie, TCP_TFO_COOKIE_LEN) != 0 ||
+            data_len == 0) {
+            // cookie request or invalid cookie, the data(if any) is not acked.
+            tcp_send_synack(qconf, m, NULL, pinfo, is_ipv4, isn, seq + 1, msstab[mssind], cookie);
+            return;
+        }
+        // valid TFO cookie, answer the query carried by SYN.
+        conn = tcp_conn_create(tbl, &key);
+        if (conn == NULL) {
+            tcp_send_synack(qconf, m, NULL, pinfo, is_ipv4, isn, seq + 1, msstab[mssind], NULL);
+            return;
+        }
+        conn->mss = msstab[mssind];
+        conn->snd_nxt = isn + 1;
+        conn->rcv_nxt = seq + 1;
+        conn->last_active_tsc = rte_rdtsc();
+        if (tcp_send_synack(qconf, NULL, m, pinfo, is_ipv4, isn, seq + 1, conn->mss, NULL) != OK_CODE) {
+            tcp_conn_delete(tbl, &key);
+            goto invalid;
+        }
+        tcp_process_data(qconf, tbl, conn, m, pinfo, is_ipv4, svc_id, data, data_len, src_addr,
+                         tcp_h->src_port, rte_be_to_cpu_16(tcp_h->rx_win), seq + 1, isn + 1, fin);
+        if (conn->mss == 0) tcp_conn_delete(tbl, &key);
+        return;
+    }
+
+    if (!(flags & TCP_ACK_FLAG)) goto invalid;
+
+    pos = rte_hash_lookup(tbl->h, &key);
+    if (pos >= 0) {
+        conn = &tbl->conns[pos];
+    } else {
+        if (data_len == 0 && !fin) {
+            // the last ACK of handshake or the ACK of our FIN.
+            goto invalid;
+        }
+        // the first segment with data, check syn cookie.
+        mssind = check_syn_cookie(&key, ack - 1, seq - 1);
+        if (mssind < 0) {
+            LOG_DEBUG(DPDK, "invalid syn cookie, reset it.");
+            tcp_send_rst(qconf, m, pinfo, is_ipv4, ack, seq + (uint32_t)data_len);
+            return;
+        }
+        conn = tcp_conn_create(tbl, &key);
+        if (conn == NULL) {
+            LOG_DEBUG(DPDK, "tcp connection table is full.");
+            tcp_send_rst(qconf, m, pinfo, is_ipv4, ack, seq + (uint32_t)data_len);
+            return;
+        }
+        conn->mss = msstab[mssind];
+        conn->snd_nxt = ack;
+        conn->rcv_nxt = seq;
+    }
+    conn->last_active_tsc = rte_rdtsc();
+
+    if (conn->held && !TCP_SEQ_LT(ack, conn->snd_nxt)) {
+        // the client has all the segments of the response, ack the query.
+        conn->held = false;
+        if (TCP_SEQ_LT(conn->rcv_nxt, conn->held_ack)) conn->rcv_nxt = conn->held_ack;
+        if (data_len == 0 && !fin) {
+            tcp_prepare_reply(m, pinfo, qconf, is_ipv4, TCP_ACK_FLAG, conn->snd_nxt,
+                              conn->rcv_nxt, NULL, 0, 0);
+            sk_send_packet(qconf, m, portid);
+            return;
+        }
+    }
+
+    if (seq == conn->last_req_seq && data_len > 0 && (conn->held || seq != conn->rcv_nxt)) {
+        // retransmitted segment, our response may be lost, answer it again.
+        tcp_process_data(qconf, tbl, conn, m, pinfo, is_ipv4, svc_id, data, data_len, src_addr,
+                         tcp_h->src_port, rte_be_to_cpu_16(tcp_h->rx_win), seq, conn->last_resp_seq, fin);
+    } else if (seq == conn->rcv_nxt) {
+        if (data_len == 0 && !fin) goto invalid;
+        tcp_process_data(qconf, tbl, conn, m, pinfo, is_ipv4, svc_id, data, data_len, src_addr,
+                         tcp_h->src_port, rte_be_to_cpu_16(tcp_h->rx_win), seq, conn->snd_nxt, fin);
+    } else {
+        // out of order segment, just send an ACK.
+        tcp_prepare_reply(m, pinfo, qconf, is_ipv4, TCP_ACK_FLAG, conn->snd_nxt,
+                          conn->rcv_nxt, NULL, 0, 0);
+        sk_send_packet(qconf, m, portid);
+        return;
+    }
+    // the FIN of a held query is acked later.
+    if ((fin && !conn->held) || conn->mss == 0) {
+        tcp_conn_delete(tbl, &key);
+    }
+    return;
+
+invalid:
+    rte_pktmbuf_free(m);
+}
+
+/*
+ * remove the idle connections, only a few connections are checked
+ * every time, so it's cheap enough to be called in main loop.
+ */
+void
+sk_tcp_expire(lcore_conf_t *qconf) {
+    struct tcp_table *tbl = qconf->tcp_tbl;
+    const void *key;
+    void *data;
+    int32_t pos;
+    uint64_t now = rte_rdtsc();
+
+    for (int i = 0; i < TCP_EXPIRE_BATCH; ++i) {
+        pos = rte_hash_iterate(tbl->h, &key, &data, &tbl->iter);
+        if (pos < 0) {
+            tbl->iter = 0;
+            break;
+        }
+        if (now - tbl->conns[pos].last_active_tsc > tbl->idle_tsc) {
+            rte_hash_del_key(tbl->h, key);
+        }
+    }
+}
+
+int
+sk_init_tcp_module(void) {
+    struct rte_hash_parameters params;
+    char name[RTE_HASH_NAMESIZE];
+
+    for (int i = 0; i < 4; ++i) {
+        tcp_secret[i] = (uint32_t)rte_rand();
+    }
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (qconf->nr_ports == 0 || qconf->role == LCORE_ROLE_IO) continue;
+
+        int socketid = sk.numa_on? (int)rte_lcore_to_socket_id((unsigned)lcore_id): 0;
+        struct tcp_table *tbl = rte_zmalloc_socket("tcp_table", sizeof(*tbl),
+                                                   RTE_CACHE_LINE_SIZE, socketid);
+        if (tbl == NULL) {
+            LOG_ERR(DPDK, "can't allocate tcp table for lcore %d.", lcore_id);
+            return ERR_CODE;
+        }
+        snprintf(name, sizeof(name), "tcp_conn_%d", lcore_id);
+        memset(&params, 0, sizeof(params));
+        params.name = name;
+        params.entries = (uint32_t)sk.tcp_conn_table_size;
+        params.key_len = sizeof(tcp_conn_key_t);
+        params.hash_func = rte_jhash;
+        params.socket_id = socketid;
+        tbl->h = rte_hash_create(&params);
+        if (tbl->h == NULL) {
+            LOG_ERR(DPDK, "can't create tcp connection table for lcore %d.", lcore_id);
+            return ERR_CODE;
+        }
+        // rte_hash_add_key returns a position in [0, entries)
+        tbl->conns = rte_zmalloc_socket("tcp_conns",
+                                        sizeof(tcp_conn_t) * sk.tcp_conn_table_size,
+                                        RTE_CACHE_LINE_SIZE, socketid);
+        if (tbl->conns == NULL) {
+            LOG_ERR(DPDK, "can't allocate tcp connections for lcore %d.", lcore_id);
+            return ERR_CODE;
+        }
+        tbl->idle_tsc = rte_get_tsc_hz() * (uint64_t)sk.tcp_idle_timeout;
+        qconf->tcp_tbl = tbl;
+    }
+    return OK_CODE;
+}
+
+#if defined(SK_TEST)
+#include "testhelp.h"
+
+int tcpTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    tcp_conn_key_t k, k2;
+    uint8_t c1[TCP_TFO_COOKIE_LEN], c2[TCP_TFO_COOKIE_LEN];
+    uint32_t sseq = 0xfffffff0;
+    uint32_t count = cookie_counter();
+    bool ok = true;
+
+    for (int i = 0; i < 4; ++i) tcp_secret[i] = (uint32_t)rte_rand();
+    memset(&k, 0, sizeof(k));
+    k.is_ipv4 = 1;
+    memcpy(k.saddr, "\xc0\x00\x02\x01", 4);
+    memcpy(k.daddr, "\xc0\x00\x02\x35", 4);
+    k.sport = 12345;
+    k.dport = 53;
+    k2 = k;
+    k2.sport = 12346;
+
+    for (uint32_t i = 0; i < RTE_DIM(msstab); ++i) {
+        if (check_syn_cookie(&k, make_syn_cookie(&k, sseq, i), sseq) != (int)i) ok = false;
+    }
+    test_cond("syn cookie round trip", ok);
+    test_cond("syn cookie of last period",
+              check_syn_cookie(&k, syn_cookie_at(&k, sseq, 2, count - 1), sseq) == 2);
+    test_cond("expired syn cookie",
+              check_syn_cookie(&k, syn_cookie_at(&k, sseq, 2, count - MAX_SYNCOOKIE_AGE), sseq) == -1);
+    test_cond("syn cookie of other flow", check_syn_cookie(&k2, make_syn_cookie(&k, sseq, 1), sseq) == -1);
+    test_cond("syn cookie of other seq", check_syn_cookie(&k, make_syn_cookie(&k, sseq, 1), sseq + 100) == -1);
+    test_cond("mss index", mss_to_index(1460) == 3 && mss_to_index(1400) == 1 &&
+                           mss_to_index(500) == 0 && mss_to_index(9000) == 3);
+
+    make_tfo_cookie(&k, c1);
+    make_tfo_cookie(&k2, c2);
+    test_cond("tfo cookie of the same client", memcmp(c1, c2, TCP_TFO_COOKIE_LEN) == 0);
+    k2.saddr[3]++;
+    make_tfo_cookie(&k2, c2);
+    test_cond("tfo cookie of other client", memcmp(c1, c2, TCP_TFO_COOKIE_LEN) != 0);
+    tcp_secret[2]++;
+    make_tfo_cookie(&k, c2);
+    test_cond("tfo cookie of other secret", memcmp(c1, c2, TCP_TFO_COOKIE_LEN) != 0);
+
+    // a response bigger than the mss is split into several segments.
+    {
+        struct rte_mempool *mp = rte_pktmbuf_pool_create("tcp_test", 64, 0, 0,
+                                                         RTE_MBUF_DEFAULT_BUF_SIZE,
+                                                         (int)rte_socket_id());
+        lcore_conf_t *qconf = calloc(1, sizeof(*qconf));
+        port_info_t pinfo;
+        struct rte_mbuf *m, *s;
+        struct tcp_hdr *tcp_h;
+        char resp[3000], out[3000];
+        uint16_t mss = 536, hdr_len = 14 + 20 + TCP_HDR_LEN;
+        uint32_t seq = 1000, ack = 2000, n, off = 0;
+
+        memset(&pinfo, 0, sizeof(pinfo));
+        for (size_t i = 0; i < sizeof(resp); ++i) resp[i] = (char)(i * 7);
+        m = rte_pktmbuf_alloc(mp);
+        rte_pktmbuf_append(m, hdr_len);
+        memset(rte_pktmbuf_mtod(m, char *), 0, hdr_len);
+        rte_pktmbuf_mtod(m, struct ether_hdr *)->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+        rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, 14)->version_ihl = 0x45;
+        m->l2_len = 14;
+        m->l3_len = 20;
+        m->ol_flags = PKT_TX_VLAN_PKT;
+        m->vlan_tci = 100;
+
+        tcp_send_response(qconf, m, &pinfo, true, TCP_PSH_FLAG | TCP_ACK_FLAG,
+                          seq, ack, resp, (int)sizeof(resp), mss);
+        n = qconf->tx_mbufs[0].len;
+        test_cond("response split by mss", n == (sizeof(resp) + mss - 1) / mss);
+        ok = true;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t len;
+            s = qconf->tx_mbufs[0].m_table[i];
+            tcp_h = rte_pktmbuf_mtod_offset(s, struct tcp_hdr *, 14 + 20);
+            len = s->pkt_len - hdr_len;
+            if (len > mss || off + len > sizeof(out)) {
+                ok = false;
+                break;
+            }
+            if (rte_be_to_cpu_32(tcp_h->sent_seq) != seq + off ||
+                rte_be_to_cpu_32(tcp_h->recv_ack) != ack ||
+                ((tcp_h->tcp_flags & TCP_PSH_FLAG) != 0) != (i == n - 1) ||
+                s->vlan_tci != 100 || !(s->ol_flags & PKT_TX_VLAN_PKT)) {
+                ok = false;
+            }
+            memcpy(out + off, (char *)(tcp_h + 1), len);
+            off += len;
+        }
+        test_cond("segments of response", ok && off == sizeof(resp) &&
+                                          memcmp(resp, out, sizeof(resp)) == 0);
+        for (uint32_t i = 0; i < n; ++i) rte_pktmbuf_free(qconf->tx_mbufs[0].m_table[i]);
+        free(qconf);
+    }
+    test_report();
+    return 0;
+}
+#endif
@@ -6,6 +6,7 @@
 #include <arpa/inet.h>
 
 #include <rte_branch_prediction.h>
+#include <rte_mbuf.h>
 
 #include "endianconv.h"
 #include "zmalloc.h"
@@ -120,6 +121,7 @@ RRSet *RRSetDup(RRSet *rs, int socket_id) {
     rte_memcpy(new, rs, sz);
     new->socket_id = socket_id;
     new->offsets = NULL;
+    new->zc_body = NULL;
     return new;
 }
 
@@ -274,6 +276,18 @@ static inline int dumpCompressedRRHeader(char *buf, int offset, size_t size, uin
  * @param nameOffset: the offset of the name in sds, used to compress the name
  * @return OK_CODE if everything is OK, otherwise return ERR_CODE.
  */
+// support round robin, return the index of the first RR to dump.
+static inline int32_t RRSetNextStartIdx(struct context *ctx, RRSet *rs) {
+    if (rs->num <= 1) return 0;
+    //TODO better way to support round rabin
+    zone *z = ctx->z;
+    int idx = ctx->lcore_id - z->start_core_idx;
+    uint8_t *arr = (uint8_t *)(z->rr_offset_array) + z->rr_offset_array[idx];
+    int32_t start_idx = (++ arr[rs->z_rr_idx]) % rs->num;
+    LOG_DEBUG(USER1, "core: %d, rr idx: %d", ctx->lcore_id, arr[rs->z_rr_idx]);
+    return start_idx;
+}
+
 int RRSetCompressPack(struct context *ctx, RRSet *rs, size_t nameOffset)
 {
     char *resp = ctx->resp;
@@ -282,20 +296,10 @@ int RRSetCompressPack(struct context *ctx, RRSet *rs, size_t nameOffset)
 
     char *name;
     char *rdata;
-    int32_t start_idx = 0;
+    int32_t start_idx = RRSetNextStartIdx(ctx, rs);
     uint16_t dnsNameOffset = (uint16_t)(nameOffset | 0xC000);
     int len_offset;
 
-    // support round robin
-    if (rs->num > 1) {
-        //TODO better way to support round rabin
-        zone *z = ctx->z;
-        int idx = ctx->lcore_id - z->start_core_idx;
-        uint8_t *arr = (uint8_t *)(z->rr_offset_array) + z->rr_offset_array[idx];
-        start_idx = (++ arr[rs->z_rr_idx]) % rs->num;
-        LOG_DEBUG(USER1, "core: %d, rr idx: %d", ctx->lcore_id, arr[rs->z_rr_idx]);
-    }
-
     for (int i = 0; i < rs->num; ++i) {
         int idx = (i + start_idx) % rs->num;
         rdata = rs->data + (rs->offsets[idx]);
@@ -368,8 +372,73 @@ int RRSetCompressPack(struct context *ctx, RRSet *rs, size_t nameOffset)
     return cur;
 }
 
+/*
+ * the answer section of a RRSet can be pre-rendered only if the RRs don't
+ * contain domain names that need compression or additional section processing.
+ */
+bool RRSetIsZeroCopyable(RRSet *rs) {
+    switch (rs->type) {
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_NS:
+        case DNS_TYPE_MX:
+        case DNS_TYPE_SRV:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/*!
+ * render the answer section of the RRSet to buffer, the owner name of RRs
+ * is a pointer to the question name, so the rendered bytes are the same as
+ * the output of RRSetCompressPack for an answer section.
+ * the RRs are rendered twice when there are multiple RRs, so every round robin
+ * rotation is a contiguous slice of the buffer.
+ *
+ * @return the size of rendered bytes, or ERR_CODE if the buffer is too small.
+ */
+int RRSetRenderAnswer(RRSet *rs, char *buf, size_t size) {
+    uint16_t dnsNameOffset = (uint16_t)(DNS_HDR_SIZE | 0xC000);
+    int copies = rs->num > 1? 2: 1;
+    int cur = 0;
+    char *rdata;
+    uint16_t rdlength;
+
+    if (!RRSetIsZeroCopyable(rs)) return ERR_CODE;
+    for (int c = 0; c < copies; ++c) {
+        for (int i = 0; i < rs->num; ++i) {
+            rdata = rs->data + (rs->offsets[i]);
+            rdlength = load16be(rdata);
+
+            cur = dumpCompressedRRHeader(buf, cur, size, dnsNameOffset, rs->type, DNS_CLASS_IN, rs->ttl);
+            if (cur == ERR_CODE) return ERR_CODE;
+            if ((int)(size-cur) < rdlength+2) return ERR_CODE;
+            rte_memcpy(buf+cur, rdata, rdlength+2);
+            cur += (rdlength+2);
+        }
+    }
+    return cur;
+}
+
+/*
+ * use the pre-rendered answer section of the RRSet instead of dumping it to
+ * response buffer, the caller must hold a reference of the body before
+ * leaving RCU read-side critical section.
+ */
+int RRSetZeroCopyAnswer(struct context *ctx, RRSet *rs) {
+    int32_t start_idx = RRSetNextStartIdx(ctx, rs);
+
+    // every rendered RR has 10 more bytes(name, type, class, ttl) than rdata.
+    ctx->zc->body = rs->zc_body;
+    ctx->zc->off = (uint32_t)(rs->offsets[start_idx] + 10 * start_idx);
+    ctx->zc->len = rs->len + 10 * rs->num;
+    return OK_CODE;
+}
+
 void RRSetDestroy(RRSet *rs) {
     if (rs == NULL) return;
+    // the body is freed when the last packet referring to it is sent.
+    if (rs->zc_body) rte_pktmbuf_free(rs->zc_body);
     socket_free(rs->socket_id, rs->offsets);
     socket_free(rs->socket_id, rs);
 }
@@ -695,10 +764,29 @@ int zoneDictHtMatch(struct cds_lfht_node *ht_node, const void *_key)
     return strcasecmp(z->origin, key) == 0;
 }
 
+// zones removed from zone dicts but not freed yet.
+static rte_atomic64_t nr_retired_zones;
+
 void zoneDictFreeCallback(struct rcu_head *head)
 {
     zone *z = caa_container_of(head, zone, rcu_head);
     zoneDestroy(z);
+    rte_atomic64_dec(&nr_retired_zones);
+}
+
+/*
+ * free a zone removed from a zone dict after the readers are done with it.
+ */
+void zoneDictRetire(zone *z) {
+    rte_atomic64_inc(&nr_retired_zones);
+    call_rcu(&z->rcu_head, zoneDictFreeCallback);
+}
+
+/*
+ * the number of zones waiting for a grace period(the RCU backlog).
+ */
+int64_t zoneDictNumRetired(void) {
+    return rte_atomic64_read(&nr_retired_zones);
 }
 
 static
@@ -746,7 +834,7 @@ void zoneDictDestroy(zoneDict *zd) {
         ht_node = cds_lfht_iter_get_node(&iter);
         ret = cds_lfht_del(ht, ht_node);
         if (!ret) {
-            call_rcu(&z->rcu_head, zoneDictFreeCallback);
+            zoneDictRetire(z);
         }
     }
     zoneDictWUnlock(zd);
@@ -806,7 +894,7 @@ int zoneDictReplace(zoneDict *zd, zone *z) {
                                    &z->htnode);
     if (ht_node) {
         old_z = caa_container_of(ht_node, zone, htnode);
-        call_rcu(&old_z->rcu_head, zoneDictFreeCallback);
+        zoneDictRetire(old_z);
         err = 0;
     }
     zoneDictWUnlock(zd);
@@ -843,7 +931,7 @@ int zoneDictDelete(zoneDict *zd, char *origin) {
         ret = cds_lfht_del(ht, ht_node);
         if (!ret) {
             zone *del_z = caa_container_of(ht_node, zone, htnode);
-            call_rcu(&del_z->rcu_head, zoneDictFreeCallback);
+            zoneDictRetire(del_z);
         }
     }
     zoneDictWUnlock(zd);
@@ -861,7 +949,7 @@ int zoneDictEmpty(zoneDict *zd) {
         ht_node = cds_lfht_iter_get_node(&iter);
         ret = cds_lfht_del(zd->ht, ht_node);
         if (!ret) {
-            call_rcu(&z->rcu_head, zoneDictFreeCallback);
+            zoneDictRetire(z);
         }
     }
     zoneDictWUnlock(zd);
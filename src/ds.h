@@ -46,9 +46,24 @@ typedef struct {
     int offset;
 } arInfo;
 
+/*
+ * a slice of the pre-rendered answer section of a RRSet(see RRSetRenderAnswer),
+ * the response is the bytes in the response buffer followed by the slice and
+ * the trailer(the OPT RR of EDNS).
+ */
+typedef struct {
+    void *body;        // struct rte_mbuf holding the rendered answer
+    uint32_t off;
+    uint32_t len;
+    uint32_t trailer_len;
+    char trailer[DNS_OPT_RR_SIZE];
+} zcSlice;
+
 struct context {
     struct  numaNode_s *node;
     int lcore_id;
+    // service id of the queried address, -1 if unknown.
+    int svc_id;
     struct _zone *z;
     // information parsed from dns query packet.
     dnsHeader_t hdr;
@@ -63,6 +78,14 @@ struct context {
     char *resp;
     size_t totallen;
     int cur;
+    // the biggest udp response the transport can carry, 0 for tcp.
+    size_t maxUdpSize;
+    // true if the query carries an OPT RR.
+    bool edns;
+    // not NULL if the answer section can be sent without copy.
+    zcSlice *zc;
+    // counters of the thread processing the query, may be NULL.
+    struct sk_query_stats *stats;
 
     size_t ari_sz;
     size_t cps_sz;
@@ -113,6 +136,8 @@ typedef struct {
 
     size_t *offsets;       // offset array, mainly for round rabin
     int z_rr_idx;          // round rabin index position in zone
+    // pre-rendered answer section(struct rte_mbuf), NULL if not rendered.
+    void *zc_body;
 
     char data[];
 } RRSet;
@@ -208,6 +233,9 @@ RRSet* RRSetCat(RRSet *rs, char *buf, size_t len);
 RRSet *RRSetRemoveFreeSpace(RRSet *rs);
 
 int RRSetCompressPack(struct context *ctx, RRSet *rs, size_t nameOffset);
+bool RRSetIsZeroCopyable(RRSet *rs);
+int RRSetRenderAnswer(RRSet *rs, char *buf, size_t size);
+int RRSetZeroCopyAnswer(struct context *ctx, RRSet *rs);
 sds RRSetToStr(RRSet *rs);
 
 void RRSetDestroy(RRSet *rs);
@@ -233,6 +261,8 @@ sds zoneToStr(zone *z);
  *---------------------------------------------*/
 int zoneDictHtMatch(struct cds_lfht_node *ht_node, const void *_key);
 void zoneDictFreeCallback(struct rcu_head *head);
+void zoneDictRetire(zone *z);
+int64_t zoneDictNumRetired(void);
 
 unsigned int zoneDictHash(char *buf, size_t len);
 zoneDict *zoneDictCreate(int socket_id);
@@ -0,0 +1,230 @@
+//
+// response latency histograms.
+//
+// every lcore owns two histograms in its lcore_conf_t:
+//   rx: from the TSC read by the main loop before the rx burst to the end of
+//       the processing of the burst, when the responses are in the tx buffer.
+//       all the packets of a burst get the latency of the burst.
+//   tx: from the end of the burst that put the first response in the tx buffer
+//       to the time the buffer is passed to rte_eth_tx_burst(or to the tx ring
+//       of an I/O lcore in pipeline mode), measured with the TSC of the main
+//       loop, so it is accurate to one loop iteration.
+// the tcp server thread records the time used to process every query.
+// the socket I/O backend and the I/O lcores of pipeline mode aren't
+// instrumented.
+//
+// LATENCY RESET doesn't touch the histograms of the lcores, the master keeps
+// a copy of them and subtracts it when the histograms are shown.
+//
+#include <math.h>
+
+#include "shuke.h"
+#include "utils.h"
+
+#define LAT_NR_BASE (RTE_MAX_LCORE * 2 + 1)
+#define LAT_TCP_BASE (RTE_MAX_LCORE * 2)
+
+// baseline taken by the last reset, NULL if never reset.
+static sk_lat_hist_t *lat_base;
+
+void sk_lat_merge(sk_lat_hist_t *dst, const sk_lat_hist_t *src) {
+    dst->count += src->count;
+    if (src->max > dst->max) dst->max = src->max;
+    for (int i = 0; i < SK_LAT_NR_BUCKETS; ++i) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+void sk_lat_sub(sk_lat_hist_t *dst, const sk_lat_hist_t *base) {
+    dst->count = 0;
+    for (int i = 0; i < SK_LAT_NR_BUCKETS; ++i) {
+        // the lcore may be recording while the baseline is taken.
+        dst->buckets[i] = dst->buckets[i] > base->buckets[i] ?
+            dst->buckets[i] - base->buckets[i] : 0;
+        dst->count += dst->buckets[i];
+    }
+}
+
+/*
+ * the biggest value falls in bucket `idx`.
+ */
+static uint64_t bucketUpperBound(int idx) {
+    unsigned shift;
+
+    if (idx < SK_LAT_SUB_COUNT) return (uint64_t)idx;
+    shift = (unsigned)(idx >> SK_LAT_SUB_BITS) - 1;
+    return (((uint64_t)(SK_LAT_SUB_COUNT | (idx & (SK_LAT_SUB_COUNT - 1))) + 1) << shift) - 1;
+}
+
+/*
+ * the value(TSC cycles) of percentile `pct`, it is the upper bound of the
+ * bucket, so it never underestimates.
+ */
+uint64_t sk_lat_percentile(const sk_lat_hist_t *h, double pct) {
+    uint64_t total = 0, acc = 0, target;
+
+    for (int i = 0; i < SK_LAT_NR_BUCKETS; ++i) total += h->buckets[i];
+    if (total == 0) return 0;
+    target = (uint64_t)ceil((double)total * pct / 100.0);
+    if (target == 0) target = 1;
+    for (int i = 0; i < SK_LAT_NR_BUCKETS; ++i) {
+        acc += h->buckets[i];
+        if (acc >= target) return MIN(bucketUpperBound(i), sk_lat_max(h));
+    }
+    return sk_lat_max(h);
+}
+
+/*
+ * h->max isn't reset by LATENCY RESET, so it is limited by the highest
+ * non-empty bucket.
+ */
+uint64_t sk_lat_max(const sk_lat_hist_t *h) {
+    for (int i = SK_LAT_NR_BUCKETS - 1; i >= 0; --i) {
+        if (h->buckets[i] == 0) continue;
+        if (i == SK_LAT_NR_BUCKETS - 1) return h->max;
+        return MIN(bucketUpperBound(i), h->max);
+    }
+    return 0;
+}
+
+static sds latHistToStr(sds s, const char *name, const sk_lat_hist_t *h) {
+    double us_per_tsc = (double)US_PER_S / (double)rte_get_tsc_hz();
+
+    return sdscatprintf(s, "%s:count=%llu,p50=%.2f,p99=%.2f,p999=%.2f,max=%.2f\r\n",
+                        name,
+                        (unsigned long long)h->count,
+                        (double)sk_lat_percentile(h, 50) * us_per_tsc,
+                        (double)sk_lat_percentile(h, 99) * us_per_tsc,
+                        (double)sk_lat_percentile(h, 99.9) * us_per_tsc,
+                        (double)sk_lat_max(h) * us_per_tsc);
+}
+
+/*
+ * copy the histogram of an lcore and subtract the baseline.
+ */
+static void latSnapshot(sk_lat_hist_t *dst, const sk_lat_hist_t *src, int base_idx) {
+    memcpy(dst, src, sizeof(*dst));
+    if (lat_base) sk_lat_sub(dst, &lat_base[base_idx]);
+}
+
+/*
+ * one line for every stage of every lcore and the aggregate of all lcores,
+ * the values are in microseconds.
+ */
+sds sk_latency_info(sds s) {
+    sk_lat_hist_t *h = zcalloc(sizeof(*h));
+    sk_lat_hist_t *rx_all = zcalloc(sizeof(*rx_all));
+    sk_lat_hist_t *tx_all = zcalloc(sizeof(*tx_all));
+    char name[64];
+
+    s = sdscat(s, "# Lcores\r\n");
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        unsigned lcore_id = (unsigned )sk.lcore_ids[i];
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (qconf == NULL || qconf->nr_ports == 0) continue;
+
+        latSnapshot(h, &qconf->lat_rx, lcore_id * 2);
+        sk_lat_merge(rx_all, h);
+        snprintf(name, sizeof(name), "lcore%u_rx", lcore_id);
+        s = latHistToStr(s, name, h);
+
+        latSnapshot(h, &qconf->lat_tx, lcore_id * 2 + 1);
+        sk_lat_merge(tx_all, h);
+        snprintf(name, sizeof(name), "lcore%u_tx", lcore_id);
+        s = latHistToStr(s, name, h);
+    }
+
+    s = sdscat(s, "\r\n# Aggregate\r\n");
+    s = latHistToStr(s, "rx", rx_all);
+    s = latHistToStr(s, "tx", tx_all);
+    if (sk.tcp_srv) {
+        latSnapshot(h, &sk.tcp_srv->lat, LAT_TCP_BASE);
+        s = latHistToStr(s, "tcp", h);
+    }
+
+    zfree(h);
+    zfree(rx_all);
+    zfree(tx_all);
+    return s;
+}
+
+void sk_latency_reset(void) {
+    if (lat_base == NULL) lat_base = zcalloc(LAT_NR_BASE * sizeof(*lat_base));
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        unsigned lcore_id = (unsigned )sk.lcore_ids[i];
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (qconf == NULL) continue;
+        memcpy(&lat_base[lcore_id * 2], &qconf->lat_rx, sizeof(*lat_base));
+        memcpy(&lat_base[lcore_id * 2 + 1], &qconf->lat_tx, sizeof(*lat_base));
+    }
+    if (sk.tcp_srv) {
+        memcpy(&lat_base[LAT_TCP_BASE], &sk.tcp_srv->lat, sizeof(*lat_base));
+    }
+}
+
+#if defined(SK_TEST)
+#include "testhelp.h"
+
+static bool checkBucket(uint64_t v) {
+    unsigned idx = sk_lat_bucket(v);
+    uint64_t ub = bucketUpperBound((int)idx);
+
+    if (v < SK_LAT_SUB_COUNT) return idx == v && ub == v;
+    // v is in the bucket and the bucket is narrower than v/SK_LAT_SUB_COUNT.
+    return v <= ub && bucketUpperBound((int)idx - 1) < v &&
+           ub - v < (v >> SK_LAT_SUB_BITS);
+}
+
+int latencyTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    sk_lat_hist_t *h = calloc(1, sizeof(*h));
+    sk_lat_hist_t *h2 = calloc(1, sizeof(*h2));
+    uint64_t p;
+    bool ok = true;
+
+    for (uint64_t v = 0; v < 65536; ++v) {
+        if (!checkBucket(v) || sk_lat_bucket(v) > sk_lat_bucket(v + 1)) ok = false;
+    }
+    for (unsigned e = 16; e < SK_LAT_MAX_BITS; ++e) {
+        uint64_t v = (uint64_t)1 << e;
+        if (!checkBucket(v - 1) || !checkBucket(v) || !checkBucket(v + 1) ||
+            !checkBucket(v + v / 2) || sk_lat_bucket(v - 1) >= sk_lat_bucket(v))
+            ok = false;
+    }
+    test_cond("bucket bounds", ok);
+    test_cond("sub buckets", sk_lat_bucket(16) == 16 && sk_lat_bucket(31) == 31 &&
+                             sk_lat_bucket(32) == 32 && sk_lat_bucket(33) == 32 &&
+                             sk_lat_bucket(34) == 33);
+    test_cond("last bucket",
+              sk_lat_bucket((uint64_t)1 << (SK_LAT_MAX_BITS - 1)) < SK_LAT_NR_BUCKETS - 1 &&
+              sk_lat_bucket((uint64_t)1 << SK_LAT_MAX_BITS) == SK_LAT_NR_BUCKETS - 1 &&
+              sk_lat_bucket(UINT64_MAX) == SK_LAT_NR_BUCKETS - 1);
+
+    test_cond("empty histogram", sk_lat_percentile(h, 50) == 0 && sk_lat_max(h) == 0);
+    for (uint64_t v = 1; v <= 1000; ++v) sk_lat_record(h, v, 1);
+    p = sk_lat_percentile(h, 50);
+    test_cond("p50", p >= 500 && p <= 500 + 500 / SK_LAT_SUB_COUNT);
+    p = sk_lat_percentile(h, 99);
+    test_cond("p99", p >= 990 && p <= 990 + 990 / SK_LAT_SUB_COUNT);
+    test_cond("p100 and max", sk_lat_percentile(h, 100) == 1000 && sk_lat_max(h) == 1000);
+    test_cond("p0", sk_lat_percentile(h, 0) == 1);
+
+    sk_lat_record(h2, 5000, 10);
+    sk_lat_merge(h2, h);
+    test_cond("merge", h2->count == 1010 && h2->max == 5000 &&
+                       sk_lat_percentile(h2, 100) == 5000);
+    sk_lat_sub(h2, h);
+    p = sk_lat_percentile(h2, 50);
+    test_cond("subtract baseline", h2->count == 10 && p >= 5000 &&
+                                   p <= 5000 + 5000 / SK_LAT_SUB_COUNT);
+    // samples of the baseline the histogram doesn't have are ignored.
+    sk_lat_sub(h, h2);
+    test_cond("subtract baseline of other samples", h->count == 1000);
+
+    free(h);
+    free(h2);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,63 @@
+//
+// log-linear latency histograms.
+//
+// the values are TSC cycles. values below SK_LAT_SUB_COUNT have their own
+// bucket, every power of two above is split into SK_LAT_SUB_COUNT linear
+// sub buckets, so the relative error of a value is below 1/SK_LAT_SUB_COUNT.
+// a histogram has a single writer, readers merge the buckets without locks,
+// so a snapshot may be off by the few samples recorded while it is taken.
+//
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+
+#include "sds.h"
+
+#define SK_LAT_SUB_BITS   4
+#define SK_LAT_SUB_COUNT  (1 << SK_LAT_SUB_BITS)
+// values not smaller than 2^SK_LAT_MAX_BITS cycles go to the last bucket.
+#define SK_LAT_MAX_BITS   40
+#define SK_LAT_NR_BUCKETS ((SK_LAT_MAX_BITS - SK_LAT_SUB_BITS + 1) * SK_LAT_SUB_COUNT)
+
+typedef struct sk_lat_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[SK_LAT_NR_BUCKETS];
+} sk_lat_hist_t;
+
+static inline unsigned
+sk_lat_bucket(uint64_t v) {
+    unsigned exp;
+
+    if (v < SK_LAT_SUB_COUNT) return (unsigned)v;
+    exp = 63 - (unsigned)__builtin_clzll(v);
+    if (exp >= SK_LAT_MAX_BITS) return SK_LAT_NR_BUCKETS - 1;
+    return ((exp - SK_LAT_SUB_BITS + 1) << SK_LAT_SUB_BITS) |
+        (unsigned)((v >> (exp - SK_LAT_SUB_BITS)) & (SK_LAT_SUB_COUNT - 1));
+}
+
+/*
+ * record `n` samples of value `v`, only called by the owner of the histogram.
+ */
+static inline void
+sk_lat_record(sk_lat_hist_t *h, uint64_t v, uint64_t n) {
+    h->buckets[sk_lat_bucket(v)] += n;
+    h->count += n;
+    if (v > h->max) h->max = v;
+}
+
+void sk_lat_merge(sk_lat_hist_t *dst, const sk_lat_hist_t *src);
+void sk_lat_sub(sk_lat_hist_t *dst, const sk_lat_hist_t *base);
+uint64_t sk_lat_percentile(const sk_lat_hist_t *h, double pct);
+uint64_t sk_lat_max(const sk_lat_hist_t *h);
+
+sds sk_latency_info(sds s);
+void sk_latency_reset(void);
+
+#if defined(SK_TEST)
+int latencyTest(int argc, char *argv[]);
+#endif
+
+#endif /* _LATENCY_H_ */
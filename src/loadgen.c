@@ -0,0 +1,567 @@
+//
+// synthetic load generator.
+//
+// when loadgen_lcore_id is set, a ring port(net_ring) is created after the
+// physical ports, the vdevs and the bonds, it is served by the workers like any other
+// port, so it should be in portmask, queue_config and bind(an ipv4 address).
+// the generator lcore synthesizes DNS queries, enqueues them to the RX rings
+// of the port and dequeues the responses from its TX rings, so the capacity
+// of the workers can be measured on one machine without a traffic generator.
+//
+// the queries are picked from a weighted list(loadgen_query_file) or from
+// all the names of the loaded zones. a part of them is turned into NXDOMAIN
+// queries by prepending a random label, the case of the names can be
+// randomized, and the client addresses are drawn from 198.18.0.0/15(the
+// benchmarking range of RFC 2544) with uniform or zipf distribution.
+//
+// every response is checked: the id must be in flight, the question must be
+// echoed as it is sent, and the rcode must be NXDOMAIN for the synthesized
+// NXDOMAIN queries and NOERROR for the others. QPS is logged every second,
+// the latency percentiles and correctness counters are logged when the run
+// ends and are shown by `info loadgen`.
+//
+#include <ctype.h>
+#include <math.h>
+
+#include <rte_eth_ring.h>
+
+#include "shuke.h"
+
+#define RTE_LOGTYPE_DPDK RTE_LOGTYPE_USER1
+
+#define LG_RING_SIZE      4096
+#define LG_NB_MBUF        16383
+#define LG_MBUF_CACHE     256
+#define LG_MAX_QUERIES    (1 << 20)
+#define LG_MAX_RX_QUEUES  32
+#define LG_CLIENT_BASE    0xC6120000   // 198.18.0.0
+#define LG_NX_LABEL_LEN   8
+
+static const struct ether_addr lg_eth_addr = {
+    .addr_bytes = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01}
+};
+
+typedef struct {
+    char name[MAX_DOMAIN_LEN+2];    // len label
+    uint16_t name_len;              // including the last 0
+    uint16_t qtype;
+} lg_query_t;
+
+typedef struct {
+    uint64_t tsc;       // 0 if the id is not in flight
+    uint32_t qhash;     // hash of the question section
+    bool nx;
+} lg_inflight_t;
+
+typedef struct {
+    struct rte_mempool *pool;
+    struct rte_ring *rx_rings[LG_MAX_RX_QUEUES];
+    struct rte_ring *tx_rings[LG_MAX_RX_QUEUES];
+    int nr_queues;
+    // queues served by the workers, the exception queue is the last one.
+    int nr_worker_queues;
+    uint8_t port_id;
+    struct ether_addr dst_eth;
+    uint32_t dst_ip;    // network byte order
+
+    lg_query_t *queries;
+    uint64_t *cum_weights;
+    int nr_queries;
+
+    double *client_cdf;     // NULL for uniform distribution
+    uint32_t nr_clients;
+
+    lg_inflight_t inflight[UINT16_MAX + 1];
+    uint16_t next_id;
+    uint64_t nr_inflight;
+} lg_state_t;
+
+static lg_state_t *lg;
+sk_loadgen_stats_t sk_loadgen_stats;
+
+/*
+ * a query entry of loadgen_query_file: `<name> <type> [weight]`.
+ */
+static int parse_query_line(char *errstr, int argc, char *argv[], lg_query_t *q, uint64_t *weight) {
+    char buf[MAX_DOMAIN_LEN+2];
+    size_t len;
+    int type;
+
+    if (argc != 2 && argc != 3) {
+        snprintf(errstr, ERR_STR_LEN, "query entry needs 2 or 3 fields but gives %d", argc);
+        return ERR_CODE;
+    }
+    len = strlen(argv[0]);
+    if (len == 0 || len > MAX_DOMAIN_LEN - 1) {
+        snprintf(errstr, ERR_STR_LEN, "invalid name %s", argv[0]);
+        return ERR_CODE;
+    }
+    snprintf(buf, sizeof(buf), "%s%s", argv[0], argv[0][len-1] == '.'? "": ".");
+    if ((type = strToDNSType(argv[1])) == PROTO_ERR) {
+        snprintf(errstr, ERR_STR_LEN, "unsupported type %s", argv[1]);
+        return ERR_CODE;
+    }
+    *weight = 1;
+    if (argc == 3 && (*weight = strtoull(argv[2], NULL, 10)) == 0) {
+        snprintf(errstr, ERR_STR_LEN, "invalid weight %s", argv[2]);
+        return ERR_CODE;
+    }
+    if (strcmp(buf, ".") == 0) {
+        q->name[0] = 0;
+        q->name_len = 1;
+    } else {
+        dot2lenlabel(buf, q->name);
+        q->name_len = (uint16_t)(strlen(buf) + 1);
+    }
+    q->qtype = (uint16_t)type;
+    return OK_CODE;
+}
+
+static int load_query_file(const char *fname) {
+    char line[1024], errstr[ERR_STR_LEN];
+    char *argv[4];
+    int argc, lineno = 0;
+    uint64_t weight, total = 0;
+    FILE *fp = fopen(fname, "r");
+
+    if (fp == NULL) {
+        LOG_ERROR(DPDK, "can't open loadgen query file %s: %s.", fname, strerror(errno));
+        return ERR_CODE;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && lg->nr_queries < LG_MAX_QUERIES) {
+        lineno++;
+        argc = 4;
+        if (tokenize(line, argv, &argc, " \t\r\n") < 0) goto invalid;
+        if (argc == 0 || argv[0][0] == '#') continue;
+        if (parse_query_line(errstr, argc, argv, &lg->queries[lg->nr_queries], &weight) != OK_CODE)
+            goto invalid;
+        total += weight;
+        lg->cum_weights[lg->nr_queries++] = total;
+    }
+    fclose(fp);
+    return OK_CODE;
+invalid:
+    LOG_ERROR(DPDK, "%s:%d: invalid query entry.", fname, lineno);
+    fclose(fp);
+    return ERR_CODE;
+}
+
+/*
+ * every (name, type) of the loaded zones is a query with weight 1.
+ */
+static void load_zone_queries(void) {
+    struct cds_lfht_iter iter;
+    dictIterator *it;
+    dictEntry *de;
+    zone *z;
+
+    zoneDictRLock(sk.zd);
+    cds_lfht_for_each_entry(sk.zd->ht, &iter, z, htnode) {
+        it = dictGetIterator(z->d);
+        while ((de = dictNext(it)) != NULL) {
+            char *k = dictGetKey(de);
+            dnsDictValue *dv = dictGetVal(de);
+            size_t klen = strcmp(k, "@") == 0? 0: strlen(k);
+
+            // originLen doesn't include the last 0.
+            if (klen + z->originLen + 1 > MAX_DOMAIN_LEN) continue;
+            for (int i = 0; i < SUPPORT_TYPE_NUM && lg->nr_queries < LG_MAX_QUERIES; ++i) {
+                RRSet *rs = dv->v.rsArr[i];
+                lg_query_t *q = &lg->queries[lg->nr_queries];
+
+                if (rs == NULL) continue;
+                memcpy(q->name, k, klen);
+                memcpy(q->name + klen, z->origin, z->originLen + 1);
+                q->name_len = (uint16_t)(klen + z->originLen + 1);
+                q->qtype = rs->type;
+                lg->nr_queries++;
+                lg->cum_weights[lg->nr_queries-1] = (uint64_t)lg->nr_queries;
+            }
+        }
+        dictReleaseIterator(it);
+    }
+    zoneDictRUnlock(sk.zd);
+}
+
+static int pick_query(void) {
+    uint64_t r = rte_rand() % lg->cum_weights[lg->nr_queries-1];
+    int lo = 0, hi = lg->nr_queries - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lg->cum_weights[mid] > r) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+static uint32_t pick_client(void) {
+    uint32_t idx;
+
+    if (lg->client_cdf == NULL) {
+        idx = (uint32_t)(rte_rand() % lg->nr_clients);
+    } else {
+        double r = (double)(rte_rand() >> 11) / (double)(1ULL << 53);
+        uint32_t lo = 0, hi = lg->nr_clients - 1;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (lg->client_cdf[mid] > r) hi = mid;
+            else lo = mid + 1;
+        }
+        idx = lo;
+    }
+    return LG_CLIENT_BASE + idx;
+}
+
+static void init_client_cdf(void) {
+    double sum = 0;
+
+    lg->client_cdf = rte_malloc_socket("loadgen_cdf", lg->nr_clients * sizeof(double), 0,
+                                       (int)rte_socket_id());
+    if (lg->client_cdf == NULL)
+        rte_exit(EXIT_FAILURE, "can't allocate loadgen client table.\n");
+    // zipf distribution with exponent 1.
+    for (uint32_t i = 0; i < lg->nr_clients; ++i) {
+        sum += 1.0 / (double)(i + 1);
+        lg->client_cdf[i] = sum;
+    }
+    for (uint32_t i = 0; i < lg->nr_clients; ++i) {
+        lg->client_cdf[i] /= sum;
+    }
+}
+
+static uint32_t question_hash(const uint8_t *p, size_t len) {
+    return rte_jhash(p, (uint32_t)len, 0);
+}
+
+/*
+ * build the question section at `p`, return its size.
+ */
+static size_t build_question(uint8_t *p, const lg_query_t *q, bool nx) {
+    static const char hex[] = "0123456789abcdef";
+    uint8_t *start = p;
+
+    if (nx) {
+        uint64_t r = rte_rand();
+        *p++ = LG_NX_LABEL_LEN;
+        for (int i = 0; i < LG_NX_LABEL_LEN; ++i, r >>= 4) *p++ = (uint8_t)hex[r & 0xF];
+    }
+    rte_memcpy(p, q->name, q->name_len);
+    if (sk.loadgen_random_case) {
+        uint64_t r = rte_rand();
+        for (uint16_t i = 0; i < q->name_len; ++i) {
+            if (isalpha(p[i]) && ((r >> (i & 63)) & 1)) p[i] ^= 0x20;
+        }
+    }
+    p += q->name_len;
+    dump16be(q->qtype, (char *)p);
+    dump16be(DNS_CLASS_IN, (char *)p + 2);
+    return (size_t)(p + 4 - start);
+}
+
+static struct rte_mbuf *build_query(void) {
+    const lg_query_t *q = &lg->queries[pick_query()];
+    bool nx = sk.loadgen_nxdomain_ratio > 0 &&
+              (int)(rte_rand() % 100) < sk.loadgen_nxdomain_ratio &&
+              q->name_len + LG_NX_LABEL_LEN + 1 <= MAX_DOMAIN_LEN;
+    struct rte_mbuf *m;
+    struct ether_hdr *eth;
+    struct ipv4_hdr *ip;
+    struct udp_hdr *udp;
+    uint8_t *dns;
+    size_t qlen;
+    uint16_t id = lg->next_id++;
+    lg_inflight_t *f = &lg->inflight[id];
+
+    if ((m = rte_pktmbuf_alloc(lg->pool)) == NULL) return NULL;
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ip = (struct ipv4_hdr *)(eth + 1);
+    udp = (struct udp_hdr *)(ip + 1);
+    dns = (uint8_t *)(udp + 1);
+
+    dumpDNSHeader((char *)dns, DNS_HDR_SIZE, id, 0, 1, 0, 0, 0);
+    qlen = build_question(dns + DNS_HDR_SIZE, q, nx);
+
+    ether_addr_copy(&lg->dst_eth, &eth->d_addr);
+    ether_addr_copy(&lg_eth_addr, &eth->s_addr);
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+    memset(ip, 0, sizeof(*ip));
+    ip->version_ihl = 0x45;
+    ip->total_length = rte_cpu_to_be_16((uint16_t)(sizeof(*ip) + sizeof(*udp) + DNS_HDR_SIZE + qlen));
+    ip->time_to_live = 64;
+    ip->next_proto_id = IPPROTO_UDP;
+    ip->src_addr = rte_cpu_to_be_32(pick_client());
+    ip->dst_addr = lg->dst_ip;
+    ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+    udp->src_port = rte_cpu_to_be_16((uint16_t)(1024 + rte_rand() % 64512));
+    udp->dst_port = rte_cpu_to_be_16((uint16_t)sk.port);
+    udp->dgram_len = rte_cpu_to_be_16((uint16_t)(sizeof(*udp) + DNS_HDR_SIZE + qlen));
+    udp->dgram_cksum = 0;
+    // the workers verify the checksum in software on the ring port.
+    udp->dgram_cksum = rte_ipv4_udptcp_cksum(ip, udp);
+
+    m->data_len = (uint16_t)(sizeof(*eth) + sizeof(*ip) + sizeof(*udp) + DNS_HDR_SIZE + qlen);
+    m->pkt_len = m->data_len;
+
+    if (f->tsc) {
+        // the query sent with this id is not answered.
+        sk_loadgen_stats.lost++;
+        lg->nr_inflight--;
+    }
+    f->tsc = rte_rdtsc();
+    f->qhash = question_hash(dns + DNS_HDR_SIZE, qlen);
+    f->nx = nx;
+    lg->nr_inflight++;
+    return m;
+}
+
+/*
+ * the query can't be enqueued, so it is not in flight.
+ */
+static void cancel_query(struct rte_mbuf *m) {
+    char *dns = rte_pktmbuf_mtod_offset(m, char *, sizeof(struct ether_hdr) +
+                                        sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr));
+    lg->inflight[load16be(dns)].tsc = 0;
+    lg->nr_inflight--;
+    rte_pktmbuf_free(m);
+}
+
+static void check_response(struct rte_mbuf *m, uint64_t now) {
+    uint8_t buf[DNS_HDR_SIZE + MAX_DOMAIN_LEN + 6];
+    const struct ipv4_hdr *ip;
+    const uint8_t *dns, *p, *end;
+    uint32_t dns_off, len;
+    lg_inflight_t *f;
+    uint16_t id;
+    uint64_t us;
+
+    sk_loadgen_stats.received++;
+    ip = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, sizeof(struct ether_hdr));
+    dns_off = (uint32_t)(sizeof(struct ether_hdr) + (ip->version_ihl & 0x0F) * 4 + sizeof(struct udp_hdr));
+    if (rte_pktmbuf_pkt_len(m) < dns_off + DNS_HDR_SIZE) goto bad;
+    len = RTE_MIN(rte_pktmbuf_pkt_len(m) - dns_off, (uint32_t)sizeof(buf));
+    if ((dns = rte_pktmbuf_read(m, dns_off, len, buf)) == NULL) goto bad;
+
+    id = load16be((char *)dns);
+    f = &lg->inflight[id];
+    if (f->tsc == 0 || (dns[2] & 0x80) == 0) goto bad;
+
+    us = (now - f->tsc) * US_PER_S / rte_get_tsc_hz();
+    sk_loadgen_stats.hist[RTE_MIN(us, (uint64_t)(SK_LOADGEN_HIST_SIZE - 1))]++;
+    f->tsc = 0;
+    lg->nr_inflight--;
+
+    // the question must be echoed as it is sent(including the case).
+    end = dns + len;
+    for (p = dns + DNS_HDR_SIZE; p < end && *p; p += *p + 1) ;
+    if (p + 5 > end || question_hash(dns + DNS_HDR_SIZE, (size_t)(p + 5 - dns - DNS_HDR_SIZE)) != f->qhash) {
+        sk_loadgen_stats.bad_answer++;
+        return;
+    }
+    if ((dns[3] & 0x0F) != (f->nx? DNS_RCODE_NXDOMAIN: DNS_RCODE_OK)) {
+        sk_loadgen_stats.bad_rcode++;
+        return;
+    }
+    sk_loadgen_stats.ok++;
+    return;
+bad:
+    sk_loadgen_stats.bad_answer++;
+}
+
+/*
+ * the latency(microseconds) of percentile `pct`.
+ */
+uint64_t sk_loadgen_percentile(double pct) {
+    uint64_t total = 0, acc = 0, target;
+
+    for (int i = 0; i < SK_LOADGEN_HIST_SIZE; ++i) total += sk_loadgen_stats.hist[i];
+    if (total == 0) return 0;
+    target = (uint64_t)ceil((double)total * pct / 100.0);
+    for (int i = 0; i < SK_LOADGEN_HIST_SIZE; ++i) {
+        acc += sk_loadgen_stats.hist[i];
+        if (acc >= target) return (uint64_t)i;
+    }
+    return SK_LOADGEN_HIST_SIZE - 1;
+}
+
+sds sk_loadgen_info(sds s) {
+    sk_loadgen_stats_t *st = &sk_loadgen_stats;
+    return sdscatprintf(s,
+                        "loadgen_running:%d\r\n"
+                        "loadgen_sent:%llu\r\n"
+                        "loadgen_received:%llu\r\n"
+                        "loadgen_ok:%llu\r\n"
+                        "loadgen_bad_rcode:%llu\r\n"
+                        "loadgen_bad_answer:%llu\r\n"
+                        "loadgen_lost:%llu\r\n"
+                        "loadgen_qps:%.2f\r\n"
+                        "loadgen_latency_p50_us:%llu\r\n"
+                        "loadgen_latency_p90_us:%llu\r\n"
+                        "loadgen_latency_p99_us:%llu\r\n"
+                        "loadgen_latency_p999_us:%llu\r\n",
+                        st->running,
+                        (unsigned long long)st->sent,
+                        (unsigned long long)st->received,
+                        (unsigned long long)st->ok,
+                        (unsigned long long)st->bad_rcode,
+                        (unsigned long long)st->bad_answer,
+                        (unsigned long long)st->lost,
+                        st->qps,
+                        (unsigned long long)sk_loadgen_percentile(50),
+                        (unsigned long long)sk_loadgen_percentile(90),
+                        (unsigned long long)sk_loadgen_percentile(99),
+                        (unsigned long long)sk_loadgen_percentile(99.9));
+}
+
+/*
+ * create the ring port, it gets the port id following the physical ports,
+ * the vdevs and the bonds, must be called before the ports are configured.
+ */
+void sk_create_loadgen_port(void) {
+    char name[RTE_RING_NAMESIZE];
+    uint8_t portid = (uint8_t)rte_eth_dev_count();
+    port_info_t *pinfo = sk.port_info[portid];
+    int socketid = (int)rte_lcore_to_socket_id((unsigned)sk.loadgen_lcore_id);
+    int ret;
+
+    if (pinfo == NULL)
+        rte_exit(EXIT_FAILURE, "loadgen port is port %d, it should be in portmask and queue_config.\n", portid);
+    if (!pinfo->has_ipv4)
+        rte_exit(EXIT_FAILURE, "loadgen port %d needs an ipv4 address.\n", portid);
+
+    lg = rte_zmalloc_socket("loadgen", sizeof(*lg), RTE_CACHE_LINE_SIZE, socketid);
+    if (lg == NULL) rte_exit(EXIT_FAILURE, "can't allocate loadgen state.\n");
+
+    // one ring pair for each queue, including the exception queue,
+    // its rx ring is unused unless flow steering is on.
+    lg->nr_worker_queues = pinfo->nr_lcore;
+    lg->nr_queues = pinfo->nr_lcore + (sk.exception_queue_on? 1: 0);
+    if (lg->nr_queues > LG_MAX_RX_QUEUES)
+        rte_exit(EXIT_FAILURE, "loadgen port has too many queues(max %d).\n", LG_MAX_RX_QUEUES);
+    for (int i = 0; i < lg->nr_queues; ++i) {
+        snprintf(name, sizeof(name), "loadgen_rx%d", i);
+        lg->rx_rings[i] = rte_ring_create(name, LG_RING_SIZE, socketid, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        snprintf(name, sizeof(name), "loadgen_tx%d", i);
+        lg->tx_rings[i] = rte_ring_create(name, LG_RING_SIZE, socketid, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (lg->rx_rings[i] == NULL || lg->tx_rings[i] == NULL)
+            rte_exit(EXIT_FAILURE, "can't create loadgen rings.\n");
+    }
+    ret = rte_eth_from_rings("net_ring_loadgen", lg->rx_rings, (unsigned)lg->nr_queues,
+                             lg->tx_rings, (unsigned)lg->nr_queues, (unsigned)socketid);
+    if (ret != portid)
+        rte_exit(EXIT_FAILURE, "can't create loadgen port %d: err=%d\n", portid, ret);
+    lg->port_id = portid;
+
+    lg->pool = rte_pktmbuf_pool_create("loadgen_pool", LG_NB_MBUF, LG_MBUF_CACHE, 0,
+                                       RTE_MBUF_DEFAULT_BUF_SIZE, socketid);
+    if (lg->pool == NULL) rte_exit(EXIT_FAILURE, "can't create loadgen mbuf pool.\n");
+    LOG_INFO(DPDK, "loadgen port is port %d, %d queues.", portid, lg->nr_queues);
+}
+
+static int init_queries(void) {
+    int socketid = (int)rte_socket_id();
+
+    lg->queries = rte_malloc_socket("loadgen_queries", LG_MAX_QUERIES * sizeof(lg_query_t), 0, socketid);
+    lg->cum_weights = rte_malloc_socket("loadgen_weights", LG_MAX_QUERIES * sizeof(uint64_t), 0, socketid);
+    if (lg->queries == NULL || lg->cum_weights == NULL) {
+        LOG_ERROR(DPDK, "can't allocate loadgen queries.");
+        return ERR_CODE;
+    }
+    if (sk.loadgen_query_file) {
+        if (load_query_file(sk.loadgen_query_file) != OK_CODE) return ERR_CODE;
+    } else {
+        // the zones may still be loading.
+        while (!sk.force_quit && zoneDictGetNumZones(sk.zd) == 0) usleep(100000);
+        load_zone_queries();
+    }
+    if (lg->nr_queries == 0) {
+        LOG_ERROR(DPDK, "loadgen has no query to send.");
+        return ERR_CODE;
+    }
+    LOG_INFO(DPDK, "loadgen: %d queries.", lg->nr_queries);
+    return OK_CODE;
+}
+
+static void log_report(void) {
+    sk_loadgen_stats_t *st = &sk_loadgen_stats;
+    LOG_INFO(DPDK, "loadgen: sent %llu, received %llu, ok %llu, bad rcode %llu, "
+                   "bad answer %llu, lost %llu, qps %.2f, latency(us) p50 %llu "
+                   "p90 %llu p99 %llu p99.9 %llu.",
+             (unsigned long long)st->sent, (unsigned long long)st->received,
+             (unsigned long long)st->ok, (unsigned long long)st->bad_rcode,
+             (unsigned long long)st->bad_answer, (unsigned long long)st->lost, st->qps,
+             (unsigned long long)sk_loadgen_percentile(50),
+             (unsigned long long)sk_loadgen_percentile(90),
+             (unsigned long long)sk_loadgen_percentile(99),
+             (unsigned long long)sk_loadgen_percentile(99.9));
+}
+
+void sk_loadgen_main_loop(void) {
+    struct rte_mbuf *burst[MAX_PKT_BURST];
+    sk_loadgen_stats_t *st = &sk_loadgen_stats;
+    uint64_t hz = rte_get_tsc_hz(), now, start, deadline, next_report, next_send;
+    uint64_t interval = sk.loadgen_rate > 0? hz / (uint64_t)sk.loadgen_rate: 0;
+    uint64_t last_received = 0;
+    int q = 0, n, sent;
+
+    port_info_t *pinfo = sk.port_info[lg->port_id];
+
+    // the queries are sent to the first ipv4 address of the port.
+    lg->dst_eth = pinfo->eth_addr;
+    for (int i = 0; i < pinfo->nr_addrs; ++i) {
+        if (pinfo->addrs[i].family == AF_INET) {
+            memcpy(&lg->dst_ip, pinfo->addrs[i].addr, 4);
+            break;
+        }
+    }
+    lg->nr_clients = (uint32_t)sk.loadgen_clients;
+    if (strcasecmp(sk.loadgen_client_dist, "zipf") == 0) init_client_cdf();
+    if (init_queries() != OK_CODE) return;
+
+    st->running = true;
+    start = now = rte_rdtsc();
+    next_send = now;
+    next_report = now + hz;
+    deadline = sk.loadgen_duration > 0? now + hz * (uint64_t)sk.loadgen_duration: UINT64_MAX;
+    LOG_INFO(DPDK, "loadgen is started on lcore %u.", rte_lcore_id());
+
+    while (!sk.force_quit && now < deadline) {
+        // send a burst to the next queue served by a worker.
+        n = 0;
+        while (n < MAX_PKT_BURST && lg->nr_inflight < (uint64_t)sk.loadgen_max_inflight &&
+               (interval == 0 || next_send <= now)) {
+            if ((burst[n] = build_query()) == NULL) break;
+            next_send += interval;
+            n++;
+        }
+        if (n > 0) {
+            sent = (int)rte_ring_enqueue_burst(lg->rx_rings[q], (void **)burst, (unsigned)n, NULL);
+            for (int i = sent; i < n; ++i) cancel_query(burst[i]);
+            st->sent += sent;
+            q = (q + 1) % lg->nr_worker_queues;
+        }
+
+        now = rte_rdtsc();
+        for (int i = 0; i < lg->nr_queues; ++i) {
+            n = (int)rte_ring_dequeue_burst(lg->tx_rings[i], (void **)burst, MAX_PKT_BURST, NULL);
+            for (int j = 0; j < n; ++j) {
+                check_response(burst[j], now);
+                rte_pktmbuf_free(burst[j]);
+            }
+        }
+
+        if (now >= next_report) {
+            st->qps = (double)(st->received - last_received);
+            last_received = st->received;
+            next_report += hz;
+            LOG_INFO(DPDK, "loadgen: %.0f qps, %llu in flight.", st->qps,
+                     (unsigned long long)lg->nr_inflight);
+        }
+    }
+    st->lost += lg->nr_inflight;
+    st->qps = (double)st->received * (double)hz / (double)(rte_rdtsc() - start);
+    st->running = false;
+    log_report();
+}
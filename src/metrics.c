@@ -0,0 +1,367 @@
+//
+// OpenMetrics exporter.
+//
+// a tiny HTTP/1.1 server on the event loop of master, it only serves
+// GET /metrics, every response closes the connection. the metrics are built
+// from the counters the lcores already keep, so a scrape never stops or
+// signals an lcore, the NIC statistics are read through the ethdev API.
+//
+#include <stdio.h>
+#include <unistd.h>
+
+#include "shuke.h"
+#include "utils.h"
+
+#define METRICS_MAX_REQUEST 4096
+// seconds an idle connection is kept.
+#define METRICS_CONN_EXPIRE 10
+
+typedef struct _metricsConn {
+    int fd;
+    size_t nRead;
+    char buf[METRICS_MAX_REQUEST + 1];
+    sds reply;
+    size_t wcur;
+    long lastActiveTs;
+    struct list_head node;
+} metricsConn;
+
+static int metrics_fd = -1;
+static struct list_head metrics_conns;
+
+static void metricsAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void metricsReadHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void metricsWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+static sds metricFamily(sds s, const char *name, const char *type, const char *help) {
+    return sdscatprintf(s, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static sds genLcoreMetrics(sds s) {
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } counters[] = {
+        {"shuke_lcore_received_packets", "Packets received by the lcore.",
+         offsetof(lcore_conf_t, received_req)},
+        {"shuke_lcore_dequeued_packets", "Packets fetched from the I/O lcores by the worker.",
+         offsetof(lcore_conf_t, dequeued_req)},
+        {"shuke_lcore_requests", "Requests answered by the lcore.",
+         offsetof(lcore_conf_t, nr_req)},
+        {"shuke_lcore_dropped_requests", "Requests dropped by the lcore.",
+         offsetof(lcore_conf_t, nr_dropped)},
+        {"shuke_lcore_bad_dst_packets", "DNS packets sent to non-service addresses.",
+         offsetof(lcore_conf_t, nr_bad_dst)},
+    };
+
+    for (size_t j = 0; j < RTE_DIM(counters); ++j) {
+        s = metricFamily(s, counters[j].name, "counter", counters[j].help);
+        for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+            int lcore_id = sk.lcore_ids[i];
+            lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+            if (qconf == NULL) continue;
+            int64_t v = *(int64_t *)((char *)qconf + counters[j].offset);
+            s = sdscatprintf(s, "%s_total{lcore=\"%d\"} %lld\n",
+                             counters[j].name, lcore_id, (long long)v);
+        }
+    }
+    return s;
+}
+
+static sds genPortMetrics(sds s) {
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } counters[] = {
+        {"shuke_port_rx_packets", "Packets received by the port.",
+         offsetof(struct rte_eth_stats, ipackets)},
+        {"shuke_port_tx_packets", "Packets sent by the port.",
+         offsetof(struct rte_eth_stats, opackets)},
+        {"shuke_port_rx_bytes", "Bytes received by the port.",
+         offsetof(struct rte_eth_stats, ibytes)},
+        {"shuke_port_tx_bytes", "Bytes sent by the port.",
+         offsetof(struct rte_eth_stats, obytes)},
+        {"shuke_port_rx_missed_packets", "Packets dropped by the NIC because the rx queues are full.",
+         offsetof(struct rte_eth_stats, imissed)},
+        {"shuke_port_rx_errors", "Erroneous received packets.",
+         offsetof(struct rte_eth_stats, ierrors)},
+        {"shuke_port_tx_errors", "Failed transmitted packets.",
+         offsetof(struct rte_eth_stats, oerrors)},
+        {"shuke_port_rx_nombuf", "Receive failures because no mbuf is available.",
+         offsetof(struct rte_eth_stats, rx_nombuf)},
+    };
+    struct rte_eth_stats stats[RTE_MAX_ETHPORTS];
+    bool ok[RTE_MAX_ETHPORTS];
+
+    for (int i = 0; i < sk.nr_ports; ++i) {
+        ok[i] = rte_eth_stats_get((uint8_t)sk.port_ids[i], &stats[i]) == 0;
+    }
+    for (size_t j = 0; j < RTE_DIM(counters); ++j) {
+        s = metricFamily(s, counters[j].name, "counter", counters[j].help);
+        for (int i = 0; i < sk.nr_ports; ++i) {
+            if (!ok[i]) continue;
+            uint64_t v = *(uint64_t *)((char *)&stats[i] + counters[j].offset);
+            s = sdscatprintf(s, "%s_total{port=\"%d\"} %llu\n",
+                             counters[j].name, sk.port_ids[i], (unsigned long long)v);
+        }
+    }
+
+    // the extended statistics are driver specific, not all of them are counters.
+    s = metricFamily(s, "shuke_port_xstat", "unknown", "Extended statistics of the port.");
+    for (int i = 0; i < sk.nr_ports; ++i) {
+        uint8_t portid = (uint8_t)sk.port_ids[i];
+        int n = rte_eth_xstats_get_names(portid, NULL, 0);
+        if (n <= 0) continue;
+
+        struct rte_eth_xstat_name *names = zmalloc(sizeof(*names) * n);
+        struct rte_eth_xstat *xstats = zmalloc(sizeof(*xstats) * n);
+        if (rte_eth_xstats_get_names(portid, names, (unsigned)n) == n &&
+            rte_eth_xstats_get(portid, xstats, (unsigned)n) == n) {
+            for (int k = 0; k < n; ++k) {
+                if (xstats[k].id >= (uint64_t)n) continue;
+                s = sdscatprintf(s, "shuke_port_xstat{port=\"%d\",name=\"%s\"} %llu\n",
+                                 portid, names[xstats[k].id].name,
+                                 (unsigned long long)xstats[k].value);
+            }
+        }
+        zfree(names);
+        zfree(xstats);
+    }
+    return s;
+}
+
+/*
+ * resident set size of the process, 0 if unknown.
+ */
+static uint64_t residentMemory(void) {
+    unsigned long size, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp == NULL) return 0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fp);
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static sds genMemoryMetrics(sds s) {
+    struct rte_malloc_socket_stats stat;
+
+    s = metricFamily(s, "shuke_resident_memory_bytes", "gauge",
+                     "Resident memory of the process, hugepages included.");
+    s = sdscatprintf(s, "shuke_resident_memory_bytes %llu\n",
+                     (unsigned long long)residentMemory());
+    s = metricFamily(s, "shuke_hugepage_heap_bytes", "gauge",
+                     "Size of the hugepage heap used by zmalloc and the zones.");
+    for (int i = 0; i < sk.nr_numa_id; ++i) {
+        int numa_id = sk.numa_ids[i];
+        if (rte_malloc_get_socket_stats(numa_id, &stat) != 0) continue;
+        s = sdscatprintf(s,
+                         "shuke_hugepage_heap_bytes{socket=\"%d\",state=\"total\"} %zu\n"
+                         "shuke_hugepage_heap_bytes{socket=\"%d\",state=\"allocated\"} %zu\n"
+                         "shuke_hugepage_heap_bytes{socket=\"%d\",state=\"free\"} %zu\n",
+                         numa_id, stat.heap_totalsz_bytes,
+                         numa_id, stat.heap_allocsz_bytes,
+                         numa_id, stat.heap_freesz_bytes);
+    }
+    return s;
+}
+
+static sds genZoneMetrics(sds s) {
+    static const char *outcomes[NR_RELOAD_OUTCOMES] = {
+        "ok", "unchanged", "removed", "failed",
+    };
+
+    s = metricFamily(s, "shuke_zones", "gauge", "Zones in memory.");
+    s = sdscatprintf(s, "shuke_zones %zu\n", zoneDictGetNumZones(sk.zd));
+    s = metricFamily(s, "shuke_zone_load_seconds", "gauge", "Time used by the initial zone load.");
+    s = sdscatprintf(s, "shuke_zone_load_seconds %.3f\n", (double)sk.zone_load_time / 1000.0);
+
+    s = metricFamily(s, "shuke_zone_reloads", "counter",
+                     "Zone reloads by outcome, a failed reload is counted once per try.");
+    for (int i = 0; i < NR_RELOAD_OUTCOMES; ++i) {
+        s = sdscatprintf(s, "shuke_zone_reloads_total{outcome=\"%s\"} %lld\n",
+                         outcomes[i], (long long)sk.nr_reloads[i]);
+    }
+    s = metricFamily(s, "shuke_zone_reload_seconds", "summary",
+                     "Time from a reload request to the new zone being served, retries included.");
+    s = sdscatprintf(s,
+                     "shuke_zone_reload_seconds_count %lld\n"
+                     "shuke_zone_reload_seconds_sum %.3f\n",
+                     (long long)sk.nr_timed_reloads, (double)sk.reload_ms_sum / 1000.0);
+
+    s = metricFamily(s, "shuke_rcu_retired_zones", "gauge",
+                     "Zones replaced or deleted but not freed until a grace period elapses.");
+    s = sdscatprintf(s, "shuke_rcu_retired_zones %lld\n", (long long)zoneDictNumRetired());
+    return s;
+}
+
+static sds genMetrics(void) {
+    sk_query_stats_t st;
+    sds s = sdsempty();
+
+    s = metricFamily(s, "shuke_start_time_seconds", "gauge", "Start time of the process.");
+    s = sdscatprintf(s, "shuke_start_time_seconds %lld\n", (long long)sk.starttime);
+
+    s = genLcoreMetrics(s);
+    sk_stats_collect(&st);
+    s = sk_stats_metrics(s, &st);
+    s = genPortMetrics(s);
+    s = genMemoryMetrics(s);
+    s = genZoneMetrics(s);
+
+    if (!sk.only_udp) {
+        s = metricFamily(s, "shuke_tcp_connections", "gauge", "Connections of the kernel tcp server.");
+        s = sdscatprintf(s, "shuke_tcp_connections %llu\n", (unsigned long long)sk.num_tcp_conn);
+    }
+    return sdscat(s, "# EOF\n");
+}
+
+static void metricsConnDestroy(metricsConn *c) {
+    aeDeleteFileEvent(sk.el, c->fd, AE_READABLE | AE_WRITABLE);
+    close(c->fd);
+    list_del(&c->node);
+    sdsfree(c->reply);
+    zfree(c);
+}
+
+static int metricsCron(struct aeEventLoop *el, long long id, void *clientData) {
+    UNUSED3(el, id, clientData);
+    struct list_head *pos, *temp;
+
+    list_for_each_safe(pos, temp, &metrics_conns) {
+        metricsConn *c = list_entry(pos, metricsConn, node);
+        if (sk.unixtime - c->lastActiveTs > METRICS_CONN_EXPIRE) metricsConnDestroy(c);
+    }
+    return TIME_INTERVAL;
+}
+
+int initMetricsServer(void) {
+    INIT_LIST_HEAD(&metrics_conns);
+
+    if (strchr(sk.metrics_host, ':') == NULL) {
+        metrics_fd = anetTcpServer(sk.errstr, sk.metrics_port, sk.metrics_host, sk.tcp_backlog, 0);
+    } else {
+        metrics_fd = anetTcp6Server(sk.errstr, sk.metrics_port, sk.metrics_host, sk.tcp_backlog, 0);
+    }
+    if (metrics_fd == ANET_ERR) {
+        return ERR_CODE;
+    }
+    anetNonBlock(NULL, metrics_fd);
+    if (aeCreateFileEvent(sk.el, metrics_fd, AE_READABLE, metricsAcceptHandler, NULL) == AE_ERR) {
+        LOG_ERROR(USER1, "Can't create file event for metrics socket %d", metrics_fd);
+        return ERR_CODE;
+    }
+    if (aeCreateTimeEvent(sk.el, TIME_INTERVAL, metricsCron, NULL, NULL) == AE_ERR) {
+        return ERR_CODE;
+    }
+    return OK_CODE;
+}
+
+static void metricsReply(metricsConn *c, const char *status, const char *type, sds body) {
+    c->reply = sdscatprintf(sdsempty(),
+                            "HTTP/1.1 %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n"
+                            "\r\n",
+                            status, type, sdslen(body));
+    c->reply = sdscatsds(c->reply, body);
+    sdsfree(body);
+    c->wcur = 0;
+
+    aeDeleteFileEvent(sk.el, c->fd, AE_READABLE);
+    if (aeCreateFileEvent(sk.el, c->fd, AE_WRITABLE, metricsWriteHandler, c) == AE_ERR) {
+        metricsConnDestroy(c);
+    }
+}
+
+static void handleRequest(metricsConn *c) {
+    char *path = c->buf + 4;
+    size_t len = strcspn(path, " ?\r\n");
+
+    if (strncmp(c->buf, "GET ", 4) != 0) {
+        metricsReply(c, "405 Method Not Allowed", "text/plain", sdsnew("only GET is supported.\n"));
+    } else if (len == strlen("/metrics") && strncmp(path, "/metrics", len) == 0) {
+        metricsReply(c, "200 OK",
+                     "application/openmetrics-text; version=1.0.0; charset=utf-8",
+                     genMetrics());
+    } else {
+        metricsReply(c, "404 Not Found", "text/plain", sdsnew("only /metrics is served.\n"));
+    }
+}
+
+static void metricsReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED2(el, mask);
+    metricsConn *c = privdata;
+    ssize_t n;
+
+    c->lastActiveTs = sk.unixtime;
+    n = read(fd, c->buf + c->nRead, METRICS_MAX_REQUEST - c->nRead);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+        LOG_WARN(USER1, "metrics server read: %s", strerror(errno));
+        metricsConnDestroy(c);
+        return;
+    }
+    if (n == 0) {
+        metricsConnDestroy(c);
+        return;
+    }
+    c->nRead += n;
+    c->buf[c->nRead] = 0;
+    // the body of a request is ignored.
+    if (strstr(c->buf, "\r\n\r\n") != NULL || strstr(c->buf, "\n\n") != NULL) {
+        handleRequest(c);
+    } else if (c->nRead == METRICS_MAX_REQUEST) {
+        LOG_WARN(USER1, "metrics server got a request bigger than %d bytes.", METRICS_MAX_REQUEST);
+        metricsConnDestroy(c);
+    }
+}
+
+static void metricsWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED2(el, mask);
+    metricsConn *c = privdata;
+    ssize_t n;
+
+    c->lastActiveTs = sk.unixtime;
+    while (c->wcur < sdslen(c->reply)) {
+        n = write(fd, c->reply + c->wcur, sdslen(c->reply) - c->wcur);
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            LOG_WARN(USER1, "metrics server can't write data to client: %s", strerror(errno));
+            break;
+        }
+        c->wcur += n;
+    }
+    metricsConnDestroy(c);
+}
+
+#define MAX_ACCEPTS_PER_CALL 1000
+static void metricsAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED2(privdata, mask);
+    int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
+    char cip[IP_STR_LEN];
+
+    while(max--) {
+        cfd = anetTcpAccept(sk.errstr, fd, cip, sizeof(cip), &cport);
+        if (cfd == ANET_ERR) {
+            if (errno != EWOULDBLOCK)
+                LOG_WARN(USER1, "Accepting metrics connection: %s", sk.errstr);
+            return;
+        }
+        anetNonBlock(NULL, cfd);
+        anetEnableTcpNoDelay(NULL, cfd);
+
+        metricsConn *c = zcalloc(sizeof(*c));
+        c->fd = cfd;
+        c->lastActiveTs = sk.unixtime;
+        list_add_tail(&c->node, &metrics_conns);
+        if (aeCreateFileEvent(el, cfd, AE_READABLE, metricsReadHandler, c) == AE_ERR) {
+            LOG_ERROR(USER1, "metrics server can't create file event for client. %s", strerror(errno));
+            metricsConnDestroy(c);
+            return;
+        }
+    }
+}
@@ -158,6 +158,7 @@ ok:
             }
         } else if (ctx->new_zn == NULL) {
             LOG_WARN(MONGO, "zone %s is not in mongodb.", ctx->dotOrigin);
+            zoneReloadDone(ctx, RELOAD_FAILED);
             zoneReloadContextDestroy(ctx);
         } else if (ctx->new_zn->soa == NULL) {
             LOG_ERROR(MONGO, "zone %s must contain a SOA record.", ctx->dotOrigin);
@@ -168,6 +169,7 @@ ok:
             LOG_INFO(MONGO, "reload zone %s successfully. ", ctx->dotOrigin);
             replaceZoneAllNumaNodes(ctx->new_zn);
             ctx->new_zn = NULL;
+            zoneReloadDone(ctx, RELOAD_OK);
             zoneReloadContextDestroy(ctx);
         }
     }
@@ -192,6 +194,7 @@ static void zoneSOAGetCallback(mongoAsyncContext *c, void *r, void *privdata) {
         LOG_INFO(MONGO, "zone %s is removed.", ctx->dotOrigin);
         dot2lenlabel(ctx->dotOrigin, origin);
         deleteZoneAllNumaNodes(origin);
+        zoneReloadDone(ctx, RELOAD_REMOVED);
         zoneReloadContextDestroy(ctx);
         goto ok;
     }
@@ -212,6 +215,7 @@ static void zoneSOAGetCallback(mongoAsyncContext *c, void *r, void *privdata) {
         dot2lenlabel(ctx->dotOrigin, origin);
         masterRefreshZone(origin);
 
+        zoneReloadDone(ctx, RELOAD_UNCHANGED);
         zoneReloadContextDestroy(ctx);
         goto ok;
     } else {
@@ -255,6 +255,46 @@ int parseDnsQuestion(char *buf, size_t size, char **name, uint16_t *qType, uint1
     return (int) (nameLen + 4);
 }
 
+/*
+ * parse the OPT RR(rfc 6891) of a query, options are ignored.
+ * return the length of the RR or PROTO_ERR.
+ */
+int parseEdnsOpt(char *buf, size_t size, uint16_t *udpSize, uint8_t *version) {
+    size_t rdlength;
+    // the owner name must be root.
+    if (size < DNS_OPT_RR_SIZE || buf[0] != 0) {
+        return PROTO_ERR;
+    }
+    if (load16be(buf+1) != DNS_TYPE_OPT) {
+        return PROTO_ERR;
+    }
+    rdlength = load16be(buf+9);
+    if (size < DNS_OPT_RR_SIZE + rdlength) {
+        return PROTO_ERR;
+    }
+    *udpSize = load16be(buf+3);
+    *version = (uint8_t)buf[6];
+    return (int) (DNS_OPT_RR_SIZE + rdlength);
+}
+
+/*
+ * dump an OPT RR without options, extRcode is the upper 8 bits of the rcode.
+ */
+int dumpEdnsOpt(char *buf, size_t size, uint16_t udpSize, uint8_t extRcode) {
+    if (size < DNS_OPT_RR_SIZE) {
+        return PROTO_ERR;
+    }
+    buf[0] = 0;
+    dump16be(DNS_TYPE_OPT, buf+1);
+    dump16be(udpSize, buf+3);
+    buf[5] = (char)extRcode;
+    // version 0, no flags, no options.
+    buf[6] = 0;
+    dump16be(0, buf+7);
+    dump16be(0, buf+9);
+    return DNS_OPT_RR_SIZE;
+}
+
 int dumpDnsQuestion(char *buf, size_t size, char *name, uint16_t qType, uint16_t qClass) {
     char *p = buf;
     size_t nameLen = strlen(name) + 1;
@@ -30,6 +30,12 @@ typedef struct _dname {
 #define MAX_LABEL_LEN   (63)
 #define MAX_DOMAIN_LEN  (255)
 #define MAX_UDP_SIZE    (512)
+// rfc 6891, OPT RR without options: root name, type, class, ttl, rdlength.
+#define DNS_OPT_RR_SIZE (11)
+// udp payload size advertised in the OPT RR of tcp responses.
+#define EDNS_UDP_SIZE   (1232)
+// extended rcode of BADVERS, the upper 8 bits of 16.
+#define EDNS_RCODE_BADVERS (1)
 
 // rfc 2817
 #define MAX_TTL (7 * 86400)
@@ -286,6 +292,8 @@ static inline int dnsHeader_dump(dnsHeader_t *hdr, char *buf, size_t size) {
 }
 
 int parseDnsQuestion(char *buf, size_t size, char **name, uint16_t *qType, uint16_t *qClass);
+int parseEdnsOpt(char *buf, size_t size, uint16_t *udpSize, uint8_t *version);
+int dumpEdnsOpt(char *buf, size_t size, uint16_t udpSize, uint8_t extRcode);
 int dumpDnsQuestion(char *buf, size_t size, char *name, uint16_t qType, uint16_t qClass);
 static inline
 int dnsQuestion_load(char *buf, size_t size, dnsQuestion_t *q) {
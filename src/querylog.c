@@ -0,0 +1,404 @@
+//
+// asynchronous query log.
+//
+// the lcores never format or write the query log, every lcore owns a
+// single producer/single consumer ring of fixed size records, the query
+// path only copies the question and client address to the ring. a writer
+// thread drains the rings, formats the records and writes the log file, it
+// also rotates the file. when a ring is full, the record is dropped and
+// counted.
+//
+// sampling is deterministic: query_log_sample_rate logs 1 in N queries of
+// every lcore, query_log_qname_sample only logs the names whose hash is a
+// multiple of N, so all the queries of these names are kept.
+//
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "shuke.h"
+
+#define QLOG_IDLE_SLEEP_US 1000
+
+/* frame streams control frames */
+#define FSTRM_CONTROL_START 0x02
+#define FSTRM_CONTROL_STOP  0x03
+#define FSTRM_CONTROL_FIELD_CONTENT_TYPE 0x01
+#define QLOG_CONTENT_TYPE "shuke.querylog.v1"
+
+typedef struct sk_qlog_ring {
+    /* written by the lcore */
+    volatile uint32_t head __rte_cache_aligned;
+    uint64_t nr_seen;
+    uint64_t nr_dropped;
+
+    /* written by the writer thread */
+    volatile uint32_t tail __rte_cache_aligned;
+
+    uint32_t mask __rte_cache_aligned;
+    sk_qlog_rec_t recs[];
+} sk_qlog_ring_t;
+
+static pthread_t writer_tid;
+static volatile bool writer_stop = false;
+static uint64_t nr_written = 0;
+static size_t file_size = 0;
+
+int sk_qlog_parse_format(const char *s) {
+    if (strcasecmp(s, "text") == 0) return QLOG_FORMAT_TEXT;
+    if (strcasecmp(s, "binary") == 0) return QLOG_FORMAT_BINARY;
+    if (strcasecmp(s, "framed") == 0) return QLOG_FORMAT_FRAMED;
+    return -1;
+}
+
+uint32_t sk_qname_hash(const char *name, size_t len) {
+    // FNV-1a, case insensitive.
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)tolower((unsigned char)name[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * called in the query path, only the owner lcore of the ring can call it.
+ */
+void sk_qlog_append(struct context *ctx, int family, const void *addr,
+                    uint16_t cport, bool is_tcp) {
+    sk_qlog_ring_t *r = sk.lcore_conf[ctx->lcore_id]->qlog_ring;
+    sk_qlog_rec_t *rec;
+    uint32_t head;
+    size_t name_len;
+
+    if (unlikely(r == NULL)) return;
+    if (sk.query_log_sample_rate > 1 &&
+        (r->nr_seen++ % (uint64_t)sk.query_log_sample_rate) != 0)
+        return;
+    if (sk.query_log_qname_sample > 1 &&
+        sk_qname_hash(ctx->name, ctx->nameLen) % (uint32_t)sk.query_log_qname_sample != 0)
+        return;
+
+    head = r->head;
+    if (unlikely(head - r->tail > r->mask)) {
+        r->nr_dropped++;
+        return;
+    }
+    rec = &r->recs[head & r->mask];
+    rec->ts_ms = rte_tsc_mstime();
+    rec->qtype = ctx->qType;
+    rec->cport = cport;
+    rec->family = (uint8_t)family;
+    rec->is_tcp = is_tcp;
+    name_len = RTE_MIN(ctx->nameLen + 1, sizeof(rec->name) - 1);
+    rec->name_len = (uint8_t)name_len;
+    memcpy(rec->addr, addr, family == AF_INET? 4: 16);
+    memcpy(rec->name, ctx->name, name_len);
+    rec->name[name_len] = 0;
+
+    // the record must be visible before the new head.
+    rte_smp_wmb();
+    r->head = head + 1;
+}
+
+static void write_be32(FILE *fp, uint32_t v) {
+    v = htonl(v);
+    fwrite_unlocked(&v, 4, 1, fp);
+}
+
+static void write_control_frame(FILE *fp, uint32_t type) {
+    uint32_t len = 4;
+    if (type == FSTRM_CONTROL_START) len += 8 + sizeof(QLOG_CONTENT_TYPE) - 1;
+    // escape sequence
+    write_be32(fp, 0);
+    write_be32(fp, len);
+    write_be32(fp, type);
+    if (type == FSTRM_CONTROL_START) {
+        write_be32(fp, FSTRM_CONTROL_FIELD_CONTENT_TYPE);
+        write_be32(fp, sizeof(QLOG_CONTENT_TYPE) - 1);
+        fwrite_unlocked(QLOG_CONTENT_TYPE, sizeof(QLOG_CONTENT_TYPE) - 1, 1, fp);
+    }
+    file_size += 12 + (len - 4);
+}
+
+static void write_record(FILE *fp, sk_qlog_rec_t *rec) {
+    static time_t last_sec = -1;
+    static char time_buf[32];
+    char line[512];
+    char dotName[MAX_DOMAIN_LEN+2];
+    char cip[INET6_ADDRSTRLEN];
+    time_t sec = (time_t)(rec->ts_ms / 1000);
+    struct tm tm;
+    int n;
+
+    switch (sk.query_log_format) {
+        case QLOG_FORMAT_BINARY:
+            fwrite_unlocked(rec, sizeof(*rec), 1, fp);
+            file_size += sizeof(*rec);
+            return;
+        case QLOG_FORMAT_FRAMED:
+            write_be32(fp, sizeof(*rec));
+            fwrite_unlocked(rec, sizeof(*rec), 1, fp);
+            file_size += 4 + sizeof(*rec);
+            return;
+        default:
+            break;
+    }
+    // localtime_r is expensive, so the string of current second is cached.
+    if (sec != last_sec) {
+        localtime_r(&sec, &tm);
+        strftime(time_buf, sizeof(time_buf), "%Y/%m/%d %H:%M:%S", &tm);
+        last_sec = sec;
+    }
+    len2dotlabel(rec->name, dotName);
+    inet_ntop(rec->family, rec->addr, cip, sizeof(cip));
+    n = snprintf(line, sizeof(line), "%s.%03d queries: client %s#%d%s: query %s IN %s \n",
+                 time_buf, (int)(rec->ts_ms % 1000), cip, rec->cport,
+                 rec->is_tcp? " +tcp": "", dotName, DNSTypeToStr(rec->qtype));
+    if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+    fwrite_unlocked(line, (size_t)n, 1, fp);
+    file_size += (size_t)n;
+}
+
+static FILE *open_log_file(void) {
+    FILE *fp = fopen(sk.query_log_file, "a");
+    if (fp == NULL) return NULL;
+    file_size = (size_t)ftell(fp);
+    if (sk.query_log_format == QLOG_FORMAT_FRAMED) write_control_frame(fp, FSTRM_CONTROL_START);
+    return fp;
+}
+
+/*
+ * rename file to file.1, file.1 to file.2 ..., and open a new file.
+ */
+static void rotate_log_file(void) {
+    char from[PATH_MAX], to[PATH_MAX];
+    FILE *fp;
+
+    if (sk.query_log_format == QLOG_FORMAT_FRAMED) write_control_frame(sk.query_log_fp, FSTRM_CONTROL_STOP);
+    fclose(sk.query_log_fp);
+    for (int i = sk.query_log_rotate_count - 1; i >= 1; --i) {
+        snprintf(from, sizeof(from), "%s.%d", sk.query_log_file, i);
+        snprintf(to, sizeof(to), "%s.%d", sk.query_log_file, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", sk.query_log_file);
+    if (sk.query_log_rotate_count > 0) rename(sk.query_log_file, to);
+    else unlink(sk.query_log_file);
+
+    fp = open_log_file();
+    if (fp == NULL) {
+        // keep logging to stderr rather than losing the writer.
+        LOG_ERROR(USER1, "can't open query log file %s: %s.", sk.query_log_file, strerror(errno));
+        fp = stderr;
+    }
+    sk.query_log_fp = fp;
+}
+
+static int drain_rings(void) {
+    int n = 0;
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_qlog_ring_t *r = sk.lcore_conf[sk.lcore_ids[i]]->qlog_ring;
+        uint32_t head = r->head, tail = r->tail;
+
+        if (head == tail) continue;
+        // read the records after the head.
+        rte_smp_rmb();
+        for (; tail != head; ++tail) {
+            write_record(sk.query_log_fp, &r->recs[tail & r->mask]);
+            n++;
+        }
+        // the records must be consumed before the slots are released.
+        rte_smp_mb();
+        r->tail = tail;
+    }
+    nr_written += n;
+    return n;
+}
+
+static void *query_log_writer(void *arg) {
+    ((void) arg);
+    bool can_rotate = (strcasecmp(sk.query_log_file, "stdout") != 0);
+    size_t rotate_size = (size_t)sk.query_log_rotate_size * 1024 * 1024;
+
+    while (!writer_stop) {
+        if (drain_rings() == 0) {
+            fflush(sk.query_log_fp);
+            usleep(QLOG_IDLE_SLEEP_US);
+        }
+        if (can_rotate && rotate_size > 0 && file_size >= rotate_size) {
+            rotate_log_file();
+        }
+    }
+    drain_rings();
+    if (sk.query_log_format == QLOG_FORMAT_FRAMED) write_control_frame(sk.query_log_fp, FSTRM_CONTROL_STOP);
+    fflush(sk.query_log_fp);
+    return NULL;
+}
+
+/*
+ * create the rings and start the writer thread,
+ * must be called before the lcores are launched.
+ */
+int sk_init_query_log(void) {
+    uint32_t nr_recs = rte_align32pow2((uint32_t)sk.query_log_buffer_size);
+
+    if (strcasecmp(sk.query_log_file, "stdout") == 0) {
+        sk.query_log_fp = stdout;
+        if (sk.query_log_format == QLOG_FORMAT_FRAMED) write_control_frame(stdout, FSTRM_CONTROL_START);
+    } else {
+        sk.query_log_fp = open_log_file();
+        if (sk.query_log_fp == NULL) {
+            LOG_ERROR(USER1, "can't open query log file %s: %s.", sk.query_log_file, strerror(errno));
+            return ERR_CODE;
+        }
+    }
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        int socketid = sk.numa_on? (int)rte_lcore_to_socket_id((unsigned)lcore_id): 0;
+        sk_qlog_ring_t *r = socket_calloc(socketid, 1, sizeof(*r) + nr_recs * sizeof(sk_qlog_rec_t));
+
+        if (r == NULL) {
+            LOG_ERROR(USER1, "can't allocate query log ring of lcore %d.", lcore_id);
+            return ERR_CODE;
+        }
+        r->mask = nr_recs - 1;
+        sk.lcore_conf[lcore_id]->qlog_ring = r;
+    }
+    if (pthread_create(&writer_tid, NULL, query_log_writer, NULL) != 0) {
+        LOG_ERROR(USER1, "can't create query log writer thread.");
+        return ERR_CODE;
+    }
+    return OK_CODE;
+}
+
+/*
+ * stop the writer thread after it drains the rings,
+ * must be called after the lcores exit.
+ */
+void sk_stop_query_log(void) {
+    if (sk.query_log_fp == NULL) return;
+    writer_stop = true;
+    pthread_join(writer_tid, NULL);
+    if (sk.query_log_fp != stdout && sk.query_log_fp != stderr) fclose(sk.query_log_fp);
+    sk.query_log_fp = NULL;
+}
+
+void sk_qlog_stats(uint64_t *written, uint64_t *dropped) {
+    *written = nr_written;
+    *dropped = 0;
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_qlog_ring_t *r = sk.lcore_conf[sk.lcore_ids[i]]->qlog_ring;
+        if (r) *dropped += r->nr_dropped;
+    }
+}
+
+#if defined(SK_TEST)
+#include <stddef.h>
+#include "testhelp.h"
+
+static uint32_t read_be32(FILE *fp) {
+    uint32_t v = 0;
+    if (fread(&v, 4, 1, fp) != 1) return UINT32_MAX;
+    return ntohl(v);
+}
+
+int qlogTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    char name[] = "\3www\7example\3com";
+    uint8_t addr[4] = {192, 0, 2, 1};
+    char content_type[sizeof(QLOG_CONTENT_TYPE)] = {0};
+    struct context ctx;
+    lcore_conf_t *qconf = calloc(1, sizeof(*qconf));
+    int lcore_ids[1] = {0};
+    sk_qlog_ring_t *r;
+    sk_qlog_rec_t rec;
+    FILE *fp;
+    bool ok;
+
+    test_cond("record layout", offsetof(sk_qlog_rec_t, ts_ms) == 0 &&
+                               offsetof(sk_qlog_rec_t, qtype) == 8 &&
+                               offsetof(sk_qlog_rec_t, cport) == 10 &&
+                               offsetof(sk_qlog_rec_t, family) == 12 &&
+                               offsetof(sk_qlog_rec_t, is_tcp) == 13 &&
+                               offsetof(sk_qlog_rec_t, name_len) == 14 &&
+                               offsetof(sk_qlog_rec_t, addr) == 16 &&
+                               offsetof(sk_qlog_rec_t, name) == 32 &&
+                               sizeof(sk_qlog_rec_t) == 288);
+
+    r = calloc(1, sizeof(*r) + 4 * sizeof(sk_qlog_rec_t));
+    r->mask = 3;
+    qconf->qlog_ring = r;
+    sk.lcore_conf[0] = qconf;
+    sk.lcore_ids = lcore_ids;
+    sk.nr_lcore_ids = 1;
+    sk.query_log_sample_rate = 1;
+    sk.query_log_qname_sample = 1;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.lcore_id = 0;
+    ctx.name = name;
+    ctx.nameLen = strlen(name);
+    ctx.qType = DNS_TYPE_AAAA;
+    for (int i = 0; i < 5; ++i) sk_qlog_append(&ctx, AF_INET, addr, (uint16_t)(5353 + i), i == 1);
+    test_cond("full ring drops", r->head == 4 && r->nr_dropped == 1);
+    rec = r->recs[1];
+    test_cond("record fields", rec.qtype == DNS_TYPE_AAAA && rec.cport == 5354 &&
+                               rec.family == AF_INET && rec.is_tcp == 1 &&
+                               rec.name_len == sizeof(name) &&
+                               memcmp(rec.name, name, sizeof(name)) == 0 &&
+                               memcmp(rec.addr, addr, 4) == 0);
+
+    // frame streams: start frame, one data frame per record, stop frame.
+    fp = tmpfile();
+    file_size = 0;
+    sk.query_log_format = QLOG_FORMAT_FRAMED;
+    sk.query_log_fp = fp;
+    write_control_frame(fp, FSTRM_CONTROL_START);
+    test_cond("drain ring", drain_rings() == 4 && r->tail == 4);
+    write_control_frame(fp, FSTRM_CONTROL_STOP);
+    fflush(fp);
+    test_cond("framed file size", (long)file_size == ftell(fp) &&
+                                  file_size == 2 * 12 + 8 + sizeof(QLOG_CONTENT_TYPE) - 1 +
+                                               4 * (4 + sizeof(sk_qlog_rec_t)));
+    rewind(fp);
+    ok = read_be32(fp) == 0 && read_be32(fp) == 12 + sizeof(QLOG_CONTENT_TYPE) - 1 &&
+         read_be32(fp) == FSTRM_CONTROL_START && read_be32(fp) == FSTRM_CONTROL_FIELD_CONTENT_TYPE &&
+         read_be32(fp) == sizeof(QLOG_CONTENT_TYPE) - 1 &&
+         fread(content_type, sizeof(QLOG_CONTENT_TYPE) - 1, 1, fp) == 1 &&
+         strcmp(content_type, QLOG_CONTENT_TYPE) == 0;
+    test_cond("start frame", ok);
+    ok = true;
+    for (int i = 0; i < 4; ++i) {
+        if (read_be32(fp) != sizeof(sk_qlog_rec_t) || fread(&rec, sizeof(rec), 1, fp) != 1 ||
+            memcmp(&rec, &r->recs[i], sizeof(rec)) != 0)
+            ok = false;
+    }
+    test_cond("data frames", ok);
+    test_cond("stop frame", read_be32(fp) == 0 && read_be32(fp) == 4 &&
+                            read_be32(fp) == FSTRM_CONTROL_STOP && fgetc(fp) == EOF);
+    fclose(fp);
+
+    // binary: raw records.
+    fp = tmpfile();
+    file_size = 0;
+    sk.query_log_format = QLOG_FORMAT_BINARY;
+    sk.query_log_fp = fp;
+    sk.query_log_sample_rate = 2;
+    for (int i = 0; i < 4; ++i) sk_qlog_append(&ctx, AF_INET, addr, 5353, false);
+    test_cond("sample rate", r->head - r->tail == 2);
+    drain_rings();
+    fflush(fp);
+    test_cond("binary file size", file_size == 2 * sizeof(sk_qlog_rec_t) && ftell(fp) == (long)file_size);
+    fclose(fp);
+
+    sk.query_log_fp = NULL;
+    sk.lcore_conf[0] = NULL;
+    sk.nr_lcore_ids = 0;
+    free(r);
+    free(qconf);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,51 @@
+//
+// asynchronous query log.
+//
+
+#ifndef _QUERYLOG_H_
+#define _QUERYLOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "protocol.h"
+
+struct context;
+
+enum {
+    QLOG_FORMAT_TEXT = 0,
+    // raw records
+    QLOG_FORMAT_BINARY,
+    // raw records in frame streams(the framing of dnstap) data frames
+    QLOG_FORMAT_FRAMED,
+};
+
+/*
+ * a query log record, it is also the record format of binary output,
+ * integers are in host byte order.
+ */
+typedef struct sk_qlog_rec {
+    uint64_t ts_ms;         // unix time in milliseconds
+    uint16_t qtype;
+    uint16_t cport;
+    uint8_t family;         // AF_INET or AF_INET6
+    uint8_t is_tcp;
+    uint8_t name_len;       // length of name(len label format, including the last 0)
+    uint8_t reserved;
+    uint8_t addr[16];       // ipv4 address only uses the first 4 bytes
+    char name[MAX_DOMAIN_LEN+1];
+} sk_qlog_rec_t;
+
+int sk_qlog_parse_format(const char *s);
+int sk_init_query_log(void);
+void sk_stop_query_log(void);
+void sk_qlog_append(struct context *ctx, int family, const void *addr,
+                    uint16_t cport, bool is_tcp);
+void sk_qlog_stats(uint64_t *written, uint64_t *dropped);
+uint32_t sk_qname_hash(const char *name, size_t len);
+
+#if defined(SK_TEST)
+int qlogTest(int argc, char *argv[]);
+#endif
+
+#endif /* _QUERYLOG_H_ */
@@ -0,0 +1,457 @@
+//
+// offline pcap replay.
+//
+//     shuke-server -c conf/shuke.conf -r queries.pcap [-w responses.pcap]
+//
+// the packets in a pcap or pcapng file(ethernet link type only) are fed to
+// the packet handler of the first port on master lcore, exactly as if they
+// were received from the NIC, no port, KNI or event loop is started. the
+// responses are written to a pcap file with the timestamps of their queries,
+// so the outputs of two versions can be compared byte by byte.
+//
+// the checksums are verified and computed by software, TCP and the packets
+// which would be punted to KNI are dropped. the cycles spent on reading,
+// handling and writing packets are printed as one JSON object when the
+// replay is finished.
+//
+// with -a the pcap is replayed once more for every other variant of the
+// packet handler(see DEFINE_PACKET_HANDLER), one JSON object per variant.
+// the offloads are simulated when the packets are read, which isn't timed:
+// the packet type is filled by rte_net_get_ptype, and the rx checksums are
+// marked good. only the first pass writes the responses, the others carry
+// the partial checksums left for the NIC.
+//
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+#include <rte_net.h>
+
+#include "shuke.h"
+#include "utils.h"
+
+#define REPLAY_NB_MBUF       8191
+#define REPLAY_MBUF_CACHE    256
+#define REPLAY_MAX_IFACES    64
+#define REPLAY_MAX_BLOCK     (16 * 1024 * 1024)
+#define REPLAY_SNAPLEN       65535
+
+#define PCAP_MAGIC_US        0xA1B2C3D4
+#define PCAP_MAGIC_NS        0xA1B23C4D
+#define PCAPNG_SHB           0x0A0D0D0A
+#define PCAPNG_IDB           0x00000001
+#define PCAPNG_PB            0x00000002
+#define PCAPNG_SPB           0x00000003
+#define PCAPNG_EPB           0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_TSRESOL   9
+#define LINKTYPE_ETHERNET    1
+
+typedef struct {
+    uint32_t linktype;
+    uint64_t ts_units;          // timestamp units per second
+} replay_iface_t;
+
+typedef struct {
+    FILE *fp;
+    bool pcapng;
+    bool swapped;               // the byte order of file isn't host order
+    replay_iface_t ifaces[REPLAY_MAX_IFACES];
+    int nr_ifaces;
+    uint8_t *buf;
+    size_t buf_size;
+} replay_reader_t;
+
+typedef struct {
+    uint64_t ts_us;
+    uint32_t linktype;
+    uint32_t cap_len;
+    uint32_t orig_len;
+    uint8_t *data;
+} replay_pkt_t;
+
+static inline uint32_t r32(replay_reader_t *r, const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped? __builtin_bswap32(v): v;
+}
+
+static inline uint16_t r16(replay_reader_t *r, const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return r->swapped? __builtin_bswap16(v): v;
+}
+
+static int reserve_buf(replay_reader_t *r, size_t size) {
+    if (size <= r->buf_size) return OK_CODE;
+    uint8_t *buf = realloc(r->buf, size);
+    if (buf == NULL) return ERR_CODE;
+    r->buf = buf;
+    r->buf_size = size;
+    return OK_CODE;
+}
+
+static uint64_t ts_to_us(uint64_t ts, uint64_t units) {
+    return ts / units * US_PER_S + (uint64_t)((double)(ts % units) * US_PER_S / units);
+}
+
+static int open_reader(char *errstr, replay_reader_t *r, const char *fname) {
+    uint8_t hdr[24];
+    uint32_t magic;
+
+    memset(r, 0, sizeof(*r));
+    if ((r->fp = fopen(fname, "r")) == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "can't open %s: %s.", fname, strerror(errno));
+        return ERR_CODE;
+    }
+    if (fread(hdr, 4, 1, r->fp) != 1) goto invalid;
+    memcpy(&magic, hdr, 4);
+    if (magic == PCAPNG_SHB) {
+        // the byte order is known when the section header block is read.
+        r->pcapng = true;
+        rewind(r->fp);
+        return OK_CODE;
+    }
+    if (fread(hdr + 4, sizeof(hdr) - 4, 1, r->fp) != 1) goto invalid;
+    if (magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        r->swapped = true;
+        magic = __builtin_bswap32(magic);
+    }
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) goto invalid;
+    r->nr_ifaces = 1;
+    r->ifaces[0].linktype = r32(r, hdr + 20);
+    r->ifaces[0].ts_units = (magic == PCAP_MAGIC_NS)? 1000000000: US_PER_S;
+    return OK_CODE;
+
+invalid:
+    snprintf(errstr, ERR_STR_LEN, "%s is not a pcap or pcapng file.", fname);
+    fclose(r->fp);
+    r->fp = NULL;
+    return ERR_CODE;
+}
+
+static void close_reader(replay_reader_t *r) {
+    if (r->fp) fclose(r->fp);
+    free(r->buf);
+}
+
+static int next_pcap_packet(char *errstr, replay_reader_t *r, replay_pkt_t *pkt) {
+    uint8_t hdr[16];
+
+    if (fread(hdr, sizeof(hdr), 1, r->fp) != 1) return 0;
+    pkt->linktype = r->ifaces[0].linktype;
+    pkt->ts_us = ts_to_us((uint64_t)r32(r, hdr) * r->ifaces[0].ts_units + r32(r, hdr + 4),
+                          r->ifaces[0].ts_units);
+    pkt->cap_len = r32(r, hdr + 8);
+    pkt->orig_len = r32(r, hdr + 12);
+    if (pkt->cap_len > REPLAY_MAX_BLOCK || reserve_buf(r, pkt->cap_len) != OK_CODE) {
+        snprintf(errstr, ERR_STR_LEN, "invalid packet length %u.", pkt->cap_len);
+        return -1;
+    }
+    if (pkt->cap_len && fread(r->buf, pkt->cap_len, 1, r->fp) != 1) {
+        snprintf(errstr, ERR_STR_LEN, "truncated pcap file.");
+        return -1;
+    }
+    pkt->data = r->buf;
+    return 1;
+}
+
+static void parse_idb(replay_reader_t *r, const uint8_t *body, uint32_t len) {
+    replay_iface_t *iface;
+    uint32_t off = 8;
+
+    if (r->nr_ifaces >= REPLAY_MAX_IFACES || len < 8) return;
+    iface = &r->ifaces[r->nr_ifaces++];
+    iface->linktype = r16(r, body);
+    iface->ts_units = US_PER_S;
+    while (off + 4 <= len) {
+        uint16_t code = r16(r, body + off);
+        uint16_t olen = r16(r, body + off + 2);
+
+        if (code == 0 || off + 4 + olen > len) break;
+        if (code == PCAPNG_OPT_TSRESOL && olen >= 1) {
+            uint8_t v = body[off + 4];
+            uint64_t units = 1;
+            if (v & 0x80) {
+                units = 1ULL << RTE_MIN(v & 0x7F, 63);
+            } else {
+                for (int i = 0; i < RTE_MIN(v, 19); ++i) units *= 10;
+            }
+            iface->ts_units = units;
+        }
+        off += 4 + RTE_ALIGN_CEIL(olen, 4);
+    }
+}
+
+/*
+ * return 1 if a packet is read, 0 at the end of file, -1 on error.
+ */
+static int next_pcapng_packet(char *errstr, replay_reader_t *r, replay_pkt_t *pkt) {
+    uint8_t hdr[8];
+    uint32_t type, len, blen;
+    const uint8_t *body;
+    replay_iface_t *iface;
+    uint64_t ts;
+
+    for (;;) {
+        if (fread(hdr, sizeof(hdr), 1, r->fp) != 1) return 0;
+        memcpy(&type, hdr, 4);
+        if (type == PCAPNG_SHB) {
+            uint32_t bom;
+            // the byte order of a section is given by its header.
+            if (fread(&bom, 4, 1, r->fp) != 1) goto truncated;
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) r->swapped = false;
+            else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) r->swapped = true;
+            else {
+                snprintf(errstr, ERR_STR_LEN, "invalid pcapng byte order magic.");
+                return -1;
+            }
+            len = r32(r, hdr + 4);
+            if (len < 16 || len > REPLAY_MAX_BLOCK || fseek(r->fp, (long)len - 12, SEEK_CUR) != 0)
+                goto truncated;
+            r->nr_ifaces = 0;
+            continue;
+        }
+        type = r32(r, hdr);
+        len = r32(r, hdr + 4);
+        if (len < 12 || len % 4 || len > REPLAY_MAX_BLOCK) {
+            snprintf(errstr, ERR_STR_LEN, "invalid pcapng block length %u.", len);
+            return -1;
+        }
+        if (reserve_buf(r, len) != OK_CODE) goto truncated;
+        if (fread(r->buf, len - 8, 1, r->fp) != 1) goto truncated;
+        body = r->buf;
+        blen = len - 12;
+
+        switch (type) {
+            case PCAPNG_IDB:
+                parse_idb(r, body, blen);
+                break;
+            case PCAPNG_EPB:
+                if (blen < 20 || r32(r, body) >= (uint32_t)r->nr_ifaces) break;
+                iface = &r->ifaces[r32(r, body)];
+                ts = ((uint64_t)r32(r, body + 4) << 32) | r32(r, body + 8);
+                pkt->cap_len = r32(r, body + 12);
+                pkt->orig_len = r32(r, body + 16);
+                if (pkt->cap_len > blen - 20) break;
+                pkt->linktype = iface->linktype;
+                pkt->ts_us = ts_to_us(ts, iface->ts_units);
+                pkt->data = r->buf + 20;
+                return 1;
+            case PCAPNG_PB:
+                if (blen < 20 || r16(r, body) >= (uint32_t)r->nr_ifaces) break;
+                iface = &r->ifaces[r16(r, body)];
+                ts = ((uint64_t)r32(r, body + 4) << 32) | r32(r, body + 8);
+                pkt->cap_len = r32(r, body + 12);
+                pkt->orig_len = r32(r, body + 16);
+                if (pkt->cap_len > blen - 20) break;
+                pkt->linktype = iface->linktype;
+                pkt->ts_us = ts_to_us(ts, iface->ts_units);
+                pkt->data = r->buf + 20;
+                return 1;
+            case PCAPNG_SPB:
+                if (blen < 4 || r->nr_ifaces == 0) break;
+                pkt->orig_len = r32(r, body);
+                pkt->cap_len = RTE_MIN(pkt->orig_len, blen - 4);
+                pkt->linktype = r->ifaces[0].linktype;
+                pkt->ts_us = 0;
+                pkt->data = r->buf + 4;
+                return 1;
+            default:
+                break;
+        }
+    }
+
+truncated:
+    snprintf(errstr, ERR_STR_LEN, "truncated pcapng file.");
+    return -1;
+}
+
+static inline int next_packet(char *errstr, replay_reader_t *r, replay_pkt_t *pkt) {
+    return r->pcapng? next_pcapng_packet(errstr, r, pkt): next_pcap_packet(errstr, r, pkt);
+}
+
+static FILE *open_writer(char *errstr, const char *fname) {
+    uint32_t hdr[6] = {PCAP_MAGIC_US, 2 | (4 << 16), 0, 0, REPLAY_SNAPLEN, LINKTYPE_ETHERNET};
+    FILE *fp = fopen(fname, "w");
+
+    if (fp == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "can't open %s: %s.", fname, strerror(errno));
+        return NULL;
+    }
+    fwrite_unlocked(hdr, sizeof(hdr), 1, fp);
+    return fp;
+}
+
+static void write_packet(FILE *fp, uint64_t ts_us, struct rte_mbuf *m) {
+    uint32_t hdr[4] = {(uint32_t)(ts_us / US_PER_S), (uint32_t)(ts_us % US_PER_S),
+                       rte_pktmbuf_pkt_len(m), rte_pktmbuf_pkt_len(m)};
+
+    fwrite_unlocked(hdr, sizeof(hdr), 1, fp);
+    for (; m != NULL; m = m->next)
+        fwrite_unlocked(rte_pktmbuf_mtod(m, void *), rte_pktmbuf_data_len(m), 1, fp);
+}
+
+typedef struct {
+    const char *name;
+    bool hw_csum;
+    bool ptype;
+} replay_handler_t;
+
+// the first one is the handler init_replay_module selects.
+static const replay_handler_t replay_handlers[] = {
+    {"sw", false, false},
+    {"sw_ptype", false, true},
+    {"hw", true, false},
+    {"hw_ptype", true, true},
+};
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y? -1: (x > y);
+}
+
+static int replay_pass(struct rte_mempool *pool, const char *in, const char *out,
+                       uint8_t portid, const replay_handler_t *h) {
+    char errstr[ERR_STR_LEN];
+    lcore_conf_t *qconf = sk.lcore_conf[rte_lcore_id()];
+    struct mbuf_table *tx = &qconf->tx_mbufs[portid];
+    sk_pkt_handler_t handler = sk_packet_handler(h->hw_csum, h->ptype);
+    struct rte_mbuf *m;
+    replay_reader_t r;
+    replay_pkt_t pkt;
+    FILE *wfp = NULL;
+    uint32_t *cycles = NULL;
+    size_t nr_cycles = 0, cycles_size = 0;
+    uint64_t nr_pkts = 0, nr_resps = 0, nr_skipped = 0, nr_truncated = 0, nr_oversize = 0;
+    uint64_t read_cycles = 0, handle_cycles = 0, write_cycles = 0;
+    uint64_t t0, t1, t2, t3;
+    int64_t nr_req = qconf->nr_req, nr_dropped = qconf->nr_dropped, nr_bad_dst = qconf->nr_bad_dst;
+    long long start = ustime();
+    int ret = ERR_CODE;
+    int n;
+
+    if (open_reader(errstr, &r, in) != OK_CODE) {
+        LOG_ERROR(USER1, "replay: %s", errstr);
+        return ERR_CODE;
+    }
+    if (out && (wfp = open_writer(errstr, out)) == NULL) {
+        LOG_ERROR(USER1, "replay: %s", errstr);
+        goto end;
+    }
+    LOG_INFO(USER1, "replaying %s on port %d with handler %s.", in, portid, h->name);
+
+    while (!sk.force_quit) {
+        t0 = rte_rdtsc();
+        if ((n = next_packet(errstr, &r, &pkt)) <= 0) {
+            if (n < 0) {
+                LOG_ERROR(USER1, "replay: %s", errstr);
+                goto end;
+            }
+            break;
+        }
+        if (pkt.linktype != LINKTYPE_ETHERNET) {
+            ++nr_skipped;
+            continue;
+        }
+        // the lengths in headers don't match a truncated packet.
+        if (pkt.cap_len < pkt.orig_len) {
+            ++nr_truncated;
+            continue;
+        }
+        if ((m = rte_pktmbuf_alloc(pool)) == NULL) {
+            LOG_ERROR(USER1, "replay: mbuf pool is exhausted.");
+            goto end;
+        }
+        if (pkt.cap_len > rte_pktmbuf_tailroom(m)) {
+            ++nr_oversize;
+            rte_pktmbuf_free(m);
+            continue;
+        }
+        rte_pktmbuf_append(m, (uint16_t)pkt.cap_len);
+        rte_memcpy(rte_pktmbuf_mtod(m, void *), pkt.data, pkt.cap_len);
+        m->port = portid;
+        if (h->ptype)
+            m->packet_type = rte_net_get_ptype(m, NULL, RTE_PTYPE_L2_MASK | RTE_PTYPE_L3_MASK);
+        if (h->hw_csum)
+            m->ol_flags |= PKT_RX_IP_CKSUM_GOOD | PKT_RX_L4_CKSUM_GOOD;
+
+        t1 = rte_rdtsc();
+        rcu_read_lock();
+        handler(m, portid, qconf);
+        rcu_read_unlock();
+        t2 = rte_rdtsc();
+
+        for (int i = 0; i < tx->len; ++i) {
+            if (wfp) write_packet(wfp, pkt.ts_us, tx->m_table[i]);
+            rte_pktmbuf_free(tx->m_table[i]);
+        }
+        nr_resps += tx->len;
+        tx->len = 0;
+        t3 = rte_rdtsc();
+
+        ++nr_pkts;
+        read_cycles += t1 - t0;
+        handle_cycles += t2 - t1;
+        write_cycles += t3 - t2;
+        if (nr_cycles == cycles_size) {
+            cycles_size = RTE_MAX(cycles_size * 2, (size_t)65536);
+            cycles = realloc(cycles, cycles_size * sizeof(uint32_t));
+            if (cycles == NULL) {
+                LOG_ERROR(USER1, "replay: out of memory.");
+                goto end;
+            }
+        }
+        cycles[nr_cycles++] = (uint32_t)RTE_MIN(t2 - t1, (uint64_t)UINT32_MAX);
+    }
+    if (wfp && (fflush(wfp) != 0 || ferror(wfp))) {
+        LOG_ERROR(USER1, "replay: can't write %s.", out);
+        goto end;
+    }
+
+    if (nr_cycles > 0) qsort(cycles, nr_cycles, sizeof(uint32_t), cmp_u32);
+#define PCT(p) (nr_cycles? cycles[(size_t)((double)nr_cycles * (p))]: 0)
+    printf("{\"replay\":\"%s\",\"version\":\"%s\",\"handler\":\"%s\",\"packets\":%"PRIu64",\"responses\":%"PRIu64","
+           "\"dns_responses\":%"PRId64",\"dropped\":%"PRId64",\"bad_dst\":%"PRId64","
+           "\"skipped_linktype\":%"PRIu64",\"truncated\":%"PRIu64",\"oversize\":%"PRIu64","
+           "\"read_cycles_per_packet\":%.2f,\"handle_cycles_per_packet\":%.2f,"
+           "\"write_cycles_per_packet\":%.2f,\"handle_p50\":%u,\"handle_p90\":%u,"
+           "\"handle_p99\":%u,\"handle_p999\":%u,\"handle_pps\":%.0f,\"elapsed_seconds\":%.3f}\n",
+           in, SHUKE_VERSION, h->name, nr_pkts, nr_resps,
+           qconf->nr_req - nr_req, qconf->nr_dropped - nr_dropped, qconf->nr_bad_dst - nr_bad_dst,
+           nr_skipped, nr_truncated, nr_oversize,
+           nr_pkts? (double)read_cycles / nr_pkts: 0, nr_pkts? (double)handle_cycles / nr_pkts: 0,
+           nr_pkts? (double)write_cycles / nr_pkts: 0,
+           PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999),
+           handle_cycles? (double)rte_get_tsc_hz() * nr_pkts / handle_cycles: 0,
+           (double)(ustime() - start) / US_PER_S);
+#undef PCT
+    fflush(stdout);
+    ret = OK_CODE;
+
+end:
+    if (wfp) fclose(wfp);
+    close_reader(&r);
+    free(cycles);
+    return ret;
+}
+
+/*
+ * replay the pcap with the handler selected for the port, and with the other
+ * variants if `all_handlers` is true.
+ */
+int sk_replay_pcap(const char *in, const char *out, uint8_t portid, bool all_handlers) {
+    struct rte_mempool *pool;
+    size_t n = all_handlers? RTE_DIM(replay_handlers): 1;
+
+    pool = rte_pktmbuf_pool_create("replay_pool", REPLAY_NB_MBUF, REPLAY_MBUF_CACHE, 0,
+                                   RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    if (pool == NULL) {
+        LOG_ERROR(USER1, "can't create mbuf pool for replay.");
+        return ERR_CODE;
+    }
+    for (size_t i = 0; i < n && !sk.force_quit; ++i) {
+        if (replay_pass(pool, in, i == 0? out: NULL, portid, &replay_handlers[i]) != OK_CODE)
+            return ERR_CODE;
+    }
+    return OK_CODE;
+}
@@ -82,6 +82,7 @@ void zoneUpdateRoundRabinInfo(zone *z) {
             RRSet *rs = dv->v.rsArr[i];
             if (rs) {
                 RRSetUpdateOffsets(rs);
+                sk_zc_render(rs);
                 if (rs->num > 1) {
                     rs->z_rr_idx = nr_rr_idx++;
                 }
@@ -98,7 +99,8 @@ void zoneUpdateRoundRabinInfo(zone *z) {
 
     z->start_core_idx = node->min_lcore_id;
     int arr_len = node->max_lcore_id - node->min_lcore_id + 1;
-    uint32_t arr_size = sizeof(uint32_t)*arr_len;
+    // the counters of lcores don't share cache line with the offsets.
+    uint32_t arr_size = RTE_ALIGN_CEIL(sizeof(uint32_t)*arr_len, RTE_CACHE_LINE_SIZE);
     size_t totalsize = arr_size + node->nr_lcore_ids * nr_rr_idx;
     z->rr_offset_array = socket_calloc(z->socket_id, 1, totalsize);
 
@@ -132,7 +134,7 @@ int replaceZoneAllNumaNodes(zone *z) {
     if (ht_node) {
         old_z = caa_container_of(ht_node, zone, htnode);
         rbtreeDeleteZone(old_z);
-        call_rcu(&old_z->rcu_head, zoneDictFreeCallback);
+        zoneDictRetire(old_z);
         err = 0;
     }
     zoneDictWUnlock(zd);
@@ -177,7 +179,7 @@ int deleteZoneAllNumaNodes(char *origin) {
         if (ret == 0) {
             zone *del_z = caa_container_of(ht_node, zone, htnode);
             rbtreeDeleteZone(del_z);
-            call_rcu(&del_z->rcu_head, zoneDictFreeCallback);
+            zoneDictRetire(del_z);
         }
     }
     zoneDictWUnlock(zd);
@@ -257,6 +259,7 @@ zoneReloadContext *zoneReloadContextCreate(char *dotOrigin) {
     t->refresh_ts = refresh_ts;
     t->zone_exist = zone_exist;
     t->status = TASK_PENDING;
+    t->start_ms = mstime();
 invalid:
     zoneDictRUnlock(sk.zd);
     return t;
@@ -282,7 +285,8 @@ void zoneReloadContextDestroy(zoneReloadContext *t) {
  * @return
  */
 int asyncRereloadZone(zoneReloadContext *ctx) {
-    // this is a good place to check if the zone is expired.
+    // this is a good place to check if the zone is expired,
+    // an expired zone is counted as removed only.
     if (ctx->zone_exist) {
         char origin[MAX_DOMAIN_LEN+2];
         long last_reload_ts = ctx->refresh_ts - ctx->refresh;
@@ -290,14 +294,26 @@ int asyncRereloadZone(zoneReloadContext *ctx) {
         // the zone is expired, remove it.
         if (last_reload_ts+ctx->expiry < sk.unixtime) {
             deleteZoneAllNumaNodes(origin);
+            zoneReloadDone(ctx, RELOAD_REMOVED);
             return ERR_CODE;
         }
     }
+    zoneReloadDone(ctx, RELOAD_FAILED);
     zoneReloadContextReset(ctx);
     __pushZoneReloadContext(ctx);
     return OK_CODE;
 }
 
+/*
+ * count the outcome of a zone reload, the time is counted unless it failed.
+ */
+void zoneReloadDone(zoneReloadContext *ctx, int outcome) {
+    sk.nr_reloads[outcome]++;
+    if (outcome == RELOAD_FAILED) return;
+    sk.nr_timed_reloads++;
+    sk.reload_ms_sum += mstime() - ctx->start_ms;
+}
+
 int asyncReloadZoneRaw(char *dotOrigin) {
     if (sk.checkAsyncContext() != OK_CODE) return ERR_CODE;
     zoneReloadContext *ctx = zoneReloadContextCreate(dotOrigin);
@@ -348,7 +364,7 @@ void addZoneOtherNuma(zone *z) {
 }
 
 void collectStats() {
-    int64_t nr_req = 0, nr_dropped = 0;
+    int64_t nr_req = 0, nr_dropped = 0, nr_bad_dst = 0;
     unsigned lcore_id = 0;
     lcore_conf_t *qconf;
 
@@ -356,12 +372,15 @@ void collectStats() {
         lcore_id = (unsigned )sk.lcore_ids[i];
         if (lcore_id == rte_get_master_lcore()) continue;
 
-        qconf = &sk.lcore_conf[lcore_id];
+        qconf = sk.lcore_conf[lcore_id];
         nr_req += qconf->nr_req;
         nr_dropped += qconf->nr_dropped;
+        nr_bad_dst += qconf->nr_bad_dst;
     }
     sk.nr_req = nr_req;
     sk.nr_dropped = nr_dropped;
+    sk.nr_bad_dst = nr_bad_dst;
+    sk_stats_collect(&sk.query_stats);
     sk.last_collect_ms = mstime();
 }
 
@@ -424,6 +443,10 @@ static void daemonize(void) {
 
 static void usage() {
     printf("-c /path/to/shuke.conf    configure file.\n"
+           "-r /path/to/queries.pcap  replay the queries in pcap offline and exit.\n"
+           "-w /path/to/resp.pcap     write the responses of replay to pcap.\n"
+           "-a                        replay once more with every other packet handler\n"
+           "                          and report the cycles per packet of each.\n"
            "-h                        print this help and exit. \n"
            "-v                        print version. \n");
 }
@@ -448,7 +471,8 @@ static void sigShutdownHandler(int sig) {
 
     LOG_WARN(USER1, msg);
     sk.force_quit = true;
-    aeStop(sk.el);
+    // there is no event loop in replay mode.
+    if (sk.el) aeStop(sk.el);
     if (sk.daemonize)
         unlink(sk.pidfile);
 }
@@ -524,16 +548,20 @@ int reloadZoneFromFile(zoneReloadContext *t) {
     if (fname == NULL) {
         dot2lenlabel(t->dotOrigin, origin);
         deleteZoneAllNumaNodes(origin);
+        zoneReloadDone(t, RELOAD_REMOVED);
     } else {
         if (loadZoneFromFile(sk.master_numa_id, fname, &z) == ERR_CODE) {
+            zoneReloadDone(t, RELOAD_FAILED);
             return ERR_CODE;
         } else {
             if (strcasecmp(z->dotOrigin, t->dotOrigin) != 0) {
                 LOG_ERROR(USER1, "the origin(%s) of zone in file %s is not %s", z->dotOrigin, fname, t->dotOrigin);
                 zoneDestroy(z);
+                zoneReloadDone(t, RELOAD_FAILED);
                 return ERR_CODE;
             }
             replaceZoneAllNumaNodes(z);
+            zoneReloadDone(t, RELOAD_OK);
         }
     }
     return OK_CODE;
@@ -542,30 +570,6 @@ int reloadZoneFromFile(zoneReloadContext *t) {
 /*----------------------------------------------
  *     utility fucntion
  *---------------------------------------------*/
-void logQuery(struct context *ctx, char *cip, int cport, bool is_tcp) {
-
-    char *tcpstr;
-    char dotName[MAX_DOMAIN_LEN+2];
-    char *ty_str = DNSTypeToStr(ctx->qType);
-    char buf[64];
-    size_t off;
-    uint64_t msec = rte_tsc_mstime();
-    time_t sec = msec/1000;
-    // printf("ts %lld, ms %llu\n", sec, msec);
-    // struct timeval tv;
-
-    // gettimeofday(&tv,NULL);
-    // off = strftime(buf,sizeof(buf),"%Y/%m/%d %H:%M:%S.",localtime(&tv.tv_sec));
-    // snprintf(buf+off,sizeof(buf)-off,"%03d",(int)tv.tv_usec/1000);
-
-    off = strftime(buf,sizeof(buf),"%Y/%m/%d %H:%M:%S.",localtime((const time_t *)&sec));
-    snprintf(buf+off,sizeof(buf)-off,"%03d",(int)(msec%1000));
-    len2dotlabel(ctx->name, dotName);
-    tcpstr = is_tcp? " +tcp": "";
-
-    fprintf(sk.query_log_fp, "%s queries: client %s#%d%s: query %s IN %s \n", buf, cip, cport, tcpstr, dotName, ty_str);
-}
-
 int dumpDnsResp(struct context *ctx, dnsDictValue *dv, zone *z) {
     if (dv == NULL) return ERR_CODE;
     // current start position in response buffer.
@@ -613,7 +617,12 @@ int dumpDnsResp(struct context *ctx, dnsDictValue *dv, zone *z) {
         RRSet *rs = dnsDictValueGet(dv, ctx->qType);
         if (rs) {
             hdr.nAnRR = rs->num;
-            errcode = RRSetCompressPack(ctx, rs, DNS_HDR_SIZE);
+            // the pre-rendered body must be the last part of the response.
+            if (ctx->zc && rs->zc_body && sk.minimize_resp) {
+                errcode = RRSetZeroCopyAnswer(ctx, rs);
+            } else {
+                errcode = RRSetCompressPack(ctx, rs, DNS_HDR_SIZE);
+            }
             if (errcode == ERR_CODE) {
                 return ERR_CODE;
             }
@@ -691,6 +700,44 @@ static inline int dumpDnsRefusedErr(struct context *ctx) {
     return dumpDnsError(ctx, DNS_RCODE_REFUSED);
 }
 
+/*
+ * the answer doesn't fit in the udp payload size of the client, respond with
+ * the question only and TC set, so the client retries over tcp.
+ */
+static void dumpDnsTruncated(struct context *ctx, int qEnd) {
+    dnsHeader_t hdr = {ctx->hdr.xid, 0, 1, 0, 0, 0};
+
+    SET_QR_R(hdr.flag);
+    SET_AA(hdr.flag);
+    SET_TC(hdr.flag);
+    if (GET_RD(ctx->hdr.flag)) SET_RD(hdr.flag);
+
+    dnsHeader_dump(&hdr, ctx->resp, ctx->totallen);
+    ctx->cur = qEnd;
+    if (ctx->zc) ctx->zc->body = NULL;
+}
+
+/*
+ * append the OPT RR to the additional section, the room is reserved by
+ * _getDnsResponse. it follows the pre-rendered answer if there is one.
+ */
+static void dumpDnsOpt(struct context *ctx, uint8_t extRcode) {
+    uint16_t udpSize = EDNS_UDP_SIZE;
+    char *p = ctx->resp + ctx->cur;
+
+    if (ctx->maxUdpSize > 0) {
+        udpSize = ctx->maxUdpSize < UINT16_MAX? (uint16_t)ctx->maxUdpSize: UINT16_MAX;
+    }
+    if (ctx->zc && ctx->zc->body) {
+        p = ctx->zc->trailer;
+        ctx->zc->trailer_len = DNS_OPT_RR_SIZE;
+    } else {
+        ctx->cur += DNS_OPT_RR_SIZE;
+    }
+    dumpEdnsOpt(p, DNS_OPT_RR_SIZE, udpSize, extRcode);
+    dump16be((uint16_t)(load16be(ctx->resp+10) + 1), ctx->resp+10);
+}
+
 static int _getDnsResponse(char *buf, size_t sz, struct context *ctx)
 {
     numaNode_t *node = ctx->node;
@@ -699,9 +746,18 @@ static int _getDnsResponse(char *buf, size_t sz, struct context *ctx)
     // int64_t now;
     char *name;
     int ret;
-
+    int qEnd;
+    uint16_t udpSize = MAX_UDP_SIZE;
+    uint8_t version = 0;
+    uint8_t extRcode = 0;
+    // the biggest response the client accepts.
+    size_t limit;
+    bool capped = false;
+
+    ctx->edns = false;
     if (sz < 12) {
         LOG_DEBUG(USER1, "receive bad dns query message with only %d bytes, drop it", sz);
+        if (ctx->stats) ctx->stats->drop[SK_DROP_BAD_HEADER]++;
         // just ignore this packet(don't send response)
         return ERR_CODE;
     }
@@ -709,10 +765,14 @@ static int _getDnsResponse(char *buf, size_t sz, struct context *ctx)
     ret = parseDnsQuestion(buf+DNS_HDR_SIZE, sz-DNS_HDR_SIZE, &(ctx->name), &(ctx->qType), &(ctx->qClass));
     if (ret == PROTO_ERR) {
         LOG_DEBUG(USER1, "parse dns question error.");
+        if (ctx->stats) ctx->stats->drop[SK_DROP_BAD_LABEL]++;
         return ERR_CODE;
     }
     // skip dns header and dns question.
     ctx->cur = DNS_HDR_SIZE + ret;
+    qEnd = ctx->cur;
+    // the query log reads the name of FORMERR responses too.
+    ctx->nameLen = lenlabellen(ctx->name);
 
     LOG_DEBUG(USER1, "receive dns query message(xid: %d, qd: %d, an: %d, ns: %d, ar:%d)",
               ctx->hdr.xid, ctx->hdr.nQd, ctx->hdr.nAnRR, ctx->hdr.nNsRR, ctx->hdr.nArRR);
@@ -723,15 +783,38 @@ static int _getDnsResponse(char *buf, size_t sz, struct context *ctx)
         dumpDnsFormatErr(ctx);
         return ctx->cur;
     }
+    if (ctx->hdr.nArRR == 1) {
+        if (parseEdnsOpt(buf+qEnd, sz-qEnd, &udpSize, &version) == PROTO_ERR) {
+            LOG_DEBUG(USER1, "parse OPT RR error.");
+            dumpDnsFormatErr(ctx);
+            return ctx->cur;
+        }
+        ctx->edns = true;
+        // rfc 6891: values below 512 are treated as 512.
+        if (udpSize < MAX_UDP_SIZE) udpSize = MAX_UDP_SIZE;
+    }
+    // udp responses are limited by the payload size of the client and the
+    // transport, answers over the limit are truncated instead of retried.
+    limit = ctx->totallen;
+    if (ctx->maxUdpSize > 0) {
+        limit = udpSize < ctx->maxUdpSize? udpSize: ctx->maxUdpSize;
+        if (limit <= ctx->totallen) {
+            ctx->totallen = limit;
+            capped = true;
+        }
+    }
+    // reserve room for the OPT RR of the response.
+    if (ctx->edns) ctx->totallen -= DNS_OPT_RR_SIZE;
 
-    ctx->nameLen = lenlabellen(ctx->name);
-
+    if (version != 0) {
+        // rfc 6891: only version 0 is supported.
+        dumpDnsError(ctx, DNS_RCODE_OK);
+        extRcode = EDNS_RCODE_BADVERS;
+        goto opt;
+    }
     if (isSupportDnsType(ctx->qType) == false) {
         dumpDnsNotImplErr(ctx);
-        return ctx->cur;
-    }
-    if (ctx->hdr.nArRR == 1) {
-        // TODO parse OPT message(EDNS)
+        goto opt;
     }
     LOG_DEBUG(USER1, "dns question: %s, %d", ctx->name, ctx->qType);
 
@@ -760,61 +843,146 @@ static int _getDnsResponse(char *buf, size_t sz, struct context *ctx)
         dumpDnsNameErr(ctx);
         goto end;
     }
-    if (dumpDnsResp(ctx, dv, z) == OK_CODE) {
-        goto end;
+    if (dumpDnsResp(ctx, dv, z) != OK_CODE) {
+        if (capped) {
+            dumpDnsTruncated(ctx, qEnd);
+            goto end;
+        }
+        // the response buffer is too small, the caller may retry with a
+        // bigger buffer, the query in buffer is left untouched except the
+        // OPT RR overwritten by the answer, which is restored here.
+        if (ctx->edns && ctx->resp == buf) {
+            dumpEdnsOpt(buf+qEnd, DNS_OPT_RR_SIZE, udpSize, 0);
+        }
+        zoneDictRUnlock(node->zd);
+        return NO_MEM_CODE;
+    }
+    if (ctx->zc && ctx->zc->body &&
+        (size_t)ctx->cur + ctx->zc->len + (ctx->edns? DNS_OPT_RR_SIZE: 0) > limit) {
+        dumpDnsTruncated(ctx, qEnd);
     }
 end:
     zoneDictRUnlock(node->zd);
+opt:
+    if (ctx->edns) dumpDnsOpt(ctx, extRcode);
     return ctx->cur;
 }
 
-// TODO: handle the situation when one mbuf is not enough
-int processUDPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen,
-                       char *src_addr, uint16_t src_port, bool is_ipv4,
-                       numaNode_t *node, int lcore_id)
+static inline int _processDnsQuery(char *buf, size_t sz, char *resp, size_t respLen,
+                                   size_t max_udp_size, char *src_addr, uint16_t src_port, bool is_ipv4,
+                                   bool is_tcp, int svc_id, zcSlice *zc, uint16_t *qtype,
+                                   numaNode_t *node, int lcore_id)
 {
     struct context ctx;
     ctx.node = node;
     ctx.lcore_id = lcore_id;
+    ctx.svc_id = svc_id;
     ctx.resp = resp;
     ctx.totallen = respLen;
+    ctx.maxUdpSize = max_udp_size;
     ctx.cur = 0;
+    ctx.zc = zc;
+    ctx.stats = NULL;
+    // FORMERR and NOTIMP responses are sent before the zone lookup.
+    ctx.z = NULL;
+    if (lcore_id >= 0 && sk.lcore_conf[lcore_id]) ctx.stats = &sk.lcore_conf[lcore_id]->stats;
     int status;
     status = _getDnsResponse(buf, sz, &ctx);
 
-    if (status != ERR_CODE && sk.query_log_fp) {
-        char cip[IP_STR_LEN];
-        int cport;
-        int af = is_ipv4? AF_INET:AF_INET6;
-        inet_ntop(af, (void*)src_addr,cip,IP_STR_LEN);
-        cport = ntohs(src_port);
-        logQuery(&ctx, cip, cport, false);
+    if (status >= 0 && qtype) {
+        *qtype = ctx.qType;
+    } else if (status >= 0 && ctx.stats) {
+        sk_stats_response(ctx.stats, ctx.qType, load16be(resp + 2),
+                          (uint32_t)status + (zc && zc->body? zc->len + zc->trailer_len: 0), is_tcp);
+    }
+    if (status >= 0 && sk.query_log_on) {
+        sk_qlog_append(&ctx, is_ipv4? AF_INET: AF_INET6, src_addr, ntohs(src_port), is_tcp);
+    }
+    if (status >= 0 && sk.topk_on && lcore_id >= 0) {
+        sk_topk_query(&ctx, src_addr, is_ipv4);
     }
     return status;
 }
 
+/*
+ * return the size of the response, or NO_MEM_CODE if the response doesn't
+ * fit in `respLen` bytes, in that case the caller can copy the query to a
+ * bigger buffer and call this function again.
+ * the response never exceeds the udp payload size of the client(512 without
+ * EDNS) and `max_udp_size`, bigger answers are truncated to the question with
+ * TC set, so NO_MEM_CODE is only returned if `respLen` is below both.
+ * if `zc` is not NULL, the answer section may be a pre-rendered body, then
+ * `zc->body` is set and the response is the returned bytes followed by the
+ * slice and `zc->trailer_len` bytes of `zc->trailer`.
+ * if `qtype` is not NULL, the response is not counted, the query type is
+ * stored to it and the caller counts the response with sk_stats_response()
+ * once the packet is built.
+ */
+int processUDPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen,
+                       size_t max_udp_size, char *src_addr, uint16_t src_port,
+                       bool is_ipv4, int svc_id, zcSlice *zc, uint16_t *qtype,
+                       numaNode_t *node, int lcore_id)
+{
+    return _processDnsQuery(buf, sz, resp, respLen, max_udp_size, src_addr, src_port,
+                            is_ipv4, false, svc_id, zc, qtype, node, lcore_id);
+}
+
+/*
+ * used by the userspace tcp stack of dpdk lcores,
+ * just like processUDPDnsQuery, the query must be in resp buffer.
+ */
+int processFastTCPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen,
+                           char *src_addr, uint16_t src_port, bool is_ipv4,
+                           int svc_id, numaNode_t *node, int lcore_id)
+{
+    return _processDnsQuery(buf, sz, resp, respLen, 0, src_addr, src_port,
+                            is_ipv4, true, svc_id, NULL, NULL, node, lcore_id);
+}
+
 int processTCPDnsQuery(tcpConn *conn, char *buf, size_t sz)
 {
     int status;
     char resp[4096];
+    char *bigResp = NULL;
     size_t respLen = 4096;
 
     struct context ctx;
     ctx.node = sk.nodes[sk.master_numa_id];
     ctx.lcore_id = sk.master_lcore_id;
+    // the service address is unknown for kernel tcp server.
+    ctx.svc_id = -1;
     ctx.resp = resp;
     ctx.totallen = respLen;
+    ctx.maxUdpSize = 0;
     ctx.cur = 0;
+    ctx.zc = NULL;
+    ctx.stats = &conn->srv->stats;
 
     status = _getDnsResponse(buf, sz, &ctx);
+    if (status == NO_MEM_CODE) {
+        // the message size of dns over tcp is limited by the 2 bytes length field.
+        respLen = UINT16_MAX;
+        bigResp = zmalloc(respLen);
+        ctx.resp = bigResp;
+        ctx.totallen = respLen;
+        ctx.cur = 0;
+        status = _getDnsResponse(buf, sz, &ctx);
+    }
+    if (status < 0) goto end;
+    sk_stats_response(ctx.stats, ctx.qType, load16be(ctx.resp + 2), (uint32_t)status, true);
 
-    if (status != ERR_CODE && sk.query_log_fp) {
-        logQuery(&ctx, conn->cip, conn->cport, true);
+    if (sk.query_log_on) {
+        uint8_t addr[16];
+        int af = strchr(conn->cip, ':')? AF_INET6: AF_INET;
+        if (inet_pton(af, conn->cip, addr) == 1)
+            sk_qlog_append(&ctx, af, addr, (uint16_t)conn->cport, true);
     }
 
     snpack(ctx.resp, DNS_HDR_SIZE, respLen, "m>hh", ctx.name, ctx.nameLen+1, ctx.qType, ctx.qClass);
     tcpConnAppendDnsResponse(conn, ctx.resp, ctx.cur);
 
+end:
+    zfree(bigResp);
     return status;
 }
 
@@ -823,6 +991,54 @@ static void updateCachedTime() {
     sk.mstime = mstime();
 }
 
+static volatile bool kni_ifconfig_done = false;
+
+static void *kniIfconfigThread(void *arg) {
+    UNUSED(arg);
+    kni_ifconfig_all();
+    kni_ifconfig_done = true;
+    return NULL;
+}
+
+/*
+ * configure the KNI interfaces and wait for them to be ready.
+ * KNI requests(such as interface up) are serviced by exception lcore,
+ * if master lcore is the exception lcore, the configuration is done in
+ * another thread, and master lcore keeps servicing the KNI devices.
+ */
+static void initKniInterfaces(void) {
+    pthread_t tid;
+    long long deadline;
+
+    if (sk.exception_lcore_id != sk.master_lcore_id) {
+        kni_ifconfig_all();
+        sleep(4);
+        return;
+    }
+    if (pthread_create(&tid, NULL, kniIfconfigThread, NULL) != 0) {
+        LOG_FATAL(USER1, "can't create kni ifconfig thread.");
+    }
+    while (!kni_ifconfig_done) {
+        sk_exception_poll();
+        usleep(100);
+    }
+    pthread_join(tid, NULL);
+    deadline = mstime() + 4000;
+    while (mstime() < deadline) {
+        sk_exception_poll();
+        usleep(100);
+    }
+}
+
+/*
+ * master lcore is the exception lcore, drain the exception queues every millisecond.
+ */
+static int exceptionPollCron(struct aeEventLoop *el, long long id, void *clientData) {
+    UNUSED3(el, id, clientData);
+    sk_exception_poll();
+    return 1;
+}
+
 static int mainThreadCron(struct aeEventLoop *el, long long id, void *clientData) {
     UNUSED3(el, id, clientData);
     zone *z;
@@ -848,10 +1064,12 @@ static int mainThreadCron(struct aeEventLoop *el, long long id, void *clientData
         }
     }
 
-    if (! sk.only_udp) {
+    if (sk.tcp_srv) {
         // run tcp dns server cron
         tcpServerCron(el, id, (void *)sk.tcp_srv);
     }
+    sk_stats_cron();
+    if (sk.topk_on) sk_topk_cron();
     return TIME_INTERVAL;
 }
 
@@ -951,11 +1169,20 @@ static char *getConfigBuf(int argc, char **argv) {
         fprintf(stderr, "getcwd: %s.\n", strerror(errno));
         exit(1);
     }
-    while ((c = getopt(argc, argv, "c:hv")) != -1) {
+    while ((c = getopt(argc, argv, "c:r:w:ahv")) != -1) {
         switch (c) {
             case 'c':
                 conffile = optarg;
                 break;
+            case 'r':
+                sk.replay_file = toAbsPath(optarg, cwd);
+                break;
+            case 'w':
+                sk.replay_out = toAbsPath(optarg, cwd);
+                break;
+            case 'a':
+                sk.replay_all_handlers = true;
+                break;
             case 'h':
                 usage();
                 exit(0);
@@ -971,6 +1198,14 @@ static char *getConfigBuf(int argc, char **argv) {
         fprintf(stderr, "you must specify config file\n");
         exit(1);
     }
+    if (sk.replay_out && sk.replay_file == NULL) {
+        fprintf(stderr, "-w is only valid with -r\n");
+        exit(1);
+    }
+    if (sk.replay_all_handlers && sk.replay_file == NULL) {
+        fprintf(stderr, "-a is only valid with -r\n");
+        exit(1);
+    }
     cbuf = readFile(conffile);
     if (cbuf == NULL) {
         fprintf(stderr, "Can't open configure file(%s)\n", conffile);
@@ -994,6 +1229,7 @@ static void initConfigFromFile(int argc, char **argv) {
     sk.master_lcore_id = -1;
     sk.promiscuous_on = false;
     sk.numa_on = false;
+    sk.pci_on = true;
 
     sk.only_udp = false;
     sk.port = 53;
@@ -1009,8 +1245,32 @@ static void initConfigFromFile(int argc, char **argv) {
     sk.mongo_port = 27017;
 
     sk.admin_port = 14141;
+    sk.metrics_port = 0;
     sk.all_reload_interval = 36000;
     sk.minimize_resp = true;
+    sk.flow_steering_on = false;
+    sk.exception_lcore_id = -1;
+    sk.tcp_fastpath_on = false;
+    sk.tcp_conn_table_size = 8192;
+    sk.zerocopy_min_size = 0;
+    sk.query_log_buffer_size = 4096;
+    sk.query_log_sample_rate = 1;
+    sk.query_log_qname_sample = 1;
+    sk.query_log_rotate_size = 0;
+    sk.query_log_rotate_count = 5;
+    sk.capture_buffer_size = 1024;
+    sk.capture_max_size = 64;
+    sk.capture_max_duration = 60;
+    sk.topk_on = false;
+    sk.topk_size = 32;
+    sk.topk_width = 4096;
+    sk.loadgen_lcore_id = -1;
+    sk.loadgen_rate = 0;
+    sk.loadgen_duration = 0;
+    sk.loadgen_max_inflight = 4096;
+    sk.loadgen_nxdomain_ratio = 0;
+    sk.loadgen_random_case = false;
+    sk.loadgen_clients = 65536;
 
 
     sk.coremask = getStrVal(cbuf, "coremask", NULL);
@@ -1026,6 +1286,18 @@ static void initConfigFromFile(int argc, char **argv) {
     CHECK_CONF_ERR(conf_err, sk.errstr);
     conf_err = getIntVal(sk.errstr, cbuf, "portmask", &sk.portmask);
     CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getBoolVal(sk.errstr, cbuf, "pci_on", &sk.pci_on);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    // vdevs is optional.
+    char *vdevs = getStrVal(cbuf, "vdevs", NULL);
+    if (vdevs != NULL) {
+        free(vdevs);
+        sk.vdevs_count = CONFIG_VDEV_MAX;
+        if (getStrArrayVal(sk.errstr, cbuf, "vdevs", sk.vdevs, &(sk.vdevs_count)) < 0) {
+            fprintf(stderr, "Config Error: %s\n", sk.errstr);
+            exit(1);
+        }
+    }
     conf_err = getBoolVal(sk.errstr, cbuf, "numa_on", &sk.numa_on);
     CHECK_CONF_ERR(conf_err, sk.errstr);
     conf_err = getBoolVal(sk.errstr, cbuf, "jumbo_on", &sk.jumbo_on);
@@ -1035,6 +1307,29 @@ static void initConfigFromFile(int argc, char **argv) {
     sk.queue_config = getStrVal(cbuf, "queue_config", NULL);
     CHECK_CONFIG("queue_config", sk.queue_config != NULL,
                  "Config Error: queue_config can't be empty");
+    conf_err = getBoolVal(sk.errstr, cbuf, "flow_steering_on", &sk.flow_steering_on);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "exception_lcore_id", &sk.exception_lcore_id);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+
+    sk.io_backend = getStrVal(cbuf, "io_backend", "dpdk");
+    CHECK_CONFIG("io_backend", strcasecmp(sk.io_backend, "dpdk") == 0 ||
+                               strcasecmp(sk.io_backend, "socket") == 0,
+                 "Config Error: io_backend should be dpdk or socket");
+    sk.socket_io_on = (strcasecmp(sk.io_backend, "socket") == 0);
+    sk.exception_path = getStrVal(cbuf, "exception_path", "kni");
+    CHECK_CONFIG("exception_path", sk_exception_path_valid(sk.exception_path),
+                 "Config Error: exception_path should be kni, tap or virtio_user");
+
+    // bonds is optional.
+    char *bonds = getStrVal(cbuf, "bonds", NULL);
+    if (bonds != NULL) {
+        free(bonds);
+        if (getBlockVal(sk.errstr, cbuf, "bonds", &sk_bond_conf_parse, NULL) != CONF_OK) {
+            fprintf(stderr, "Config Error: %s.\n", sk.errstr);
+            exit(1);
+        }
+    }
 
     /* printf("cmsk: %s, pmsk: %d" */
     /*        " config: %s, promiscuous: %d" */
@@ -1067,9 +1362,86 @@ static void initConfigFromFile(int argc, char **argv) {
     CHECK_CONF_ERR(conf_err, sk.errstr);
     conf_err = getIntVal(sk.errstr, cbuf, "max_tcp_connections", &sk.max_tcp_connections);
     CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getBoolVal(sk.errstr, cbuf, "tcp_fastpath_on", &sk.tcp_fastpath_on);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "tcp_conn_table_size", &sk.tcp_conn_table_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("tcp_conn_table_size", sk.tcp_conn_table_size > 0, NULL);
+    // the tcp fast path needs NIC queues.
+    if (sk.socket_io_on) sk.tcp_fastpath_on = false;
 
     sk.pidfile = getStrVal(cbuf, "pidfile", "/var/run/cdns.pid");
     sk.query_log_file = getStrVal(cbuf, "query_log_file", NULL);
+    char *query_log_format = getStrVal(cbuf, "query_log_format", "text");
+    sk.query_log_format = sk_qlog_parse_format(query_log_format);
+    free(query_log_format);
+    CHECK_CONFIG("query_log_format", sk.query_log_format >= 0,
+                 "Config Error: query_log_format should be text, binary or framed");
+    conf_err = getIntVal(sk.errstr, cbuf, "query_log_buffer_size", &sk.query_log_buffer_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("query_log_buffer_size", sk.query_log_buffer_size > 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "query_log_sample_rate", &sk.query_log_sample_rate);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("query_log_sample_rate", sk.query_log_sample_rate > 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "query_log_qname_sample", &sk.query_log_qname_sample);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("query_log_qname_sample", sk.query_log_qname_sample > 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "query_log_rotate_size", &sk.query_log_rotate_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "query_log_rotate_count", &sk.query_log_rotate_count);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+
+    sk.capture_dir = getStrVal(cbuf, "capture_dir", "/tmp");
+    conf_err = getIntVal(sk.errstr, cbuf, "capture_buffer_size", &sk.capture_buffer_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("capture_buffer_size", sk.capture_buffer_size >= 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "capture_max_size", &sk.capture_max_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("capture_max_size", sk.capture_max_size > 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "capture_max_duration", &sk.capture_max_duration);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("capture_max_duration", sk.capture_max_duration > 0, NULL);
+
+    conf_err = getBoolVal(sk.errstr, cbuf, "topk_on", &sk.topk_on);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "topk_size", &sk.topk_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("topk_size", sk.topk_size > 0 && sk.topk_size <= 1024, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "topk_width", &sk.topk_width);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("topk_width", sk.topk_width >= 64 && sk.topk_width <= (1 << 24) &&
+                               rte_is_power_of_2((uint32_t)sk.topk_width),
+                 "Config Error: topk_width should be a power of 2 between 64 and 16777216");
+
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_lcore_id", &sk.loadgen_lcore_id);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    sk.loadgen_query_file = getStrVal(cbuf, "loadgen_query_file", NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_rate", &sk.loadgen_rate);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("loadgen_rate", sk.loadgen_rate >= 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_duration", &sk.loadgen_duration);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("loadgen_duration", sk.loadgen_duration >= 0, NULL);
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_max_inflight", &sk.loadgen_max_inflight);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("loadgen_max_inflight", sk.loadgen_max_inflight > 0 &&
+                                         sk.loadgen_max_inflight <= UINT16_MAX,
+                 "Config Error: loadgen_max_inflight should in 1-65535");
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_nxdomain_ratio", &sk.loadgen_nxdomain_ratio);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("loadgen_nxdomain_ratio", sk.loadgen_nxdomain_ratio >= 0 &&
+                                           sk.loadgen_nxdomain_ratio <= 100,
+                 "Config Error: loadgen_nxdomain_ratio should in 0-100");
+    conf_err = getBoolVal(sk.errstr, cbuf, "loadgen_random_case", &sk.loadgen_random_case);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "loadgen_clients", &sk.loadgen_clients);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("loadgen_clients", sk.loadgen_clients > 0 &&
+                                    sk.loadgen_clients <= SK_LOADGEN_MAX_CLIENTS, NULL);
+    sk.loadgen_client_dist = getStrVal(cbuf, "loadgen_client_dist", "uniform");
+    CHECK_CONFIG("loadgen_client_dist", strcasecmp(sk.loadgen_client_dist, "uniform") == 0 ||
+                                        strcasecmp(sk.loadgen_client_dist, "zipf") == 0,
+                 "Config Error: loadgen_client_dist should be uniform or zipf");
     sk.logfile = getStrVal(cbuf, "logfile", NULL);
 
     conf_err = getBoolVal(sk.errstr, cbuf, "log_verbose", &sk.logVerbose);
@@ -1082,11 +1454,18 @@ static void initConfigFromFile(int argc, char **argv) {
     sk.admin_host = getStrVal(cbuf, "admin_host", NULL);
     conf_err = getIntVal(sk.errstr, cbuf, "admin_port", &sk.admin_port);
     CHECK_CONF_ERR(conf_err, sk.errstr);
+    sk.metrics_host = getStrVal(cbuf, "metrics_host", "127.0.0.1");
+    conf_err = getIntVal(sk.errstr, cbuf, "metrics_port", &sk.metrics_port);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("metrics_port", sk.metrics_port >= 0 && sk.metrics_port <= 65535, NULL);
 
     conf_err = getIntVal(sk.errstr, cbuf, "all_reload_interval", &sk.all_reload_interval);
     CHECK_CONF_ERR(conf_err, sk.errstr);
     conf_err = getBoolVal(sk.errstr, cbuf, "minimize_resp", &sk.minimize_resp);
     CHECK_CONF_ERR(conf_err, sk.errstr);
+    conf_err = getIntVal(sk.errstr, cbuf, "zerocopy_min_size", &sk.zerocopy_min_size);
+    CHECK_CONF_ERR(conf_err, sk.errstr);
+    CHECK_CONFIG("zerocopy_min_size", sk.zerocopy_min_size >= 0, NULL);
 
     if (strcasecmp(sk.data_store, "file") == 0) {
         sk.zone_files_root = getStrVal(cbuf, "zone_files_root", cwd);
@@ -1116,28 +1495,12 @@ static void initConfigFromFile(int argc, char **argv) {
     free(cbuf);
 }
 
-static void initShuke() {
+/*
+ * select the data store and load all the zones into the zone dicts of
+ * numa nodes synchronously.
+ */
+static void initZoneData() {
     numaNode_t *master_node = sk.nodes[sk.master_numa_id];
-    sk.arch_bits = (sizeof(long) == 8)? 64 : 32;
-    sk.starttime = time(NULL);
-    updateCachedTime();
-    sk.last_collect_ms = sk.mstime;
-
-    sk.el = aeCreateEventLoop(1024, true);
-    assert(sk.el);
-
-    if (isEmptyStr(sk.query_log_file)) {
-        sk.query_log_fp = NULL;
-    } else {
-        if (!strcasecmp(sk.query_log_file, "stdout")) sk.query_log_fp = stdout;
-        else {
-            sk.query_log_fp = fopen(sk.query_log_file, "a");
-            if (!sk.query_log_fp) {
-                fprintf(stderr, "can't open %s.\n", sk.query_log_file);
-                exit(1);
-            }
-        }
-    }
 
     if (strcasecmp(sk.data_store, "mongo") == 0) {
         sk.initAsyncContext = &initMongo;
@@ -1171,6 +1534,31 @@ static void initShuke() {
     sk.zone_load_time = mstime() - reload_all_start;
     LOG_INFO(USER1, "loading all zone from %s to memory cost %lld milliseconds.", sk.data_store, sk.zone_load_time);
     sk.last_all_reload_ts = sk.unixtime;
+}
+
+static void initShuke() {
+    sk.arch_bits = (sizeof(long) == 8)? 64 : 32;
+    sk.starttime = time(NULL);
+    updateCachedTime();
+    sk.last_collect_ms = sk.mstime;
+
+    sk.el = aeCreateEventLoop(1024, true);
+    assert(sk.el);
+
+    if (isEmptyStr(sk.query_log_file)) {
+        sk.query_log_fp = NULL;
+    } else {
+        if (sk_init_query_log() != OK_CODE) {
+            fprintf(stderr, "can't init query log %s.\n", sk.query_log_file);
+            exit(1);
+        }
+        sk.query_log_on = true;
+    }
+    // the capture rings are only filled by the lcores driving NICs.
+    if (sk.capture_buffer_size > 0 && !sk.socket_io_on) sk_init_capture();
+    if (sk.topk_on) sk_init_topk();
+
+    initZoneData();
 
     if (sk.initAsyncContext() == ERR_CODE) {
         LOG_FATAL(USER1, "init %s async context error.", sk.data_store);
@@ -1185,6 +1573,34 @@ static void initShuke() {
     if (initAdminServer() == ERR_CODE) {
         LOG_FATAL(USER1, "can't init admin server.");
     }
+    if (sk.metrics_port > 0) {
+        LOG_INFO(USER1, "starting metrics server on %s:%d", sk.metrics_host, sk.metrics_port);
+        if (initMetricsServer() == ERR_CODE) {
+            LOG_FATAL(USER1, "can't init metrics server: %s", sk.errstr);
+        }
+    }
+}
+
+/*
+ * offline replay, there is no NIC, KNI, admin server or event loop, the
+ * packets in pcap are processed by the packet handler on master lcore.
+ */
+static int replayMain(void) {
+    int portid, ret;
+
+    sk.arch_bits = (sizeof(long) == 8)? 64 : 32;
+    sk.starttime = time(NULL);
+    updateCachedTime();
+    // only DNS over UDP is replayed, the packets which would be punted to
+    // KNI are dropped.
+    sk.only_udp = true;
+    portid = init_replay_module();
+
+    rcu_register_thread();
+    initZoneData();
+    ret = sk_replay_pcap(sk.replay_file, sk.replay_out, (uint8_t)portid, sk.replay_all_handlers);
+    rcu_unregister_thread();
+    return ret == OK_CODE? 0: 1;
 }
 
 static int construct_lcore_list() {
@@ -1282,6 +1698,11 @@ invalid:
     return -1;
 }
 
+/*
+ * parse one part of queue config, if the ports field is "w",
+ * then the cores of this part are worker lcores(pipeline mode),
+ * in this case, nrPorts will be set to 0.
+ */
 int parseQueueConfigPart(char *errstr, char *s, int cores[], int *nrCores,
                      int ports[], int *nrPorts) {
     char *cStart, *pStart;
@@ -1295,6 +1716,11 @@ int parseQueueConfigPart(char *errstr, char *s, int cores[], int *nrCores,
     if (parseQueueConfigNumList(errstr, cStart, cores, nrCores) < 0) {
         goto invalid;
     }
+    pStart = strip(pStart, " ");
+    if (strcasecmp(pStart, "w") == 0) {
+        *nrPorts = 0;
+        return OK_CODE;
+    }
     if (parseQueueConfigNumList(errstr, pStart, ports, nrPorts) < 0) {
         goto invalid;
     }
@@ -1303,6 +1729,66 @@ invalid:
     return ERR_CODE;
 }
 
+static int addWorkerLcores(char *errstr, int cores[], int nrCores) {
+    int n = sk.nr_worker_lcores;
+    sk.worker_lcore_ids = realloc(sk.worker_lcore_ids, sizeof(int)*(n+nrCores));
+    for (int i = 0; i < nrCores; ++i) {
+        int lcore_id = cores[i];
+        if (lcore_id < 0 || lcore_id >= RTE_MAX_LCORE) {
+            snprintf(errstr, ERR_STR_LEN, "lcore should in 0-%d, but gives %d.", RTE_MAX_LCORE, lcore_id);
+            return ERR_CODE;
+        }
+        if (lcore_id == sk.master_lcore_id) {
+            snprintf(errstr, ERR_STR_LEN, "queue config should not contain master lcore id.");
+            return ERR_CODE;
+        }
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (qconf == NULL) {
+            snprintf(errstr, ERR_STR_LEN, "queue config: lcore %d is not enabled.", lcore_id);
+            return ERR_CODE;
+        }
+        if (qconf->role == LCORE_ROLE_WORKER) {
+            snprintf(errstr, ERR_STR_LEN, "duplicate worker lcore %d.", lcore_id);
+            return ERR_CODE;
+        }
+        qconf->role = LCORE_ROLE_WORKER;
+        sk.worker_lcore_ids[n++] = lcore_id;
+    }
+    sk.nr_worker_lcores = n;
+    return OK_CODE;
+}
+
+/*
+ * in pipeline mode, lcores which own NIC queues are I/O lcores,
+ * an I/O lcore can't be a worker at the same time.
+ */
+static int checkPipelineConfig(char *errstr) {
+    int ids[RTE_MAX_LCORE];
+    int n = 0;
+
+    if (sk.nr_worker_lcores == 0) return OK_CODE;
+
+    sk.pipeline_on = true;
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+        if (qconf->nr_ports == 0) continue;
+        if (qconf->role == LCORE_ROLE_WORKER) {
+            snprintf(errstr, ERR_STR_LEN, "lcore %d can't be I/O lcore and worker at the same time.", lcore_id);
+            return ERR_CODE;
+        }
+        qconf->role = LCORE_ROLE_IO;
+        ids[n++] = lcore_id;
+    }
+    if (n == 0) {
+        snprintf(errstr, ERR_STR_LEN, "pipeline mode needs at least one I/O lcore.");
+        return ERR_CODE;
+    }
+    sk.io_lcore_ids = memdup(ids, sizeof(int)*n);
+    sk.nr_io_lcores = n;
+    return OK_CODE;
+}
+
 int parseQueueConfig(char *errstr, char *s) {
     char *ss = strdup(s);
     char *tokens[4096];
@@ -1319,6 +1805,8 @@ int parseQueueConfig(char *errstr, char *s) {
     }
 
     for (int j = 0; j < nrTokens; ++j) {
+        nrCores = 1024;
+        nrPorts = 1024;
         ret = parseQueueConfigPart(errstr, tokens[j], cores, &nrCores,
                                     ports, &nrPorts);
         if (ret != OK_CODE) {
@@ -1327,6 +1815,12 @@ int parseQueueConfig(char *errstr, char *s) {
         sortIntArray(cores, nrCores);
         sortIntArray(ports, nrPorts);
 
+        if (nrCores > 0 && nrPorts == 0) {
+            if (addWorkerLcores(errstr, cores, nrCores) != OK_CODE) {
+                goto invalid;
+            }
+            continue;
+        }
         if (nrCores <= 0 || nrPorts <= 0) {
             snprintf(errstr, ERR_STR_LEN, "invalid queue config.");
             goto invalid;
@@ -1358,8 +1852,8 @@ int parseQueueConfig(char *errstr, char *s) {
                     snprintf(errstr, ERR_STR_LEN, "queue config should not contain master lcore id.");
                     goto invalid;
                 }
-                lcore_conf_t *qconf = &sk.lcore_conf[lcore_id];
-                if (qconf->lcore_id >= RTE_MAX_LCORE) {
+                lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+                if (qconf == NULL) {
                     snprintf(errstr, ERR_STR_LEN, "queue config: lcore %d is not enabled.", lcore_id);
                     goto invalid;
                 }
@@ -1370,6 +1864,13 @@ int parseQueueConfig(char *errstr, char *s) {
             }
         }
     }
+    if (checkPipelineConfig(errstr) != OK_CODE) {
+        goto invalid;
+    }
+    if (sk.pipeline_on && sk.socket_io_on) {
+        snprintf(errstr, ERR_STR_LEN, "pipeline mode is not supported by socket I/O backend.");
+        goto invalid;
+    }
 
     free(ss);
     return OK_CODE;
@@ -1378,6 +1879,104 @@ invalid:
     return ERR_CODE;
 }
 
+/*
+ * parse the bind address of a port, the format is `addr[@vlan][,addr[@vlan]...]`,
+ * every addr can be an ipv4 or ipv6 address, vlan is `<id>` or
+ * `<outer id>.<inner id>`(QinQ), for example:
+ *     "10.0.0.2,2001:db8::2,10.1.0.2@100,10.2.0.2@200.300"
+ * addresses in vlans are configured to the vlan interfaces of KNI.
+ */
+static int parseBindAddr(char *errstr, port_info_t *pinfo, char *s) {
+    char *ss = strdup(s);
+    char *saveptr = NULL;
+    char *token;
+    sk_addr_t a;
+
+    for (token = strtok_r(ss, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        if (sk_addr_parse(&a, token) != OK_CODE) {
+            snprintf(errstr, ERR_STR_LEN, "invalid address %s.", token);
+            goto invalid;
+        }
+        if (sk_port_append_addr(pinfo, &a) != OK_CODE) {
+            snprintf(errstr, ERR_STR_LEN, "duplicate address %s.", token);
+            goto invalid;
+        }
+    }
+    if (pinfo->nr_addrs == 0) {
+        snprintf(errstr, ERR_STR_LEN, "port %d has no address.", pinfo->port_id);
+        goto invalid;
+    }
+    free(ss);
+    return OK_CODE;
+invalid:
+    free(ss);
+    return ERR_CODE;
+}
+
+/*
+ * unless only_udp is on, every port has an extra tx queue(exception queue)
+ * which is owned by exception lcore, the exception lcore owns the KNI devices,
+ * other lcores send the packets punted to KNI to it through rings.
+ * only when flow steering is on, the exception queue has a rx queue too,
+ * all non-DNS traffic is received by it.
+ */
+static int initExceptionLcore(char *errstr) {
+    // with socket I/O backend, the kernel handles all the other traffic.
+    if (sk.only_udp || sk.socket_io_on) return OK_CODE;
+
+    if (sk.exception_lcore_id < 0) {
+        sk.exception_lcore_id = sk.master_lcore_id;
+        LOG_WARN(USER1, "exception_lcore_id is not set, master lcore %d handles the exception traffic.",
+                 sk.master_lcore_id);
+    }
+    int lcore_id = sk.exception_lcore_id;
+    if (lcore_id >= RTE_MAX_LCORE) {
+        snprintf(errstr, ERR_STR_LEN, "lcore should in 0-%d, but gives %d.", RTE_MAX_LCORE, lcore_id);
+        return ERR_CODE;
+    }
+    lcore_conf_t *qconf = sk.lcore_conf[lcore_id];
+    if (qconf == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "lcore %d is not enabled.", lcore_id);
+        return ERR_CODE;
+    }
+    if (qconf->nr_ports > 0 || qconf->role != LCORE_ROLE_RTC) {
+        snprintf(errstr, ERR_STR_LEN, "lcore %d is used by queue config.", lcore_id);
+        return ERR_CODE;
+    }
+    qconf->role = LCORE_ROLE_EXCEPTION;
+    for (int i = 0; i < sk.nr_ports; ++i) {
+        int port_id = sk.port_ids[i];
+        port_info_t *pinfo = sk.port_info[port_id];
+        pinfo->exception_queue_id = (uint16_t)pinfo->nr_lcore;
+        qconf->queue_id_list[port_id] = pinfo->exception_queue_id;
+        qconf->port_id_list[qconf->nr_ports++] = (uint16_t)port_id;
+    }
+    sk.exception_queue_on = true;
+    return OK_CODE;
+}
+
+/*
+ * the load generator needs an lcore of its own.
+ */
+static int checkLoadgenLcore(char *errstr) {
+    int lcore_id = sk.loadgen_lcore_id;
+
+    if (lcore_id < 0) return OK_CODE;
+    if (sk.socket_io_on) {
+        snprintf(errstr, ERR_STR_LEN, "load generator is not supported by socket I/O backend.");
+        return ERR_CODE;
+    }
+    if (lcore_id >= RTE_MAX_LCORE || sk.lcore_conf[lcore_id] == NULL) {
+        snprintf(errstr, ERR_STR_LEN, "lcore %d is not enabled.", lcore_id);
+        return ERR_CODE;
+    }
+    if (lcore_id == sk.master_lcore_id || sk.lcore_conf[lcore_id]->nr_ports > 0) {
+        snprintf(errstr, ERR_STR_LEN, "lcore %d is used by master, exception lcore or queue config.", lcore_id);
+        return ERR_CODE;
+    }
+    return OK_CODE;
+}
+
 static int parse_str_coremask(char *coremask, int buf[], int *n) {
     int max = *n;
     int nr_id = 0;
@@ -1402,9 +2001,8 @@ static int parse_str_coremask(char *coremask, int buf[], int *n) {
 static int get_port_ids(int buf[], int *n) {
     int max = *n;
     int nr_id = 0;
-    int num_bits = sizeof(sk.portmask) * 8;
-    for (int i = 0; i < num_bits; ++i) {
-        if (sk.portmask & (1 << i)) {
+    for (int i = 0; i < SK_MAX_MASKED_PORT; ++i) {
+        if (SK_PORT_IN_MASK(i)) {
             if (nr_id >= max) return ERR_CODE;
             buf[nr_id++] = i;
         }
@@ -1436,9 +2034,12 @@ int initNumaConfig() {
         }
         node->nr_lcore_ids++;
 
-        sk.lcore_conf[lcore_id].lcore_id = (uint16_t)lcore_id;
-        sk.lcore_conf[lcore_id].node = node;
-        sk.lcore_conf[lcore_id].ipv4_packet_id = (uint16_t )i;
+        // per-lcore state lives on the socket of the lcore.
+        lcore_conf_t *qconf = socket_calloc(numa_id, 1, sizeof(lcore_conf_t));
+        qconf->lcore_id = (uint16_t)lcore_id;
+        qconf->node = node;
+        qconf->ipv4_packet_id = (uint16_t )i;
+        sk.lcore_conf[lcore_id] = qconf;
     }
 
     // initialize the lcore id array belongs to this numa node
@@ -1530,8 +2131,8 @@ int initOtherConfig() {
         sk.port_info[portid] = calloc(1, sizeof(port_info_t));
         assert(sk.port_info[portid]);
         sk.port_info[portid]->port_id = (uint8_t)portid;
-        if (!str2ipv4(sk.bindaddr[i], &sk.port_info[portid]->ipv4_addr)) {
-            fprintf(stderr, "invalid ipv4 address %s\n", sk.bindaddr[i]);
+        if (parseBindAddr(sk.errstr, sk.port_info[portid], sk.bindaddr[i]) != OK_CODE) {
+            fprintf(stderr, "bind: %s\n", sk.errstr);
             exit(-1);
         }
     }
@@ -1553,16 +2154,20 @@ int initOtherConfig() {
         fprintf(stderr, "queue config: %s\n", sk.errstr);
         exit(-1);
     }
+    if (initExceptionLcore(sk.errstr) != OK_CODE) {
+        fprintf(stderr, "exception lcore: %s\n", sk.errstr);
+        exit(-1);
+    }
+    if (checkLoadgenLcore(sk.errstr) != OK_CODE) {
+        fprintf(stderr, "loadgen lcore: %s\n", sk.errstr);
+        exit(-1);
+    }
 
     return OK_CODE;
 }
 
 int main(int argc, char *argv[]) {
     memset(&sk, 0, sizeof(sk));
-    // set lcore_id to invalid id
-    for (int i = 0; i < RTE_MAX_LCORE; ++i) {
-        sk.lcore_conf[i].lcore_id = RTE_MAX_LCORE + 1;
-    }
 
     struct timeval tv;
     srand(time(NULL)^getpid());
@@ -1577,12 +2182,38 @@ int main(int argc, char *argv[]) {
             return dsTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zone_parser")) {
             return zoneParserTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "tcp")) {
+            return tcpTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "addr")) {
+            return addrTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "qlog")) {
+            return qlogTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "latency")) {
+            return latencyTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "topk")) {
+            return topkTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "stats")) {
+            return statsTest(argc, argv);
         }
         return -1;  /* test not found */
     }
 #endif
+#ifdef SK_BENCH
+    if (argc >= 3 && !strcasecmp(argv[1], "bench")) {
+        initTestDpdkEal();
+
+        if (!strcasecmp(argv[2], "query")) {
+            return queryPathBench(argc, argv);
+        } else if (!strcasecmp(argv[2], "control")) {
+            return controlPlaneBench(argc, argv);
+        }
+        return -1;  /* bench not found */
+    }
+#endif
 
     initConfigFromFile(argc, argv);
+    // replay runs in foreground and exits when the pcap is finished.
+    if (sk.replay_file) sk.daemonize = false;
     if (sk.daemonize) daemonize();
     if (sk.daemonize) createPidFile();
     // configure log as early as possible
@@ -1594,10 +2225,12 @@ int main(int argc, char *argv[]) {
 
     setupSignalHandlers();
 
+    if (sk.replay_file) return replayMain();
+
     sk.force_quit = false;
     init_dpdk_module();
 
-    if (!sk.only_udp) init_kni_module();
+    if (!sk.only_udp && !sk.socket_io_on) init_kni_module();
 
     rcu_register_thread();
 
@@ -1605,19 +2238,30 @@ int main(int argc, char *argv[]) {
 
     start_dpdk_threads();
 
+    if (sk.exception_queue_on && sk.exception_lcore_id == sk.master_lcore_id) {
+        if (aeCreateTimeEvent(sk.el, 1, exceptionPollCron, NULL, NULL) == AE_ERR) {
+            LOG_FATAL(USER1, "Can't create exception poll time event.");
+        }
+    }
+
     if (! sk.only_udp) {
-        kni_ifconfig_all();
+        if (!sk.socket_io_on) initKniInterfaces();
 
-        sleep(4);
-        LOG_INFO(USER1, "starting dns tcp server.");
-        sk.tcp_srv = tcpServerCreate();
-        assert(sk.tcp_srv);
+        // when tcp fast path is on, tcp queries never reach kernel.
+        if (!sk.tcp_fastpath_on) {
+            LOG_INFO(USER1, "starting dns tcp server.");
+            sk.tcp_srv = tcpServerCreate();
+            assert(sk.tcp_srv);
+        }
     }
     aeMain(sk.el);
 
-    if (! sk.only_udp) cleanup_kni_module();
+    if (!sk.only_udp && !sk.socket_io_on) cleanup_kni_module();
 
     cleanup_dpdk_module();
+    sk_stop_capture();
+    // the lcores have exited, so the rings can be drained for the last time.
+    sk_stop_query_log();
 
     rcu_unregister_thread();
 }
@@ -25,10 +25,14 @@
 #include "log.h"
 #include "ds.h"
 #include "dpdk_module.h"
+#include "querylog.h"
+#include "capture.h"
+#include "topk.h"
 
 #include "himongo/async.h"
 
 #define CONFIG_BINDADDR_MAX 16
+#define CONFIG_VDEV_MAX 16
 #define TIME_INTERVAL 1000
 
 #define CONN_READ_N     0     /**< reading in a fixed number of bytes */
@@ -57,6 +61,14 @@ enum taskStates {
     TASK_ERROR = 2,
 };
 
+enum reloadOutcomes {
+    RELOAD_OK = 0,
+    RELOAD_UNCHANGED,
+    RELOAD_REMOVED,
+    RELOAD_FAILED,
+    NR_RELOAD_OUTCOMES,
+};
+
 typedef struct numaNode_s {
     int numa_id;
     int main_lcore_id;
@@ -74,6 +86,9 @@ typedef struct _tcpServer {
     aeEventLoop *el;
     pthread_t tid;
     struct list_head tcp_head;     // tcp connection list.
+    // time used to process every query, read by master.
+    sk_lat_hist_t lat;
+    sk_query_stats_t stats;
 
     char errstr[ERR_STR_LEN];
 } tcpServer;
@@ -126,6 +141,7 @@ typedef struct _zoneReloadContext {
     RRParser *psr;
     zone *new_zn;
     bool zone_exist;
+    long long start_ms;   // when the reload is requested, retries included.
 
     struct _zoneReloadContext *next;
 }zoneReloadContext;
@@ -140,16 +156,42 @@ struct shuke {
 
     // config
     char *configfile;
+    // offline replay mode(-r), responses are written to replay_out(-w).
+    char *replay_file;
+    char *replay_out;
+    // replay with every variant of the packet handler(-a).
+    bool replay_all_handlers;
 
     char *coremask;
     int master_lcore_id;
     char *mem_channels;
     int portmask;
+    // probe the NICs bound to DPDK.
+    bool pci_on;
+    // arguments of virtual devices, passed to EAL with --vdev.
+    char *vdevs[CONFIG_VDEV_MAX];
+    int vdevs_count;
     bool promiscuous_on;
     bool numa_on;
     bool jumbo_on;
     int max_pkt_len;
     char *queue_config;
+    // true if queue_config declares worker lcores.
+    bool pipeline_on;
+    // steer non-DNS traffic to an exception queue with rte_flow.
+    bool flow_steering_on;
+    // lcore which owns the exception queues, -1 means master lcore.
+    int exception_lcore_id;
+    // packet I/O backend: dpdk or socket.
+    char *io_backend;
+    // true if io_backend is socket, lcores use kernel UDP sockets
+    // instead of NIC queues.
+    bool socket_io_on;
+    // backend of the kernel interfaces: kni, tap or virtio_user.
+    char *exception_path;
+    // bonded ports, created before the ports are initialized.
+    sk_bond_t bonds[SK_MAX_BONDS];
+    int nr_bonds;
 
     char *bindaddr[CONFIG_BINDADDR_MAX];
     int bindaddr_count;
@@ -158,6 +200,44 @@ struct shuke {
     char *pidfile;
     bool daemonize;
     char *query_log_file;
+    int query_log_format;
+    // records buffered per lcore.
+    int query_log_buffer_size;
+    // log 1 in N queries.
+    int query_log_sample_rate;
+    // only log the queries of 1 in N names.
+    int query_log_qname_sample;
+    // rotate the log file when it is bigger than this size(MB), 0 disables it.
+    int query_log_rotate_size;
+    int query_log_rotate_count;
+    // directory of the capture files.
+    char *capture_dir;
+    // packets buffered per lcore, 0 disables capture.
+    int capture_buffer_size;
+    // default limits of a capture(MB and seconds).
+    int capture_max_size;
+    int capture_max_duration;
+    // heavy hitter detection of qnames, clients and zones.
+    bool topk_on;
+    // candidates per dimension of every lcore.
+    int topk_size;
+    // counters per row of the count-min sketches, a power of 2.
+    int topk_width;
+
+    // the lcore of load generator, -1 if it is disabled.
+    int loadgen_lcore_id;
+    // weighted query list, the names of the zones are used if it is NULL.
+    char *loadgen_query_file;
+    // queries per second, 0 means as fast as possible.
+    int loadgen_rate;
+    // seconds, 0 means until exit.
+    int loadgen_duration;
+    int loadgen_max_inflight;
+    // percent of NXDOMAIN queries.
+    int loadgen_nxdomain_ratio;
+    bool loadgen_random_case;
+    int loadgen_clients;
+    char *loadgen_client_dist;
     char *logLevelStr;
     char *logfile;
     bool logVerbose;
@@ -166,6 +246,10 @@ struct shuke {
     int tcp_keepalive;
     int tcp_idle_timeout;
     int max_tcp_connections;
+    // handle DNS over TCP in dpdk lcores instead of kernel.
+    bool tcp_fastpath_on;
+    // size of the tcp connection table of every lcore.
+    int tcp_conn_table_size;
 
     char *zone_files_root;
     dict *zone_files_dict;
@@ -178,17 +262,23 @@ struct shuke {
 
     char *admin_host;
     int admin_port;
+    // OpenMetrics exporter, disabled when the port is 0.
+    char *metrics_host;
+    int metrics_port;
 
     char *data_store;
     int all_reload_interval;
     bool minimize_resp;
+    // answer sections at least this size are pre-rendered and sent
+    // without copy, 0 disables it.
+    int zerocopy_min_size;
     // end config
 
     /*
      * these fields will allocate using malloc
      */
-    // MAP: lcore_id => lcore_conf_t
-    lcore_conf_t lcore_conf[RTE_MAX_LCORE];
+    // MAP: lcore_id => lcore_conf_t(on the socket of the lcore), NULL if the lcore is disabled
+    lcore_conf_t *lcore_conf[RTE_MAX_LCORE];
     // MAP: portid => port_info_t*
     port_info_t *port_info[RTE_MAX_ETHPORTS];
 
@@ -204,6 +294,15 @@ struct shuke {
 
     int *port_ids;
     int nr_ports;
+
+    // worker lcores and I/O lcores, only used in pipeline mode.
+    int *worker_lcore_ids;
+    int nr_worker_lcores;
+    int *io_lcore_ids;
+    int nr_io_lcores;
+    // true if exception lcore exists(only_udp is off),
+    // in this case every port has an exception queue.
+    bool exception_queue_on;
     // char *total_coremask;
     char *total_lcore_list;
     // end
@@ -213,6 +312,12 @@ struct shuke {
     struct rb_root rbroot;
 
     volatile bool force_quit;
+    // true when a capture is running, tested by lcores for every query.
+    volatile bool capture_on;
+    // true if query log is enabled, query_log_fp is owned by the writer thread.
+    bool query_log_on;
+    // selects the half of the heavy hitter sketches updated by lcores.
+    volatile uint32_t topk_epoch;
     FILE *query_log_fp;
     FILE *log_fp;
 
@@ -253,6 +358,11 @@ struct shuke {
 
     int arch_bits;
     long last_all_reload_ts; // timestamp of last all reload
+    // outcomes of zone reloads, a failed reload is counted once per try.
+    int64_t nr_reloads[NR_RELOAD_OUTCOMES];
+    // time used by the reloads that didn't fail.
+    int64_t nr_timed_reloads;
+    long long reload_ms_sum;
 
 
     aeEventLoop *el;      // event loop for main thread.
@@ -269,6 +379,8 @@ struct shuke {
     // statistics
     int64_t nr_req;                   // number of processed requests
     int64_t nr_dropped;
+    int64_t nr_bad_dst;               // packets sent to non-service addresses
+    sk_query_stats_t query_stats;     // counters of all lcores and tcp server
     long long last_collect_ms;
 
     uint64_t num_tcp_conn;
@@ -283,6 +395,11 @@ extern struct shuke sk;
 extern dictType commandTableDictType;
 extern dictType zoneFileDictType;
 
+// portmask is an int, so it only selects the ports below 31.
+#define SK_MAX_MASKED_PORT 31
+#define SK_PORT_IN_MASK(portid) \
+    ((unsigned)(portid) < SK_MAX_MASKED_PORT && (sk.portmask & (1 << (portid))) != 0)
+
 int snpack(char *buf, int offset, size_t size, char const *fmt, ...);
 /*----------------------------------------------
  *     zoneReloadContext
@@ -293,6 +410,7 @@ void zoneReloadContextDestroy(zoneReloadContext *t);
 
 int asyncReloadZoneRaw(char *dotOrigin);
 int asyncRereloadZone(zoneReloadContext *ctx);
+void zoneReloadDone(zoneReloadContext *ctx, int outcome);
 int triggerReloadAllZone();
 /*----------------------------------------------
  *     admin server
@@ -300,6 +418,8 @@ int triggerReloadAllZone();
 int initAdminServer(void);
 void releaseAdminServer(void);
 
+int initMetricsServer(void);
+
 /*----------------------------------------------
  *     tcp server
  *---------------------------------------------*/
@@ -316,10 +436,16 @@ int mongoGetAllZone(void);
 int mongoAsyncReloadZone(zoneReloadContext *t);
 int mongoAsyncReloadAllZone(void);
 
-int processUDPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen, char *src_addr, uint16_t src_port, bool is_ipv4,
-                       numaNode_t *node, int lcore_id);
+int processUDPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen, size_t max_udp_size,
+                       char *src_addr, uint16_t src_port, bool is_ipv4,
+                       int svc_id, zcSlice *zc, uint16_t *qtype, numaNode_t *node,
+                       int lcore_id);
 
 int processTCPDnsQuery(tcpConn *conn, char *buf, size_t sz);
+int dumpDnsResp(struct context *ctx, dnsDictValue *dv, zone *z);
+void zoneUpdateRoundRabinInfo(zone *z);
+int processFastTCPDnsQuery(char *buf, size_t sz, char *resp, size_t respLen, char *src_addr, uint16_t src_port,
+                           bool is_ipv4, int svc_id, numaNode_t *node, int lcore_id);
 
 void addZoneOtherNuma(zone *z);
 void deleteZoneOtherNuma(char *origin);
@@ -332,6 +458,11 @@ void masterRefreshZone(char *origin);
 
 void config_log();
 void collectStats();
+
+#if defined(SK_BENCH)
+int queryPathBench(int argc, char *argv[]);
+int controlPlaneBench(int argc, char *argv[]);
+#endif
 /*----------------------------------------------
  *     debug utils
  *---------------------------------------------*/
@@ -0,0 +1,221 @@
+//
+// kernel socket I/O backend.
+//
+// when io_backend is socket, no NIC is driven by DPDK. every lcore in
+// queue_config opens its own UDP socket for each address of its ports with
+// SO_REUSEPORT, so the kernel spreads the queries over the lcores. queries
+// are received with recvmmsg and the responses are sent with sendmmsg in
+// batches of MAX_PKT_BURST, the lcores share the query engine, stats and
+// RCU protected zone data with the DPDK backend.
+//
+// addresses are bound as they are, vlans are handled by the kernel, and
+// the admin command ADDR ADD is rejected. DNS over TCP is served by the
+// kernel tcp server.
+//
+#include "fmacros.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "shuke.h"
+
+#define RTE_LOGTYPE_DPDK RTE_LOGTYPE_USER1
+
+// lcores check force_quit at least this often.
+#define SOCK_POLL_TIMEOUT_MS 100
+
+typedef struct sk_sock {
+    int fd;
+    bool is_ipv4;
+    int svc_id;
+    // responses are limited to an ethernet frame, the kernel doesn't know
+    // the payload size of the client.
+    size_t max_udp_size;
+} sk_sock_t;
+
+/*
+ * buffers of a burst, every query is answered in place,
+ * so a slot holds the biggest UDP response.
+ */
+typedef struct {
+    struct mmsghdr msgs[MAX_PKT_BURST];
+    struct mmsghdr out[MAX_PKT_BURST];
+    struct iovec iovs[MAX_PKT_BURST];
+    struct iovec out_iovs[MAX_PKT_BURST];
+    struct sockaddr_storage addrs[MAX_PKT_BURST];
+    char bufs[MAX_PKT_BURST][SK_RESP_BUF_SIZE];
+} sock_burst_t;
+
+static int open_udp_socket(const sk_addr_t *a) {
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int fd, on = 1;
+
+    memset(&ss, 0, sizeof(ss));
+    if (a->family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons((uint16_t)sk.port);
+        memcpy(&sin->sin_addr, a->addr, 4);
+        len = sizeof(*sin);
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons((uint16_t)sk.port);
+        memcpy(&sin6->sin6_addr, a->addr, 16);
+        len = sizeof(*sin6);
+    }
+    fd = socket(a->family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) goto error;
+    if (a->family == AF_INET6 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0) goto error;
+    if (bind(fd, (struct sockaddr *)&ss, len) < 0) goto error;
+    return fd;
+error:
+    close(fd);
+    return -1;
+}
+
+static bool lcore_has_addr(lcore_conf_t *qconf, const sk_addr_t *a, sk_addr_t *bound) {
+    for (int i = 0; i < qconf->nr_socks; ++i) {
+        if (bound[i].family == a->family &&
+            memcmp(bound[i].addr, a->addr, a->family == AF_INET? 4: 16) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * open the sockets of every lcore, called by master before the lcores
+ * are launched.
+ */
+void sk_init_socket_io(void) {
+    char buf[INET6_ADDRSTRLEN];
+    sk_addr_t bound[SK_MAX_SOCKS];
+
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        lcore_conf_t *qconf = sk.lcore_conf[sk.lcore_ids[i]];
+        int socketid = sk.numa_on? (int)rte_lcore_to_socket_id(qconf->lcore_id): 0;
+
+        if (qconf->nr_ports == 0) continue;
+        qconf->socks = socket_calloc(socketid, SK_MAX_SOCKS, sizeof(sk_sock_t));
+        qconf->nr_socks = 0;
+        for (int j = 0; j < qconf->nr_ports; ++j) {
+            port_info_t *pinfo = sk.port_info[qconf->port_id_list[j]];
+            for (int k = 0; k < pinfo->nr_addrs; ++k) {
+                sk_addr_t *a = &pinfo->addrs[k];
+                sk_sock_t *s;
+
+                if (lcore_has_addr(qconf, a, bound)) continue;
+                if (qconf->nr_socks >= SK_MAX_SOCKS)
+                    rte_exit(EXIT_FAILURE, "lcore %d: too many addresses(max %d).\n",
+                             qconf->lcore_id, SK_MAX_SOCKS);
+                s = &qconf->socks[qconf->nr_socks];
+                s->fd = open_udp_socket(a);
+                if (s->fd < 0)
+                    rte_exit(EXIT_FAILURE, "lcore %d: can't bind %s:%d: %s.\n", qconf->lcore_id,
+                             sk_addr_ntop(a, buf, sizeof(buf)), sk.port, strerror(errno));
+                s->is_ipv4 = (a->family == AF_INET);
+                s->svc_id = a->svc_id;
+                s->max_udp_size = ETHER_MTU - sizeof(struct udp_hdr) -
+                    (s->is_ipv4? sizeof(struct ipv4_hdr): sizeof(struct ipv6_hdr));
+                bound[qconf->nr_socks++] = *a;
+            }
+        }
+        LOG_INFO(DPDK, "lcore %d: %d sockets.", qconf->lcore_id, qconf->nr_socks);
+    }
+}
+
+void sk_cleanup_socket_io(void) {
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        lcore_conf_t *qconf = sk.lcore_conf[sk.lcore_ids[i]];
+        for (int j = 0; j < qconf->nr_socks; ++j) {
+            close(qconf->socks[j].fd);
+        }
+        qconf->nr_socks = 0;
+    }
+}
+
+/*
+ * receive a burst of queries from a socket and answer them.
+ */
+static void
+handle_socket(lcore_conf_t *qconf, sk_sock_t *s, sock_burst_t *b) {
+    struct sockaddr_storage *ss;
+    char *src_addr;
+    uint16_t src_port;
+    int nb_rx, nb_tx = 0, sent, n;
+
+    // the kernel overwrites the length of source address.
+    for (int i = 0; i < MAX_PKT_BURST; ++i) {
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+    }
+    nb_rx = recvmmsg(s->fd, b->msgs, MAX_PKT_BURST, MSG_DONTWAIT, NULL);
+    if (nb_rx <= 0) return;
+    qconf->received_req += nb_rx;
+
+    rcu_read_lock();
+    for (int i = 0; i < nb_rx; ++i) {
+        ss = &b->addrs[i];
+        if (s->is_ipv4) {
+            src_addr = (char *)&((struct sockaddr_in *)ss)->sin_addr;
+            src_port = ((struct sockaddr_in *)ss)->sin_port;
+        } else {
+            src_addr = (char *)&((struct sockaddr_in6 *)ss)->sin6_addr;
+            src_port = ((struct sockaddr_in6 *)ss)->sin6_port;
+        }
+        n = processUDPDnsQuery(b->bufs[i], b->msgs[i].msg_len, b->bufs[i], SK_RESP_BUF_SIZE,
+                               s->max_udp_size, src_addr, src_port, s->is_ipv4,
+                               s->svc_id, NULL, NULL, qconf->node, qconf->lcore_id);
+        if (n < 0) {
+            qconf->nr_dropped++;
+            continue;
+        }
+        b->out_iovs[nb_tx].iov_base = b->bufs[i];
+        b->out_iovs[nb_tx].iov_len = (size_t)n;
+        b->out[nb_tx].msg_hdr = b->msgs[i].msg_hdr;
+        b->out[nb_tx].msg_hdr.msg_iov = &b->out_iovs[nb_tx];
+        nb_tx++;
+    }
+    rcu_read_unlock();
+
+    sent = nb_tx > 0? sendmmsg(s->fd, b->out, (unsigned)nb_tx, MSG_DONTWAIT): 0;
+    if (sent < 0) sent = 0;
+    qconf->nr_req += sent;
+    qconf->nr_dropped += nb_tx - sent;
+    qconf->stats.drop[SK_DROP_RING_FULL] += nb_tx - sent;
+}
+
+void
+sk_main_loop_socket(lcore_conf_t *qconf) {
+    int socketid = sk.numa_on? (int)rte_lcore_to_socket_id(qconf->lcore_id): 0;
+    struct pollfd pfds[SK_MAX_SOCKS];
+    sock_burst_t *b;
+
+    b = rte_zmalloc_socket("sock_burst", sizeof(*b), RTE_CACHE_LINE_SIZE, socketid);
+    if (b == NULL)
+        rte_exit(EXIT_FAILURE, "lcore %d: can't allocate socket buffers.\n", qconf->lcore_id);
+    for (int i = 0; i < MAX_PKT_BURST; ++i) {
+        b->iovs[i].iov_base = b->bufs[i];
+        b->iovs[i].iov_len = SK_RESP_BUF_SIZE;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+    }
+
+    for (int i = 0; i < qconf->nr_socks; ++i) {
+        pfds[i].fd = qconf->socks[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    while (!sk.force_quit) {
+        if (poll(pfds, (nfds_t)qconf->nr_socks, SOCK_POLL_TIMEOUT_MS) <= 0)
+            continue;
+        for (int i = 0; i < qconf->nr_socks; ++i) {
+            if (pfds[i].revents & POLLIN)
+                handle_socket(qconf, &qconf->socks[i], b);
+        }
+    }
+    rte_free(b);
+}
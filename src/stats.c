@@ -0,0 +1,191 @@
+//
+// query counters.
+//
+// every lcore counts its responses by rcode, qtype and size, and its drops by
+// reason in the sk_query_stats_t of its lcore_conf_t, the kernel tcp server
+// has its own counters. the master sums them up every second in its cron and
+// keeps the sums of the last 60 seconds to compute the rates of 1s, 10s and 60s
+// windows.
+//
+#include "shuke.h"
+#include "utils.h"
+
+#define STATS_HISTORY 61
+
+// the names are also the label values of /metrics after the prefix.
+static const char *counterNames[] = {
+    "udp_responses", "tcp_responses", "truncated_responses",
+    "rcode_noerror", "rcode_formerr", "rcode_servfail", "rcode_nxdomain",
+    "rcode_notimp", "rcode_refused", "rcode_yxdomain", "rcode_yxrrset",
+    "rcode_nxrrset", "rcode_notauth", "rcode_notzone", "rcode_11",
+    "rcode_12", "rcode_13", "rcode_14", "rcode_15",
+    "qtype_a", "qtype_ns", "qtype_cname", "qtype_soa", "qtype_ptr",
+    "qtype_mx", "qtype_txt", "qtype_aaaa", "qtype_srv", "qtype_any",
+    "qtype_other",
+    "drop_bad_header", "drop_bad_label", "drop_non_dns", "drop_bad_csum",
+    "drop_bad_dst", "drop_ring_full", "drop_tx_full", "drop_no_mbuf",
+    "drop_vlan",
+    "size_lt128", "size_lt256", "size_lt512", "size_lt1024", "size_lt1232",
+    "size_lt1500", "size_lt4096", "size_ge4096",
+    "response_bytes",
+};
+
+// sums taken by the cron, history[head] is the latest one.
+static sk_query_stats_t history[STATS_HISTORY];
+static long long history_ms[STATS_HISTORY];
+static int history_head = -1;
+static int history_len = 0;
+
+static const int rate_windows[] = {1, 10, 60};
+static double rates[RTE_DIM(rate_windows)][SK_STATS_NR_COUNTERS];
+
+static void statsAdd(sk_query_stats_t *dst, const sk_query_stats_t *src) {
+    uint64_t *d = (uint64_t *)dst;
+    const uint64_t *s = (const uint64_t *)src;
+
+    for (size_t i = 0; i < SK_STATS_NR_COUNTERS; ++i) d[i] += s[i];
+}
+
+/*
+ * sum up the counters of all lcores and the tcp server.
+ */
+void sk_stats_collect(sk_query_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        lcore_conf_t *qconf = sk.lcore_conf[sk.lcore_ids[i]];
+        if (qconf) statsAdd(st, &qconf->stats);
+    }
+    if (sk.tcp_srv) statsAdd(st, &sk.tcp_srv->stats);
+}
+
+/*
+ * called every second by the cron of master.
+ */
+void sk_stats_cron(void) {
+    const uint64_t *cur, *old;
+    long long now = mstime();
+    int idx;
+
+    RTE_BUILD_BUG_ON(RTE_DIM(counterNames) != SK_STATS_NR_COUNTERS);
+
+    history_head = (history_head + 1) % STATS_HISTORY;
+    sk_stats_collect(&history[history_head]);
+    history_ms[history_head] = now;
+    if (history_len < STATS_HISTORY) history_len++;
+
+    cur = (const uint64_t *)&history[history_head];
+    for (size_t w = 0; w < RTE_DIM(rate_windows); ++w) {
+        // the oldest sums are used until the history covers the window.
+        int back = MIN(rate_windows[w], history_len - 1);
+        if (back == 0) continue;
+        idx = (history_head - back + STATS_HISTORY) % STATS_HISTORY;
+        old = (const uint64_t *)&history[idx];
+        double secs = (double)(now - history_ms[idx]) / 1000.0;
+        if (secs <= 0) continue;
+        for (size_t i = 0; i < SK_STATS_NR_COUNTERS; ++i) {
+            rates[w][i] = (double)(cur[i] - old[i]) / secs;
+        }
+    }
+}
+
+/*
+ * one line for every counter: the total and the rates(per second) of 1s, 10s
+ * and 60s windows. the totals are taken by the last collectStats().
+ */
+sds sk_stats_info(sds s) {
+    const uint64_t *total = (const uint64_t *)&sk.query_stats;
+
+    for (size_t i = 0; i < SK_STATS_NR_COUNTERS; ++i) {
+        s = sdscatprintf(s, "%s:total=%llu,1s=%.2f,10s=%.2f,60s=%.2f\r\n",
+                         counterNames[i], (unsigned long long)total[i],
+                         rates[0][i], rates[1][i], rates[2][i]);
+    }
+    return s;
+}
+
+/*
+ * a counter family of /metrics, one sample for every counter in [first, first+n),
+ * labeled by the name of the counter without the prefix before the first '_'.
+ */
+static sds metricsFamily(sds s, const char *name, const char *help,
+                         const char *label, const uint64_t *v, size_t first, size_t n) {
+    s = sdscatprintf(s, "# TYPE %s counter\n# HELP %s %s\n", name, name, help);
+    for (size_t i = first; i < first + n; ++i) {
+        const char *value = strchr(counterNames[i], '_') + 1;
+        s = sdscatprintf(s, "%s_total{%s=\"%s\"} %llu\n",
+                         name, label, value, (unsigned long long)v[i]);
+    }
+    return s;
+}
+
+#define COUNTER_IDX(field) (offsetof(sk_query_stats_t, field) / sizeof(uint64_t))
+
+/*
+ * the counters in OpenMetrics text format.
+ */
+sds sk_stats_metrics(sds s, const sk_query_stats_t *st) {
+    static const char *size_le[SK_STATS_NR_SIZES] = {
+        "127", "255", "511", "1023", "1231", "1499", "4095", "+Inf",
+    };
+    const uint64_t *v = (const uint64_t *)st;
+    uint64_t acc = 0;
+
+    s = sdscatprintf(s,
+                     "# TYPE shuke_responses counter\n"
+                     "# HELP shuke_responses Responses by transport.\n"
+                     "shuke_responses_total{proto=\"udp\"} %llu\n"
+                     "shuke_responses_total{proto=\"tcp\"} %llu\n"
+                     "# TYPE shuke_truncated_responses counter\n"
+                     "# HELP shuke_truncated_responses Responses with TC bit.\n"
+                     "shuke_truncated_responses_total %llu\n",
+                     (unsigned long long)st->udp, (unsigned long long)st->tcp,
+                     (unsigned long long)st->truncated);
+    s = metricsFamily(s, "shuke_responses_by_rcode", "Responses by rcode.", "rcode",
+                      v, COUNTER_IDX(rcode), SK_STATS_NR_RCODES);
+    s = metricsFamily(s, "shuke_queries_by_qtype", "Answered queries by qtype.", "qtype",
+                      v, COUNTER_IDX(qtype), SK_STATS_NR_QTYPES);
+    s = metricsFamily(s, "shuke_drops", "Dropped packets by reason.", "reason",
+                      v, COUNTER_IDX(drop), SK_STATS_NR_DROPS);
+
+    s = sdscat(s,
+               "# TYPE shuke_response_size_bytes histogram\n"
+               "# HELP shuke_response_size_bytes Size of the dns responses.\n");
+    for (int i = 0; i < SK_STATS_NR_SIZES; ++i) {
+        acc += st->size[i];
+        s = sdscatprintf(s, "shuke_response_size_bytes_bucket{le=\"%s\"} %llu\n",
+                         size_le[i], (unsigned long long)acc);
+    }
+    return sdscatprintf(s, "shuke_response_size_bytes_count %llu\n"
+                        "shuke_response_size_bytes_sum %llu\n",
+                        (unsigned long long)acc, (unsigned long long)st->size_sum);
+}
+
+#if defined(SK_TEST)
+#include "testhelp.h"
+
+int statsTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    static const char *reasons[SK_STATS_NR_DROPS] = {
+        "bad_header", "bad_label", "non_dns", "bad_csum", "bad_dst",
+        "ring_full", "tx_full", "no_mbuf", "vlan",
+    };
+    sk_query_stats_t st;
+    char line[128];
+    bool ok = true;
+    sds s;
+
+    memset(&st, 0, sizeof(st));
+    for (int i = 0; i < SK_STATS_NR_DROPS; ++i) st.drop[i] = (uint64_t)(i + 1) * 10;
+    st.udp = 3;
+    s = sk_stats_metrics(sdsempty(), &st);
+    for (int i = 0; i < SK_STATS_NR_DROPS; ++i) {
+        snprintf(line, sizeof(line), "shuke_drops_total{reason=\"%s\"} %d\n", reasons[i], (i + 1) * 10);
+        if (strstr(s, line) == NULL) ok = false;
+    }
+    test_cond("drops by reason", ok);
+    test_cond("responses by transport", strstr(s, "shuke_responses_total{proto=\"udp\"} 3\n") != NULL);
+    sdsfree(s);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,128 @@
+//
+// query counters.
+//
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sds.h"
+#include "protocol.h"
+
+// the rcode field of the dns header has 4 bits.
+#define SK_STATS_NR_RCODES 16
+
+enum {
+    SK_QTYPE_A = 0,
+    SK_QTYPE_NS,
+    SK_QTYPE_CNAME,
+    SK_QTYPE_SOA,
+    SK_QTYPE_PTR,
+    SK_QTYPE_MX,
+    SK_QTYPE_TXT,
+    SK_QTYPE_AAAA,
+    SK_QTYPE_SRV,
+    SK_QTYPE_ANY,
+    // all the other types
+    SK_QTYPE_OTHER,
+    SK_STATS_NR_QTYPES,
+};
+
+enum {
+    // shorter than a dns header.
+    SK_DROP_BAD_HEADER = 0,
+    // the question can't be parsed.
+    SK_DROP_BAD_LABEL,
+    // not a dns packet.
+    SK_DROP_NON_DNS,
+    // wrong ip, udp or tcp checksum.
+    SK_DROP_BAD_CSUM,
+    // a dns packet whose destination isn't a service address.
+    SK_DROP_BAD_DST,
+    // a ring between lcores or the socket buffer is full.
+    SK_DROP_RING_FULL,
+    // the tx queue of NIC is full.
+    SK_DROP_TX_FULL,
+    // no mbuf for a chained, zero copy or fragmented response.
+    SK_DROP_NO_MBUF,
+    // the vlan tags stripped by NIC can't be inserted by software(no
+    // headroom or a shared mbuf).
+    SK_DROP_VLAN,
+    SK_STATS_NR_DROPS,
+};
+
+// response size buckets: <128, <256, <512, <1024, <1232, <1500, <4096 and the rest.
+#define SK_STATS_NR_SIZES 8
+
+/*
+ * written by a single thread, the master reads them without locks.
+ * all the fields are uint64_t, the master treats the struct as an array.
+ */
+typedef struct sk_query_stats {
+    // responses sent over udp and tcp.
+    uint64_t udp;
+    uint64_t tcp;
+    // responses with TC bit.
+    uint64_t truncated;
+    uint64_t rcode[SK_STATS_NR_RCODES];
+    uint64_t qtype[SK_STATS_NR_QTYPES];
+    uint64_t drop[SK_STATS_NR_DROPS];
+    uint64_t size[SK_STATS_NR_SIZES];
+    // bytes of all the responses, the sum of the size histogram.
+    uint64_t size_sum;
+} sk_query_stats_t;
+
+#define SK_STATS_NR_COUNTERS (sizeof(sk_query_stats_t) / sizeof(uint64_t))
+
+static inline int
+sk_stats_qtype_idx(uint16_t qtype) {
+    switch (qtype) {
+    case DNS_TYPE_A: return SK_QTYPE_A;
+    case DNS_TYPE_NS: return SK_QTYPE_NS;
+    case DNS_TYPE_CNAME: return SK_QTYPE_CNAME;
+    case DNS_TYPE_SOA: return SK_QTYPE_SOA;
+    case DNS_TYPE_PTR: return SK_QTYPE_PTR;
+    case DNS_TYPE_MX: return SK_QTYPE_MX;
+    case DNS_TYPE_TXT: return SK_QTYPE_TXT;
+    case DNS_TYPE_AAAA: return SK_QTYPE_AAAA;
+    case DNS_TYPE_SRV: return SK_QTYPE_SRV;
+    case DNS_TYPE_ANY: return SK_QTYPE_ANY;
+    default: return SK_QTYPE_OTHER;
+    }
+}
+
+static inline int
+sk_stats_size_idx(uint32_t len) {
+    if (len < 512) return len < 128? 0: (len < 256? 1: 2);
+    if (len < 1232) return len < 1024? 3: 4;
+    return len < 1500? 5: (len < 4096? 6: 7);
+}
+
+/*
+ * `flag` is the flag field of the response header in host byte order,
+ * `len` is the size of the dns message.
+ */
+static inline void
+sk_stats_response(sk_query_stats_t *st, uint16_t qtype, uint16_t flag,
+                  uint32_t len, bool is_tcp) {
+    if (is_tcp) st->tcp++;
+    else st->udp++;
+    if (GET_TC(flag)) st->truncated++;
+    st->rcode[flag & 0x0F]++;
+    st->qtype[sk_stats_qtype_idx(qtype)]++;
+    st->size[sk_stats_size_idx(len)]++;
+    st->size_sum += len;
+}
+
+void sk_stats_cron(void);
+void sk_stats_collect(sk_query_stats_t *st);
+sds sk_stats_info(sds s);
+sds sk_stats_metrics(sds s, const sk_query_stats_t *st);
+
+#if defined(SK_TEST)
+int statsTest(int argc, char *argv[]);
+#endif
+
+#endif /* _STATS_H_ */
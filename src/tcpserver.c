@@ -130,61 +130,38 @@ static inline void tcpConnMoveTail(tcpConn *conn) {
 
 static int tcpBindAddrs(tcpServer *srv) {
     int port = sk.port;
-    char **bindaddr = sk.bindaddr;
-    int bindaddr_count = sk.bindaddr_count;
     int *fds = srv->ipfd;
     int *count = &(srv->ipfd_count);
-    int j;
-
-    /* Force binding of 0.0.0.0 if no bind address is specified, always
-     * entering the loop if j == 0. */
-    for (j = 0; j < bindaddr_count || j == 0; j++) {
-        if (bindaddr[j] == NULL) {
-            int unsupported = 0;
-            /* Bind * for both IPv6 and IPv4, we enter here only if
-             * bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(srv->errstr, port, NULL, sk.tcp_backlog, 1);
-            if (fds[*count] != ANET_ERR) {
-                anetNonBlock(NULL, fds[*count]);
-                (*count)++;
-            } else if (errno == EAFNOSUPPORT) {
-                unsupported++;
-                LOG_WARN(TCP, "Not listening to IPv6: unsupproted");
+    char addr[INET6_ADDRSTRLEN];
+
+    // listen on the addresses of all ports, they are configured to KNI interfaces.
+    for (int i = 0; i < sk.nr_ports; i++) {
+        port_info_t *pinfo = sk.port_info[sk.port_ids[i]];
+        for (int j = 0; j < pinfo->nr_addrs; j++) {
+            sk_addr_t *a = &pinfo->addrs[j];
+            sk_addr_ntop(a, addr, sizeof(addr));
+            if (*count >= CONFIG_BINDADDR_MAX) {
+                LOG_WARN(TCP, "too many addresses, not listening %s:%d.", addr, port);
+                return ERR_CODE;
             }
-
-            if (*count == 1 || unsupported) {
-                /* Bind the IPv4 address as well. */
-                fds[*count] = anetTcpServer(srv->errstr, port, NULL, sk.tcp_backlog, 1);
-                if (fds[*count] != ANET_ERR) {
-                    anetNonBlock(NULL, fds[*count]);
-                    (*count)++;
-                } else if (errno == EAFNOSUPPORT) {
-                    unsupported++;
-                    LOG_WARN(TCP, "Not listening to IPv4: unsupproted");
-                }
+            if (a->family == AF_INET6) {
+                /* Bind IPv6 address. */
+                fds[*count] = anetTcp6Server(srv->errstr, port, addr, sk.tcp_backlog, 1);
+            } else {
+                /* Bind IPv4 address. */
+                fds[*count] = anetTcpServer(srv->errstr, port, addr, sk.tcp_backlog, 1);
+            }
+            if (fds[*count] == ANET_ERR) {
+                LOG_WARN(TCP, "Creating Server TCP listening socket %s:%d: %s",
+                         addr, port, srv->errstr);
+                return ERR_CODE;
             }
-            /* Exit the loop if we were able to bind * on IPv4 and IPv6,
-             * otherwise fds[*count] will be ANET_ERR and we'll print an
-             * error and return to the caller with an error. */
-            if (*count + unsupported == 2) break;
-        } else if (strchr(bindaddr[j], ':')) {
-            /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(srv->errstr, port, bindaddr[j], sk.tcp_backlog, 1);
-        } else {
-            /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(srv->errstr, port, bindaddr[j], sk.tcp_backlog, 1);
-        }
-        if (fds[*count] == ANET_ERR) {
-            LOG_WARN(TCP, "Creating Server TCP listening socket %s:%d: %s",
-                     bindaddr[j] ? bindaddr[j] : "*",
-                     port, srv->errstr);
-            return ERR_CODE;
-        }
 
-        LOG_INFO(TCP, "dns tcp server listening %s:%d.", bindaddr[j], port);
+            LOG_INFO(TCP, "dns tcp server listening %s:%d.", addr, port);
 
-        anetNonBlock(NULL, fds[*count]);
-        (*count)++;
+            anetNonBlock(NULL, fds[*count]);
+            (*count)++;
+        }
     }
     return OK_CODE;
 }
@@ -241,7 +218,9 @@ static void tcpReadHandler(struct aeEventLoop *el, int fd,
                 conn->nRead += n;
                 totalread += n;
                 if (conn->nRead == conn->dnsPacketSize) {
+                    uint64_t start_tsc = rte_rdtsc();
                     processTCPDnsQuery(conn, conn->data, conn->dnsPacketSize);
+                    sk_lat_record(&conn->srv->lat, rte_rdtsc() - start_tsc, 1);
                     if (sk.force_quit) {
                         goto closing;
                     }
@@ -0,0 +1,391 @@
+//
+// heavy hitters of qnames, clients and zones.
+//
+// every lcore keeps a count-min sketch and a space-saving style top-K table
+// for each dimension in its lcore_conf_t. for every answered query the
+// counters of the key are incremented, the estimate(minimum of the counters)
+// replaces the count of the key in the table, or replaces the smallest
+// candidate when the table is full and the estimate is bigger.
+//
+// the sketches are double buffered, the lcores update the half selected by
+// sk.topk_epoch. every second the master harvests and clears the half the
+// lcores left a second ago, then flips the epoch, so it never races with a
+// writer unless an lcore stalls for a whole second, in which case a few
+// counts are lost. the candidates of all lcores are merged into one table per
+// dimension whose scores decay by TOPK_DECAY every second, the rate shown is
+// the score scaled to queries per second.
+//
+// names are hashed with the case insensitive hash of the query log,
+// addresses with jhash, the rows of the sketch derive their indexes from
+// the single hash.
+//
+#include <arpa/inet.h>
+#include <ctype.h>
+
+#include <rte_jhash.h>
+
+#include "shuke.h"
+#include "str.h"
+#include "utils.h"
+
+#define TOPK_DECAY 0.8
+// the merged tables keep more candidates than the lcores.
+#define TOPK_MERGED_FACTOR 4
+// candidates below this score are dropped after the merge.
+#define TOPK_MIN_SCORE 0.5
+
+typedef struct topkItem {
+    uint32_t hash;
+    uint16_t len;
+    double score;
+    uint8_t key[SK_TOPK_KEY_LEN];
+} topkItem;
+
+static const char *dimNames[SK_TOPK_NR_DIMS] = {"qname", "client", "zone"};
+static const char *dimTitles[SK_TOPK_NR_DIMS] = {"Qnames", "Clients", "Zones"};
+
+static topkItem *merged[SK_TOPK_NR_DIMS];
+static int nr_merged[SK_TOPK_NR_DIMS];
+static int merged_cap;
+
+static inline uint32_t mixHash(uint32_t h) {
+    // finalizer of murmur3
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline bool keyEqual(const uint8_t *a, const uint8_t *b, uint16_t len, int dim) {
+    if (dim == SK_TOPK_CLIENT) return memcmp(a, b, len) == 0;
+    // the length bytes of labels are below 64, tolower() doesn't change them.
+    for (uint16_t i = 0; i < len; ++i) {
+        if (a[i] != (uint8_t)tolower(b[i])) return false;
+    }
+    return true;
+}
+
+static inline void updateMin(sk_topk_sketch_t *s) {
+    s->min_idx = 0;
+    s->min_count = s->counts[0];
+    for (uint32_t i = 1; i < s->nr_entries; ++i) {
+        if (s->counts[i] < s->min_count) {
+            s->min_count = s->counts[i];
+            s->min_idx = i;
+        }
+    }
+}
+
+static void sketchUpdate(sk_topk_t *t, sk_topk_sketch_t *s, int dim,
+                         uint32_t h, const uint8_t *key, uint16_t len) {
+    uint32_t h2 = mixHash(h) | 1;
+    uint32_t mask = t->width - 1;
+    uint32_t *row = s->cms;
+    uint32_t est = UINT32_MAX;
+    uint32_t j;
+    sk_topk_entry_t *e;
+
+    for (uint32_t i = 0; i < SK_TOPK_DEPTH; ++i, row += t->width) {
+        uint32_t c = ++row[(h + i * h2) & mask];
+        if (c < est) est = c;
+    }
+    // the estimate of a candidate grows by at least 1 for every update,
+    // so a key not above the smallest count can't be in the table.
+    if (s->nr_entries == t->size && est <= s->min_count) return;
+
+    for (j = 0; j < s->nr_entries; ++j) {
+        if (s->hashes[j] != h) continue;
+        e = &s->entries[j];
+        if (e->len == len && keyEqual(e->key, key, len, dim)) {
+            s->counts[j] = est;
+            if (j == s->min_idx) updateMin(s);
+            return;
+        }
+    }
+
+    j = s->nr_entries < t->size? s->nr_entries++: s->min_idx;
+    e = &s->entries[j];
+    if (dim == SK_TOPK_CLIENT) {
+        memcpy(e->key, key, len);
+    } else {
+        for (uint16_t i = 0; i < len; ++i) e->key[i] = (uint8_t)tolower(key[i]);
+    }
+    e->len = len;
+    s->hashes[j] = h;
+    s->counts[j] = est;
+    updateMin(s);
+}
+
+/*
+ * called in the query path for every answered query, only the owner lcore
+ * of the sketches can call it.
+ */
+void sk_topk_query(struct context *ctx, const void *addr, bool is_ipv4) {
+    sk_topk_t *t = sk.lcore_conf[ctx->lcore_id]->topk;
+    sk_topk_sketch_t *s;
+    uint16_t len;
+
+    if (unlikely(t == NULL)) return;
+    s = t->sketches[sk.topk_epoch & 1];
+
+    sketchUpdate(t, &s[SK_TOPK_QNAME], SK_TOPK_QNAME,
+                 sk_qname_hash(ctx->name, ctx->nameLen),
+                 (const uint8_t *)ctx->name, (uint16_t)(ctx->nameLen + 1));
+    len = is_ipv4? 4: 16;
+    sketchUpdate(t, &s[SK_TOPK_CLIENT], SK_TOPK_CLIENT,
+                 rte_jhash(addr, len, 0), addr, len);
+    if (ctx->z) {
+        sketchUpdate(t, &s[SK_TOPK_ZONE], SK_TOPK_ZONE,
+                     sk_qname_hash(ctx->z->origin, ctx->z->originLen),
+                     (const uint8_t *)ctx->z->origin, (uint16_t)(ctx->z->originLen + 1));
+    }
+}
+
+static void mergeItem(int dim, uint32_t h, const uint8_t *key, uint16_t len, uint32_t count) {
+    topkItem *items = merged[dim];
+    topkItem *it;
+    int i, min_i = 0;
+
+    for (i = 0; i < nr_merged[dim]; ++i) {
+        it = &items[i];
+        if (it->hash == h && it->len == len && memcmp(it->key, key, len) == 0) {
+            it->score += count;
+            return;
+        }
+        if (it->score < items[min_i].score) min_i = i;
+    }
+    if (nr_merged[dim] < merged_cap) {
+        it = &items[nr_merged[dim]++];
+    } else {
+        it = &items[min_i];
+        if (it->score >= count) return;
+    }
+    it->hash = h;
+    it->len = len;
+    it->score = count;
+    memcpy(it->key, key, len);
+}
+
+static void harvest(sk_topk_t *t, sk_topk_sketch_t *s, int dim) {
+    for (uint32_t j = 0; j < s->nr_entries; ++j) {
+        sk_topk_entry_t *e = &s->entries[j];
+        mergeItem(dim, s->hashes[j], e->key, e->len, s->counts[j]);
+    }
+    memset(s->cms, 0, SK_TOPK_DEPTH * t->width * sizeof(uint32_t));
+    s->nr_entries = 0;
+    s->min_idx = 0;
+    s->min_count = 0;
+}
+
+/*
+ * called every second by the cron of master.
+ */
+void sk_topk_cron(void) {
+    // the half the lcores left at the last flip.
+    unsigned idle = (sk.topk_epoch + 1) & 1;
+
+    for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+        for (int i = 0; i < nr_merged[dim]; ++i) merged[dim][i].score *= TOPK_DECAY;
+    }
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        sk_topk_t *t = sk.lcore_conf[sk.lcore_ids[i]]->topk;
+        if (t == NULL) continue;
+        for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+            harvest(t, &t->sketches[idle][dim], dim);
+        }
+    }
+    for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+        int n = 0;
+        for (int i = 0; i < nr_merged[dim]; ++i) {
+            if (merged[dim][i].score < TOPK_MIN_SCORE) continue;
+            if (n != i) merged[dim][n] = merged[dim][i];
+            n++;
+        }
+        nr_merged[dim] = n;
+    }
+    // the cleared half must be visible before the lcores switch to it.
+    rte_smp_wmb();
+    sk.topk_epoch++;
+}
+
+static void initSketch(sk_topk_sketch_t *s, int socketid, uint32_t width, uint32_t size) {
+    s->cms = socket_calloc(socketid, SK_TOPK_DEPTH * width, sizeof(uint32_t));
+    s->hashes = socket_calloc(socketid, size, sizeof(uint32_t));
+    s->counts = socket_calloc(socketid, size, sizeof(uint32_t));
+    s->entries = socket_calloc(socketid, size, sizeof(sk_topk_entry_t));
+}
+
+/*
+ * create the sketches, must be called before the lcores are launched.
+ */
+int sk_init_topk(void) {
+    merged_cap = sk.topk_size * TOPK_MERGED_FACTOR;
+    for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+        merged[dim] = zcalloc(merged_cap * sizeof(topkItem));
+    }
+    for (int i = 0; i < sk.nr_lcore_ids; ++i) {
+        int lcore_id = sk.lcore_ids[i];
+        int socketid = sk.numa_on? (int)rte_lcore_to_socket_id((unsigned)lcore_id): 0;
+        sk_topk_t *t = socket_calloc(socketid, 1, sizeof(*t));
+
+        t->width = (uint32_t)sk.topk_width;
+        t->size = (uint32_t)sk.topk_size;
+        for (int half = 0; half < 2; ++half) {
+            for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+                initSketch(&t->sketches[half][dim], socketid, t->width, t->size);
+            }
+        }
+        sk.lcore_conf[lcore_id]->topk = t;
+    }
+    return OK_CODE;
+}
+
+int sk_topk_parse_dim(const char *s) {
+    for (int dim = 0; dim < SK_TOPK_NR_DIMS; ++dim) {
+        if (strcasecmp(s, dimNames[dim]) == 0) return dim;
+    }
+    return -1;
+}
+
+static int itemCmp(const void *a, const void *b) {
+    double sa = ((const topkItem *)a)->score;
+    double sb = ((const topkItem *)b)->score;
+
+    if (sa == sb) return 0;
+    return sa < sb? 1: -1;
+}
+
+static sds itemToStr(sds s, int rank, int dim, const topkItem *it) {
+    char buf[MAX_DOMAIN_LEN + 2];
+    char label[SK_TOPK_KEY_LEN];
+
+    if (dim == SK_TOPK_CLIENT) {
+        inet_ntop(it->len == 4? AF_INET: AF_INET6, it->key, buf, sizeof(buf));
+    } else if (it->key[0] == 0) {
+        strcpy(buf, ".");
+    } else {
+        memcpy(label, it->key, it->len);
+        len2dotlabel(label, buf);
+    }
+    return sdscatprintf(s, "%d:key=%s,qps=%.2f\r\n", rank, buf, it->score * (1 - TOPK_DECAY));
+}
+
+/*
+ * the top `n` keys of dimension `dim`(all dimensions if it is -1) by their
+ * decayed rates.
+ */
+sds sk_topk_info(sds s, int dim, int n) {
+    topkItem *items;
+
+    if (!sk.topk_on) return sdscat(s, "heavy hitter detection is disabled.\r\n");
+
+    items = zmalloc(merged_cap * sizeof(topkItem));
+    for (int d = 0; d < SK_TOPK_NR_DIMS; ++d) {
+        if (dim >= 0 && d != dim) continue;
+        int nr = nr_merged[d];
+
+        memcpy(items, merged[d], nr * sizeof(topkItem));
+        qsort(items, (size_t)nr, sizeof(topkItem), itemCmp);
+        if (dim < 0 && d > 0) s = sdscat(s, "\r\n");
+        s = sdscatprintf(s, "# %s\r\n", dimTitles[d]);
+        for (int i = 0; i < nr && i < n; ++i) {
+            s = itemToStr(s, i + 1, d, &items[i]);
+        }
+    }
+    zfree(items);
+    return s;
+}
+
+#if defined(SK_TEST)
+#include "testhelp.h"
+
+static int findEntry(sk_topk_sketch_t *s, const uint8_t *key, uint16_t len) {
+    for (uint32_t j = 0; j < s->nr_entries; ++j) {
+        if (s->entries[j].len == len && memcmp(s->entries[j].key, key, len) == 0) return (int)j;
+    }
+    return -1;
+}
+
+static void updateClient(sk_topk_t *t, sk_topk_sketch_t *s, uint8_t id, int n) {
+    uint8_t addr[4] = {192, 0, 2, id};
+    for (int i = 0; i < n; ++i) {
+        sketchUpdate(t, s, SK_TOPK_CLIENT, rte_jhash(addr, 4, 0), addr, 4);
+    }
+}
+
+int topkTest(int argc, char *argv[]) {
+    ((void)argc); ((void) argv);
+    sk_topk_t t;
+    sk_topk_sketch_t s, s2, names;
+    char upper[] = "\3WWW\7example\3com";
+    char mixed[] = "\3www\7EXAMPLE\3com";
+    char lower[] = "\3www\7example\3com";
+    uint8_t a1[4] = {192, 0, 2, 1}, a4[4] = {192, 0, 2, 4}, a6[4] = {192, 0, 2, 6};
+    int idx;
+    sds info;
+
+    memset(&t, 0, sizeof(t));
+    t.width = 1024;
+    t.size = 4;
+    initSketch(&s, 0, t.width, t.size);
+    initSketch(&s2, 0, t.width, t.size);
+    initSketch(&names, 0, t.width, t.size);
+
+    // 192.0.2.1 ... 192.0.2.5 are seen 100, 50, 20, 10 and 5 times.
+    updateClient(&t, &s, 1, 100);
+    updateClient(&t, &s, 2, 50);
+    updateClient(&t, &s, 3, 20);
+    updateClient(&t, &s, 4, 10);
+    updateClient(&t, &s, 5, 5);
+    idx = findEntry(&s, a1, 4);
+    test_cond("top-K is full", s.nr_entries == 4);
+    test_cond("count of the heaviest key", idx >= 0 && s.counts[idx] >= 100);
+    test_cond("smallest candidate", s.min_count >= 10 && findEntry(&s, a4, 4) == (int)s.min_idx);
+
+    // a new key replaces the smallest candidate once its estimate is bigger.
+    updateClient(&t, &s, 6, 30);
+    idx = findEntry(&s, a6, 4);
+    test_cond("eviction of the smallest candidate",
+              findEntry(&s, a4, 4) < 0 && idx >= 0 && s.counts[idx] >= 30);
+    test_cond("smallest candidate after eviction", s.min_count >= 20 && s.min_count < 30);
+
+    sketchUpdate(&t, &names, SK_TOPK_QNAME, sk_qname_hash(upper, strlen(upper)),
+                 (uint8_t *)upper, (uint16_t)(strlen(upper) + 1));
+    sketchUpdate(&t, &names, SK_TOPK_QNAME, sk_qname_hash(mixed, strlen(mixed)),
+                 (uint8_t *)mixed, (uint16_t)(strlen(mixed) + 1));
+    test_cond("names are case insensitive", names.nr_entries == 1 && names.counts[0] == 2 &&
+                                            memcmp(names.entries[0].key, lower, sizeof(lower)) == 0);
+
+    // merge the candidates of two lcores.
+    merged_cap = 4;
+    merged[SK_TOPK_CLIENT] = zcalloc(merged_cap * sizeof(topkItem));
+    updateClient(&t, &s2, 1, 10);
+    harvest(&t, &s, SK_TOPK_CLIENT);
+    test_cond("harvest clears the sketch", s.nr_entries == 0 && s.min_count == 0 && s.cms[0] == 0);
+    harvest(&t, &s2, SK_TOPK_CLIENT);
+    test_cond("merged candidates", nr_merged[SK_TOPK_CLIENT] == 4);
+    idx = -1;
+    for (int i = 0; i < nr_merged[SK_TOPK_CLIENT]; ++i) {
+        if (memcmp(merged[SK_TOPK_CLIENT][i].key, a1, 4) == 0) idx = i;
+    }
+    test_cond("scores of the same key are added", idx >= 0 && merged[SK_TOPK_CLIENT][idx].score >= 110);
+
+    // the merged table is full, a small key is dropped, a big one replaces the smallest.
+    updateClient(&t, &s, 7, 1);
+    harvest(&t, &s, SK_TOPK_CLIENT);
+    test_cond("small key is dropped by the merge", nr_merged[SK_TOPK_CLIENT] == 4);
+    updateClient(&t, &s, 8, 200);
+    harvest(&t, &s, SK_TOPK_CLIENT);
+    sk.topk_on = true;
+    info = sk_topk_info(sdsempty(), SK_TOPK_CLIENT, 2);
+    test_cond("top keys", strstr(info, "1:key=192.0.2.8,") != NULL &&
+                          strstr(info, "2:key=192.0.2.1,") != NULL &&
+                          strstr(info, "3:key=") == NULL);
+    sdsfree(info);
+    sk.topk_on = false;
+    test_report();
+    return 0;
+}
+#endif
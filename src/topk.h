@@ -0,0 +1,70 @@
+//
+// heavy hitters of qnames, clients and zones.
+//
+
+#ifndef _TOPK_H_
+#define _TOPK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sds.h"
+#include "protocol.h"
+
+struct context;
+
+enum {
+    SK_TOPK_QNAME = 0,
+    SK_TOPK_CLIENT,
+    SK_TOPK_ZONE,
+    SK_TOPK_NR_DIMS,
+};
+
+// rows of the count-min sketch.
+#define SK_TOPK_DEPTH 4
+// a name in len label format including the last 0, or an address.
+#define SK_TOPK_KEY_LEN (MAX_DOMAIN_LEN + 1)
+
+/*
+ * a candidate of the top-K table, names are lowercased.
+ */
+typedef struct sk_topk_entry {
+    uint16_t len;
+    uint8_t key[SK_TOPK_KEY_LEN];
+} sk_topk_entry_t;
+
+/*
+ * count-min sketch and top-K candidates of one dimension, hashes and counts
+ * are kept apart from the keys so the scan of the candidates is cheap.
+ */
+typedef struct sk_topk_sketch {
+    uint32_t nr_entries;
+    uint32_t min_idx;
+    uint32_t min_count;
+    uint32_t *cms;              // SK_TOPK_DEPTH rows of `width` counters
+    uint32_t *hashes;
+    uint32_t *counts;
+    sk_topk_entry_t *entries;
+} sk_topk_sketch_t;
+
+/*
+ * owned by an lcore, it updates sketches[sk.topk_epoch & 1], the master
+ * harvests and clears the other half.
+ */
+typedef struct sk_topk {
+    uint32_t width;
+    uint32_t size;
+    sk_topk_sketch_t sketches[2][SK_TOPK_NR_DIMS];
+} sk_topk_t;
+
+int sk_init_topk(void);
+void sk_topk_query(struct context *ctx, const void *addr, bool is_ipv4);
+void sk_topk_cron(void);
+int sk_topk_parse_dim(const char *s);
+sds sk_topk_info(sds s, int dim, int n);
+
+#if defined(SK_TEST)
+int topkTest(int argc, char *argv[]);
+#endif
+
+#endif /* _TOPK_H_ */
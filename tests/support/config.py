@@ -1,25 +1,23 @@
+# the unit tests run the socket I/O backend by default, so they need neither
+# NICs bound to DPDK nor hugepages. set SHUKE_IO_BACKEND=dpdk to merge
+# dpdk_cfg into the config and run them against the NICs.
 default_cfg = {
-    "coremask":  "0xf0f",
+    "coremask":  "0x3",
     "master_lcore_id":  0,
 
     "mem_channels":  4,
-    "portmask":  0x3,
+    "io_backend": "socket",
+    "portmask":  0x1,
     "promiscuous_on": "no",
-    "numa_on": "yes",
+    "pci_on": "no",
+    "numa_on": "no",
     "jumbo_on": "no",
     "max_pkt_len": 2048,
-    # Rx queue configuration (port, queue, lcore)
-    "rx_queue_config": "(0,0,1),(0,1,2),(0,2,3),(0,3,8),(0,4,9)(0,5,10),(0,6,11),(1,0,1),(1,1,2),(1,2,3),(1,3,8),(1,4,9)(1,5,10),(1,6,11)",
-
-    # kni tx config (port,lcore)
-    "kni_tx_config": "(0,14),(1,14)",
-
-    # core for kni kernel (port,lcore). optional
-    "kni_kernel_config": "(0,15),(1,15)",
+    # lcore 1 serves port 0
+    "queue_config": "1.0",
 
     "bind":  [
-        "192.168.0.110",
-        "192.168.10.110"
+        "127.0.0.1",
     ],
     # in production environment, use 53
     "port": 19899,
@@ -30,9 +28,9 @@ default_cfg = {
     # timeout used to close idle tcp connection.
     "tcp_idle_timeout": 120,
 
-    "daemonize": "yes",
+    "daemonize": "no",
 
-    "pidfile": "/var/run/shuke_53.pid",
+    "pidfile": "/tmp/shuke_test.pid",
 
     "query_log_file": "stdout",
 
@@ -64,3 +62,16 @@ default_cfg = {
     "all_reload_interval": 36000,  # 10 hours
     "minimize_resp": "yes"
 }
+
+# merged into default_cfg when SHUKE_IO_BACKEND is dpdk, the addresses must
+# be reachable through the DPDK ports.
+dpdk_cfg = {
+    "coremask":  "0xf",
+    "io_backend": "dpdk",
+    "pci_on": "yes",
+    "numa_on": "yes",
+    "queue_config": "[1-3].0",
+    "bind":  [
+        "192.168.0.110",
+    ],
+}
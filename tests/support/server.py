@@ -20,7 +20,7 @@ import dns.query
 import pymongo
 
 from . import settings, zone2mongo, utils
-from .config import default_cfg
+from .config import default_cfg, dpdk_cfg
 from .zone2mongo import ZoneMongo
 
 
@@ -108,6 +108,8 @@ class DNSServer(object):
         self.pid = None
         self.popen = None
         self.cf = copy.deepcopy(default_cfg)
+        if settings.IO_BACKEND.lower() == "dpdk":
+            self.cf.update(copy.deepcopy(dpdk_cfg))
         if overrides:
             self.cf.update(overrides)
         # override mongo host and mongo port
@@ -197,18 +199,18 @@ class DNSServer(object):
     def admin_cmd(self, cmd):
         return self.admin_cli.exec_cmd(cmd)
 
-    def dns_query(self, name, ty, use_tcp=True):
+    def dns_query(self, name, ty, use_tcp=True, use_edns=None, payload=None):
         dns_hosts = self.cf["bind"]
         dns_port = self.cf["port"]
         if len(dns_hosts) > 0:
             dns_host = dns_hosts[0]
         else:
             dns_host = ""
-        q = dns.message.make_query(name, ty)
+        q = dns.message.make_query(name, ty, use_edns=use_edns, payload=payload)
         if use_tcp:
             return dns.query.tcp(q, dns_host, port=dns_port)
         else:
-            return dns.query.udp(q, dns_host, port=dns_port)
+            return dns.query.udp(q, dns_host, port=dns_port, ignore_trunc=True)
 
     def isalive(self):
         return self.popen.poll() is not None
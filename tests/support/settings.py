@@ -15,5 +15,8 @@ DNS_BIN = os.path.join(REPO_ROOT, "build/shuke-server")
 ASSETS_DIR = os.path.join(REPO_ROOT, "tests/assets")
 EXAMPLE_ZONE_FILE = os.path.join(ASSETS_DIR, "example.z")
 
+# socket or dpdk, see support/config.py
+IO_BACKEND = os.getenv("SHUKE_IO_BACKEND", "socket")
+
 MONGO_HOST = os.getenv("MONGO_HOST", "localhost")
 MONGO_PORT = int(os.getenv("MONGO_PORT", 27017))
@@ -11,6 +11,8 @@ import pytest
 
 sys.path.insert(0, dirname(dirname(abspath(__file__))))
 from support import dns_srv, settings, utils
+import dns.flags
+import dns.rcode
 
 overrides = {
     "data_store": "file",
@@ -182,3 +184,47 @@ def test_query_subsub(dns_srv):
 
     add_rdata = collect_rdata(msg.additional)
     assert add_rdata == {"10.0.1.1", "aaaa:bbbb::1", "10.0.1.2", "aaaa:bbbb::2"}
+
+
+def test_query_udp_truncated(dns_srv):
+    msg = dns_srv.dns_query("test-big.example.com.", "TXT", use_tcp=False)
+    assert msg.flags & dns.flags.TC
+    assert len(msg.question) == 1 and len(msg.answer) == 0 and \
+        len(msg.authority) == 0 and len(msg.additional) == 0
+
+    msg = dns_srv.dns_query("test-big.example.com.", "TXT")
+    assert not (msg.flags & dns.flags.TC)
+    assert len(msg.answer) == 1 and len(msg.answer[0].items) == 8
+
+
+def test_query_tcp_multi_segment(dns_srv):
+    # the response takes several tcp segments.
+    msg = dns_srv.dns_query("test-huge.example.com.", "TXT")
+    assert not (msg.flags & dns.flags.TC)
+    assert len(msg.answer) == 1 and len(msg.answer[0].items) == 20
+    assert {"%02d" % i * 50 for i in range(20)} == \
+        {b"".join(rd.strings).decode() for rd in msg.answer[0].items}
+
+
+def test_query_udp_edns(dns_srv):
+    msg = dns_srv.dns_query("test-big.example.com.", "TXT", use_tcp=False, payload=4096)
+    assert not (msg.flags & dns.flags.TC)
+    assert msg.edns == 0
+    assert len(msg.answer) == 1 and len(msg.answer[0].items) == 8
+
+    # payload sizes below 512 are treated as 512.
+    msg = dns_srv.dns_query("test-big.example.com.", "TXT", use_tcp=False, payload=256)
+    assert msg.flags & dns.flags.TC
+    assert msg.edns == 0 and len(msg.answer) == 0
+
+
+def test_query_edns_badvers(dns_srv):
+    msg = dns_srv.dns_query("test-a.example.com.", "A", use_tcp=False, use_edns=1)
+    assert msg.rcode() == dns.rcode.BADVERS
+    assert msg.edns == 0 and len(msg.answer) == 0
+
+
+@pytest.mark.skipif(settings.IO_BACKEND != "socket", reason="socket I/O backend only")
+def test_addr_add_socket_io(dns_srv):
+    ret = dns_srv.admin_cmd("addr add 0 127.0.0.2")
+    assert "not supported by socket I/O backend" in ret
@@ -2,18 +2,20 @@
 # -*- coding:utf-8 -*-
 
 """
-
+generate zone data, either to mongodb or to zone files(-o), the zone files
+can be used by the file data store or `shuke-server bench control <dir>`.
 """
 from __future__ import print_function, division, absolute_import
+import os
 from os import path
 import random
+import re
 import argparse
 from urllib import request
-from pymongo import MongoClient
-from pymongo.errors import BulkWriteError
 
 
 CUR_DIR = path.dirname(path.realpath(__file__))
+MIX_RE = re.compile(r'BENCH_MIX\((\d+), (\d+), "(\w+)", "(.*)"\)')
 
 def to_abs_domain(domain, origin):
     if domain.endswith(origin):
@@ -38,6 +40,7 @@ def to_relative_domain(domain, origin):
 
 class ZoneMongo(object):
     def __init__(self, host, port, dbname="zone"):
+        from pymongo import MongoClient
         self.r = MongoClient(host=host, port=port)
         self.dbname = dbname
 
@@ -92,12 +95,93 @@ def gen_a_zone(zone_name, subdomains):
     return dot_origin, rr_list
 
 
+def load_record_mix():
+    """
+    the record mix is defined once in src/bench_mix.h for both this script
+    and `shuke-server bench`.
+    """
+    with open(path.join(CUR_DIR, "..", "src", "bench_mix.h")) as f:
+        entries = MIX_RE.findall(f.read())
+    return [(int(m), int(r), ty, rdata.replace('\\"', '"')) for m, r, ty, rdata in entries]
+
+
+RECORD_MIX = load_record_mix()
+
+
+def gen_synthetic_rrs(subdomain, idx, dot_origin):
+    """
+    a record mix close to real zones: A(sometimes round robin), AAAA, MX,
+    TXT and CNAME, see src/bench_mix.h.
+    """
+    fields = {
+        "b2": (idx >> 16) & 0xFF,
+        "b1": (idx >> 8) & 0xFF,
+        "b0": idx & 0xFF,
+        "b2h": 128 | ((idx >> 16) & 0x7F),
+        "hex": "%x" % idx,
+        "origin": dot_origin,
+    }
+    rrs = []
+    for modulus, remainder, ty, rdata in RECORD_MIX:
+        if idx % modulus != remainder:
+            continue
+        rrs.append((subdomain, ty, rdata.format(**fields)))
+        # a CNAME can't coexist with other records.
+        if ty == "CNAME":
+            break
+    return rrs
+
+
+def write_zone_file(out_dir, dot_origin, rrs):
+    fname = path.join(out_dir, "%szone" % dot_origin)
+    with open(fname, "w") as f:
+        f.write("$ORIGIN %s\n$TTL 86400\n" % dot_origin)
+        f.write("@ SOA ns1.%s hostmaster.%s 2001062501 21600 3600 604800 86400\n" % (dot_origin, dot_origin))
+        f.write("@ NS ns1.%s\n@ NS ns2.%s\n" % (dot_origin, dot_origin))
+        f.write("ns1 A 10.255.0.1\nns2 A 10.255.0.2\nmail A 10.255.0.3\nwww A 10.255.0.4\n")
+        for name, ty, rdata in rrs:
+            f.write("%s %s %s\n" % (name, ty, rdata))
+    return fname
+
+
+def gen_zone_files(parsed):
+    """
+    write synthetic zones z<i>.<suffix> with names s<j>, and a zone_files
+    block for shuke.conf.
+    """
+    out_dir = parsed.output_dir
+    if not path.isdir(out_dir):
+        os.makedirs(out_dir)
+    rnd = random.Random(parsed.seed)
+    suffix = parsed.suffix.strip(".")
+    conf_lines = ["zone_files {"]
+    for i in range(parsed.num_zones):
+        dot_origin = "z%d.%s." % (i, suffix)
+        # the number of names of zones varies like real zones do.
+        n = max(1, int(rnd.expovariate(1.0 / parsed.num_subdomains))) if parsed.vary else parsed.num_subdomains
+        rrs = []
+        for j in range(n):
+            rrs.extend(gen_synthetic_rrs("s%d" % j, j, dot_origin))
+        fname = write_zone_file(out_dir, dot_origin, rrs)
+        conf_lines.append('    %s "%s"' % (dot_origin, fname))
+    conf_lines.append("}")
+    with open(path.join(out_dir, "zone_files.conf"), "w") as f:
+        f.write("\n".join(conf_lines) + "\n")
+    print("%d zones are written to %s." % (parsed.num_zones, out_dir))
+
+
 def parse_cmd_args():
     parser = argparse.ArgumentParser()
     parser.add_argument('-Nz', '--num-zones', default=10000, type=int, help="number of zones")
     parser.add_argument('-Ns', '--num-subdomains', default=100, type=int, help="number of sumdomain per zone")
     parser.add_argument('-Mh', '--mongo_host', default="127.0.0.1", help='mongodb host(default: 127.0.0.1)')
     parser.add_argument('-Mp', '--mongo_port', default=27017, type=int, help='mongodb port(default: 27017)')
+    parser.add_argument('-o', '--output-dir', default=None,
+                        help='write synthetic zone files and zone_files.conf to this directory instead of mongodb')
+    parser.add_argument('--suffix', default="bench.", help='parent domain of synthetic zones(default: bench.)')
+    parser.add_argument('--vary', action="store_true",
+                        help='draw the number of subdomains of every zone from exponential distribution')
+    parser.add_argument('--seed', default=0, type=int, help='random seed of synthetic zones')
     return parser.parse_args()
 
 
@@ -108,6 +192,7 @@ def remote_get_list(url):
 
 
 def gen_zone_data(parsed):
+    from pymongo.errors import BulkWriteError
     num_zones = parsed.num_zones
     num_domains = parsed.num_subdomains
     zm = ZoneMongo(parsed.mongo_host, parsed.mongo_port)
@@ -136,4 +221,7 @@ def gen_zone_data(parsed):
 
 if __name__ == '__main__':
     parsed = parse_cmd_args()
-    gen_zone_data(parsed)
+    if parsed.output_dir:
+        gen_zone_files(parsed)
+    else:
+        gen_zone_data(parsed)